@@ -13,8 +13,8 @@ class CxxmetricsConan(ConanFile):
     license = "Apache 2.0"
     url = "https://github.com/kmaragon/cxxmetrics"
     settings = ("compiler", "os")
-    options = { "with_prometheus": [True, False] }
-    default_options = { "with_prometheus": True }
+    options = { "with_prometheus": [True, False], "with_statsd": [True, False], "with_graphite": [True, False], "with_influx": [True, False], "with_json": [True, False], "with_otlp": [True, False], "with_zlib": [True, False], "with_zstd": [True, False] }
+    default_options = { "with_prometheus": True, "with_statsd": True, "with_graphite": True, "with_influx": True, "with_json": True, "with_otlp": True, "with_zlib": False, "with_zstd": False }
     package_type = "header-library"
     exports_sources = "CMakeLists.txt", "cxxmetrics*"
     no_copy_source = True
@@ -31,7 +31,10 @@ class CxxmetricsConan(ConanFile):
             check_min_cppstd(self, self._min_cppstd)
 
     def requirements(self):
-        pass
+        if self.options.with_zlib:
+            self.requires("zlib/[>=1.2.11 <2]")
+        if self.options.with_zstd:
+            self.requires("zstd/[>=1.4.0 <2]")
 
     def package(self):
         copy(self,
@@ -43,6 +46,31 @@ class CxxmetricsConan(ConanFile):
                  "*.hpp",
                  os.path.join(self.source_folder, "cxxmetrics_prometheus"),
                  os.path.join(self.package_folder, "include/cxxmetrics_prometheus"))
+        if self.options.with_statsd:
+            copy(self,
+                 "*.hpp",
+                 os.path.join(self.source_folder, "cxxmetrics_statsd"),
+                 os.path.join(self.package_folder, "include/cxxmetrics_statsd"))
+        if self.options.with_graphite:
+            copy(self,
+                 "*.hpp",
+                 os.path.join(self.source_folder, "cxxmetrics_graphite"),
+                 os.path.join(self.package_folder, "include/cxxmetrics_graphite"))
+        if self.options.with_influx:
+            copy(self,
+                 "*.hpp",
+                 os.path.join(self.source_folder, "cxxmetrics_influx"),
+                 os.path.join(self.package_folder, "include/cxxmetrics_influx"))
+        if self.options.with_json:
+            copy(self,
+                 "*.hpp",
+                 os.path.join(self.source_folder, "cxxmetrics_json"),
+                 os.path.join(self.package_folder, "include/cxxmetrics_json"))
+        if self.options.with_otlp:
+            copy(self,
+                 "*.hpp",
+                 os.path.join(self.source_folder, "cxxmetrics_otlp"),
+                 os.path.join(self.package_folder, "include/cxxmetrics_otlp"))
 
     def package_info(self):
         self.cpp_info.set_property("cmake_file_name", "cxxmetrics")
@@ -51,4 +79,10 @@ class CxxmetricsConan(ConanFile):
 
         if self.settings.os == 'Linux':
             self.cpp_info.components["cxxmetrics"].system_libs = ["atomic"]
+        if self.options.with_zlib:
+            self.cpp_info.components["cxxmetrics"].defines.append("CXXMETRICS_WITH_ZLIB")
+            self.cpp_info.components["cxxmetrics"].requires.append("zlib::zlib")
+        if self.options.with_zstd:
+            self.cpp_info.components["cxxmetrics"].defines.append("CXXMETRICS_WITH_ZSTD")
+            self.cpp_info.components["cxxmetrics"].requires.append("zstd::zstd")
 
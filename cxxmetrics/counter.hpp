@@ -14,6 +14,7 @@ template<typename TCount = int64_t>
 class counter : public metric<counter<TCount>>
 {
     std::atomic<TCount> value_;
+    internal::change_epoch epoch_;
 public:
     /**
      * \brief Construct a counter
@@ -65,6 +66,14 @@ public:
      */
     TCount value() const noexcept;
 
+    /**
+     * \brief Get the change epoch of the counter, which changes every time the counter is modified
+     */
+    uint64_t epoch() const noexcept
+    {
+        return epoch_.value();
+    }
+
     /**
      * \brief Convenience cast operator
      */
@@ -147,21 +156,25 @@ counter<TCount>::counter(TCount initial_value) noexcept:
 template<typename TCount>
 counter<TCount>::counter(const counter &c) noexcept :
         metric<counter<TCount>>(c),
-        value_(c.value_.load())
+        value_(c.value_.load()),
+        epoch_(c.epoch_)
 {}
 
 template<typename TCount>
 counter<TCount>::counter(counter &&c) noexcept :
         metric<counter<TCount>>(c),
-        value_(c.value_.load())
+        value_(c.value_.load()),
+        epoch_(c.epoch_)
 {
     c.value_ = 0;
+    c.epoch_.touch();
 }
 
 template<typename TCount>
 counter<TCount> &counter<TCount>::operator=(const counter<TCount> &c) noexcept
 {
     value_ = c;
+    epoch_.touch();
     return *this;
 }
 
@@ -170,6 +183,8 @@ counter<TCount> &counter<TCount>::operator=(counter<TCount>  &&c) noexcept
 {
     value_ = c;
     c.value_ = 0;
+    epoch_.touch();
+    c.epoch_.touch();
     return *this;
 }
 
@@ -177,13 +192,16 @@ template<typename TCount>
 counter<TCount> &counter<TCount>::operator=(TCount value) noexcept
 {
     value_ = value;
+    epoch_.touch();
     return *this;
 }
 
 template<typename TCount>
 TCount counter<TCount>::incr(TCount by) noexcept
 {
-    return value_ += by;
+    auto result = value_ += by;
+    epoch_.touch();
+    return result;
 }
 
 template<typename TCount>
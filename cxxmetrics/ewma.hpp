@@ -2,6 +2,7 @@
 #define CXXMETRICS_EWMA_HPP
 
 #include "metric.hpp"
+#include "self_metrics.hpp"
 #include <cmath>
 #include <chrono>
 #include <atomic>
@@ -197,14 +198,22 @@ TValue ewma<TClockGet, TWindow, TInterval, TValue>::tick(const clock_point &at)
             {
                 // one thread sets the last timestamp
                 if (!pending_.compare_exchange_weak(pending, 0))
+                {
+                    self_metric_add(self_stat::ewma_tick_retries, 1);
                     return pending; // someone else ticked from under us
+                }
 
                 if (rate_.compare_exchange_weak(nrate, pending))
                     last_ = at;
+                else
+                    self_metric_add(self_stat::ewma_tick_retries, 1);
             }
 
             return pending;
         }
+
+        if (TWrite)
+            self_metric_add(self_stat::ewma_tick_retries, 1);
     }
 
     // apply the pending value to our current rate
@@ -213,6 +222,7 @@ TValue ewma<TClockGet, TWindow, TInterval, TValue>::tick(const clock_point &at)
 
     // figure out how many intervals we've missed
     missed_intervals = ((at - last) / period(TInterval)) - 1;
+    auto skipped = missed_intervals;
     if (missed_intervals > 0)
     {
         // we missed some intervals - we'll average in zeros
@@ -240,7 +250,13 @@ TValue ewma<TClockGet, TWindow, TInterval, TValue>::tick(const clock_point &at)
         return rate;
 
     if (!pending_.compare_exchange_weak(pending, 0))
+    {
+        self_metric_add(self_stat::ewma_tick_retries, 1);
         return rate; // someone else already either ticked or added a pending value
+    }
+
+    if (skipped > 0)
+        self_metric_add(self_stat::ewma_skipped_ticks, skipped);
 
     rate_.store(rate);
     if (last_ < at)
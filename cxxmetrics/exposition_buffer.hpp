@@ -0,0 +1,144 @@
+#ifndef CXXMETRICS_EXPOSITION_BUFFER_HPP
+#define CXXMETRICS_EXPOSITION_BUFFER_HPP
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <ostream>
+#include <string>
+#include "output_sink.hpp"
+
+namespace cxxmetrics
+{
+
+/**
+ * \brief A growable contiguous buffer that the prometheus exposition is rendered into
+ *
+ * This is the output sink for output that's kept in memory. Numbers are formatted straight into the buffer without
+ * going through locales, streams or strings, and the buffer keeps its capacity when cleared so that rendering into
+ * the same buffer repeatedly doesn't allocate once it's big enough.
+ */
+class exposition_buffer : public output_sink<exposition_buffer>
+{
+    std::unique_ptr<char[]> data_;
+    std::size_t size_;
+    std::size_t capacity_;
+
+    char* reserve_more(std::size_t count)
+    {
+        auto required = size_ + count;
+        if (required > capacity_)
+        {
+            auto capacity = std::max(required, capacity_ * 2);
+            std::unique_ptr<char[]> data(new char[capacity]);
+            if (size_)
+                std::memcpy(data.get(), data_.get(), size_);
+
+            data_ = std::move(data);
+            capacity_ = capacity;
+        }
+
+        return data_.get() + size_;
+    }
+
+public:
+    /**
+     * \brief Construct an exposition buffer
+     *
+     * \param capacity the initial capacity of the buffer
+     */
+    explicit exposition_buffer(std::size_t capacity = 4096) :
+            data_(new char[capacity ? capacity : 1]),
+            size_(0),
+            capacity_(capacity ? capacity : 1)
+    { }
+
+    exposition_buffer(exposition_buffer&& other) noexcept :
+            data_(std::move(other.data_)),
+            size_(other.size_),
+            capacity_(other.capacity_)
+    {
+        other.size_ = 0;
+        other.capacity_ = 0;
+    }
+
+    exposition_buffer& operator=(exposition_buffer&& other) noexcept
+    {
+        data_ = std::move(other.data_);
+        size_ = other.size_;
+        capacity_ = other.capacity_;
+        other.size_ = 0;
+        other.capacity_ = 0;
+        return *this;
+    }
+
+    exposition_buffer(const exposition_buffer&) = delete;
+    exposition_buffer& operator=(const exposition_buffer&) = delete;
+
+    const char* data() const noexcept { return data_.get(); }
+    std::size_t size() const noexcept { return size_; }
+    std::size_t capacity() const noexcept { return capacity_; }
+    bool empty() const noexcept { return size_ == 0; }
+
+    /**
+     * \brief Drop the contents of the buffer, keeping its capacity
+     */
+    void clear() noexcept { size_ = 0; }
+
+    /**
+     * \brief Drop everything in the buffer past the specified size
+     */
+    void truncate(std::size_t size) noexcept
+    {
+        if (size < size_)
+            size_ = size;
+    }
+
+    exposition_buffer& append(const char* str, std::size_t length)
+    {
+        if (length)
+        {
+            std::memcpy(reserve_more(length), str, length);
+            size_ += length;
+        }
+        return *this;
+    }
+
+    exposition_buffer& append(const std::string& str)
+    {
+        return append(str.data(), str.size());
+    }
+
+    exposition_buffer& append(char c)
+    {
+        *reserve_more(1) = c;
+        ++size_;
+        return *this;
+    }
+
+    /**
+     * \brief Copy the contents of the buffer into a string
+     */
+    std::string str() const
+    {
+        return std::string(data_.get(), size_);
+    }
+
+    /**
+     * \brief Write the contents of the buffer to a standard stream
+     */
+    void write_to(std::ostream& into) const
+    {
+        into.write(data_.get(), size_);
+    }
+};
+
+inline std::ostream& operator<<(std::ostream& into, const exposition_buffer& buffer)
+{
+    buffer.write_to(into);
+    return into;
+}
+
+}
+
+#endif //CXXMETRICS_EXPOSITION_BUFFER_HPP
@@ -39,11 +39,13 @@ template<typename TGaugeType, gauge_aggregation_type TAggregation = aggregation_
 class primitive_gauge : gauge<TGaugeType, TAggregation>
 {
     TGaugeType value_;
+    internal::change_epoch epoch_;
 public:
     primitive_gauge(const TGaugeType& initial_value = TGaugeType()) noexcept;
     primitive_gauge(const primitive_gauge& copy) = default;
     primitive_gauge(primitive_gauge&& mv) :
-            value_(std::forward<TGaugeType>(mv.value_))
+            value_(std::forward<TGaugeType>(mv.value_)),
+            epoch_(mv.epoch_)
     { }
     ~primitive_gauge() = default;
 
@@ -52,11 +54,20 @@ public:
 
     primitive_gauge& operator=(primitive_gauge&& other) {
         value_ = std::move(other.value_);
+        epoch_.touch();
         return *this;
     }
 
     void set(TGaugeType value) noexcept;
 
+    /**
+     * \brief Get the change epoch of the gauge, which changes every time the gauge is set
+     */
+    uint64_t epoch() const noexcept
+    {
+        return epoch_.value();
+    }
+
     TGaugeType get() noexcept override;
     TGaugeType get() const noexcept override;
 
@@ -72,6 +83,7 @@ template<typename TGaugeType, gauge_aggregation_type TAggregation>
 primitive_gauge<TGaugeType, TAggregation> &primitive_gauge<TGaugeType, TAggregation>::operator=(const TGaugeType& value) noexcept
 {
     value_ = value;
+    epoch_.touch();
     return *this;
 }
 
@@ -79,6 +91,7 @@ template<typename TGaugeType, gauge_aggregation_type TAggregation>
 void primitive_gauge<TGaugeType, TAggregation>::set(TGaugeType value) noexcept
 {
     value_ = value;
+    epoch_.touch();
 }
 
 template<typename TGaugeType, gauge_aggregation_type TAggregation>
@@ -230,6 +243,8 @@ public:
     }
     gauge& operator=(const gauge& other) = default;
     gauge& operator=(gauge&& mv) = default;
+
+    using gauges::primitive_gauge<TGaugeType, TAggregation>::epoch;
 };
 
 template<typename T, gauges::gauge_aggregation_type TAggregation>
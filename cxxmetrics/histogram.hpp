@@ -20,6 +20,7 @@ class histogram : public metric<histogram<TElem, TReservoir>>
 {
     TReservoir reservoir_;
     counter<uint64_t> count_;
+    internal::change_epoch epoch_;
 
 public:
     histogram() = default;
@@ -42,6 +43,7 @@ public:
     {
         ++count_;
         reservoir_.update(value);
+        epoch_.touch();
     }
 
     /**
@@ -54,6 +56,16 @@ public:
         return static_cast<uint64_t>(count_);
     }
 
+    /**
+     * \brief Get the change epoch of the histogram
+     *
+     * \return a value that changes with every update, or 0 if the reservoir expires values on its own
+     */
+    uint64_t epoch() const noexcept
+    {
+        return internal::is_time_windowed<TReservoir>::value ? 0 : epoch_.value();
+    }
+
     /**
      * \brief Get a snapshot of the histogram
      *
@@ -0,0 +1,310 @@
+#ifndef CXXMETRICS_HTTP_CONNECTION_HPP
+#define CXXMETRICS_HTTP_CONNECTION_HPP
+
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <system_error>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "exposition_buffer.hpp"
+
+namespace cxxmetrics
+{
+
+namespace internal
+{
+
+/**
+ * \brief A blocking HTTP/1.1 client connection that's kept alive between requests
+ */
+class http_connection
+{
+    int socket_;
+    std::string address_;
+    uint16_t port_;
+    std::chrono::milliseconds timeout_;
+    std::string response_;
+
+    bool wait(short events, std::chrono::steady_clock::time_point deadline)
+    {
+        while (true)
+        {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+            if (left <= 0)
+                return false;
+
+            pollfd target{socket_, events, 0};
+            auto ready = ::poll(&target, 1, static_cast<int>(left));
+            if (ready > 0)
+                return true;
+            if (ready < 0 && errno != EINTR)
+                return false;
+        }
+    }
+
+    bool connect(std::chrono::steady_clock::time_point deadline)
+    {
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port_);
+        if (inet_pton(AF_INET, address_.c_str(), &address.sin_addr) != 1)
+            throw std::system_error(std::make_error_code(std::errc::invalid_argument), "invalid address");
+
+        socket_ = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (socket_ < 0)
+            throw std::system_error(errno, std::generic_category(), "socket");
+
+        int on = 1;
+        setsockopt(socket_, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        if (::connect(socket_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0)
+            return true;
+        if (errno != EINPROGRESS || !wait(POLLOUT, deadline))
+            return false;
+
+        int error = 0;
+        socklen_t length = sizeof(error);
+        return getsockopt(socket_, SOL_SOCKET, SO_ERROR, &error, &length) == 0 && error == 0;
+    }
+
+    bool send(iovec* parts, int count, std::chrono::steady_clock::time_point deadline)
+    {
+        while (count > 0)
+        {
+            msghdr message{};
+            message.msg_iov = parts;
+            message.msg_iovlen = static_cast<std::size_t>(count);
+
+            auto sent = ::sendmsg(socket_, &message, MSG_NOSIGNAL);
+            if (sent < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                if ((errno != EAGAIN && errno != EWOULDBLOCK) || !wait(POLLOUT, deadline))
+                    return false;
+                continue;
+            }
+
+            auto done = static_cast<std::size_t>(sent);
+            while (count > 0 && done >= parts->iov_len)
+            {
+                done -= parts->iov_len;
+                ++parts;
+                --count;
+            }
+            if (count > 0)
+            {
+                parts->iov_base = static_cast<char*>(parts->iov_base) + done;
+                parts->iov_len -= done;
+            }
+        }
+
+        return true;
+    }
+
+    /**
+     * \brief Read more of the response, returning false if the connection failed or timed out
+     */
+    bool receive(std::chrono::steady_clock::time_point deadline)
+    {
+        char chunk[4096];
+        while (true)
+        {
+            auto got = ::recv(socket_, chunk, sizeof(chunk), 0);
+            if (got > 0)
+            {
+                response_.append(chunk, static_cast<std::size_t>(got));
+                return true;
+            }
+            if (got == 0)
+                return false;
+            if (errno == EINTR)
+                continue;
+            if ((errno != EAGAIN && errno != EWOULDBLOCK) || !wait(POLLIN, deadline))
+                return false;
+        }
+    }
+
+    static bool header_is(const std::string& head, std::size_t at, std::size_t end, const char* name)
+    {
+        auto length = std::strlen(name);
+        if (end - at < length || head[at + length] != ':')
+            return false;
+        for (std::size_t i = 0; i < length; i++)
+        {
+            if (std::tolower(static_cast<unsigned char>(head[at + i])) != name[i])
+                return false;
+        }
+        return true;
+    }
+
+    /**
+     * \brief Read a whole response, returning its status, or -1 if there wasn't a complete one
+     *
+     * \param body where to put the body of the response, or null to skip it
+     */
+    int read_response(bool& keep_alive, std::chrono::steady_clock::time_point deadline, std::string* body)
+    {
+        std::size_t head_end;
+        while ((head_end = response_.find("\r\n\r\n")) == std::string::npos)
+        {
+            if (!receive(deadline))
+                return -1;
+        }
+
+        if (response_.compare(0, 5, "HTTP/") != 0)
+            return -1;
+        auto space = response_.find(' ');
+        if (space == std::string::npos || space > head_end)
+            return -1;
+        auto status = std::atoi(response_.c_str() + space + 1);
+
+        std::size_t content_length = 0;
+        bool chunked = false;
+        keep_alive = response_.compare(5, 3, "1.1") == 0;
+        auto line = response_.find("\r\n") + 2;
+        while (line < head_end)
+        {
+            auto end = response_.find("\r\n", line);
+            auto value = response_.find_first_not_of(' ', response_.find(':', line) + 1);
+            if (header_is(response_, line, end, "content-length"))
+                content_length = std::strtoull(response_.c_str() + value, nullptr, 10);
+            else if (header_is(response_, line, end, "transfer-encoding"))
+                chunked = response_.compare(value, 7, "chunked") == 0;
+            else if (header_is(response_, line, end, "connection"))
+                keep_alive = response_.compare(value, 5, "close") != 0;
+            line = end + 2;
+        }
+
+        auto body_start = head_end + 4;
+        if (body)
+            body->clear();
+        if (!chunked)
+        {
+            while (response_.size() < body_start + content_length)
+            {
+                if (!receive(deadline))
+                    return -1;
+            }
+            if (body)
+                body->assign(response_, body_start, content_length);
+            response_.erase(0, body_start + content_length);
+            return status;
+        }
+
+        auto at = body_start;
+        while (true)
+        {
+            std::size_t size_end;
+            while ((size_end = response_.find("\r\n", at)) == std::string::npos)
+            {
+                if (!receive(deadline))
+                    return -1;
+            }
+
+            auto size = std::strtoull(response_.c_str() + at, nullptr, 16);
+            auto next = size_end + 2 + size + 2;
+            while (response_.size() < next)
+            {
+                if (!receive(deadline))
+                    return -1;
+            }
+
+            if (body)
+                body->append(response_, size_end + 2, size);
+
+            at = next;
+            if (size == 0)
+                break;
+        }
+
+        response_.erase(0, at);
+        return status;
+    }
+
+public:
+    http_connection(std::string address, uint16_t port, std::chrono::milliseconds timeout) :
+            socket_(-1),
+            address_(std::move(address)),
+            port_(port),
+            timeout_(timeout)
+    { }
+
+    http_connection(const http_connection&) = delete;
+    http_connection& operator=(const http_connection&) = delete;
+
+    ~http_connection()
+    {
+        close();
+    }
+
+    void close()
+    {
+        if (socket_ >= 0)
+            ::close(socket_);
+        socket_ = -1;
+        response_.clear();
+    }
+
+    /**
+     * \brief Send a request and wait on its response
+     *
+     * \param head the request line and headers, including the blank line that ends them
+     * \param response where to put the body of the response, or null if it isn't needed
+     *
+     * \return the status of the response, or -1 if the request couldn't be sent or the response couldn't be read
+     */
+    int request(const std::string& head, const char* body, std::size_t length, uint64_t& connections, std::string* response = nullptr)
+    {
+        auto deadline = std::chrono::steady_clock::now() + timeout_;
+        for (int attempt = 0; attempt < 2; attempt++)
+        {
+            // a kept alive connection may have been closed by the receiver while it was idle, in which case the
+            // request is tried once more on a new one
+            bool reused = socket_ >= 0;
+            if (!reused)
+            {
+                if (!connect(deadline))
+                {
+                    close();
+                    return -1;
+                }
+                ++connections;
+            }
+
+            iovec parts[2];
+            parts[0].iov_base = const_cast<char*>(head.data());
+            parts[0].iov_len = head.size();
+            parts[1].iov_base = const_cast<char*>(body);
+            parts[1].iov_len = length;
+
+            bool keep_alive = false;
+            int status = send(parts, 2, deadline) ? read_response(keep_alive, deadline, response) : -1;
+            if (status < 0 || !keep_alive)
+                close();
+            if (status >= 0 || !reused)
+                return status;
+        }
+
+        return -1;
+    }
+
+    int request(const std::string& head, const exposition_buffer& body, uint64_t& connections)
+    {
+        return request(head, body.data(), body.size(), connections);
+    }
+};
+
+}
+
+}
+
+#endif //CXXMETRICS_HTTP_CONNECTION_HPP
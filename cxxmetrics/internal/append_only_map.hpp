@@ -0,0 +1,174 @@
+#ifndef CXXMETRICS_APPEND_ONLY_MAP_HPP
+#define CXXMETRICS_APPEND_ONLY_MAP_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+namespace cxxmetrics
+{
+namespace internal
+{
+
+/**
+ * \brief A map that's only ever added to, with lookups and iteration that never take a lock
+ *
+ * Entries are allocated once and never move or go away until the map does. They're linked in the order they were
+ * added, so iteration just follows the links, and indexed by an open addressed table of pointers to them. Adding an
+ * entry only fills an empty slot of the table, which readers either see or don't. When the table is half full, a
+ * table twice its size is built from the entries and swapped in, and readers that were still probing the old one
+ * keep it alive until they're done with it. Adding an entry is therefore amortized O(1) and never copies the entries.
+ *
+ * Writers are serialized by the caller.
+ */
+template<typename TKey, typename TValue, typename THash = std::hash<TKey>>
+class append_only_map
+{
+public:
+    struct entry
+    {
+        const TKey key;
+        TValue value;
+
+    private:
+        friend class append_only_map;
+
+        std::size_t hash_;
+        std::atomic<entry*> next_;
+
+        entry(const TKey& key, TValue value, std::size_t hash) :
+                key(key),
+                value(std::move(value)),
+                hash_(hash),
+                next_(nullptr)
+        { }
+
+    public:
+        const entry* next() const noexcept
+        {
+            return next_.load(std::memory_order_acquire);
+        }
+    };
+
+private:
+    struct index
+    {
+        std::size_t mask;
+        std::unique_ptr<std::atomic<entry*>[]> slots;
+
+        explicit index(std::size_t size) :
+                mask(size - 1),
+                slots(new std::atomic<entry*>[size])
+        {
+            for (std::size_t i = 0; i < size; i++)
+                slots[i].store(nullptr, std::memory_order_relaxed);
+        }
+
+        void put(entry* e) noexcept
+        {
+            auto at = e->hash_ & mask;
+            while (slots[at].load(std::memory_order_relaxed))
+                at = (at + 1) & mask;
+            slots[at].store(e, std::memory_order_release);
+        }
+    };
+
+    std::shared_ptr<index> index_;
+    std::atomic<entry*> head_;
+    entry* tail_;
+    std::atomic<std::size_t> size_;
+
+    std::shared_ptr<index> current() const noexcept
+    {
+        return std::atomic_load_explicit(&index_, std::memory_order_acquire);
+    }
+
+public:
+    append_only_map() :
+            index_(std::make_shared<index>(16)),
+            head_(nullptr),
+            tail_(nullptr),
+            size_(0)
+    { }
+
+    append_only_map(const append_only_map&) = delete;
+    append_only_map& operator=(const append_only_map&) = delete;
+
+    ~append_only_map()
+    {
+        auto at = head_.load(std::memory_order_relaxed);
+        while (at)
+        {
+            auto next = at->next_.load(std::memory_order_relaxed);
+            delete at;
+            at = next;
+        }
+    }
+
+    /**
+     * \brief Find the entry with a key, or null if there isn't one
+     */
+    const entry* find(const TKey& key) const
+    {
+        auto hash = THash()(key);
+        auto table = current();
+        for (auto at = hash & table->mask; ; at = (at + 1) & table->mask)
+        {
+            auto e = table->slots[at].load(std::memory_order_acquire);
+            if (!e)
+                return nullptr;
+            if (e->hash_ == hash && e->key == key)
+                return e;
+        }
+    }
+
+    /**
+     * \brief Add an entry for a key that isn't in the map yet. Only one writer can add at a time
+     */
+    const entry* add(const TKey& key, TValue value)
+    {
+        std::unique_ptr<entry> added(new entry(key, std::move(value), THash()(key)));
+        auto size = size_.load(std::memory_order_relaxed) + 1;
+
+        auto table = current();
+        if (size * 2 > table->mask + 1)
+        {
+            auto grown = std::make_shared<index>((table->mask + 1) * 2);
+            for (auto at = head_.load(std::memory_order_relaxed); at; at = at->next_.load(std::memory_order_relaxed))
+                grown->put(at);
+            std::atomic_store_explicit(&index_, grown, std::memory_order_release);
+            table = std::move(grown);
+        }
+
+        auto result = added.release();
+        if (tail_)
+            tail_->next_.store(result, std::memory_order_release);
+        else
+            head_.store(result, std::memory_order_release);
+        tail_ = result;
+        table->put(result);
+        size_.store(size, std::memory_order_release);
+        return result;
+    }
+
+    /**
+     * \brief The first entry in the order they were added, or null if there aren't any
+     */
+    const entry* first() const noexcept
+    {
+        return head_.load(std::memory_order_acquire);
+    }
+
+    std::size_t size() const noexcept
+    {
+        return size_.load(std::memory_order_acquire);
+    }
+};
+
+}
+}
+
+#endif //CXXMETRICS_APPEND_ONLY_MAP_HPP
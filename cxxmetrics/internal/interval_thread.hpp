@@ -0,0 +1,127 @@
+#ifndef CXXMETRICS_INTERVAL_THREAD_HPP
+#define CXXMETRICS_INTERVAL_THREAD_HPP
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace cxxmetrics
+{
+namespace internal
+{
+
+/**
+ * \brief The background thread of a publisher that does its work on an interval until it's stopped
+ *
+ * The thread waits on an eventfd, so stopping it wakes it right away instead of at the end of the interval, and a
+ * loop that has file descriptors of its own to wait on can poll the eventfd along with them. Starting and stopping
+ * are done by the owner of the thread and aren't synchronized with each other.
+ */
+class interval_thread
+{
+    std::thread thread_;
+    int wake_;
+    bool running_;
+
+public:
+    interval_thread() noexcept :
+            wake_(-1),
+            running_(false)
+    { }
+
+    interval_thread(const interval_thread&) = delete;
+    interval_thread& operator=(const interval_thread&) = delete;
+
+    ~interval_thread()
+    {
+        stop();
+    }
+
+    /**
+     * \brief Wait out an interval on the eventfd of a thread
+     *
+     * \return whether the thread was stopped
+     */
+    static bool wait(int wake, std::chrono::milliseconds interval)
+    {
+        pollfd waits{wake, POLLIN, 0};
+        return ::poll(&waits, 1, static_cast<int>(interval.count())) > 0;
+    }
+
+    /**
+     * \brief Run a task at the end of every interval. A task that throws is tried again on the next interval
+     *
+     * \throws std::invalid_argument if the interval isn't positive
+     */
+    template<typename TTask>
+    void start(std::chrono::milliseconds interval, TTask task)
+    {
+        start_loop(interval, [task](int wake, std::chrono::milliseconds interval) mutable {
+            while (!wait(wake, interval))
+            {
+                try
+                {
+                    task();
+                }
+                catch (...)
+                {
+                    // try again on the next interval
+                }
+            }
+        });
+    }
+
+    /**
+     * \brief Run a loop of its own on the thread, which is given the eventfd and the interval and returns once the
+     * eventfd is readable
+     *
+     * \throws std::invalid_argument if the interval isn't positive
+     */
+    template<typename TLoop>
+    void start_loop(std::chrono::milliseconds interval, TLoop loop)
+    {
+        if (interval.count() <= 0)
+            throw std::invalid_argument("a background thread needs a positive interval");
+        if (running_)
+            return;
+
+        wake_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (wake_ < 0)
+            throw std::system_error(errno, std::generic_category(), "eventfd");
+
+        running_ = true;
+        auto wake = wake_;
+        thread_ = std::thread([loop, wake, interval]() mutable { loop(wake, interval); });
+    }
+
+    void stop()
+    {
+        if (!running_)
+            return;
+
+        uint64_t one = 1;
+        auto written = ::write(wake_, &one, sizeof(one));
+        (void)written;
+        thread_.join();
+        ::close(wake_);
+        wake_ = -1;
+        running_ = false;
+    }
+
+    bool running() const noexcept
+    {
+        return running_;
+    }
+};
+
+}
+}
+
+#endif //CXXMETRICS_INTERVAL_THREAD_HPP
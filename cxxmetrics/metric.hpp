@@ -1,6 +1,7 @@
 #ifndef CXXMETRICS_METRIC_HPP
 #define CXXMETRICS_METRIC_HPP
 
+#include <atomic>
 #include "snapshots.hpp"
 
 #if __cplusplus < 201700L
@@ -22,6 +23,51 @@ public:
     virtual ~metric() = default;
 };
 
+/**
+ * \brief A cheap change counter for metrics whose snapshots only change when the metric is updated
+ *
+ * Publishers use it to figure out whether a metric changed since the last time they snapshotted it.
+ * Epochs start at 1 so that 0 can mean "not tracked".
+ */
+class change_epoch
+{
+    std::atomic_uint_fast64_t epoch_;
+public:
+    change_epoch() noexcept :
+            epoch_(1)
+    { }
+
+    change_epoch(const change_epoch& other) noexcept :
+            epoch_(other.epoch_.load(std::memory_order_acquire))
+    { }
+
+    change_epoch& operator=(const change_epoch&) noexcept
+    {
+        touch();
+        return *this;
+    }
+
+    /**
+     * \brief mark the owning metric as changed. This should be done after the change is written
+     */
+    void touch() noexcept
+    {
+        epoch_.fetch_add(1, std::memory_order_release);
+    }
+
+    uint64_t value() const noexcept
+    {
+        return epoch_.load(std::memory_order_acquire);
+    }
+};
+
+/**
+ * \brief whether the values in a reservoir expire on their own, regardless of updates
+ */
+template<typename TReservoir>
+struct is_time_windowed : public std::false_type
+{ };
+
 template<typename TMetric>
 struct default_metric_builder
 {
@@ -67,6 +113,18 @@ public:
      * \return the metric type that the metric implements - taken from TMetricType
      */
     std::string metric_type() const noexcept override;
+
+    /**
+     * \brief Get the change epoch of the metric
+     *
+     * Metrics whose snapshots only change when they're updated hide this with a value that changes on every
+     * update. The default of 0 is for metrics whose snapshots change on their own (decaying rates, externally
+     * provided values) and means that the metric always needs to be snapshotted.
+     */
+    constexpr uint64_t epoch() const noexcept
+    {
+        return 0;
+    }
 };
 
 template<typename TMetricType>
@@ -10,6 +10,17 @@
 namespace cxxmetrics
 {
 
+/**
+ * \brief The kind of data stored in a metric_value, for writers that want to format it without going through strings
+ */
+enum class metric_value_kind
+{
+    signed_integral,
+    unsigned_integral,
+    floating_point,
+    string
+};
+
 namespace internal
 {
 
@@ -22,6 +33,7 @@ public:
     virtual long double to_float(bool* valid) const = 0;
     virtual std::chrono::nanoseconds to_nanos(bool* valid) const = 0;
     virtual int type_score() const = 0;
+    virtual metric_value_kind kind() const noexcept = 0;
     virtual std::size_t hash_value() const = 0;
     virtual void copy(void* into) const noexcept = 0;
     virtual void move(void* into) noexcept { return copy(into); }
@@ -82,6 +94,11 @@ public:
         return (sizeof(T) * 10) + (std::is_signed<T>::value ? 0 : 1);
     }
 
+    metric_value_kind kind() const noexcept override
+    {
+        return std::is_signed<T>::value ? metric_value_kind::signed_integral : metric_value_kind::unsigned_integral;
+    }
+
     void add(const variant_data& other) noexcept override
     {
         bool valid;
@@ -210,6 +227,11 @@ public:
         return (sizeof(T) * 20);
     }
 
+    metric_value_kind kind() const noexcept override
+    {
+        return metric_value_kind::floating_point;
+    }
+
     void add(const variant_data& other) noexcept override
     {
         val_ += other.to_float(nullptr);
@@ -356,6 +378,11 @@ public:
         return 1;
     }
 
+    metric_value_kind kind() const noexcept override
+    {
+        return metric_value_kind::string;
+    }
+
     void add(const variant_data& other) noexcept override
     {
         val_ += other.to_string();
@@ -454,6 +481,13 @@ public:
             return (sizeof(TRep) * 10) + 2;
     }
 
+    metric_value_kind kind() const noexcept override
+    {
+        if (std::is_floating_point<TRep>::value)
+            return metric_value_kind::floating_point;
+        return std::is_signed<TRep>::value ? metric_value_kind::signed_integral : metric_value_kind::unsigned_integral;
+    }
+
     void add(const variant_data& other) noexcept override
     {
         dur_ += std::chrono::duration_cast<std::chrono::duration<TRep, TPeriod>>(other.to_nanos(nullptr));
@@ -670,6 +704,11 @@ public:
         return as<variant_data>()->to_nanos(nullptr);
     }
 
+    metric_value_kind kind() const noexcept
+    {
+        return as<variant_data>()->kind();
+    }
+
     int compare(const variant_data_holder& other) const
     {
         return as<variant_data>()->compare(*other.as<variant_data>());
@@ -745,6 +784,14 @@ public:
         return *this;
     }
 
+    /**
+     * \brief Get the kind of data that the value holds
+     */
+    metric_value_kind kind() const noexcept
+    {
+        return value_.kind();
+    }
+
     metric_value& operator+=(const metric_value& other)
     {
         value_ = (value_.add(other.value_));
@@ -2,9 +2,14 @@
 #define CXXMETRICS_METRICS_REGISTRY_HPP
 
 // TODO: use shared_mutexes with C++17
+#include <atomic>
+#include <functional>
 #include <mutex>
 #include <memory>
+#include "internal/append_only_map.hpp"
 #include "publisher.hpp"
+#include "registry_snapshot.hpp"
+#include "self_metrics.hpp"
 #include "tag_collection.hpp"
 #include "counter.hpp"
 #include "ewma.hpp"
@@ -21,11 +26,33 @@ class metrics_registry;
 namespace internal
 {
 
+/**
+ * \brief The number of publish data types that get a lock-free slot on every registered metric
+ */
+constexpr std::size_t publish_data_slots = 16;
+
+inline std::size_t next_publish_data_slot() noexcept
+{
+    static std::atomic_size_t next(0);
+    return next.fetch_add(1, std::memory_order_relaxed);
+}
+
+/**
+ * \brief The slot of a type of publish data, assigned the first time the type is used
+ */
+template<typename TDataType>
+std::size_t publish_data_slot() noexcept
+{
+    static const std::size_t slot = next_publish_data_slot();
+    return slot;
+}
+
 class registered_snapshot_visitor_builder
 {
 public:
     virtual std::size_t visitor_size() const = 0;
-    virtual void construct(snapshot_visitor* location, const tag_collection& collection) = 0;
+    virtual bool unchanged(const tag_collection& collection, uint64_t epoch) { return false; }
+    virtual void construct(snapshot_visitor* location, const tag_collection& collection, uint64_t epoch) = 0;
 };
 
 template<typename TVisitor>
@@ -60,13 +87,59 @@ public:
         return sizeof(invokable_snapshot_visitor<bound_visitor>);
     }
 
-    void construct(snapshot_visitor* location, const tag_collection& collection) override
+    void construct(snapshot_visitor* location, const tag_collection& collection, uint64_t) override
     {
-        using namespace std::placeholders;
         new (location) invokable_snapshot_visitor<bound_visitor>(bound_visitor(visitor_, collection));
     }
 };
 
+template<typename TFilter, typename TVisitor>
+class invokable_versioned_snapshot_visitor_builder : public registered_snapshot_visitor_builder
+{
+    TFilter filter_;
+    TVisitor visitor_;
+
+    class bound_visitor
+    {
+        const TVisitor& visitor_;
+        const tag_collection& tags_;
+        uint64_t epoch_;
+    public:
+        bound_visitor(const TVisitor& v, const tag_collection& t, uint64_t epoch) :
+            visitor_(v),
+            tags_(t),
+            epoch_(epoch)
+        { }
+
+        template<typename T>
+        decltype(std::declval<TVisitor>()(std::declval<const tag_collection>(), uint64_t(), std::declval<T>()))
+        operator()(T&& arg) const
+        {
+            return visitor_(tags_, epoch_, std::forward<T>(arg));
+        }
+    };
+public:
+    invokable_versioned_snapshot_visitor_builder(TFilter&& filter, TVisitor&& visitor) :
+            filter_(std::forward<TFilter>(filter)),
+            visitor_(std::forward<TVisitor>(visitor))
+    { }
+
+    std::size_t visitor_size() const override
+    {
+        return sizeof(invokable_snapshot_visitor<bound_visitor>);
+    }
+
+    bool unchanged(const tag_collection& collection, uint64_t epoch) override
+    {
+        return filter_(collection, epoch);
+    }
+
+    void construct(snapshot_visitor* location, const tag_collection& collection, uint64_t epoch) override
+    {
+        new (location) invokable_snapshot_visitor<bound_visitor>(bound_visitor(visitor_, collection, epoch));
+    }
+};
+
 }
 
 /**
@@ -118,6 +191,7 @@ class basic_registered_metric
     std::string type_;
 
     std::unordered_map<std::string, std::unique_ptr<basic_publish_options>> pubdata_;
+    std::atomic<basic_publish_options*> pubslots_[internal::publish_data_slots];
     mutable std::mutex pubdatalock_;
 
     template<typename TMetricType, typename... TConstructorArgs>
@@ -150,12 +224,25 @@ class basic_registered_metric
     typename std::enable_if<std::is_base_of<basic_publish_options, TDataType>::value, TDataType>::type&
     get_or_create_publish_data(TConstructArgs&&... args)
     {
+        // data is never removed, so once it's in its slot it can be handed out without the lock
+        auto slot = internal::publish_data_slot<TDataType>();
+        if (slot < internal::publish_data_slots)
+        {
+            auto existing = pubslots_[slot].load(std::memory_order_acquire);
+            if (existing)
+                return static_cast<TDataType&>(*existing);
+        }
+
         std::lock_guard<std::mutex> lock(pubdatalock_);
         auto key = typeid(TDataType).name();
         auto& ptr = pubdata_[key];
 
         if (!ptr)
+        {
             ptr = std::make_unique<TDataType>(std::forward<TConstructArgs>(args)...);
+            if (slot < internal::publish_data_slots)
+                pubslots_[slot].store(ptr.get(), std::memory_order_release);
+        }
 
         return static_cast<TDataType&>(*ptr);
     }
@@ -164,6 +251,11 @@ class basic_registered_metric
     typename std::enable_if<std::is_base_of<basic_publish_options, TDataType>::value, TDataType>::type*
     try_get_publish_data() const
     {
+        // data of a type with a slot is always put in its slot when it's created
+        auto slot = internal::publish_data_slot<TDataType>();
+        if (slot < internal::publish_data_slots)
+            return static_cast<TDataType*>(pubslots_[slot].load(std::memory_order_acquire));
+
         std::lock_guard<std::mutex> lock(pubdatalock_);
         auto fnd = pubdata_.find(typeid(TDataType).name());
         if (fnd == pubdata_.end())
@@ -206,7 +298,10 @@ protected:
 public:
     basic_registered_metric(const std::string& type) :
             type_(type)
-    { }
+    {
+        for (auto& slot : pubslots_)
+            slot.store(nullptr, std::memory_order_relaxed);
+    }
 
     virtual ~basic_registered_metric() = default;
 
@@ -225,6 +320,25 @@ public:
         this->visit_each(builder);
     }
 
+    /**
+     * \brief Visits all of the metrics with their tag values like visit(), but lets the caller skip unchanged metrics
+     *
+     * Before a tagged metric is snapshotted, the filter is called with its tags and its change epoch. If the
+     * filter returns true, the metric is considered unchanged and no snapshot is taken. Otherwise the handler
+     * is called with the tags, the epoch and the snapshot. Metrics that don't track changes have an epoch of 0
+     * and are never passed to the filter.
+     *
+     * \tparam TFilter the filter type, called as filter(const tag_collection&, uint64_t)
+     * \tparam THandler the handler type, called as handler(const tag_collection&, uint64_t, snapshot)
+     * \param filter the instance of the filter
+     * \param handler the instance of the handler which will be called for each of the changed metrics
+     */
+    template<typename TFilter, typename THandler>
+    void visit_changed(TFilter&& filter, THandler&& handler) {
+        internal::invokable_versioned_snapshot_visitor_builder<TFilter, THandler> builder(std::forward<TFilter>(filter), std::forward<THandler>(handler));
+        this->visit_each(builder);
+    }
+
     /**
      * \brief Aggregates all of the metrics and their different tag values into a single metric
      *
@@ -244,17 +358,28 @@ public:
      * \brief Get the type of metric registered
      */
     virtual std::string type() const { return type_; }
+
+    /**
+     * \brief Get the number of tagged permutations of the metric
+     */
+    virtual std::size_t size() const = 0;
 };
 
 /**
  * \brief the specialized root metric that will be the real types registered in the repository
  *
+ * The tagged children are kept in an append-only map whose lookups and iteration never take a lock, so a long
+ * running snapshot never blocks the creation of new children and adding a child never copies the others. lock_ only
+ * serializes writers against each other.
+ *
  * \tparam TMetricType the type of metric registered in the repository
  */
 template<typename TMetricType>
 class registered_metric : public basic_registered_metric
 {
-    std::unordered_map<tag_collection, std::shared_ptr<TMetricType>> metrics_;
+    using children_type = internal::append_only_map<tag_collection, std::shared_ptr<TMetricType>>;
+
+    children_type metrics_;
     std::mutex lock_;
 
 protected:
@@ -266,23 +391,33 @@ public:
     registered_metric(const std::string& metric_type_name) :
             basic_registered_metric(metric_type_name)
     { }
+
+    std::size_t size() const override
+    {
+        return metrics_.size();
+    }
 };
 
 template<typename TMetricType>
 void registered_metric<TMetricType>::visit_each(cxxmetrics::internal::registered_snapshot_visitor_builder &builder)
 {
-    std::lock_guard<std::mutex> lock(lock_);
-    for (auto& p : metrics_)
+    // children added while visiting come after the ones there were when it started, and aren't visited
+    auto left = metrics_.size();
+    for (auto p = metrics_.first(); left; p = p->next(), --left)
     {
+        auto epoch = p->value->epoch();
+        if (epoch && builder.unchanged(p->key, epoch))
+            continue;
+
         auto sz = builder.visitor_size() + sizeof(std::max_align_t);
         void* ptr = alloca(sz);
 
         std::align(sizeof(std::max_align_t), sz, ptr, sz);
         auto loc = reinterpret_cast<snapshot_visitor*>(ptr);
-        builder.construct(loc, p.first);
+        builder.construct(loc, p->key, epoch);
         try
         {
-            loc->visit(p.second->snapshot());
+            loc->visit(p->value->snapshot());
         }
         catch (...)
         {
@@ -297,33 +432,37 @@ void registered_metric<TMetricType>::visit_each(cxxmetrics::internal::registered
 template<typename TMetricType>
 void registered_metric<TMetricType>::aggregate_all(snapshot_visitor &visitor)
 {
-    std::unique_lock<std::mutex> lock(lock_);
-
-    auto itr = metrics_.begin();
-    if (itr == metrics_.end())
+    auto left = metrics_.size();
+    auto p = metrics_.first();
+    if (!left)
         return;
 
-    auto result = itr->second->snapshot();
-    for (++itr; itr != metrics_.end(); ++itr)
+    auto result = p->value->snapshot();
+    for (p = p->next(); --left; p = p->next())
     {
-        result.merge(itr->second->snapshot());
+        result.merge(p->value->snapshot());
     }
 
-    lock.unlock();
     visitor.visit(result);
 }
 
 template<typename TMetricType>
 std::shared_ptr<internal::metric> registered_metric<TMetricType>::child(const cxxmetrics::tag_collection &tags, void* metricbuilder)
 {
-    std::lock_guard<std::mutex> lock(lock_);
+    // the common case - the child already exists and we don't need to lock anything
     auto res = metrics_.find(tags);
+    if (res)
+        return std::static_pointer_cast<internal::metric>(res->value);
+
+    internal::timed_lock_guard<internal::self_stat::metric_lock_wait_ns, std::mutex> lock(lock_);
 
-    if (res != metrics_.end())
-        return std::static_pointer_cast<internal::metric>(res->second);
+    // someone may have added it while we were waiting on the lock
+    res = metrics_.find(tags);
+    if (res)
+        return std::static_pointer_cast<internal::metric>(res->value);
 
-    return std::static_pointer_cast<internal::metric>(
-            metrics_.emplace(tags, static_cast<basic_metric_builder<TMetricType>*>(metricbuilder)->build()).first->second);
+    auto added = metrics_.add(tags, static_cast<basic_metric_builder<TMetricType>*>(metricbuilder)->build());
+    return std::static_pointer_cast<internal::metric>(added->value);
 }
 
 /**
@@ -364,7 +503,7 @@ template<typename TAlloc>
 template<typename TMetricPtrBuilder>
 basic_registered_metric& basic_default_repository<TAlloc>::get_or_add(const metric_path& name, const TMetricPtrBuilder& builder)
 {
-    std::lock_guard<std::mutex> lock(metriclock_);
+    internal::timed_lock_guard<internal::self_stat::registry_lock_wait_ns, std::mutex> lock(metriclock_);
     auto existing = metrics_.find(name);
 
     if (existing == metrics_.end())
@@ -379,7 +518,7 @@ basic_registered_metric& basic_default_repository<TAlloc>::get_or_add(const metr
 template<typename TAlloc>
 basic_registered_metric* basic_default_repository<TAlloc>::get(const metric_path& name)
 {
-    std::lock_guard<std::mutex> lock(metriclock_);
+    internal::timed_lock_guard<internal::self_stat::registry_lock_wait_ns, std::mutex> lock(metriclock_);
     auto existing = metrics_.find(name);
 
     if (existing == metrics_.end())
@@ -392,7 +531,7 @@ template<typename TAlloc>
 template<typename THandler>
 void basic_default_repository<TAlloc>::visit(THandler&& handler)
 {
-    std::lock_guard<std::mutex> lock(metriclock_);
+    internal::timed_lock_guard<internal::self_stat::registry_lock_wait_ns, std::mutex> lock(metriclock_);
     for (auto& pair : metrics_)
         handler(pair.first, *pair.second);
 }
@@ -437,6 +576,7 @@ template<typename TRepository = default_repository>
 class metrics_registry
 {
     TRepository repo_;
+    internal::change_epoch options_epoch_;
 
     template<typename TMetricType>
     registered_metric<TMetricType>& get(const metric_path& path);
@@ -449,6 +589,9 @@ class metrics_registry
 
     auto* try_get(const metric_path& name) { return repo_.get(name); }
 
+    void register_self_metrics();
+    void register_family(const metric_path& path, basic_registered_metric& metric);
+
     friend class metrics_publisher<TRepository>;
 public:
     using repository_type = TRepository;
@@ -461,7 +604,8 @@ public:
 
     metrics_registry(const metrics_registry&) = default;
     metrics_registry(metrics_registry&& other) noexcept :
-            repo_(std::move(other.repo_))
+            repo_(std::move(other.repo_)),
+            options_epoch_(other.options_epoch_)
     { }
     ~metrics_registry() = default;
 
@@ -489,6 +633,14 @@ public:
      */
     void publish_options(const metric_path& name, cxxmetrics::publish_options&& options);
 
+    /**
+     * \brief Get a value that changes every time any publish options in the registry are set
+     *
+     * Publishers use this to tell whether anything they derived from the effective options of a metric is stale
+     * without looking the options up again.
+     */
+    uint64_t options_epoch() const noexcept { return options_epoch_.value(); }
+
     /**
      *  \brief Run a visitor on all of the registered metrics
      *
@@ -506,6 +658,16 @@ public:
     template<typename THandler>
     void visit_registered_metrics(THandler&& handler);
 
+    /**
+     * \brief Snapshot every series in the registry into an immutable snapshot that publishers can share
+     *
+     * Every metric is snapshotted once, so publishers that render from the snapshot don't snapshot or sort anything
+     * themselves.
+     *
+     * \return the snapshot, which publishers may hold on to for as long as they need it
+     */
+    std::shared_ptr<const registry_snapshot> collect();
+
     /**
      * \brief Register an existing metric in the registry (perhaps one obtained from another registry)
      *
@@ -668,7 +830,45 @@ template<typename TRepository>
 template<typename... TRepoArgs>
 metrics_registry<TRepository>::metrics_registry(TRepoArgs &&... args) :
         repo_(std::forward<TRepoArgs>(args)...)
-{ }
+{
+    register_self_metrics();
+}
+
+template<typename TRepository>
+void metrics_registry<TRepository>::register_self_metrics()
+{
+#ifdef CXXMETRICS_SELF_METRICS
+    using internal::self_stat;
+    metric_path root(internal::self_metrics_root);
+
+    auto add = [this](const metric_path& path, self_stat stat) {
+        this->gauge(path, std::function<uint64_t()>([stat]() { return internal::self_metrics::instance().value(stat); }));
+    };
+
+    add(root/"registry"/"lock_wait_ns", self_stat::registry_lock_wait_ns);
+    add(root/"registry"/"metric_lock_wait_ns", self_stat::metric_lock_wait_ns);
+    add(root/"ringbuf"/"push_retries", self_stat::ringbuf_push_retries);
+    add(root/"ewma"/"tick_retries", self_stat::ewma_tick_retries);
+    add(root/"ewma"/"skipped_ticks", self_stat::ewma_skipped_ticks);
+    add(root/"publisher"/"scrapes", self_stat::scrapes);
+    add(root/"publisher"/"scrape_ns", self_stat::scrape_ns);
+    add(root/"publisher"/"scrape_bytes", self_stat::scrape_bytes);
+#endif
+}
+
+template<typename TRepository>
+void metrics_registry<TRepository>::register_family(const metric_path& path, basic_registered_metric& metric)
+{
+#ifdef CXXMETRICS_SELF_METRICS
+    // don't count our own metrics, that's how we'd end up recursing forever
+    if (path.begin() == path.end() || *path.begin() == internal::self_metrics_root)
+        return;
+
+    this->gauge(metric_path(internal::self_metrics_root)/"series",
+            std::function<uint64_t()>([&metric]() { return static_cast<uint64_t>(metric.size()); }),
+            {{"family", path.join("/")}});
+#endif
+}
 
 template<typename TRepository>
 const cxxmetrics::publish_options& metrics_registry<TRepository>::publish_options() const
@@ -685,6 +885,7 @@ template<typename TRepository>
 void metrics_registry<TRepository>::publish_options(cxxmetrics::publish_options&& options)
 {
     repo_.template get_publish_data<cxxmetrics::publish_options>() = std::move(options);
+    options_epoch_.touch();
 }
 
 template<typename TRepository>
@@ -695,6 +896,7 @@ void metrics_registry<TRepository>::publish_options(const metric_path& path, cxx
         return;
 
     l->template get_or_create_publish_data<cxxmetrics::publish_options>() = std::move(options);
+    options_epoch_.touch();
 }
 
 template<typename TRepository>
@@ -702,10 +904,16 @@ template<typename TMetricType>
 registered_metric<TMetricType>& metrics_registry<TRepository>::get(const metric_path& path)
 {
     static const std::string mtype = internal::metric_default_value<TMetricType>().metric_type();
-    auto& l = repo_.get_or_add(path, [tn = mtype]() { return std::make_unique<registered_metric<TMetricType>>(tn); });
+    bool created = false;
+    auto& l = repo_.get_or_add(path, [tn = mtype, &created]() {
+        created = true;
+        return std::make_unique<registered_metric<TMetricType>>(tn);
+    });
 
     if (l.type() != mtype)
         throw metric_type_mismatch(l.type(), mtype);
+    if (internal::self_metrics_enabled && created)
+        register_family(path, l);
 
     return static_cast<registered_metric<TMetricType>&>(l);
 }
@@ -725,6 +933,22 @@ void metrics_registry<TRepository>::visit_registered_metrics(THandler &&handler)
     repo_.visit(std::forward<THandler>(handler));
 }
 
+template<typename TRepository>
+std::shared_ptr<const registry_snapshot> metrics_registry<TRepository>::collect()
+{
+    auto result = std::make_shared<registry_snapshot>();
+    auto& snapshot = *result;
+    repo_.visit([&snapshot](const metric_path& path, basic_registered_metric& metric) {
+        snapshot.add_family(path, metric);
+        metric.visit_changed([](const tag_collection&, uint64_t) { return false; },
+                [&snapshot](const tag_collection& tags, uint64_t epoch, const auto& value) {
+                    snapshot.add(tags, epoch, value);
+                });
+    });
+
+    return result;
+}
+
 template<typename TRepository>
 template<typename TMetric>
 bool metrics_registry<TRepository>::register_existing(const metric_path& name,
@@ -734,9 +958,15 @@ bool metrics_registry<TRepository>::register_existing(const metric_path& name,
     if (!metric)
         return false;
 
-    auto& l = repo_.get_or_add(name, [tn = metric->metric_type()]() { return std::make_unique<registered_metric<TMetric>>(tn); });
+    bool created = false;
+    auto& l = repo_.get_or_add(name, [tn = metric->metric_type(), &created]() {
+        created = true;
+        return std::make_unique<registered_metric<TMetric>>(tn);
+    });
     if (l.type() != metric->metric_type())
         throw metric_type_mismatch(l.type(), metric->metric_type());
+    if (internal::self_metrics_enabled && created)
+        register_family(name, l);
 
     return l.template add_existing<TMetric>(repo_.tags(tags), std::move(metric));
 }
@@ -0,0 +1,750 @@
+#ifndef CXXMETRICS_OUTPUT_SINK_HPP
+#define CXXMETRICS_OUTPUT_SINK_HPP
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <vector>
+#include <poll.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "metric_value.hpp"
+
+namespace cxxmetrics
+{
+
+namespace internal
+{
+
+constexpr char two_digits[] =
+        "00010203040506070809"
+        "10111213141516171819"
+        "20212223242526272829"
+        "30313233343536373839"
+        "40414243444546474849"
+        "50515253545556575859"
+        "60616263646566676869"
+        "70717273747576777879"
+        "80818283848586878889"
+        "90919293949596979899";
+
+/**
+ * \brief Format an unsigned integer backwards from the end of a buffer two digits at a time
+ *
+ * \return the first character written
+ */
+inline char* format_unsigned_backwards(char* end, unsigned long long value) noexcept
+{
+    while (value >= 100)
+    {
+        auto at = static_cast<std::size_t>(value % 100) * 2;
+        value /= 100;
+        *--end = two_digits[at + 1];
+        *--end = two_digits[at];
+    }
+
+    if (value >= 10)
+    {
+        auto at = static_cast<std::size_t>(value) * 2;
+        *--end = two_digits[at + 1];
+        *--end = two_digits[at];
+    }
+    else
+        *--end = static_cast<char>('0' + value);
+
+    return end;
+}
+
+constexpr double exact_powers_of_10[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+constexpr uint64_t integer_powers_of_10[] = {
+        1ull, 10ull, 100ull, 1000ull, 10000ull, 100000ull, 1000000ull, 10000000ull, 100000000ull,
+        1000000000ull, 10000000000ull, 100000000000ull, 1000000000000ull, 10000000000000ull,
+        100000000000000ull, 1000000000000000ull, 10000000000000000ull
+};
+
+/**
+ * \brief Format a double in fixed notation without going through printf
+ *
+ * The value is scaled to 17 significant digits using the exact product of the value and a power of 10, which
+ * is enough digits to always read back as the same double. Digits are then dropped for as long as the rounded
+ * result stays closer to the value than to either of its neighbouring doubles.
+ *
+ * \return the number of characters written into out or 0 if the value is too big or small for fixed notation
+ */
+inline int format_short_double(char* out, double value, int max_precision) noexcept
+{
+    auto magnitude = std::fabs(value);
+    if (magnitude < 1e-5 || magnitude >= 1e15)
+        return 0;
+
+    // log10 can land on the wrong side of an exact power of 10
+    auto exponent = static_cast<int>(std::floor(std::log10(magnitude)));
+    auto below = [](double m, int e) {
+        return e >= 0 ? m < exact_powers_of_10[e] : m * exact_powers_of_10[-e] < 1;
+    };
+    if (below(magnitude, exponent))
+        --exponent;
+    else if (!below(magnitude, exponent + 1))
+        ++exponent;
+
+    // magnitude * 10^scale is exactly whole + fraction + error
+    int scale = 16 - exponent;
+    auto power = exact_powers_of_10[scale];
+    auto scaled = magnitude * power;
+    auto error = std::fma(magnitude, power, -scaled);
+    auto whole = std::floor(scaled);
+    auto fraction = scaled - whole;
+    auto base = static_cast<uint64_t>(whole);
+    auto nearest = base + static_cast<int64_t>(std::floor(fraction + error + 0.5));
+
+    // half the distance to the neighbouring doubles in the same units, kept just inside so boundaries are never taken
+    int binary_exponent;
+    auto significand = std::frexp(magnitude, &binary_exponent);
+    auto above = (std::nextafter(magnitude, std::numeric_limits<double>::infinity()) - magnitude) * power * 0.5 * (1 - 1e-9);
+    auto beneath = significand == 0.5 ? above * 0.5 : above;
+
+    // find the most digits that can be dropped with either rounding of what's left still reading back the same
+    auto fits = [&](int drop, uint64_t& result) {
+        auto unit = integer_powers_of_10[drop];
+        auto quotient = nearest / unit;
+        for (auto candidate : {quotient, quotient + 1})
+        {
+            auto distance = static_cast<double>(static_cast<int64_t>(candidate * unit - base)) - fraction - error;
+            if (distance < above && -distance < beneath)
+            {
+                result = candidate;
+                return true;
+            }
+        }
+        return false;
+    };
+
+    int least = 17 - std::min(max_precision, 17);
+    int most = 16;
+    uint64_t digits = 0;
+    int dropped = least;
+    if (!fits(least, digits))
+    {
+        // out of digits, so settle for the rounded value
+        auto unit = integer_powers_of_10[least];
+        digits = (nearest + unit / 2) / unit;
+    }
+    else
+    {
+        while (least < most)
+        {
+            auto drop = (least + most + 1) / 2;
+            uint64_t shorter;
+            if (fits(drop, shorter))
+            {
+                least = drop;
+                dropped = drop;
+                digits = shorter;
+            }
+            else
+                most = drop - 1;
+        }
+    }
+
+    int decimals = scale - dropped;
+    while (decimals < 0)
+    {
+        digits *= 10;
+        ++decimals;
+    }
+
+    while (decimals > 0 && digits % 10 == 0)
+    {
+        digits /= 10;
+        --decimals;
+    }
+
+    char buffer[24];
+    auto end = buffer + sizeof(buffer);
+    auto start = format_unsigned_backwards(end, digits);
+    int length = static_cast<int>(end - start);
+
+    auto at = out;
+    if (value < 0)
+        *at++ = '-';
+
+    if (decimals == 0)
+    {
+        std::memcpy(at, start, length);
+        return static_cast<int>(at - out) + length;
+    }
+
+    if (length > decimals)
+    {
+        std::memcpy(at, start, length - decimals);
+        at += length - decimals;
+        *at++ = '.';
+        std::memcpy(at, start + length - decimals, decimals);
+        return static_cast<int>(at - out) + decimals;
+    }
+
+    *at++ = '0';
+    *at++ = '.';
+    for (int i = length; i < decimals; ++i)
+        *at++ = '0';
+    std::memcpy(at, start, length);
+    return static_cast<int>(at - out) + length;
+}
+
+}
+
+/**
+ * \brief The base of every output sink, which formats numbers and metric values into the sink
+ *
+ * An output sink is anything publishers can write their output into. A sink derives from output_sink<TSink> and
+ * provides:
+ *
+ * - append(const char*, std::size_t) and append(char), both returning TSink&
+ * - size(), the number of bytes appended to it so far
+ *
+ * Writers that are templated on the sink call straight into it, so its appends can be inlined rather than going
+ * through a virtual call per write like a std::streambuf.
+ *
+ * \tparam TSink the type of the sink deriving from this
+ */
+template<typename TSink>
+class output_sink
+{
+    TSink& sink() noexcept
+    {
+        return static_cast<TSink&>(*this);
+    }
+
+public:
+    TSink& append_unsigned(unsigned long long value)
+    {
+        char digits[24];
+        auto end = digits + sizeof(digits);
+        auto start = internal::format_unsigned_backwards(end, value);
+        return sink().append(start, end - start);
+    }
+
+    TSink& append_integer(long long value)
+    {
+        char digits[24];
+        auto end = digits + sizeof(digits);
+        auto magnitude = value < 0 ? 0ull - static_cast<unsigned long long>(value) : static_cast<unsigned long long>(value);
+        auto start = internal::format_unsigned_backwards(end, magnitude);
+        if (value < 0)
+            *--start = '-';
+        return sink().append(start, end - start);
+    }
+
+    /**
+     * \brief Append the shortest representation of a double that parses back to the same value
+     *
+     * Non-finite values use the prometheus spellings: NaN, +Inf and -Inf
+     *
+     * \param value the value to append
+     * \param max_precision the most significant digits to write, at which point the value is rounded instead
+     */
+    TSink& append_double(double value, int max_precision = 17)
+    {
+        if (std::isnan(value))
+            return sink().append("NaN", 3);
+        if (std::isinf(value))
+            return sink().append(value < 0 ? "-Inf" : "+Inf", 4);
+
+        // integral values are by far the most common so they skip printf entirely
+        if (std::fabs(value) < 1e15 && value == static_cast<double>(static_cast<long long>(value)))
+            return append_integer(static_cast<long long>(value));
+
+        char digits[32];
+        int length = internal::format_short_double(digits, value, max_precision);
+        if (length)
+            return sink().append(digits, length);
+
+        for (int precision = std::min(15, max_precision); precision <= max_precision; ++precision)
+        {
+            length = std::snprintf(digits, sizeof(digits), "%.*g", precision, value);
+            if (precision == max_precision || std::strtod(digits, nullptr) == value)
+                break;
+        }
+
+        // a C locale with a different decimal point would be the only source of anything else
+        for (int i = 0; i < length; ++i)
+        {
+            auto c = digits[i];
+            if ((c < '0' || c > '9') && c != '-' && c != '+' && c != 'e')
+                digits[i] = '.';
+        }
+
+        return sink().append(digits, length);
+    }
+
+    /**
+     * \brief Append a metric value in its natural representation
+     */
+    TSink& append_value(const metric_value& value)
+    {
+        switch (value.kind())
+        {
+            case metric_value_kind::signed_integral:
+                return append_integer(static_cast<int64_t>(value));
+            case metric_value_kind::unsigned_integral:
+                return append_unsigned(static_cast<uint64_t>(value));
+            case metric_value_kind::floating_point:
+                return append_double(static_cast<double>(value));
+            default:
+            {
+                auto str = static_cast<std::string>(value);
+                return sink().append(str.data(), str.size());
+            }
+        }
+    }
+
+    template<std::size_t Size>
+    TSink& operator<<(const char (&str)[Size])
+    {
+        return sink().append(str, Size - 1);
+    }
+
+    TSink& operator<<(const char* str)
+    {
+        return sink().append(str, std::strlen(str));
+    }
+
+    TSink& operator<<(const std::string& str)
+    {
+        return sink().append(str.data(), str.size());
+    }
+
+    TSink& operator<<(char c)
+    {
+        return sink().append(c);
+    }
+
+    TSink& operator<<(const metric_value& value)
+    {
+        return append_value(value);
+    }
+
+    template<typename TInt>
+    typename std::enable_if<std::is_integral<TInt>::value && std::is_signed<TInt>::value, TSink&>::type
+    operator<<(TInt value)
+    {
+        return append_integer(value);
+    }
+
+    template<typename TInt>
+    typename std::enable_if<std::is_integral<TInt>::value && !std::is_signed<TInt>::value, TSink&>::type
+    operator<<(TInt value)
+    {
+        return append_unsigned(value);
+    }
+
+    template<typename TFloat>
+    typename std::enable_if<std::is_floating_point<TFloat>::value, TSink&>::type
+    operator<<(TFloat value)
+    {
+        return append_double(static_cast<double>(value));
+    }
+
+};
+
+/**
+ * \brief An output sink that writes to a standard stream
+ *
+ * Writes are collected in a buffer of its own and written to the stream a buffer at a time, so the stream is only
+ * called once per buffer instead of once per write. The rest of the buffer is written when the sink is flushed or
+ * destroyed.
+ */
+class ostream_sink : public output_sink<ostream_sink>
+{
+    std::ostream& out_;
+    std::unique_ptr<char[]> buffer_;
+    std::size_t capacity_;
+    std::size_t used_;
+    std::size_t flushed_;
+
+public:
+    explicit ostream_sink(std::ostream& out, std::size_t capacity = 4096) :
+            out_(out),
+            buffer_(new char[capacity ? capacity : 1]),
+            capacity_(capacity ? capacity : 1),
+            used_(0),
+            flushed_(0)
+    { }
+
+    ostream_sink(const ostream_sink&) = delete;
+    ostream_sink& operator=(const ostream_sink&) = delete;
+
+    ~ostream_sink()
+    {
+        flush();
+    }
+
+    ostream_sink& append(const char* str, std::size_t length)
+    {
+        if (used_ + length > capacity_)
+        {
+            flush();
+            if (length >= capacity_)
+            {
+                out_.write(str, static_cast<std::streamsize>(length));
+                flushed_ += length;
+                return *this;
+            }
+        }
+
+        std::memcpy(buffer_.get() + used_, str, length);
+        used_ += length;
+        return *this;
+    }
+
+    ostream_sink& append(char c)
+    {
+        if (used_ == capacity_)
+            flush();
+        buffer_[used_++] = c;
+        return *this;
+    }
+
+    std::size_t size() const noexcept
+    {
+        return flushed_ + used_;
+    }
+
+    /**
+     * \brief Write whatever is buffered to the stream
+     */
+    void flush()
+    {
+        if (!used_)
+            return;
+
+        out_.write(buffer_.get(), static_cast<std::streamsize>(used_));
+        flushed_ += used_;
+        used_ = 0;
+    }
+};
+
+namespace internal
+{
+
+/**
+ * \brief Wait for a descriptor that would block to be ready for writing
+ */
+inline void wait_writable(int fd)
+{
+    pollfd target{fd, POLLOUT, 0};
+    while (::poll(&target, 1, -1) < 0)
+    {
+        if (errno != EINTR)
+            throw std::system_error(errno, std::generic_category(), "poll");
+    }
+}
+
+}
+
+/**
+ * \brief An output sink that writes to a file descriptor through a buffer of its own
+ *
+ * Writes are collected in the buffer and written to the descriptor once it's full, and writes at least as big as the
+ * buffer go straight to the descriptor. Descriptors that would block are waited on, so the sink works the same for
+ * files, pipes and sockets. The sink doesn't own the descriptor and doesn't close it.
+ *
+ * Whatever is buffered is written when the sink is flushed or destroyed, but only flush() reports a failure.
+ */
+class fd_sink : public output_sink<fd_sink>
+{
+    int fd_;
+    std::unique_ptr<char[]> buffer_;
+    std::size_t capacity_;
+    std::size_t used_;
+    std::size_t written_;
+
+    void write_all(const char* data, std::size_t length)
+    {
+        while (length)
+        {
+            auto written = ::write(fd_, data, length);
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                if (errno != EAGAIN && errno != EWOULDBLOCK)
+                    throw std::system_error(errno, std::generic_category(), "write");
+
+                internal::wait_writable(fd_);
+                continue;
+            }
+
+            data += written;
+            length -= static_cast<std::size_t>(written);
+            written_ += static_cast<std::size_t>(written);
+        }
+    }
+
+public:
+    explicit fd_sink(int fd, std::size_t capacity = 64 * 1024) :
+            fd_(fd),
+            buffer_(new char[capacity ? capacity : 1]),
+            capacity_(capacity ? capacity : 1),
+            used_(0),
+            written_(0)
+    { }
+
+    fd_sink(const fd_sink&) = delete;
+    fd_sink& operator=(const fd_sink&) = delete;
+
+    ~fd_sink()
+    {
+        try
+        {
+            flush();
+        }
+        catch (...)
+        {
+            // flush() is where failures are reported
+        }
+    }
+
+    fd_sink& append(const char* str, std::size_t length)
+    {
+        if (used_ + length > capacity_)
+        {
+            flush();
+            if (length >= capacity_)
+            {
+                write_all(str, length);
+                return *this;
+            }
+        }
+
+        std::memcpy(buffer_.get() + used_, str, length);
+        used_ += length;
+        return *this;
+    }
+
+    fd_sink& append(char c)
+    {
+        if (used_ == capacity_)
+            flush();
+        buffer_[used_++] = c;
+        return *this;
+    }
+
+    std::size_t size() const noexcept
+    {
+        return written_ + used_;
+    }
+
+    /**
+     * \brief Write whatever is buffered to the descriptor
+     *
+     * \throws std::system_error if the descriptor can't be written to
+     */
+    void flush()
+    {
+        auto used = used_;
+        used_ = 0;
+        write_all(buffer_.get(), used);
+    }
+};
+
+/**
+ * \brief An output sink that collects a list of buffers to be written with a single writev
+ *
+ * Appended data is copied into blocks that are never moved, so every piece stays where it was written. Data that's
+ * already in memory, such as a cached render, can be appended by reference instead, along with whatever keeps it alive
+ * until the sink is written, so it goes to the descriptor without ever being copied.
+ *
+ * Clearing the sink keeps its blocks so that filling it again doesn't allocate.
+ */
+class iovec_sink : public output_sink<iovec_sink>
+{
+    static constexpr std::size_t block_size = 16 * 1024;
+    // referencing pieces shorter than this costs more in iovecs than copying them does
+    static constexpr std::size_t min_reference = 256;
+
+    std::vector<std::unique_ptr<char[]>> blocks_;
+    std::size_t block_;
+    std::size_t block_used_;
+    std::vector<iovec> pieces_;
+    std::vector<std::shared_ptr<const void>> owners_;
+    std::size_t size_;
+
+    void add_piece(const char* data, std::size_t length)
+    {
+        if (!pieces_.empty())
+        {
+            auto& last = pieces_.back();
+            if (static_cast<const char*>(last.iov_base) + last.iov_len == data)
+            {
+                last.iov_len += length;
+                return;
+            }
+        }
+
+        pieces_.push_back(iovec{const_cast<char*>(data), length});
+    }
+
+    char* reserve(std::size_t& length)
+    {
+        if (blocks_.empty() || block_used_ == block_size)
+        {
+            if (!blocks_.empty())
+                ++block_;
+            if (block_ == blocks_.size())
+                blocks_.emplace_back(new char[block_size]);
+            block_used_ = 0;
+        }
+
+        length = std::min(length, block_size - block_used_);
+        auto result = blocks_[block_].get() + block_used_;
+        block_used_ += length;
+        return result;
+    }
+
+public:
+    iovec_sink() :
+            block_(0),
+            block_used_(0),
+            size_(0)
+    { }
+
+    iovec_sink(const iovec_sink&) = delete;
+    iovec_sink& operator=(const iovec_sink&) = delete;
+
+    iovec_sink& append(const char* str, std::size_t length)
+    {
+        size_ += length;
+        while (length)
+        {
+            auto piece = length;
+            auto at = reserve(piece);
+            std::memcpy(at, str, piece);
+            add_piece(at, piece);
+            str += piece;
+            length -= piece;
+        }
+
+        return *this;
+    }
+
+    iovec_sink& append(char c)
+    {
+        return append(&c, 1);
+    }
+
+    /**
+     * \brief Append data without copying it
+     *
+     * \param owner whatever keeps the data alive, which the sink holds until it's cleared. Without one, the data has to
+     * outlive the sink or its next clear()
+     */
+    iovec_sink& append_reference(const char* data, std::size_t length, std::shared_ptr<const void> owner = nullptr)
+    {
+        if (length < min_reference)
+            return append(data, length);
+
+        size_ += length;
+        add_piece(data, length);
+        if (owner)
+            owners_.push_back(std::move(owner));
+        return *this;
+    }
+
+    std::size_t size() const noexcept
+    {
+        return size_;
+    }
+
+    /**
+     * \brief The pieces appended so far in the order they were appended
+     */
+    const std::vector<iovec>& pieces() const noexcept
+    {
+        return pieces_;
+    }
+
+    /**
+     * \brief Copy everything appended into a string
+     */
+    std::string str() const
+    {
+        std::string result;
+        result.reserve(size_);
+        for (const auto& piece : pieces_)
+            result.append(static_cast<const char*>(piece.iov_base), piece.iov_len);
+        return result;
+    }
+
+    /**
+     * \brief Drop everything appended and let go of the owners of referenced data, keeping the blocks
+     */
+    void clear() noexcept
+    {
+        pieces_.clear();
+        owners_.clear();
+        block_ = 0;
+        block_used_ = 0;
+        size_ = 0;
+    }
+
+    /**
+     * \brief Write everything appended to a descriptor, as few writev calls as it takes
+     *
+     * Descriptors that would block are waited on.
+     *
+     * \throws std::system_error if the descriptor can't be written to
+     */
+    void write_to(int fd) const
+    {
+        std::vector<iovec> left(pieces_);
+        auto parts = left.data();
+        auto count = left.size();
+        while (count)
+        {
+            auto written = ::writev(fd, parts, static_cast<int>(std::min<std::size_t>(count, IOV_MAX)));
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                if (errno != EAGAIN && errno != EWOULDBLOCK)
+                    throw std::system_error(errno, std::generic_category(), "writev");
+
+                internal::wait_writable(fd);
+                continue;
+            }
+
+            auto done = static_cast<std::size_t>(written);
+            while (count && done >= parts->iov_len)
+            {
+                done -= parts->iov_len;
+                ++parts;
+                --count;
+            }
+            if (count)
+            {
+                parts->iov_base = static_cast<char*>(parts->iov_base) + done;
+                parts->iov_len -= done;
+            }
+        }
+    }
+};
+
+}
+
+#endif //CXXMETRICS_OUTPUT_SINK_HPP
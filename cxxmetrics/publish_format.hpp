@@ -0,0 +1,243 @@
+#ifndef CXXMETRICS_PUBLISH_FORMAT_HPP
+#define CXXMETRICS_PUBLISH_FORMAT_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+#include "exposition_buffer.hpp"
+#include "publisher.hpp"
+#include "snapshots.hpp"
+
+namespace cxxmetrics
+{
+
+namespace internal
+{
+
+/**
+ * \brief Format a window of a meter or timer in the largest unit that it has at least one of, like 5min or 30sec
+ */
+template<typename TSink, typename TRep, typename TPer>
+TSink& format_window(TSink& into, const std::chrono::duration<TRep, TPer>& time)
+{
+    using namespace std::chrono_literals;
+    if (time >= 1h)
+        return into << std::chrono::duration_cast<std::chrono::hours>(time).count() << "hr";
+    if (time >= 1min)
+        return into << std::chrono::duration_cast<std::chrono::minutes>(time).count() << "min";
+    if (time >= 1s)
+        return into << std::chrono::duration_cast<std::chrono::seconds>(time).count() << "sec";
+    if (time >= 1ms)
+        return into << std::chrono::duration_cast<std::chrono::milliseconds>(time).count() << "msec";
+    if (time >= 1us)
+        return into << std::chrono::duration_cast<std::chrono::microseconds>(time).count() << "usec";
+
+    return into << std::chrono::duration_cast<std::chrono::nanoseconds>(time).count() << "nsec";
+}
+
+/**
+ * \brief Format the name of a quantile as p and its percentile, like p99 or p99.9
+ *
+ * \param point what to write for the decimal point of the percentile, for outputs that don't allow a '.' in names
+ */
+template<typename TSink>
+TSink& format_percentile(TSink& into, const cxxmetrics::quantile& q, char point = '.')
+{
+    exposition_buffer text(16);
+    text.append_double(static_cast<double>(q.percentile()), 6);
+
+    into << 'p';
+    auto end = text.data() + text.size();
+    auto dot = std::find(text.data(), end, '.');
+    into.append(text.data(), dot - text.data());
+    if (dot != end)
+    {
+        into << point;
+        into.append(dot + 1, end - dot - 1);
+    }
+
+    return into;
+}
+
+/**
+ * \brief Copy text, replacing the characters that an output reserves with '_'
+ */
+template<typename TReserved>
+exposition_buffer& format_replaced(exposition_buffer& into, const char* text, std::size_t length, TReserved&& reserved)
+{
+    // copy runs of valid characters at once and only break them up for the ones that need replacing
+    auto end = text + length;
+    auto run = text;
+    for (auto c = text; c != end; ++c)
+    {
+        if (!reserved(*c))
+            continue;
+
+        into.append(run, c - run);
+        into << '_';
+        run = c + 1;
+    }
+
+    return into.append(run, end - run);
+}
+
+/**
+ * \brief Get the tags of a series with their values as text, sorted by name, leaving out tags with no name or value
+ */
+inline std::vector<std::pair<std::string, std::string>> sorted_tags(const cxxmetrics::tag_collection& tags)
+{
+    std::vector<std::pair<std::string, std::string>> sorted;
+    exposition_buffer value(64);
+    for (const auto& tag : tags)
+    {
+        value.clear();
+        value << tag.second;
+        if (!tag.first.empty() && !value.empty())
+            sorted.emplace_back(tag.first, value.str());
+    }
+    std::sort(sorted.begin(), sorted.end());
+
+    return sorted;
+}
+
+/**
+ * \brief The factor that publish options scale values by, which is 1 when they don't
+ */
+inline double scale_multiplier(const cxxmetrics::value_publish_options& opts) noexcept
+{
+    return opts.scale() ? opts.scale().factor() : 1.0;
+}
+
+inline cxxmetrics::metric_value scale_value(cxxmetrics::metric_value&& value, const cxxmetrics::value_publish_options& opts)
+{
+    if (opts.scale())
+        return value * cxxmetrics::metric_value(opts.scale().factor());
+    return std::move(value);
+}
+
+/**
+ * \brief Convert a value of a timer, which is in nanoseconds, to milliseconds
+ */
+inline cxxmetrics::metric_value timer_milliseconds(const cxxmetrics::metric_value& value)
+{
+    return cxxmetrics::metric_value(static_cast<std::chrono::nanoseconds>(value).count() / 1e6);
+}
+
+/**
+ * \brief Writes every component of a snapshot as a value of its own, for outputs that only have flat named values
+ *
+ * Counters and gauges are written as their value. Meters are written as their mean and a value per window.
+ * Histograms and timers are written as their count, mean and a value per quantile, with timers in milliseconds, and
+ * timers also have the mean and windows of their rates.
+ *
+ * The writer gets the values through:
+ *  - value(const metric_value&) for the value of a counter or gauge
+ *  - count(uint64_t) for the count of a histogram or timer
+ *  - field(const char* prefix, const char* name, std::size_t length, const metric_value&) for everything else, where
+ *    the prefix is the one for rates when the value is one of a timer's rates
+ */
+template<typename TWriter>
+class flat_snapshot_writer
+{
+    const cxxmetrics::publish_options& options_;
+    const char* prefix_;
+    const char* rates_prefix_;
+
+    TWriter& self() noexcept
+    {
+        return *static_cast<TWriter*>(this);
+    }
+
+    template<typename TRates>
+    void rates(const char* prefix, const TRates& rates, bool include_mean, const cxxmetrics::value_publish_options& opts)
+    {
+        if (include_mean)
+            self().field(prefix, "mean", 4, scale_value(rates.value(), opts));
+
+        exposition_buffer name(16);
+        for (const auto& rate : rates)
+        {
+            name.clear();
+            format_window(name, rate.first);
+            self().field(prefix, name.data(), name.size(), scale_value(cxxmetrics::metric_value(rate.second), opts));
+        }
+    }
+
+    template<typename TConvert>
+    void quantiles(const cxxmetrics::histogram_snapshot& snapshot, const cxxmetrics::histogram_publish_options& opts, TConvert&& convert)
+    {
+        exposition_buffer name(16);
+        opts.quantiles()->visit(snapshot, [&](const cxxmetrics::quantile& q, cxxmetrics::metric_value&& value) {
+            name.clear();
+            format_percentile(name, q, '_');
+            self().field(prefix_, name.data(), name.size(), convert(std::move(value)));
+        });
+    }
+
+protected:
+    /**
+     * \param prefix the prefix of the names of the components of a snapshot
+     * \param rates_prefix the prefix of the names of the rates of a timer
+     */
+    flat_snapshot_writer(const cxxmetrics::publish_options& options, const char* prefix, const char* rates_prefix) :
+            options_(options),
+            prefix_(prefix),
+            rates_prefix_(rates_prefix)
+    { }
+
+    const cxxmetrics::publish_options& options() const noexcept
+    {
+        return options_;
+    }
+
+public:
+    void write(const cxxmetrics::cumulative_value_snapshot& snapshot)
+    {
+        self().value(scale_value(snapshot.value(), options_.value_options()));
+    }
+
+    void write(const cxxmetrics::average_value_snapshot& snapshot)
+    {
+        self().value(scale_value(snapshot.value(), options_.value_options()));
+    }
+
+    void write(const cxxmetrics::meter_snapshot& snapshot)
+    {
+        const auto& opts = options_.meter_options();
+        rates(prefix_, snapshot, opts.include_mean(), opts);
+    }
+
+    void write(const cxxmetrics::histogram_snapshot& snapshot)
+    {
+        const auto& opts = options_.histogram_options();
+        if (opts.include_count())
+            self().count(snapshot.count());
+        self().field(prefix_, "mean", 4, scale_value(snapshot.mean(), opts));
+        quantiles(snapshot, opts, [&opts](cxxmetrics::metric_value&& value) { return scale_value(std::move(value), opts); });
+    }
+
+    void write(const cxxmetrics::timer_snapshot& snapshot)
+    {
+        const auto& opts = options_.timer_options();
+        auto millis = [&opts](const cxxmetrics::metric_value& value) {
+            return scale_value(timer_milliseconds(value), opts);
+        };
+
+        if (opts.include_count())
+            self().count(snapshot.count());
+        self().field(prefix_, "mean", 4, millis(snapshot.mean()));
+        quantiles(snapshot, opts, millis);
+
+        if (opts.include_rates())
+            rates(rates_prefix_, snapshot.rate(), opts.include_mean(), opts);
+    }
+};
+
+}
+
+}
+
+#endif //CXXMETRICS_PUBLISH_FORMAT_HPP
@@ -1,10 +1,16 @@
 #ifndef CXXMETRICS_PUBLISHER_HPP
 #define CXXMETRICS_PUBLISHER_HPP
 
+#include <algorithm>
+#include <initializer_list>
 #include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
 #include "meta.hpp"
 #include "snapshots.hpp"
 #include "metric_path.hpp"
+#include "registry_snapshot.hpp"
 
 namespace cxxmetrics
 {
@@ -185,6 +191,62 @@ template<quantile::value... TQuantiles>
 class quantile_options : public quantiles::quantile_options_builder<typename templates::sort_unique<TQuantiles...>::type>
 { };
 
+/**
+ * \brief The upper bounds of the buckets to publish a histogram with, instead of its quantiles
+ *
+ * The bounds are in the units the histogram is published in, so after scaling. Timers are published in microseconds
+ */
+class bucket_layout
+{
+    std::vector<double> bounds_;
+public:
+    explicit bucket_layout(std::vector<double> bounds) :
+            bounds_(std::move(bounds))
+    {
+        std::sort(bounds_.begin(), bounds_.end());
+        bounds_.erase(std::unique(bounds_.begin(), bounds_.end()), bounds_.end());
+    }
+
+    bucket_layout(std::initializer_list<double> bounds) :
+            bucket_layout(std::vector<double>(bounds))
+    { }
+
+    /**
+     * \brief Create a layout of evenly spaced buckets
+     *
+     * \param start the upper bound of the first bucket
+     * \param width the distance between the bucket bounds
+     * \param count the number of buckets
+     */
+    static bucket_layout linear(double start, double width, std::size_t count)
+    {
+        std::vector<double> bounds(count);
+        for (std::size_t i = 0; i < count; i++)
+            bounds[i] = start + width * i;
+        return bucket_layout(std::move(bounds));
+    }
+
+    /**
+     * \brief Create a layout of buckets whose bounds grow by a factor
+     *
+     * \param start the upper bound of the first bucket
+     * \param factor the factor between consecutive bucket bounds
+     * \param count the number of buckets
+     */
+    static bucket_layout exponential(double start, double factor, std::size_t count)
+    {
+        std::vector<double> bounds(count);
+        for (std::size_t i = 0; i < count; i++, start *= factor)
+            bounds[i] = start;
+        return bucket_layout(std::move(bounds));
+    }
+
+    /**
+     * \brief The sorted upper bounds of the buckets, not including the implicit infinite bucket
+     */
+    const std::vector<double>& bounds() const noexcept { return bounds_; }
+};
+
 /**
  * \brief Options to apply to histogram types while publishing
  */
@@ -197,12 +259,14 @@ class histogram_publish_options : public virtual value_publish_options
     }
 
     std::shared_ptr<basic_quantile_options> quantiles_;
+    std::shared_ptr<const bucket_layout> buckets_;
     bool count_;
     bool asdist_;
 public:
     histogram_publish_options(histogram_publish_options&& other) noexcept :
             value_publish_options(std::move(other)),
             quantiles_(std::move(other.quantiles_)),
+            buckets_(std::move(other.buckets_)),
             count_(other.count_),
             asdist_(other.asdist_)
     { }
@@ -233,10 +297,21 @@ public:
             asdist_(as_distribution)
     { }
 
+    /**
+     * \brief Publish the histogram as cumulative buckets with a sum and count rather than as quantiles
+     */
+    histogram_publish_options(bucket_layout buckets, const scale_factor& sf = scale_factor()) :
+            value_publish_options(sf),
+            buckets_(std::make_shared<const bucket_layout>(std::move(buckets))),
+            count_(true),
+            asdist_(false)
+    { }
+
     histogram_publish_options& operator=(histogram_publish_options&& other) noexcept
     {
         value_publish_options::operator=(std::move(other));
         quantiles_ = std::move(other.quantiles_);
+        buckets_ = std::move(other.buckets_);
         count_ = other.count_;
         asdist_ = other.asdist_;
         return *this;
@@ -255,6 +330,16 @@ public:
         return default_quantiles();
     }
 
+    /**
+     * \brief Get the buckets the histogram should be published with
+     *
+     * \return the bucket layout, or null if the histogram should be published with its quantiles
+     */
+    const std::shared_ptr<const bucket_layout>& buckets() const noexcept
+    {
+        return buckets_;
+    }
+
     /**
      * \brief whether or not the histogram total should be published
      */
@@ -313,10 +398,17 @@ public:
             rates_(rates)
     { }
 
+    timer_publish_options(bucket_layout buckets, bool rates = true, const scale_factor& sf = scale_factor()) :
+            histogram_publish_options(std::move(buckets), sf),
+            meter_publish_options(sf),
+            rates_(rates)
+    { }
+
     timer_publish_options& operator=(timer_publish_options&& other) noexcept
     {
         histogram_publish_options::operator=(std::move(other));
         meter_publish_options::operator=(std::move(other));
+        rates_ = other.rates_;
         return *this;
     }
 
@@ -392,6 +484,56 @@ public:
 
 };
 
+/**
+ * \brief The state a publisher compiles for a registered metric once and reuses every time it publishes it
+ *
+ * Publishers attach their per-metric data as a subclass of this and refresh it with metrics_publisher::refresh_plan,
+ * which resolves the effective options of the metric the first time and then again only after publish options are
+ * set somewhere in the registry. In between, publishing the metric doesn't look its options up at all.
+ */
+class publish_plan : public basic_publish_options
+{
+    const publish_options* options_ = nullptr;
+    uint64_t options_epoch_ = 0;
+
+    template<typename TMetricRepo>
+    friend class metrics_publisher;
+public:
+    /**
+     * \brief The effective publish options of the metric as of the last time the plan was refreshed
+     */
+    const publish_options& options() const noexcept { return *options_; }
+};
+
+/**
+ * \brief State that a publisher instance keeps for each registered metric, apart from any other instance
+ *
+ * Data attached with metrics_publisher::get_data_for is keyed by its type, so every publisher of the same type shares
+ * it. State that depends on what an instance has published or on how it's configured, such as the last value of a
+ * counter it sent the change of, is kept in one of these owned by the instance instead. Registered metrics are never
+ * removed from their registry, so they're keyed by where they are.
+ *
+ * \tparam TState the state of a metric, which is default constructed the first time the metric is asked for
+ */
+template<typename TState>
+class publisher_state
+{
+    std::unordered_map<const basic_registered_metric*, std::unique_ptr<TState>> states_;
+    std::mutex lock_;
+public:
+    /**
+     * \brief Get the state of a metric, creating it the first time
+     */
+    TState& get(const basic_registered_metric& metric)
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        auto& result = states_[&metric];
+        if (!result)
+            result.reset(new TState());
+        return *result;
+    }
+};
+
 /**
  * \brief The base class for the metrics publisher
  *
@@ -421,6 +563,16 @@ protected:
      */
     const publish_options& effective_options(basic_registered_metric& metric) const;
 
+    /**
+     * \brief Resolve the effective options of a metric into its plan if they may have changed since it was compiled
+     *
+     * Plans aren't synchronized here, so a publisher that might refresh a plan from more than one thread, or share
+     * its plan type between instances, needs to lock the plan around this and its use of it.
+     *
+     * \return true if the plan was refreshed and anything the publisher derived from its options should be too
+     */
+    bool refresh_plan(basic_registered_metric& metric, publish_plan& plan) const;
+
     /**
      * \brief Get a piece of data from the registry. Generally, this will be a type specific to the publisher
      *
@@ -549,6 +701,18 @@ protected:
      */
     template<typename THandler>
     void visit_all(THandler&& handler) const;
+
+    /**
+     * \brief Visit every registered metric, or every family of a collected snapshot of the registry, the same way
+     *
+     * The handler is called as handler(const metric_path&, basic_registered_metric&, series) where the series is the
+     * registered metric itself or its family in the snapshot, both of which have visit() and visit_changed(), so a
+     * publisher can render from either with the same code.
+     *
+     * \param snapshot the snapshot to visit, or null to visit the registry
+     */
+    template<typename THandler>
+    void visit_families(const registry_snapshot* snapshot, THandler&& handler) const;
 public:
     /**
      * \brief Construct a publisher that will publish from the specified registry
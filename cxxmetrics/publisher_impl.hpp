@@ -22,6 +22,18 @@ const publish_options& metrics_publisher<TMetricRepo>::effective_options(basic_r
     return const_cast<metrics_publisher<TMetricRepo>*>(this)->get_data_for<publish_options>(metric);
 }
 
+template<typename TMetricRepo>
+bool metrics_publisher<TMetricRepo>::refresh_plan(basic_registered_metric& metric, publish_plan& plan) const
+{
+    auto epoch = registry_.options_epoch();
+    if (plan.options_epoch_ == epoch)
+        return false;
+
+    plan.options_ = &effective_options(metric);
+    plan.options_epoch_ = epoch;
+    return true;
+}
+
 template<typename TMetricRepo>
 template<typename TDataType, typename... TBuildArgs>
 typename std::enable_if<std::is_base_of<basic_publish_options, TDataType>::value, TDataType>::type&
@@ -155,6 +167,23 @@ void metrics_publisher<TMetricRepo>::visit_all(THandler&& handler) const
     registry_.visit_registered_metrics(std::forward<THandler>(handler));
 }
 
+template<typename TMetricRepo>
+template<typename THandler>
+void metrics_publisher<TMetricRepo>::visit_families(const registry_snapshot* snapshot, THandler&& handler) const
+{
+    if (snapshot)
+    {
+        snapshot->visit([&handler](const registry_snapshot::family& family) {
+            handler(family.path(), family.metric(), family);
+        });
+        return;
+    }
+
+    registry_.visit_registered_metrics([&handler](const metric_path& path, basic_registered_metric& metric) {
+        handler(path, metric, metric);
+    });
+}
+
 }
 
 #endif //CXXMETRICS_PUBLISHER_IMPL_HPP
@@ -0,0 +1,413 @@
+#ifndef CXXMETRICS_REGION_AGGREGATOR_HPP
+#define CXXMETRICS_REGION_AGGREGATOR_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include "shared_region.hpp"
+
+namespace cxxmetrics
+{
+
+namespace internal
+{
+
+template<shared_metric_kind TKind>
+struct record_snapshot;
+
+template<>
+struct record_snapshot<shared_metric_kind::counter>
+{
+    static cumulative_value_snapshot get(const shared_record& record, int64_t)
+    {
+        return cumulative_value_snapshot(metric_value(record.counter_value()));
+    }
+
+    static cumulative_value_snapshot empty()
+    {
+        return cumulative_value_snapshot(metric_value(static_cast<int64_t>(0)));
+    }
+};
+
+template<>
+struct record_snapshot<shared_metric_kind::gauge>
+{
+    static average_value_snapshot get(const shared_record& record, int64_t)
+    {
+        return average_value_snapshot(metric_value(record.gauge_value()));
+    }
+
+    static average_value_snapshot empty()
+    {
+        return average_value_snapshot(metric_value(0.0));
+    }
+};
+
+template<>
+struct record_snapshot<shared_metric_kind::ewma>
+{
+    static average_value_snapshot get(const shared_record& record, int64_t now)
+    {
+        return average_value_snapshot(metric_value(record.ewma_rate(now)));
+    }
+
+    static average_value_snapshot empty()
+    {
+        return average_value_snapshot(metric_value(0.0));
+    }
+};
+
+template<>
+struct record_snapshot<shared_metric_kind::meter>
+{
+    static meter_snapshot get(const shared_record& record, int64_t now)
+    {
+        std::unordered_map<std::chrono::steady_clock::duration, metric_value> rates;
+        for (std::size_t i = 0; i < record.meter_windows(); i++)
+            rates.emplace(std::chrono::duration_cast<std::chrono::steady_clock::duration>(record.meter_window(i)), metric_value(record.meter_rate(i, now)));
+
+        return meter_snapshot(metric_value(record.meter_mean(now)), std::move(rates));
+    }
+
+    static meter_snapshot empty()
+    {
+        return meter_snapshot(metric_value(0.0), std::unordered_map<std::chrono::steady_clock::duration, metric_value>());
+    }
+};
+
+template<>
+struct record_snapshot<shared_metric_kind::histogram>
+{
+    /**
+     * \brief Estimate the values of a histogram record that doesn't keep samples from its buckets
+     *
+     * Every bucket gets its share of the estimated values spread evenly up to its bound, the way prometheus interpolates
+     * quantiles from buckets, and the first bucket starts from 0 if its bound is positive. The values in the infinite
+     * bucket are put at what's left of the sum once the other buckets are taken at their midpoints, but always above
+     * the last bound so that they stay in their bucket.
+     */
+    static std::vector<double> estimate(const shared_record& record)
+    {
+        auto bounds = record.bounds();
+        std::vector<uint64_t> counts(bounds.size() + 1);
+        uint64_t total = 0;
+        for (std::size_t i = 0; i < counts.size(); i++)
+        {
+            counts[i] = record.bucket(i);
+            total += counts[i];
+        }
+
+        std::vector<double> result;
+        if (!total)
+            return result;
+
+        auto above = record.histogram_sum();
+        for (std::size_t i = 0; i < bounds.size(); i++)
+            above -= counts[i] * (bounds[i] + (i > 0 ? bounds[i - 1] : std::min(0.0, bounds[i]))) / 2;
+        if (counts.back())
+            above /= counts.back();
+        if (!bounds.empty())
+            above = std::max(above, std::nextafter(bounds.back(), std::numeric_limits<double>::infinity()));
+
+        // the most values that are estimated from the buckets
+        constexpr uint64_t max_estimated = 1024;
+        auto estimated = std::min(total, max_estimated);
+        result.reserve(estimated);
+
+        uint64_t below = 0;
+        for (std::size_t i = 0; i < counts.size(); i++)
+        {
+            // rounding where each bucket ends rather than its own count keeps the estimated values adding up
+            auto before = result.size();
+            below += counts[i];
+            auto count = static_cast<std::size_t>((static_cast<long double>(below) * estimated / total) + 0.5l) - before;
+
+            double upper, lower;
+            if (i < bounds.size())
+            {
+                upper = bounds[i];
+                lower = i > 0 ? bounds[i - 1] : std::min(0.0, upper);
+            }
+            else
+                upper = lower = above;
+
+            for (std::size_t j = 1; j <= count; j++)
+                result.push_back(lower + (upper - lower) * j / count);
+        }
+
+        return result;
+    }
+
+    static histogram_snapshot get(const shared_record& record, int64_t)
+    {
+        auto samples = record.histogram_samples();
+        if (samples.empty())
+            samples = estimate(record);
+        return histogram_snapshot(reservoir_snapshot(samples.data(), samples.size()), record.histogram_count());
+    }
+
+    static histogram_snapshot empty()
+    {
+        std::vector<double> none;
+        return histogram_snapshot(reservoir_snapshot(none.data(), none.size()), 0);
+    }
+};
+
+/**
+ * \brief Add what the replaced records of restarted workers had counted to the sum of a counter
+ */
+inline void add_retired(cumulative_value_snapshot& snapshot, int64_t retired)
+{
+    if (retired)
+        snapshot.merge(cumulative_value_snapshot(metric_value(retired)));
+}
+
+template<typename TSnapshot>
+void add_retired(TSnapshot&, int64_t)
+{ }
+
+}
+
+/**
+ * \brief A metric in the registry of the aggregating process that merges the records of a series from every worker
+ *
+ * The snapshot of every record is taken from its region and merged with the same semantics as the snapshots of the
+ * metrics in a registry: counters are summed, gauges and rates are averaged, and the samples of histograms are merged.
+ * Histograms that don't keep samples in their regions are merged from values estimated from their buckets.
+ *
+ * When a restarted worker's record replaces the one it had, the last value of the replaced record is kept and added to
+ * the sum of a counter, so that the restart doesn't make the aggregated counter drop and look like a reset.
+ */
+template<shared_metric_kind TKind>
+class aggregated_metric : public metric<aggregated_metric<TKind>>
+{
+    struct source
+    {
+        std::size_t worker;
+        std::shared_ptr<shared_region> region;
+        shared_record record;
+    };
+
+    std::vector<source> sources_;
+    int64_t retired_ = 0;
+    mutable std::mutex lock_;
+
+public:
+    /**
+     * \brief Add the record of a worker, replacing the one it had if it was restarted
+     */
+    void add(std::size_t worker, std::shared_ptr<shared_region> region, shared_record record)
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        for (auto& existing : sources_)
+        {
+            if (existing.worker != worker)
+                continue;
+
+            if (TKind == shared_metric_kind::counter)
+                retired_ += existing.record.counter_value();
+            existing.region = std::move(region);
+            existing.record = record;
+            return;
+        }
+
+        sources_.push_back(source{worker, std::move(region), record});
+    }
+
+    /**
+     * \brief The number of workers whose records are merged
+     */
+    std::size_t workers() const
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        return sources_.size();
+    }
+
+    auto snapshot() const
+    {
+        std::vector<source> sources;
+        int64_t retired;
+        {
+            std::lock_guard<std::mutex> lock(lock_);
+            sources = sources_;
+            retired = retired_;
+        }
+
+        if (sources.empty())
+            return internal::record_snapshot<TKind>::empty();
+
+        auto now = internal::steady_ns();
+        auto result = internal::record_snapshot<TKind>::get(sources.front().record, now);
+        for (std::size_t i = 1; i < sources.size(); i++)
+            result.merge(internal::record_snapshot<TKind>::get(sources[i].record, now));
+        internal::add_retired(result, retired);
+
+        return result;
+    }
+};
+
+/**
+ * \brief Aggregates the shared regions of pre-forked workers into one view in the registry of the master process
+ *
+ * Every worker creates its own region with the name of its index and registers its metrics through it, so updating
+ * them never leaves the worker. The master calls refresh on its own cadence, for instance right before it publishes,
+ * to map the regions of the workers and register an aggregated_metric for every series any of them has. The
+ * aggregated metrics read the regions directly whenever they're snapshotted.
+ *
+ * A worker that's restarted creates a new region under the same name. The series of the worker it replaced keep their
+ * last values until the new worker registers them again. From then on the new worker's counters are added on top of
+ * what the replaced worker had counted, so the aggregated counters keep going up across restarts.
+ */
+template<typename TRepo = default_repository>
+class region_aggregator
+{
+    struct worker
+    {
+        std::shared_ptr<shared_region> region;
+        std::unordered_set<std::string> attached;
+    };
+
+    metrics_registry<TRepo>& registry_;
+    std::string prefix_;
+    std::vector<worker> workers_;
+    std::unordered_map<std::string, std::shared_ptr<internal::metric>> series_;
+    std::size_t conflicts_;
+    std::mutex lock_;
+
+    template<shared_metric_kind TKind>
+    void attach(std::size_t index, const std::shared_ptr<shared_region>& region, const shared_record& record, std::string key)
+    {
+        using metric_type = aggregated_metric<TKind>;
+
+        auto& metric = series_[key];
+        if (!metric)
+        {
+            // the first record is added before the metric is registered, where a publish can snapshot it
+            auto aggregated = std::make_shared<metric_type>();
+            aggregated->add(index, region, record);
+            try
+            {
+                registry_.register_existing(record.path(), aggregated, record.tags());
+            }
+            catch (const metric_type_mismatch&)
+            {
+                // another worker or the master has something else at the path
+                series_.erase(key);
+                ++conflicts_;
+                return;
+            }
+
+            metric = aggregated;
+            return;
+        }
+
+        std::static_pointer_cast<metric_type>(metric)->add(index, region, record);
+    }
+
+    void attach(std::size_t index, const std::shared_ptr<shared_region>& region, const shared_record& record)
+    {
+        auto key = record.key();
+        switch (record.kind())
+        {
+            case shared_metric_kind::counter:
+                return attach<shared_metric_kind::counter>(index, region, record, std::move(key));
+            case shared_metric_kind::gauge:
+                return attach<shared_metric_kind::gauge>(index, region, record, std::move(key));
+            case shared_metric_kind::histogram:
+                return attach<shared_metric_kind::histogram>(index, region, record, std::move(key));
+            case shared_metric_kind::ewma:
+                return attach<shared_metric_kind::ewma>(index, region, record, std::move(key));
+            case shared_metric_kind::meter:
+                return attach<shared_metric_kind::meter>(index, region, record, std::move(key));
+        }
+    }
+
+public:
+    /**
+     * \brief Construct the aggregator
+     *
+     * \param registry the registry of the master process to register the aggregated metrics in
+     * \param prefix the prefix of the names of the regions of the workers
+     * \param workers the number of workers
+     */
+    region_aggregator(metrics_registry<TRepo>& registry, std::string prefix, std::size_t workers) :
+            registry_(registry),
+            prefix_(std::move(prefix)),
+            workers_(workers),
+            conflicts_(0)
+    { }
+
+    /**
+     * \brief The name of the region of a worker
+     */
+    static std::string region_name(const std::string& prefix, std::size_t worker)
+    {
+        return prefix + "." + std::to_string(worker);
+    }
+
+    /**
+     * \brief Map the regions of the workers and register aggregated metrics for the series that are new since the
+     * last refresh
+     *
+     * Workers whose regions don't exist yet are skipped until the next refresh.
+     */
+    void refresh()
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        for (std::size_t i = 0; i < workers_.size(); i++)
+        {
+            std::shared_ptr<shared_region> region;
+            try
+            {
+                region = shared_region::open(region_name(prefix_, i));
+            }
+            catch (const std::exception&)
+            {
+                continue;
+            }
+
+            auto& worker = workers_[i];
+            if (worker.region && worker.region->pid() == region->pid() && worker.region->created() == region->created())
+                region = worker.region;
+            else
+            {
+                worker.region = region;
+                worker.attached.clear();
+            }
+
+            region->visit([&](const shared_record& record) {
+                if (worker.attached.insert(record.key()).second)
+                    attach(i, region, record);
+            });
+        }
+    }
+
+    /**
+     * \brief The number of distinct series across the workers
+     */
+    std::size_t series() noexcept
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        return series_.size();
+    }
+
+    /**
+     * \brief The number of series that couldn't be registered because their paths have a metric of another type
+     */
+    std::size_t conflicts() noexcept
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        return conflicts_;
+    }
+};
+
+}
+
+#endif //CXXMETRICS_REGION_AGGREGATOR_HPP
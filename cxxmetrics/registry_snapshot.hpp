@@ -0,0 +1,335 @@
+#ifndef CXXMETRICS_REGISTRY_SNAPSHOT_HPP
+#define CXXMETRICS_REGISTRY_SNAPSHOT_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "metric_path.hpp"
+#include "snapshots.hpp"
+#include "tag_collection.hpp"
+
+namespace cxxmetrics
+{
+
+template<typename TRepository>
+class metrics_registry;
+class basic_registered_metric;
+
+/**
+ * \brief An immutable snapshot of every series in a registry, taken once and shared by any number of publishers
+ *
+ * Publishers that run off the same registry each snapshot every metric when they publish, which sorts every reservoir
+ * once per publisher. A registry snapshot is collected once with metrics_registry::collect() and then any number of
+ * publishers can render from it, in parallel since it never changes.
+ *
+ * The series are stored in columns rather than as snapshot objects: the label set, change epoch, value and count of
+ * every series are each in an array, the sorted reservoir values and meter rates of every series are in arrays of
+ * their own that the series index into, and the series of a family are contiguous. Label sets are interned, so a series
+ * only holds the id of its labels.
+ *
+ * Families have the same visit() and visit_changed() as registered metrics, which rebuild the snapshot of each series
+ * from the columns without sorting anything again.
+ */
+class registry_snapshot
+{
+public:
+    /**
+     * \brief The kind of snapshot the series of a family have
+     */
+    enum class series_kind : uint8_t
+    {
+        value,
+        cumulative,
+        meter,
+        histogram,
+        timer
+    };
+
+    /**
+     * \brief The series of a registered metric in the snapshot
+     */
+    class family
+    {
+        friend class registry_snapshot;
+
+        const registry_snapshot* owner_;
+        metric_path path_;
+        basic_registered_metric* metric_;
+        series_kind kind_;
+        std::size_t first_;
+        std::size_t size_;
+
+        family(const registry_snapshot* owner, const metric_path& path, basic_registered_metric* metric, std::size_t first) :
+                owner_(owner),
+                path_(path),
+                metric_(metric),
+                kind_(series_kind::value),
+                first_(first),
+                size_(0)
+        { }
+
+        template<typename THandler>
+        void visit_series(std::size_t series, THandler&& handler) const;
+
+    public:
+        const metric_path& path() const noexcept { return path_; }
+
+        /**
+         * \brief The registered metric the family was collected from, which is where publishers keep their data for it
+         */
+        basic_registered_metric& metric() const noexcept { return *metric_; }
+
+        series_kind kind() const noexcept { return kind_; }
+
+        /**
+         * \brief The index of the first series of the family in the columns of the snapshot
+         */
+        std::size_t first() const noexcept { return first_; }
+
+        std::size_t size() const noexcept { return size_; }
+
+        /**
+         * \brief Visit the series of the family like basic_registered_metric::visit
+         *
+         * \param handler called as handler(const tag_collection&, snapshot) for every series
+         */
+        template<typename THandler>
+        void visit(THandler&& handler) const
+        {
+            for (auto i = first_; i < first_ + size_; i++)
+                visit_series(i, [&](const auto& snapshot) { handler(owner_->labels(i), snapshot); });
+        }
+
+        /**
+         * \brief Visit the series of the family like basic_registered_metric::visit_changed
+         *
+         * \param filter called as filter(const tag_collection&, uint64_t) for every series that tracks changes, skipping
+         * the series if it returns true
+         * \param handler called as handler(const tag_collection&, uint64_t, snapshot) for every other series
+         */
+        template<typename TFilter, typename THandler>
+        void visit_changed(TFilter&& filter, THandler&& handler) const
+        {
+            for (auto i = first_; i < first_ + size_; i++)
+            {
+                auto epoch = owner_->epoch(i);
+                const auto& tags = owner_->labels(i);
+                if (epoch && filter(tags, epoch))
+                    continue;
+
+                visit_series(i, [&](const auto& snapshot) { handler(tags, epoch, snapshot); });
+            }
+        }
+    };
+
+private:
+    template<typename TRepository>
+    friend class metrics_registry;
+
+    std::vector<family> families_;
+
+    std::vector<tag_collection> label_sets_;
+    std::unordered_map<tag_collection, uint32_t> label_ids_;
+
+    // one entry per series
+    std::vector<uint32_t> labels_;
+    std::vector<uint64_t> epochs_;
+    std::vector<metric_value> values_;
+    std::vector<uint64_t> counts_;
+
+    // one entry per series and one more, every series' values are between its offset and the next one
+    std::vector<std::size_t> sample_offsets_;
+    std::vector<metric_value> samples_;
+    std::vector<std::size_t> rate_offsets_;
+    std::vector<std::chrono::steady_clock::duration> rate_windows_;
+    std::vector<metric_value> rates_;
+
+    void add_family(const metric_path& path, basic_registered_metric& metric)
+    {
+        families_.push_back(family(this, path, &metric, labels_.size()));
+    }
+
+    void add_series(const tag_collection& tags, uint64_t epoch, series_kind kind, metric_value value, uint64_t count)
+    {
+        auto id = label_ids_.find(tags);
+        if (id == label_ids_.end())
+        {
+            id = label_ids_.emplace(tags, static_cast<uint32_t>(label_sets_.size())).first;
+            label_sets_.push_back(tags);
+        }
+
+        auto& current = families_.back();
+        current.kind_ = kind;
+        ++current.size_;
+
+        labels_.push_back(id->second);
+        epochs_.push_back(epoch);
+        values_.push_back(std::move(value));
+        counts_.push_back(count);
+
+        // the samples and rates of the series were added before it, so these are where they end
+        sample_offsets_.push_back(samples_.size());
+        rate_offsets_.push_back(rates_.size());
+    }
+
+    void add_rates(const meter_snapshot& meter)
+    {
+        for (const auto& rate : meter)
+        {
+            rate_windows_.push_back(rate.first);
+            rates_.push_back(rate.second);
+        }
+    }
+
+    void add_samples(const reservoir_snapshot& reservoir)
+    {
+        // metric values can't be copy assigned, so they can't be range inserted either
+        for (const auto& value : reservoir.values())
+            samples_.push_back(value);
+    }
+
+    void add(const tag_collection& tags, uint64_t epoch, const average_value_snapshot& snapshot)
+    {
+        add_series(tags, epoch, series_kind::value, snapshot.value(), 0);
+    }
+
+    void add(const tag_collection& tags, uint64_t epoch, const cumulative_value_snapshot& snapshot)
+    {
+        add_series(tags, epoch, series_kind::cumulative, snapshot.value(), 0);
+    }
+
+    void add(const tag_collection& tags, uint64_t epoch, const meter_snapshot& snapshot)
+    {
+        add_rates(snapshot);
+        add_series(tags, epoch, series_kind::meter, snapshot.value(), 0);
+    }
+
+    void add(const tag_collection& tags, uint64_t epoch, const histogram_snapshot& snapshot)
+    {
+        add_samples(snapshot);
+        add_series(tags, epoch, series_kind::histogram, metric_value(0), snapshot.count());
+    }
+
+    void add(const tag_collection& tags, uint64_t epoch, const timer_snapshot& snapshot)
+    {
+        add_samples(snapshot);
+        add_rates(snapshot.rate());
+        add_series(tags, epoch, series_kind::timer, snapshot.rate().value(), snapshot.count());
+    }
+
+    meter_snapshot meter(std::size_t series) const
+    {
+        std::unordered_map<std::chrono::steady_clock::duration, metric_value> rates;
+        for (auto i = rate_offsets_[series]; i < rate_offsets_[series + 1]; i++)
+            rates.emplace(rate_windows_[i], rates_[i]);
+        return meter_snapshot(metric_value(values_[series]), std::move(rates));
+    }
+
+    histogram_snapshot histogram(std::size_t series) const
+    {
+        std::vector<metric_value> sorted(samples_.begin() + sample_offsets_[series], samples_.begin() + sample_offsets_[series + 1]);
+        return histogram_snapshot(reservoir_snapshot::from_sorted(std::move(sorted)), counts_[series]);
+    }
+
+public:
+    registry_snapshot() :
+            sample_offsets_{0},
+            rate_offsets_{0}
+    { }
+
+    registry_snapshot(const registry_snapshot&) = delete;
+    registry_snapshot& operator=(const registry_snapshot&) = delete;
+
+    const std::vector<family>& families() const noexcept { return families_; }
+
+    /**
+     * \brief Visit every family in the snapshot
+     *
+     * \param handler called as handler(const family&)
+     */
+    template<typename THandler>
+    void visit(THandler&& handler) const
+    {
+        for (const auto& f : families_)
+            handler(f);
+    }
+
+    /**
+     * \brief The number of series in the snapshot
+     */
+    std::size_t series() const noexcept { return labels_.size(); }
+
+    /**
+     * \brief The id of the label set of a series, which is the same for every series with the same labels
+     */
+    uint32_t label_id(std::size_t series) const noexcept { return labels_[series]; }
+
+    const tag_collection& labels(std::size_t series) const noexcept { return label_sets_[labels_[series]]; }
+
+    /**
+     * \brief The change epoch of a series, or 0 if it doesn't track changes
+     */
+    uint64_t epoch(std::size_t series) const noexcept { return epochs_[series]; }
+
+    /**
+     * \brief The value of a value or cumulative series, or the mean rate of a meter or timer series
+     */
+    const metric_value& value(std::size_t series) const noexcept { return values_[series]; }
+
+    /**
+     * \brief The count of a histogram or timer series
+     */
+    uint64_t count(std::size_t series) const noexcept { return counts_[series]; }
+
+    /**
+     * \brief The sorted reservoir values of a histogram or timer series
+     */
+    std::pair<const metric_value*, const metric_value*> samples(std::size_t series) const noexcept
+    {
+        auto base = samples_.data();
+        return std::make_pair(base + sample_offsets_[series], base + sample_offsets_[series + 1]);
+    }
+
+    /**
+     * \brief The number of windowed rates of a meter or timer series
+     */
+    std::size_t rates(std::size_t series) const noexcept { return rate_offsets_[series + 1] - rate_offsets_[series]; }
+
+    /**
+     * \brief One of the windowed rates of a meter or timer series, as its window and its rate
+     */
+    std::pair<std::chrono::steady_clock::duration, const metric_value&> rate(std::size_t series, std::size_t index) const noexcept
+    {
+        auto at = rate_offsets_[series] + index;
+        return std::pair<std::chrono::steady_clock::duration, const metric_value&>(rate_windows_[at], rates_[at]);
+    }
+};
+
+template<typename THandler>
+void registry_snapshot::family::visit_series(std::size_t series, THandler&& handler) const
+{
+    switch (kind_)
+    {
+        case series_kind::value:
+            handler(average_value_snapshot(metric_value(owner_->values_[series])));
+            return;
+        case series_kind::cumulative:
+            handler(cumulative_value_snapshot(metric_value(owner_->values_[series])));
+            return;
+        case series_kind::meter:
+            handler(owner_->meter(series));
+            return;
+        case series_kind::histogram:
+            handler(owner_->histogram(series));
+            return;
+        case series_kind::timer:
+            handler(timer_snapshot(owner_->histogram(series), owner_->meter(series)));
+            return;
+    }
+}
+
+}
+
+#endif //CXXMETRICS_REGISTRY_SNAPSHOT_HPP
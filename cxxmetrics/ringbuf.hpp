@@ -3,6 +3,7 @@
 
 #include <atomic>
 #include <thread>
+#include "self_metrics.hpp"
 
 namespace cxxmetrics
 {
@@ -251,6 +252,8 @@ void ringbuf<TElemType, TSize>::push(const TElemType &elem) noexcept
 
         if (size_.compare_exchange_weak(csize, writeloc, std::memory_order_release, std::memory_order_acquire))
             return;
+
+        self_metric_add(self_stat::ringbuf_push_retries, 1);
     }
 }
 
@@ -0,0 +1,148 @@
+#ifndef CXXMETRICS_SELF_METRICS_HPP
+#define CXXMETRICS_SELF_METRICS_HPP
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+
+namespace cxxmetrics
+{
+
+namespace internal
+{
+
+/**
+ * \brief The internal costs of the library that are tracked when CXXMETRICS_SELF_METRICS is defined
+ */
+enum class self_stat
+{
+    registry_lock_wait_ns,  // time spent waiting on the repository's metric lock
+    metric_lock_wait_ns,    // time spent waiting on registered metric locks when adding tagged metrics
+    ringbuf_push_retries,   // failed compare and swaps while growing ring buffers
+    ewma_tick_retries,      // ewma ticks that lost a compare and swap to another thread
+    ewma_skipped_ticks,     // ewma intervals that elapsed without a tick and were decayed in later
+    scrapes,                // completed publisher writes
+    scrape_ns,              // total time spent in publisher writes
+    scrape_bytes,           // total bytes written by publishers
+    count
+};
+
+/**
+ * \brief The path under which the library registers its own metrics. Metrics under it aren't instrumented
+ */
+constexpr const char* self_metrics_root = "cxxmetrics";
+
+#ifdef CXXMETRICS_SELF_METRICS
+
+constexpr bool self_metrics_enabled = true;
+
+/**
+ * \brief process wide totals of the library internal costs
+ */
+class self_metrics
+{
+    std::array<std::atomic_uint_fast64_t, static_cast<std::size_t>(self_stat::count)> stats_;
+
+    self_metrics() noexcept
+    {
+        for (auto& s : stats_)
+            s.store(0, std::memory_order_relaxed);
+    }
+public:
+    static self_metrics& instance() noexcept
+    {
+        static self_metrics metrics;
+        return metrics;
+    }
+
+    void add(self_stat stat, uint64_t amount) noexcept
+    {
+        stats_[static_cast<std::size_t>(stat)].fetch_add(amount, std::memory_order_relaxed);
+    }
+
+    uint64_t value(self_stat stat) const noexcept
+    {
+        return stats_[static_cast<std::size_t>(stat)].load(std::memory_order_relaxed);
+    }
+};
+
+inline void self_metric_add(self_stat stat, uint64_t amount) noexcept
+{
+    self_metrics::instance().add(stat, amount);
+}
+
+/**
+ * \brief A lock_guard that adds the time it spent waiting for the lock to a self stat
+ */
+template<self_stat TStat, typename TMutex>
+class timed_lock_guard
+{
+    TMutex& mutex_;
+public:
+    explicit timed_lock_guard(TMutex& mutex) :
+            mutex_(mutex)
+    {
+        if (mutex_.try_lock())
+            return;
+
+        auto start = std::chrono::steady_clock::now();
+        mutex_.lock();
+        self_metric_add(TStat, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+    }
+
+    timed_lock_guard(const timed_lock_guard&) = delete;
+    timed_lock_guard& operator=(const timed_lock_guard&) = delete;
+
+    ~timed_lock_guard()
+    {
+        mutex_.unlock();
+    }
+};
+
+/**
+ * \brief Adds the time between its construction and destruction to a self stat
+ */
+template<self_stat TStat>
+class timed_scope
+{
+    std::chrono::steady_clock::time_point start_;
+public:
+    timed_scope() noexcept :
+            start_(std::chrono::steady_clock::now())
+    { }
+
+    timed_scope(const timed_scope&) = delete;
+    timed_scope& operator=(const timed_scope&) = delete;
+
+    ~timed_scope()
+    {
+        self_metric_add(TStat, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_).count());
+    }
+};
+
+#else
+
+constexpr bool self_metrics_enabled = false;
+
+inline void self_metric_add(self_stat, uint64_t) noexcept
+{ }
+
+template<self_stat TStat, typename TMutex>
+using timed_lock_guard = std::lock_guard<TMutex>;
+
+template<self_stat TStat>
+struct timed_scope
+{
+    timed_scope() noexcept
+    { }
+};
+
+#endif
+
+}
+
+}
+
+#endif //CXXMETRICS_SELF_METRICS_HPP
@@ -0,0 +1,1120 @@
+#ifndef CXXMETRICS_SHARED_REGION_HPP
+#define CXXMETRICS_SHARED_REGION_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "exposition_buffer.hpp"
+#include "histogram.hpp"
+#include "metrics_registry.hpp"
+#include "publisher.hpp"
+
+namespace cxxmetrics
+{
+
+/**
+ * \brief The kinds of metric state that can be kept in a shared_region
+ */
+enum class shared_metric_kind : uint16_t
+{
+    counter = 1,
+    gauge = 2,
+    histogram = 3,
+    ewma = 4,
+    meter = 5
+};
+
+class shared_region;
+
+namespace internal
+{
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && sizeof(std::atomic<uint64_t>) == sizeof(uint64_t),
+        "metric state can only be shared between processes with lock free 64 bit atomics");
+
+constexpr char shared_region_magic[8] = {'c', 'x', 'x', 'm', 'e', 't', 'r', 'x'};
+constexpr uint32_t shared_region_version = 1;
+
+/**
+ * \brief The start of a shared region. Everything in the region is in the byte order of the process that wrote it
+ */
+struct shared_region_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t size;
+    int64_t pid;
+    int64_t created_ns;
+
+    /**
+     * \brief The offset of the end of the last record. Records are only ever appended
+     */
+    std::atomic<uint64_t> used;
+
+    /**
+     * \brief The number of records that are ready to be read
+     */
+    std::atomic<uint64_t> records;
+};
+
+/**
+ * \brief The start of every record in a shared region
+ *
+ * The header is followed by the name of the record: its path segments and then the key and value of each of its
+ * tags, every one terminated by a NUL, padded to 8 bytes. Then come the parameters of the record, which describe it
+ * and never change, and then the slots holding its state, which are 64 bit atomics. All of them are 8 bytes.
+ */
+struct shared_record_header
+{
+    /**
+     * \brief 0 while the record is being written and 1 once it can be read
+     */
+    std::atomic<uint32_t> ready;
+    uint16_t kind;
+    uint16_t reserved;
+    uint32_t size;
+    uint32_t name_size;
+    uint32_t segments;
+    uint32_t tags;
+    uint32_t parameters;
+    uint32_t slots;
+};
+
+static_assert(sizeof(shared_record_header) % 8 == 0, "records have to keep their slots aligned");
+
+constexpr std::size_t shared_align(std::size_t size) noexcept
+{
+    return (size + 7) & ~static_cast<std::size_t>(7);
+}
+
+inline uint64_t double_bits(double value) noexcept
+{
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+inline double bits_double(uint64_t bits) noexcept
+{
+    double value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+inline void shared_add(std::atomic<uint64_t>& slot, double amount) noexcept
+{
+    auto current = slot.load(std::memory_order_relaxed);
+    while (!slot.compare_exchange_weak(current, double_bits(bits_double(current) + amount), std::memory_order_relaxed))
+        ;
+}
+
+inline int64_t steady_ns() noexcept
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * \brief The encoded name of a record, which is also its identity within a region
+ */
+inline std::string shared_record_name(const metric_path& path, const tag_collection& tags, uint32_t& segments, uint32_t& tag_count)
+{
+    std::string result;
+    segments = 0;
+    for (const auto& segment : path)
+    {
+        result.append(segment).push_back('\0');
+        ++segments;
+    }
+
+    // sorted so that the same tags always encode the same way
+    std::vector<std::pair<std::string, std::string>> sorted;
+    exposition_buffer value(64);
+    for (const auto& tag : tags)
+    {
+        value.clear();
+        value << tag.second;
+        sorted.emplace_back(tag.first, value.str());
+    }
+    std::sort(sorted.begin(), sorted.end());
+
+    tag_count = static_cast<uint32_t>(sorted.size());
+    for (const auto& tag : sorted)
+        result.append(tag.first).append(1, '\0').append(tag.second).push_back('\0');
+
+    return result;
+}
+
+}
+
+/**
+ * \brief A counter whose value lives in a shared_region
+ */
+class shared_counter : public metric<shared_counter>
+{
+    std::shared_ptr<shared_region> region_;
+    std::atomic<uint64_t>& value_;
+    internal::change_epoch epoch_;
+
+public:
+    shared_counter(std::shared_ptr<shared_region> region, std::atomic<uint64_t>* slots) noexcept :
+            region_(std::move(region)),
+            value_(slots[0])
+    { }
+
+    /**
+     * \brief increment the counter by the specified value
+     *
+     * \return the value of the counter after the increment
+     */
+    int64_t incr(int64_t by) noexcept
+    {
+        auto result = value_.fetch_add(static_cast<uint64_t>(by), std::memory_order_relaxed) + static_cast<uint64_t>(by);
+        epoch_.touch();
+        return static_cast<int64_t>(result);
+    }
+
+    int64_t value() const noexcept
+    {
+        return static_cast<int64_t>(value_.load(std::memory_order_relaxed));
+    }
+
+    uint64_t epoch() const noexcept
+    {
+        return epoch_.value();
+    }
+
+    shared_counter& operator+=(int64_t by) noexcept
+    {
+        incr(by);
+        return *this;
+    }
+
+    shared_counter& operator++() noexcept
+    {
+        incr(1);
+        return *this;
+    }
+
+    cumulative_value_snapshot snapshot() const
+    {
+        return cumulative_value_snapshot(value());
+    }
+};
+
+/**
+ * \brief A gauge of doubles whose value lives in a shared_region
+ */
+class shared_gauge : public metric<shared_gauge>
+{
+    std::shared_ptr<shared_region> region_;
+    std::atomic<uint64_t>& value_;
+    internal::change_epoch epoch_;
+
+public:
+    shared_gauge(std::shared_ptr<shared_region> region, std::atomic<uint64_t>* slots) noexcept :
+            region_(std::move(region)),
+            value_(slots[0])
+    { }
+
+    void set(double value) noexcept
+    {
+        value_.store(internal::double_bits(value), std::memory_order_relaxed);
+        epoch_.touch();
+    }
+
+    /**
+     * \brief Change the gauge by an amount
+     */
+    void add(double amount) noexcept
+    {
+        internal::shared_add(value_, amount);
+        epoch_.touch();
+    }
+
+    double get() const noexcept
+    {
+        return internal::bits_double(value_.load(std::memory_order_relaxed));
+    }
+
+    uint64_t epoch() const noexcept
+    {
+        return epoch_.value();
+    }
+
+    average_value_snapshot snapshot() const
+    {
+        return average_value_snapshot(get());
+    }
+};
+
+namespace internal
+{
+
+inline double shared_rate_alpha(uint64_t window, uint64_t interval) noexcept
+{
+    return 1 - std::exp((interval * -1.0) / (window * 2.0));
+}
+
+/**
+ * \brief Decay a rate that was last brought up to date at last to what it would be at now if nothing was marked since
+ */
+inline double decayed_rate(double rate, int64_t last, int64_t now, int64_t interval_ns, double alpha) noexcept
+{
+    if (now - last < interval_ns * 2)
+        return rate;
+    return rate * std::pow(1 - alpha, static_cast<double>((now - last) / interval_ns - 1));
+}
+
+/**
+ * \brief The exponential weighted moving average of marks per interval, kept in 4 slots of a record
+ *
+ * The slots hold the rate, the marks since the last tick, the time of the last tick and whether it ticked at all.
+ * It's brought up to date the same way as the ewma metric, by whichever marker or reader gets to the tick first.
+ */
+class shared_rate
+{
+    std::atomic<uint64_t>* slots_;
+    double alpha_;
+    int64_t interval_ns_;
+
+    enum slot { rate_slot, pending_slot, last_slot, ticked_slot };
+
+public:
+    static constexpr std::size_t slot_count = 4;
+
+    shared_rate(std::atomic<uint64_t>* slots, uint64_t window, uint64_t interval) noexcept :
+            slots_(slots),
+            alpha_(shared_rate_alpha(window, interval)),
+            interval_ns_(static_cast<int64_t>(interval) * 1000)
+    { }
+
+    static void initialize(std::atomic<uint64_t>* slots, int64_t now) noexcept
+    {
+        slots[last_slot].store(static_cast<uint64_t>(now), std::memory_order_relaxed);
+    }
+
+    void mark(int64_t amount, int64_t now) noexcept
+    {
+        slots_[pending_slot].fetch_add(static_cast<uint64_t>(amount), std::memory_order_acq_rel);
+        tick(now);
+    }
+
+    double tick(int64_t now) noexcept
+    {
+        auto last = static_cast<int64_t>(slots_[last_slot].load(std::memory_order_acquire));
+        auto rate = bits_double(slots_[rate_slot].load(std::memory_order_acquire));
+        if (now - last < interval_ns_)
+            return rate;
+
+        // one caller wins the tick and folds the pending marks into the rate
+        auto intervals = (now - last) / interval_ns_;
+        auto expected = static_cast<uint64_t>(last);
+        if (!slots_[last_slot].compare_exchange_strong(expected, static_cast<uint64_t>(last + intervals * interval_ns_), std::memory_order_acq_rel))
+            return bits_double(slots_[rate_slot].load(std::memory_order_acquire));
+
+        auto pending = static_cast<double>(static_cast<int64_t>(slots_[pending_slot].exchange(0, std::memory_order_acq_rel)));
+        if (slots_[ticked_slot].exchange(1, std::memory_order_acq_rel) == 0)
+            rate = pending;
+        else
+            rate += alpha_ * (pending - rate);
+
+        // zeros are averaged in for the intervals that were missed
+        if (intervals > 1)
+            rate *= std::pow(1 - alpha_, static_cast<double>(intervals - 1));
+
+        slots_[rate_slot].store(double_bits(rate), std::memory_order_release);
+        return rate;
+    }
+};
+
+}
+
+/**
+ * \brief An exponential weighted moving average whose state lives in a shared_region
+ *
+ * Like the ewma metric, the rate is the number of marks per interval and is brought up to date whenever it's marked or
+ * read. A reader in another process sees the rate as of the last time it was brought up to date, which it can decay
+ * to the present with the time of the last tick, the interval and the window in the parameters of its record.
+ */
+template<period::value TWindow, period::value TInterval = time::seconds(1)>
+class shared_ewma : public metric<shared_ewma<TWindow, TInterval>>
+{
+    std::shared_ptr<shared_region> region_;
+    internal::shared_rate rate_;
+    std::atomic<uint64_t>& total_;
+
+public:
+    shared_ewma(std::shared_ptr<shared_region> region, std::atomic<uint64_t>* slots) noexcept :
+            region_(std::move(region)),
+            rate_(slots, TWindow, TInterval),
+            total_(slots[internal::shared_rate::slot_count])
+    { }
+
+    static std::vector<uint64_t> parameters()
+    {
+        return {static_cast<uint64_t>(TWindow), static_cast<uint64_t>(TInterval)};
+    }
+
+    /**
+     * \brief the slots of the rate, followed by the total of the marks
+     */
+    static constexpr std::size_t slot_count = internal::shared_rate::slot_count + 1;
+
+    static void initialize(std::atomic<uint64_t>* slots) noexcept
+    {
+        internal::shared_rate::initialize(slots, internal::steady_ns());
+    }
+
+    void mark(int64_t amount) noexcept
+    {
+        total_.fetch_add(static_cast<uint64_t>(amount), std::memory_order_relaxed);
+        rate_.mark(amount, internal::steady_ns());
+    }
+
+    double rate() noexcept
+    {
+        return rate_.tick(internal::steady_ns());
+    }
+
+    average_value_snapshot snapshot() noexcept
+    {
+        return average_value_snapshot(rate());
+    }
+};
+
+/**
+ * \brief A meter with a mean rate whose state lives in a shared_region
+ *
+ * The record of the meter has the interval and then the windows as its parameters. Its slots hold the time the meter
+ * was created and the total of its marks, followed by the slots of the rate of each window.
+ */
+template<period::value TInterval, period::value... TWindows>
+class shared_meter : public metric<shared_meter<TInterval, TWindows...>>
+{
+    static_assert(sizeof...(TWindows) > 0, "a meter needs at least one window");
+
+    std::shared_ptr<shared_region> region_;
+    std::atomic<uint64_t>* slots_;
+    std::vector<internal::shared_rate> rates_;
+
+    static constexpr std::size_t rates_at = 2;
+
+public:
+    shared_meter(std::shared_ptr<shared_region> region, std::atomic<uint64_t>* slots) noexcept :
+            region_(std::move(region)),
+            slots_(slots)
+    {
+        const period::value windows[] = {TWindows...};
+        rates_.reserve(sizeof...(TWindows));
+        for (std::size_t i = 0; i < sizeof...(TWindows); i++)
+            rates_.emplace_back(slots + rates_at + internal::shared_rate::slot_count * i, windows[i], TInterval);
+    }
+
+    static std::vector<uint64_t> parameters()
+    {
+        return {static_cast<uint64_t>(TInterval), static_cast<uint64_t>(TWindows)...};
+    }
+
+    static constexpr std::size_t slot_count = rates_at + internal::shared_rate::slot_count * sizeof...(TWindows);
+
+    static void initialize(std::atomic<uint64_t>* slots) noexcept
+    {
+        auto now = internal::steady_ns();
+        slots[0].store(static_cast<uint64_t>(now), std::memory_order_relaxed);
+        for (std::size_t i = 0; i < sizeof...(TWindows); i++)
+            internal::shared_rate::initialize(slots + rates_at + internal::shared_rate::slot_count * i, now);
+    }
+
+    void mark(int64_t amount = 1) noexcept
+    {
+        auto now = internal::steady_ns();
+        slots_[1].fetch_add(static_cast<uint64_t>(amount), std::memory_order_relaxed);
+        for (auto& rate : rates_)
+            rate.mark(amount, now);
+    }
+
+    /**
+     * \brief The average of the marks per interval since the meter was created
+     */
+    double mean() const noexcept
+    {
+        auto since = internal::steady_ns() - static_cast<int64_t>(slots_[0].load(std::memory_order_relaxed));
+        auto units = since / (static_cast<double>(TInterval) * 1000);
+        auto total = static_cast<double>(static_cast<int64_t>(slots_[1].load(std::memory_order_relaxed)));
+        return units < 1 ? total : total / units;
+    }
+
+    meter_snapshot snapshot() noexcept
+    {
+        auto now = internal::steady_ns();
+        const period::value windows[] = {TWindows...};
+        std::unordered_map<std::chrono::steady_clock::duration, metric_value> rates;
+        for (std::size_t i = 0; i < sizeof...(TWindows); i++)
+            rates.emplace(period(windows[i]).to_duration(), metric_value(rates_[i].tick(now)));
+
+        return meter_snapshot(metric_value(mean()), std::move(rates));
+    }
+};
+
+/**
+ * \brief A histogram whose bucket counts live in a shared_region
+ *
+ * A reader in another process gets the counts of the buckets, along with the total count and sum, and optionally the
+ * most recent values in a ring of samples. Quantiles can't be recovered from buckets, so the histogram also keeps a
+ * reservoir in the process for the snapshots that publishers in the process take.
+ */
+template<typename TReservoir>
+class shared_histogram : public metric<shared_histogram<TReservoir>>
+{
+    using value_type = typename TReservoir::value_type;
+    static_assert(std::is_arithmetic<value_type>::value, "shared histograms need numeric values to find their buckets");
+
+    std::shared_ptr<shared_region> region_;
+    const uint64_t* bounds_;
+    std::size_t bound_count_;
+    std::atomic<uint64_t>* slots_;
+    std::size_t samples_;
+    histogram<value_type, TReservoir> histogram_;
+
+public:
+    shared_histogram(std::shared_ptr<shared_region> region, const uint64_t* bounds, std::size_t bound_count, std::atomic<uint64_t>* slots, std::size_t samples, TReservoir&& reservoir) :
+            region_(std::move(region)),
+            bounds_(bounds),
+            bound_count_(bound_count),
+            slots_(slots),
+            samples_(samples),
+            histogram_(std::forward<TReservoir>(reservoir))
+    { }
+
+    void update(const value_type& value) noexcept
+    {
+        auto v = static_cast<double>(value);
+        auto bucket = std::lower_bound(bounds_, bounds_ + bound_count_, v, [](uint64_t bound, double value) {
+            return internal::bits_double(bound) < value;
+        }) - bounds_;
+
+        slots_[bucket].fetch_add(1, std::memory_order_relaxed);
+        auto index = slots_[bound_count_ + 1].fetch_add(1, std::memory_order_relaxed);
+        internal::shared_add(slots_[bound_count_ + 2], v);
+        if (samples_)
+            slots_[bound_count_ + 3 + index % samples_].store(internal::double_bits(v), std::memory_order_relaxed);
+        histogram_.update(value);
+    }
+
+    uint64_t epoch() const noexcept
+    {
+        return histogram_.epoch();
+    }
+
+    histogram_snapshot snapshot() const noexcept
+    {
+        return histogram_.snapshot();
+    }
+};
+
+/**
+ * \brief A read only view of a record in a shared_region
+ */
+class shared_record
+{
+    const internal::shared_record_header* header_;
+
+    const char* name() const noexcept
+    {
+        return reinterpret_cast<const char*>(header_ + 1);
+    }
+
+    const uint64_t* parameter_data() const noexcept
+    {
+        return reinterpret_cast<const uint64_t*>(name() + internal::shared_align(header_->name_size));
+    }
+
+    const std::atomic<uint64_t>* slot_data() const noexcept
+    {
+        return reinterpret_cast<const std::atomic<uint64_t>*>(parameter_data() + header_->parameters);
+    }
+
+public:
+    explicit shared_record(const internal::shared_record_header* header) noexcept :
+            header_(header)
+    { }
+
+    shared_metric_kind kind() const noexcept
+    {
+        return static_cast<shared_metric_kind>(header_->kind);
+    }
+
+    metric_path path() const
+    {
+        metric_path result("");
+        auto at = name();
+        for (uint32_t i = 0; i < header_->segments; i++)
+        {
+            auto length = std::strlen(at);
+            result = result / metric_path(std::string(at, length));
+            at += length + 1;
+        }
+
+        return result;
+    }
+
+    tag_collection tags() const
+    {
+        std::unordered_map<std::string, metric_value> result;
+        auto at = name();
+        for (uint32_t i = 0; i < header_->segments; i++)
+            at += std::strlen(at) + 1;
+
+        for (uint32_t i = 0; i < header_->tags; i++)
+        {
+            std::string key(at);
+            at += key.size() + 1;
+            std::string value(at);
+            at += value.size() + 1;
+            result.emplace(std::move(key), metric_value(std::move(value)));
+        }
+
+        return tag_collection(result);
+    }
+
+    /**
+     * \brief A key that identifies the kind, path and tags of the record, so records of the same series in different
+     * regions have the same key
+     */
+    std::string key() const
+    {
+        return std::string(1, static_cast<char>(header_->kind)).append(name(), header_->name_size);
+    }
+
+    std::size_t parameters() const noexcept
+    {
+        return header_->parameters;
+    }
+
+    uint64_t parameter(std::size_t index) const noexcept
+    {
+        return parameter_data()[index];
+    }
+
+    std::size_t slots() const noexcept
+    {
+        return header_->slots;
+    }
+
+    uint64_t slot(std::size_t index) const noexcept
+    {
+        return slot_data()[index].load(std::memory_order_acquire);
+    }
+
+    /**
+     * \brief The value of a counter record
+     */
+    int64_t counter_value() const noexcept
+    {
+        return static_cast<int64_t>(slot(0));
+    }
+
+    /**
+     * \brief The value of a gauge record
+     */
+    double gauge_value() const noexcept
+    {
+        return internal::bits_double(slot(0));
+    }
+
+    /**
+     * \brief The upper bounds of the buckets of a histogram record, not including the implicit infinite bucket
+     */
+    std::vector<double> bounds() const
+    {
+        std::vector<double> result(header_->parameters);
+        for (std::size_t i = 0; i < result.size(); i++)
+            result[i] = internal::bits_double(parameter(i));
+        return result;
+    }
+
+    /**
+     * \brief The count of values in a bucket of a histogram record, which isn't cumulative. The bucket at the number of
+     * bounds is the infinite bucket
+     */
+    uint64_t bucket(std::size_t index) const noexcept
+    {
+        return slot(index);
+    }
+
+    uint64_t histogram_count() const noexcept
+    {
+        return slot(header_->parameters + 1);
+    }
+
+    double histogram_sum() const noexcept
+    {
+        return internal::bits_double(slot(header_->parameters + 2));
+    }
+
+    /**
+     * \brief The most recent values of a histogram record that keeps samples, in no particular order
+     */
+    std::vector<double> histogram_samples() const
+    {
+        auto at = header_->parameters + 3;
+        auto size = std::min<uint64_t>(histogram_count(), header_->slots - at);
+
+        std::vector<double> result(size);
+        for (std::size_t i = 0; i < result.size(); i++)
+            result[i] = internal::bits_double(slot(at + i));
+        return result;
+    }
+
+    /**
+     * \brief The rate of an ewma record as of its last tick
+     */
+    double ewma_rate() const noexcept
+    {
+        return internal::bits_double(slot(0));
+    }
+
+    /**
+     * \brief The rate of an ewma record decayed to a steady clock time in nanoseconds, as if nothing was marked since
+     * its last tick
+     */
+    double ewma_rate(int64_t now) const noexcept
+    {
+        return internal::decayed_rate(ewma_rate(), ewma_last_tick(), now, static_cast<int64_t>(parameter(1)) * 1000,
+                internal::shared_rate_alpha(parameter(0), parameter(1)));
+    }
+
+    /**
+     * \brief The steady clock time of the last tick of an ewma record, in nanoseconds
+     */
+    int64_t ewma_last_tick() const noexcept
+    {
+        return static_cast<int64_t>(slot(2));
+    }
+
+    /**
+     * \brief Everything ever marked on an ewma record
+     */
+    int64_t ewma_total() const noexcept
+    {
+        return static_cast<int64_t>(slot(4));
+    }
+
+    std::chrono::microseconds ewma_window() const noexcept
+    {
+        return std::chrono::microseconds(parameter(0));
+    }
+
+    std::chrono::microseconds ewma_interval() const noexcept
+    {
+        return std::chrono::microseconds(parameter(1));
+    }
+
+    std::chrono::microseconds meter_interval() const noexcept
+    {
+        return std::chrono::microseconds(parameter(0));
+    }
+
+    std::size_t meter_windows() const noexcept
+    {
+        return header_->parameters - 1;
+    }
+
+    std::chrono::microseconds meter_window(std::size_t index) const noexcept
+    {
+        return std::chrono::microseconds(parameter(index + 1));
+    }
+
+    /**
+     * \brief Everything ever marked on a meter record
+     */
+    int64_t meter_total() const noexcept
+    {
+        return static_cast<int64_t>(slot(1));
+    }
+
+    /**
+     * \brief The average marks per interval of a meter record from when it was created to a steady clock time in
+     * nanoseconds
+     */
+    double meter_mean(int64_t now) const noexcept
+    {
+        auto units = (now - static_cast<int64_t>(slot(0))) / (static_cast<double>(parameter(0)) * 1000);
+        auto total = static_cast<double>(meter_total());
+        return units < 1 ? total : total / units;
+    }
+
+    /**
+     * \brief The rate of a window of a meter record decayed to a steady clock time in nanoseconds, as if nothing was
+     * marked since its last tick
+     */
+    double meter_rate(std::size_t index, int64_t now) const noexcept
+    {
+        auto at = 2 + internal::shared_rate::slot_count * index;
+        return internal::decayed_rate(internal::bits_double(slot(at)), static_cast<int64_t>(slot(at + 2)), now,
+                static_cast<int64_t>(parameter(0)) * 1000, internal::shared_rate_alpha(parameter(index + 1), parameter(0)));
+    }
+};
+
+/**
+ * \brief A named shared memory segment holding the state of metrics so another process can read it
+ *
+ * The application creates the region and registers metrics through it. Their state is written straight into the
+ * region by the metrics themselves, so updating them costs the same atomic operations as any other metric, without
+ * locks or system calls. An exporter process opens the region read only and visits its records without any
+ * coordination with the application. The segment outlives the application, so its last state can still be read
+ * after a crash until the segment is removed.
+ *
+ * The layout starts with a versioned header and is followed by self describing records that are only ever appended.
+ * A record is only visited once it's completely written. Records are never removed, so the region has to be sized for
+ * every series the application will create. This is only available on POSIX systems.
+ */
+class shared_region : public std::enable_shared_from_this<shared_region>
+{
+    void* data_;
+    std::size_t size_;
+    bool writable_;
+
+    std::unordered_map<std::string, std::shared_ptr<internal::metric>> metrics_;
+    std::mutex lock_;
+
+    shared_region(void* data, std::size_t size, bool writable) noexcept :
+            data_(data),
+            size_(size),
+            writable_(writable)
+    { }
+
+    internal::shared_region_header& header() const noexcept
+    {
+        return *static_cast<internal::shared_region_header*>(data_);
+    }
+
+    static void* map(const std::string& name, int flags, std::size_t& size)
+    {
+        auto fd = ::shm_open(name.c_str(), flags, 0644);
+        if (fd < 0)
+            throw std::system_error(errno, std::generic_category(), "shm_open");
+
+        if (flags & O_CREAT)
+        {
+            if (::ftruncate(fd, static_cast<off_t>(size)) < 0)
+            {
+                auto error = errno;
+                ::close(fd);
+                throw std::system_error(error, std::generic_category(), "ftruncate");
+            }
+        }
+        else
+        {
+            struct stat info{};
+            if (::fstat(fd, &info) < 0)
+            {
+                auto error = errno;
+                ::close(fd);
+                throw std::system_error(error, std::generic_category(), "fstat");
+            }
+            size = static_cast<std::size_t>(info.st_size);
+        }
+
+        auto data = ::mmap(nullptr, size, (flags & O_RDWR) ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+        auto error = errno;
+        ::close(fd);
+        if (data == MAP_FAILED)
+            throw std::system_error(error, std::generic_category(), "mmap");
+
+        return data;
+    }
+
+    /**
+     * \brief Append a record that isn't ready yet, returning its header
+     */
+    internal::shared_record_header* allocate(shared_metric_kind kind, const std::string& name, uint32_t segments, uint32_t tags, const std::vector<uint64_t>& parameters, std::size_t slots)
+    {
+        auto size = sizeof(internal::shared_record_header) + internal::shared_align(name.size()) + (parameters.size() + slots) * 8;
+        auto offset = header().used.load(std::memory_order_relaxed);
+        if (offset + size > size_)
+            throw std::length_error("the shared region is full");
+
+        auto record = reinterpret_cast<internal::shared_record_header*>(static_cast<char*>(data_) + offset);
+        record->kind = static_cast<uint16_t>(kind);
+        record->size = static_cast<uint32_t>(size);
+        record->name_size = static_cast<uint32_t>(name.size());
+        record->segments = segments;
+        record->tags = tags;
+        record->parameters = static_cast<uint32_t>(parameters.size());
+        record->slots = static_cast<uint32_t>(slots);
+
+        // readers skip over a record that isn't ready by its size, so the size is in place before the record is
+        header().used.store(offset + size, std::memory_order_release);
+
+        auto at = reinterpret_cast<char*>(record + 1);
+        std::memcpy(at, name.data(), name.size());
+        at += internal::shared_align(name.size());
+        if (!parameters.empty())
+            std::memcpy(at, parameters.data(), parameters.size() * 8);
+
+        return record;
+    }
+
+    static std::atomic<uint64_t>* slots_of(internal::shared_record_header* record) noexcept
+    {
+        return reinterpret_cast<std::atomic<uint64_t>*>(reinterpret_cast<char*>(record + 1) + internal::shared_align(record->name_size) + record->parameters * 8);
+    }
+
+    static const uint64_t* parameters_of(internal::shared_record_header* record) noexcept
+    {
+        return reinterpret_cast<const uint64_t*>(reinterpret_cast<char*>(record + 1) + internal::shared_align(record->name_size));
+    }
+
+    /**
+     * \brief Get the metric the region made for a path and tags, or make one in a new record and register it
+     *
+     * \param build builds the metric from its record
+     */
+    template<typename TMetric, typename TRepo, typename TBuild>
+    std::shared_ptr<TMetric> get(metrics_registry<TRepo>& registry, shared_metric_kind kind, const metric_path& path, const tag_collection& tags, const std::vector<uint64_t>& parameters, std::size_t slots, TBuild&& build)
+    {
+        if (!writable_)
+            throw std::logic_error("metrics can't be added to a shared region that was opened to be read");
+
+        uint32_t segments, tag_count;
+        auto name = internal::shared_record_name(path, tags, segments, tag_count);
+        auto key = std::string(1, static_cast<char>(kind)) + name;
+
+        std::lock_guard<std::mutex> lock(lock_);
+        auto fnd = metrics_.find(key);
+        if (fnd != metrics_.end())
+        {
+            auto existing = std::dynamic_pointer_cast<TMetric>(fnd->second);
+            if (!existing)
+                throw metric_type_mismatch(fnd->second->metric_type(), TMetric::type_name());
+            return existing;
+        }
+
+        auto record = allocate(kind, name, segments, tag_count, parameters, slots);
+        auto result = build(record);
+
+        // a record whose metric can't be registered is never made ready so readers never see it
+        if (!registry.register_existing(path, result, tags))
+            throw std::logic_error("a metric that isn't in the shared region is already registered with the path and tags");
+
+        record->ready.store(1, std::memory_order_release);
+        header().records.fetch_add(1, std::memory_order_release);
+        metrics_.emplace(std::move(key), result);
+        return result;
+    }
+
+public:
+    shared_region(const shared_region&) = delete;
+    shared_region& operator=(const shared_region&) = delete;
+
+    ~shared_region()
+    {
+        ::munmap(data_, size_);
+    }
+
+    /**
+     * \brief Create a region, replacing any region with the same name
+     *
+     * \param name the name of the shared memory segment, starting with a /
+     * \param size the size of the region, which has to fit every record the application will create
+     *
+     * \throws std::system_error if the segment can't be created
+     */
+    static std::shared_ptr<shared_region> create(const std::string& name, std::size_t size = 1024 * 1024)
+    {
+        ::shm_unlink(name.c_str());
+        size = std::max(size, sizeof(internal::shared_region_header));
+        auto data = map(name, O_CREAT | O_EXCL | O_RDWR, size);
+        std::shared_ptr<shared_region> result(new shared_region(data, size, true));
+
+        auto& header = result->header();
+        header.version = internal::shared_region_version;
+        header.header_size = static_cast<uint32_t>(internal::shared_align(sizeof(internal::shared_region_header)));
+        header.size = size;
+        header.pid = ::getpid();
+        header.created_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        header.used.store(header.header_size, std::memory_order_relaxed);
+        header.records.store(0, std::memory_order_relaxed);
+
+        // the magic goes in last so a reader never takes a half written header as a region
+        std::atomic_thread_fence(std::memory_order_release);
+        std::memcpy(header.magic, internal::shared_region_magic, sizeof(header.magic));
+        return result;
+    }
+
+    /**
+     * \brief Open an existing region to read it
+     *
+     * \throws std::system_error if the segment can't be opened
+     * \throws std::runtime_error if the segment isn't a region of a version that can be read
+     */
+    static std::shared_ptr<shared_region> open(const std::string& name)
+    {
+        std::size_t size = 0;
+        auto data = map(name, O_RDONLY, size);
+        std::shared_ptr<shared_region> result(new shared_region(data, size, false));
+
+        const auto& header = result->header();
+        if (size < sizeof(internal::shared_region_header) || std::memcmp(header.magic, internal::shared_region_magic, sizeof(header.magic)) != 0)
+            throw std::runtime_error("the segment isn't a metrics region");
+        if (header.version != internal::shared_region_version || header.size > size)
+            throw std::runtime_error("the metrics region has a layout that can't be read");
+
+        return result;
+    }
+
+    /**
+     * \brief Remove a region so that it's freed once every process has unmapped it
+     */
+    static void remove(const std::string& name) noexcept
+    {
+        ::shm_unlink(name.c_str());
+    }
+
+    /**
+     * \brief The process that created the region
+     */
+    int64_t pid() const noexcept
+    {
+        return header().pid;
+    }
+
+    /**
+     * \brief When the region was created, in nanoseconds since the epoch of the system clock
+     */
+    int64_t created() const noexcept
+    {
+        return header().created_ns;
+    }
+
+    std::size_t size() const noexcept
+    {
+        return size_;
+    }
+
+    /**
+     * \brief The number of bytes taken by the header and the records
+     */
+    std::size_t used() const noexcept
+    {
+        return header().used.load(std::memory_order_acquire);
+    }
+
+    /**
+     * \brief Visit every record that's ready, calling the handler with a shared_record for each
+     */
+    template<typename THandler>
+    void visit(THandler&& handler) const
+    {
+        auto base = static_cast<const char*>(data_);
+        auto end = std::min<std::size_t>(header().used.load(std::memory_order_acquire), size_);
+        auto offset = static_cast<std::size_t>(header().header_size);
+        while (offset + sizeof(internal::shared_record_header) <= end)
+        {
+            auto record = reinterpret_cast<const internal::shared_record_header*>(base + offset);
+            if (record->size < sizeof(internal::shared_record_header) || offset + record->size > end)
+                break;
+
+            if (record->ready.load(std::memory_order_acquire))
+                handler(shared_record(record));
+            offset += record->size;
+        }
+    }
+
+    /**
+     * \brief Get the counter in the region with the path and tags, creating and registering it if it doesn't exist
+     *
+     * \throws metric_type_mismatch if the path is registered with a different type
+     * \throws std::logic_error if a metric that isn't in the region is registered with the path and tags
+     * \throws std::length_error if the region is full
+     */
+    template<typename TRepo>
+    std::shared_ptr<shared_counter> counter(metrics_registry<TRepo>& registry, const metric_path& path, const tag_collection& tags = tag_collection())
+    {
+        return get<shared_counter>(registry, shared_metric_kind::counter, path, tags, {}, 1, [this](internal::shared_record_header* record) {
+            return std::make_shared<shared_counter>(shared_from_this(), slots_of(record));
+        });
+    }
+
+    /**
+     * \brief Get the gauge in the region with the path and tags, creating and registering it if it doesn't exist
+     */
+    template<typename TRepo>
+    std::shared_ptr<shared_gauge> gauge(metrics_registry<TRepo>& registry, const metric_path& path, const tag_collection& tags = tag_collection())
+    {
+        return get<shared_gauge>(registry, shared_metric_kind::gauge, path, tags, {}, 1, [this](internal::shared_record_header* record) {
+            return std::make_shared<shared_gauge>(shared_from_this(), slots_of(record));
+        });
+    }
+
+    /**
+     * \brief Get the ewma in the region with the path and tags, creating and registering it if it doesn't exist
+     */
+    template<period::value TWindow, period::value TInterval = time::seconds(1), typename TRepo>
+    std::shared_ptr<shared_ewma<TWindow, TInterval>> ewma(metrics_registry<TRepo>& registry, const metric_path& path, const tag_collection& tags = tag_collection())
+    {
+        using ewma_type = shared_ewma<TWindow, TInterval>;
+        return get<ewma_type>(registry, shared_metric_kind::ewma, path, tags, ewma_type::parameters(), ewma_type::slot_count, [this](internal::shared_record_header* record) {
+            auto slots = slots_of(record);
+            ewma_type::initialize(slots);
+            return std::make_shared<ewma_type>(shared_from_this(), slots);
+        });
+    }
+
+    /**
+     * \brief Get the meter in the region with the path and tags, creating and registering it if it doesn't exist
+     */
+    template<period::value TInterval, period::value... TWindows, typename TRepo>
+    std::shared_ptr<shared_meter<TInterval, TWindows...>> meter(metrics_registry<TRepo>& registry, const metric_path& path, const tag_collection& tags = tag_collection())
+    {
+        using meter_type = shared_meter<TInterval, TWindows...>;
+        return get<meter_type>(registry, shared_metric_kind::meter, path, tags, meter_type::parameters(), meter_type::slot_count, [this](internal::shared_record_header* record) {
+            auto slots = slots_of(record);
+            meter_type::initialize(slots);
+            return std::make_shared<meter_type>(shared_from_this(), slots);
+        });
+    }
+
+    /**
+     * \brief Get the histogram in the region with the path and tags, creating and registering it if it doesn't exist
+     *
+     * \param layout the buckets whose counts are kept in the region
+     * \param reservoir the reservoir that backs the snapshots of the histogram within the process
+     * \param samples how many of the most recent values to keep in the region for readers that need quantiles. Without
+     *        them, readers can only estimate quantiles from the buckets
+     */
+    template<typename TReservoir, typename TRepo>
+    std::shared_ptr<shared_histogram<TReservoir>> histogram(metrics_registry<TRepo>& registry, const metric_path& path, const bucket_layout& layout, TReservoir&& reservoir = TReservoir(), const tag_collection& tags = tag_collection(), std::size_t samples = 0)
+    {
+        std::vector<uint64_t> bounds;
+        for (auto bound : layout.bounds())
+            bounds.push_back(internal::double_bits(bound));
+
+        // every bucket including the infinite one, then the count, the sum and the samples
+        auto slots = bounds.size() + 3 + samples;
+        return get<shared_histogram<TReservoir>>(registry, shared_metric_kind::histogram, path, tags, bounds, slots, [&](internal::shared_record_header* record) {
+            return std::make_shared<shared_histogram<TReservoir>>(shared_from_this(), parameters_of(record), record->parameters, slots_of(record), samples, std::forward<TReservoir>(reservoir));
+        });
+    }
+};
+
+}
+
+#endif //CXXMETRICS_SHARED_REGION_HPP
@@ -226,6 +226,15 @@ public:
     reservoir_snapshot snapshot() const noexcept;
 };
 
+namespace internal
+{
+
+template<typename TElem, size_t TMaxSize, typename TClockGet>
+struct is_time_windowed<sliding_window_reservoir<TElem, TMaxSize, TClockGet>> : public std::true_type
+{ };
+
+}
+
 template<typename TElem, size_t TMaxSize, typename TClockGet>
 sliding_window_reservoir<TElem, TMaxSize, TClockGet>::sliding_window_reservoir(const window_type &window,
                                                                                const TClockGet &clock) noexcept :
@@ -229,7 +229,21 @@ class reservoir_snapshot
 {
 protected:
     std::vector<metric_value> values_;
+
+    explicit reservoir_snapshot(std::vector<metric_value>&& sorted) noexcept :
+            values_(std::move(sorted))
+    { }
 public:
+    /**
+     * \brief Construct a snapshot from values that are already sorted, such as the values of another snapshot
+     *
+     * \param values the values of the snapshot in ascending order
+     */
+    static reservoir_snapshot from_sorted(std::vector<metric_value> values) noexcept
+    {
+        return reservoir_snapshot(std::move(values));
+    }
+
     /**
      * \brief Construct a snapshot using the specified iterators
      *
@@ -386,6 +400,14 @@ public:
     {
         return values_.size();
     }
+
+    /**
+     * \brief Get the values in the snapshot in ascending order
+     */
+    const std::vector<metric_value>& values() const noexcept
+    {
+        return values_;
+    }
 };
 
 template<typename TInputIterator>
@@ -567,6 +589,33 @@ public:
     {
         return count_;
     }
+
+    /**
+     * \brief Count the values in the snapshot into cumulative buckets in a single pass over the sorted values
+     *
+     * The counts are estimated from the reservoir, scaled up to the total count of the histogram
+     *
+     * \param bounds the sorted upper bounds of the buckets, inclusive
+     * \param convert a monotonic function that converts a value of the snapshot to the units of the bounds as a double
+     * \param cumulative where to write the cumulative counts, one per bound
+     */
+    template<typename TConvert>
+    void bucket_counts(const std::vector<double>& bounds, TConvert&& convert, uint64_t* cumulative) const
+    {
+        auto value = values_.begin();
+        std::size_t below = 0;
+        for (std::size_t i = 0; i < bounds.size(); i++)
+        {
+            while (value != values_.end() && convert(*value) <= bounds[i])
+            {
+                ++value;
+                ++below;
+            }
+
+            cumulative[i] = values_.empty() ? 0 :
+                    static_cast<uint64_t>(static_cast<long double>(below) * count_ / values_.size() + 0.5l);
+        }
+    }
 };
 
 class timer_snapshot : public histogram_snapshot
@@ -0,0 +1,651 @@
+#ifndef CXXMETRICS_GRAPHITE_PUBLISHER_HPP
+#define CXXMETRICS_GRAPHITE_PUBLISHER_HPP
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <cxxmetrics/exposition_buffer.hpp>
+#include <cxxmetrics/internal/interval_thread.hpp>
+#include <cxxmetrics/publish_format.hpp>
+#include <cxxmetrics/publisher.hpp>
+
+namespace cxxmetrics_graphite
+{
+
+using cxxmetrics::exposition_buffer;
+
+/**
+ * \brief The settings of a graphite_publisher
+ */
+struct graphite_options
+{
+    /**
+     * \brief The IPv4 address of the carbon plaintext receiver
+     */
+    std::string address = "127.0.0.1";
+
+    /**
+     * \brief The port of the carbon plaintext receiver
+     */
+    uint16_t port = 2003;
+
+    /**
+     * \brief A prefix for every metric name, joined to the name with a '.'
+     */
+    std::string prefix;
+
+    /**
+     * \brief Whether to send the tags of every series in graphite tag syntax. Untagged carbon setups don't index them
+     */
+    bool tags = true;
+
+    /**
+     * \brief The most bytes of rendered lines to hold on to while they can't be sent
+     *
+     * When there are more, the oldest lines are dropped. The lines that are in the middle of being sent are kept so
+     * that the connection never sees part of a line.
+     */
+    std::size_t max_pending = 4 * 1024 * 1024;
+
+    /**
+     * \brief How long to wait before reconnecting after the first failure. The wait doubles with every failure after it
+     */
+    std::chrono::milliseconds min_backoff = std::chrono::milliseconds(100);
+
+    /**
+     * \brief The longest wait between reconnects
+     */
+    std::chrono::milliseconds max_backoff = std::chrono::seconds(30);
+};
+
+namespace internal
+{
+
+inline bool is_reserved(char c) noexcept
+{
+    return c == ' ' || c == ';' || c == '\t' || c == '\n' || c == '\r';
+}
+
+inline bool is_reserved_tag(char c) noexcept
+{
+    return is_reserved(c) || c == '!' || c == '^' || c == '=';
+}
+
+inline std::string escaped_name(const std::string& prefix, const cxxmetrics::metric_path& path)
+{
+    exposition_buffer buffer(128);
+    if (!prefix.empty())
+        buffer << prefix << '.';
+
+    bool first = true;
+    for (const auto& elem : path)
+    {
+        if (!first)
+            buffer << '.';
+        cxxmetrics::internal::format_replaced(buffer, elem.data(), elem.size(), is_reserved);
+        first = false;
+    }
+
+    return buffer.str();
+}
+
+/**
+ * \brief Get the tags of a series in graphite tag syntax, including the leading ;
+ *
+ * Tags are sorted by name, which is how carbon stores them. Graphite doesn't allow empty tag values and treats a
+ * missing tag the same as an empty one, so tags without a value are left out.
+ */
+inline std::string escaped_tags(const cxxmetrics::tag_collection& tags)
+{
+    exposition_buffer result(128);
+    for (const auto& tag : cxxmetrics::internal::sorted_tags(tags))
+    {
+        result << ';';
+        cxxmetrics::internal::format_replaced(result, tag.first.data(), tag.first.size(), is_reserved_tag);
+        result << '=';
+
+        // a leading ~ is reserved for tag queries
+        auto start = tag.second.data();
+        if (*start == '~')
+        {
+            result << '_';
+            ++start;
+        }
+        cxxmetrics::internal::format_replaced(result, start, tag.second.data() + tag.second.size() - start, is_reserved);
+    }
+
+    return result.str();
+}
+
+/**
+ * \brief The escaped name of a registered metric and the escaped tags of each of its series
+ */
+class graphite_series
+{
+    std::unordered_map<cxxmetrics::tag_collection, std::string> tags_;
+    std::string name_;
+    std::mutex lock_;
+
+public:
+    void lock() { lock_.lock(); }
+    void unlock() { lock_.unlock(); }
+
+    const std::string& name(const std::string& prefix, const cxxmetrics::metric_path& path)
+    {
+        if (name_.empty())
+            name_ = escaped_name(prefix, path);
+        return name_;
+    }
+
+    const std::string& tags(const cxxmetrics::tag_collection& tags)
+    {
+        auto fnd = tags_.find(tags);
+        if (fnd != tags_.end())
+            return fnd->second;
+
+        return tags_.emplace(tags, escaped_tags(tags)).first->second;
+    }
+};
+
+/**
+ * \brief A run of whole lines waiting to be sent
+ */
+struct line_chunk
+{
+    exposition_buffer data;
+    std::size_t lines;
+
+    line_chunk() :
+            data(16384),
+            lines(0)
+    { }
+};
+
+/**
+ * \brief The rendered lines waiting to be sent, bounded to a number of bytes
+ *
+ * Lines are rendered straight into chunks which are queued once they're full, and the chunks that have been sent
+ * are kept to render into again. When the queue holds more than its bound, whole chunks are dropped starting with
+ * the oldest one that isn't in the middle of being sent.
+ */
+class line_queue
+{
+    static constexpr std::size_t chunk_size = 16384;
+    static constexpr std::size_t max_free = 4;
+
+    std::deque<std::unique_ptr<line_chunk>> queue_;
+    std::vector<std::unique_ptr<line_chunk>> free_;
+    std::unique_ptr<line_chunk> current_;
+    std::size_t max_pending_;
+    std::size_t pending_;
+    std::size_t sent_;
+    uint64_t dropped_;
+
+    void push(std::unique_ptr<line_chunk> chunk)
+    {
+        pending_ += chunk->data.size();
+        queue_.push_back(std::move(chunk));
+
+        // the newest chunk and the one in the middle of being sent are always kept
+        auto keep = sent_ > 0 ? 1 : 0;
+        while (pending_ > max_pending_ && queue_.size() > static_cast<std::size_t>(keep + 1))
+        {
+            auto drop = queue_.begin() + keep;
+            pending_ -= (*drop)->data.size();
+            dropped_ += (*drop)->lines;
+            recycle(std::move(*drop));
+            queue_.erase(drop);
+        }
+    }
+
+    void recycle(std::unique_ptr<line_chunk> chunk)
+    {
+        if (free_.size() >= max_free)
+            return;
+
+        chunk->data.clear();
+        chunk->lines = 0;
+        free_.push_back(std::move(chunk));
+    }
+
+public:
+    explicit line_queue(std::size_t max_pending) :
+            max_pending_(max_pending),
+            pending_(0),
+            sent_(0),
+            dropped_(0)
+    { }
+
+    /**
+     * \brief The buffer the next line is rendered into
+     */
+    exposition_buffer& buffer()
+    {
+        if (!current_)
+        {
+            if (free_.empty())
+                current_.reset(new line_chunk());
+            else
+            {
+                current_ = std::move(free_.back());
+                free_.pop_back();
+            }
+        }
+
+        return current_->data;
+    }
+
+    /**
+     * \brief Finish the line rendered since the last one, queueing the chunk it's in once that's full
+     */
+    void end_line()
+    {
+        current_->data << '\n';
+        ++current_->lines;
+        if (current_->data.size() >= chunk_size)
+            push(std::move(current_));
+    }
+
+    /**
+     * \brief Queue the lines rendered so far
+     */
+    void flush()
+    {
+        if (current_ && current_->lines)
+            push(std::move(current_));
+    }
+
+    /**
+     * \brief Fill a set of iovecs with the unsent data
+     *
+     * \return the number of iovecs filled
+     */
+    int fill(iovec* parts, int count) const noexcept
+    {
+        int filled = 0;
+        for (std::size_t i = 0; i < queue_.size() && filled < count; i++, filled++)
+        {
+            auto offset = i == 0 ? sent_ : 0;
+            parts[filled].iov_base = const_cast<char*>(queue_[i]->data.data() + offset);
+            parts[filled].iov_len = queue_[i]->data.size() - offset;
+        }
+
+        return filled;
+    }
+
+    /**
+     * \brief Mark bytes at the front of the queue as sent
+     */
+    void consume(std::size_t bytes)
+    {
+        while (bytes > 0)
+        {
+            auto remaining = queue_.front()->data.size() - sent_;
+            if (bytes < remaining)
+            {
+                sent_ += bytes;
+                pending_ -= bytes;
+                return;
+            }
+
+            bytes -= remaining;
+            pending_ -= remaining;
+            sent_ = 0;
+            recycle(std::move(queue_.front()));
+            queue_.pop_front();
+        }
+    }
+
+    /**
+     * \brief Start sending the front chunk over from its beginning, as a new connection can't take part of a line
+     *
+     * Lines of the chunk that were already sent are sent again. Carbon keeps the last value it gets for a timestamp
+     * so they don't change anything.
+     */
+    void rewind() noexcept
+    {
+        pending_ += sent_;
+        sent_ = 0;
+    }
+
+    bool empty() const noexcept
+    {
+        return queue_.empty();
+    }
+
+    std::size_t pending() const noexcept
+    {
+        return pending_;
+    }
+
+    uint64_t dropped() const noexcept
+    {
+        return dropped_;
+    }
+};
+
+/**
+ * \brief Writes the plaintext lines of the series of a metric. Timers are sent in milliseconds
+ */
+class line_writer : public cxxmetrics::internal::flat_snapshot_writer<line_writer>
+{
+    friend class cxxmetrics::internal::flat_snapshot_writer<line_writer>;
+
+    line_queue& queue_;
+    const std::string& name_;
+    const std::string& tags_;
+    int64_t timestamp_;
+
+    void field(const char* prefix, const char* name, std::size_t length, const cxxmetrics::metric_value& value)
+    {
+        auto& out = queue_.buffer();
+        out << name_ << prefix;
+        out.append(name, length) << tags_ << ' ' << value << ' ' << timestamp_;
+        queue_.end_line();
+    }
+
+    void value(const cxxmetrics::metric_value& value)
+    {
+        field("", "", 0, value);
+    }
+
+    void count(uint64_t count)
+    {
+        field(".", "count", 5, cxxmetrics::metric_value(count));
+    }
+
+public:
+    line_writer(line_queue& queue, const cxxmetrics::publish_options& options, const std::string& name, const std::string& tags, int64_t timestamp) :
+            flat_snapshot_writer(options, ".", ".rates."),
+            queue_(queue),
+            name_(name),
+            tags_(tags),
+            timestamp_(timestamp)
+    { }
+};
+
+}
+
+/**
+ * \brief A publisher that pushes the metrics in a registry to carbon over the graphite plaintext protocol
+ *
+ * Metric paths are joined with '.' and tags are sent in graphite tag syntax. Counters and gauges are sent as their
+ * value. Meters are sent as a line per rate. Histograms and timers are sent as their count, mean and a line per
+ * quantile, with timers in milliseconds.
+ *
+ * Publishing never blocks on the connection. Lines are rendered into a bounded queue and written to a non-blocking
+ * TCP socket for as long as it takes them. When carbon can't keep up or can't be reached, the oldest lines are
+ * dropped once the queue is full, and lost connections are retried with an exponential backoff. This is only
+ * available on Linux.
+ */
+template<typename TMetricRepo>
+class graphite_publisher : public cxxmetrics::metrics_publisher<TMetricRepo>
+{
+    using clock = std::chrono::steady_clock;
+
+    graphite_options options_;
+    cxxmetrics::publisher_state<internal::graphite_series> states_;
+    internal::line_queue queue_;
+    int socket_;
+    bool connecting_;
+    clock::time_point retry_at_;
+    std::chrono::milliseconds backoff_;
+    uint64_t connections_;
+    std::mutex lock_;
+
+    cxxmetrics::internal::interval_thread thread_;
+
+    void fail(clock::time_point now)
+    {
+        ::close(socket_);
+        socket_ = -1;
+        connecting_ = false;
+        queue_.rewind();
+
+        retry_at_ = now + backoff_;
+        backoff_ = std::min(backoff_ * 2, options_.max_backoff);
+    }
+
+    void connected()
+    {
+        connecting_ = false;
+        backoff_ = options_.min_backoff;
+        ++connections_;
+    }
+
+    /**
+     * \brief Move the connection along as far as it'll go without blocking
+     */
+    void send(clock::time_point now)
+    {
+        if (socket_ < 0)
+        {
+            if (queue_.empty() || now < retry_at_)
+                return;
+
+            sockaddr_in address{};
+            address.sin_family = AF_INET;
+            address.sin_port = htons(options_.port);
+            if (inet_pton(AF_INET, options_.address.c_str(), &address.sin_addr) != 1)
+                throw std::system_error(std::make_error_code(std::errc::invalid_argument), "invalid graphite address");
+
+            socket_ = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if (socket_ < 0)
+                throw std::system_error(errno, std::generic_category(), "socket");
+
+            if (::connect(socket_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0)
+                connected();
+            else if (errno == EINPROGRESS)
+                connecting_ = true;
+            else
+                return fail(now);
+        }
+
+        if (connecting_)
+        {
+            pollfd wait{socket_, POLLOUT, 0};
+            if (::poll(&wait, 1, 0) <= 0)
+                return;
+
+            int error = 0;
+            socklen_t length = sizeof(error);
+            if (getsockopt(socket_, SOL_SOCKET, SO_ERROR, &error, &length) < 0 || error != 0)
+                return fail(now);
+            connected();
+        }
+
+        while (!queue_.empty())
+        {
+            iovec parts[64];
+            msghdr message{};
+            message.msg_iov = parts;
+            message.msg_iovlen = static_cast<std::size_t>(queue_.fill(parts, 64));
+
+            auto sent = ::sendmsg(socket_, &message, MSG_NOSIGNAL);
+            if (sent < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                if (errno != EAGAIN && errno != EWOULDBLOCK)
+                    fail(now);
+                return;
+            }
+
+            queue_.consume(static_cast<std::size_t>(sent));
+        }
+    }
+
+    void run(int wake, std::chrono::milliseconds interval)
+    {
+        auto next = clock::now() + interval;
+        while (true)
+        {
+            pollfd waits[2];
+            int count = 1;
+            waits[0] = pollfd{wake, POLLIN, 0};
+
+            int timeout;
+            {
+                std::lock_guard<std::mutex> lock(lock_);
+                auto now = clock::now();
+                auto until = next;
+                if (socket_ >= 0 && !queue_.empty())
+                    waits[count++] = pollfd{socket_, POLLOUT, 0};
+                else if (socket_ < 0 && !queue_.empty())
+                    until = std::min(until, retry_at_);
+
+                timeout = static_cast<int>(std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::milliseconds>(until - now).count() + 1));
+            }
+
+            ::poll(waits, count, timeout);
+            if (waits[0].revents)
+                return;
+
+            try
+            {
+                auto now = clock::now();
+                if (now >= next)
+                {
+                    next += interval;
+                    if (next < now)
+                        next = now + interval;
+                    publish();
+                }
+                else
+                {
+                    std::lock_guard<std::mutex> lock(lock_);
+                    send(now);
+                }
+            }
+            catch (...)
+            {
+                // try again on the next interval
+            }
+        }
+    }
+
+public:
+    graphite_publisher(cxxmetrics::metrics_registry<TMetricRepo>& registry, graphite_options options = graphite_options()) :
+            cxxmetrics::metrics_publisher<TMetricRepo>(registry),
+            options_(std::move(options)),
+            queue_(options_.max_pending),
+            socket_(-1),
+            connecting_(false),
+            backoff_(options_.min_backoff),
+            connections_(0)
+    { }
+
+    graphite_publisher(const graphite_publisher&) = delete;
+    graphite_publisher& operator=(const graphite_publisher&) = delete;
+
+    ~graphite_publisher()
+    {
+        stop();
+        if (socket_ >= 0)
+            ::close(socket_);
+    }
+
+    /**
+     * \brief Render every registered metric into the queue and send as much of the queue as the connection takes now
+     *
+     * \return the number of lines that were rendered
+     */
+    std::size_t publish()
+    {
+        auto timestamp = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+
+        std::lock_guard<std::mutex> lock(lock_);
+        std::size_t lines = 0;
+        this->visit_all([&](const cxxmetrics::metric_path& path, cxxmetrics::basic_registered_metric& metric) {
+            if (path.begin() == path.end())
+                return;
+
+            const auto& options = this->effective_options(metric);
+            auto& state = states_.get(metric);
+            std::lock_guard<internal::graphite_series> state_lock(state);
+
+            const auto& name = state.name(options_.prefix, path);
+            metric.visit([&](const cxxmetrics::tag_collection& tags, const auto& snapshot) {
+                static const std::string untagged;
+                internal::line_writer writer(queue_, options, name, options_.tags ? state.tags(tags) : untagged, timestamp);
+                writer.write(snapshot);
+                ++lines;
+            });
+        });
+
+        queue_.flush();
+        send(clock::now());
+        return lines;
+    }
+
+    /**
+     * \brief Send as much of the queue as the connection takes now, reconnecting if the backoff has passed
+     */
+    void flush()
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        send(clock::now());
+    }
+
+    /**
+     * \brief Publish on an interval from a background thread until stopped, sending the queue as the connection
+     * drains in between
+     *
+     * \throws std::invalid_argument if the interval isn't positive
+     */
+    void start(std::chrono::milliseconds interval)
+    {
+        thread_.start_loop(interval, [this](int wake, std::chrono::milliseconds interval) { run(wake, interval); });
+    }
+
+    void stop()
+    {
+        thread_.stop();
+    }
+
+    /**
+     * \brief The number of bytes rendered but not sent yet
+     */
+    std::size_t pending()
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        return queue_.pending();
+    }
+
+    /**
+     * \brief The number of lines dropped because the queue was full
+     */
+    uint64_t dropped()
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        return queue_.dropped();
+    }
+
+    /**
+     * \brief The number of connections that have been established
+     */
+    uint64_t connections()
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        return connections_;
+    }
+};
+
+}
+
+#endif //CXXMETRICS_GRAPHITE_PUBLISHER_HPP
@@ -0,0 +1,331 @@
+#ifndef CXXMETRICS_INFLUX_PUBLISHER_HPP
+#define CXXMETRICS_INFLUX_PUBLISHER_HPP
+
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <poll.h>
+#include <unistd.h>
+#include <cxxmetrics/exposition_buffer.hpp>
+#include <cxxmetrics/publish_format.hpp>
+#include <cxxmetrics/publisher.hpp>
+
+namespace cxxmetrics_influx
+{
+
+using cxxmetrics::exposition_buffer;
+
+namespace internal
+{
+
+/**
+ * \brief Copy text into a line, escaping the characters that delimit its part of an influx line with a backslash
+ *
+ * Measurements only reserve commas and spaces. Tag keys, tag values and field keys reserve equals signs too.
+ */
+inline exposition_buffer& format_element(exposition_buffer& into, const char* text, std::size_t length, bool equals)
+{
+    auto end = text + length;
+    auto run = text;
+    for (auto c = text; c != end; ++c)
+    {
+        if (*c == '\n' || *c == '\r')
+        {
+            // newlines end the line no matter how they're escaped
+            into.append(run, c - run);
+            into << ' ';
+            run = c + 1;
+            continue;
+        }
+
+        if (*c != ',' && *c != ' ' && (!equals || *c != '='))
+            continue;
+
+        into.append(run, c - run);
+        into << '\\' << *c;
+        run = c + 1;
+    }
+
+    return into.append(run, end - run);
+}
+
+inline std::string escaped_measurement(const cxxmetrics::metric_path& path)
+{
+    exposition_buffer buffer(128);
+    bool first = true;
+    for (const auto& elem : path)
+    {
+        if (!first)
+            buffer << '.';
+        format_element(buffer, elem.data(), elem.size(), false);
+        first = false;
+    }
+
+    return buffer.str();
+}
+
+/**
+ * \brief Get the tags of a series as they're written after the measurement, including the leading comma
+ *
+ * Tags are sorted by key, which is the order influx stores them in and parses fastest. Influx doesn't allow empty
+ * tag values, so tags without a value are left out.
+ */
+inline std::string escaped_tags(const cxxmetrics::tag_collection& tags)
+{
+    exposition_buffer result(128);
+    for (const auto& tag : cxxmetrics::internal::sorted_tags(tags))
+    {
+        result << ',';
+        format_element(result, tag.first.data(), tag.first.size(), true);
+        result << '=';
+        format_element(result, tag.second.data(), tag.second.size(), true);
+    }
+
+    return result.str();
+}
+
+/**
+ * \brief The escaped measurement of a registered metric and the escaped tags of each of its series
+ */
+class influx_series : public cxxmetrics::basic_publish_options
+{
+    std::unordered_map<cxxmetrics::tag_collection, std::string> tags_;
+    std::string measurement_;
+    std::mutex lock_;
+
+public:
+    void lock() { lock_.lock(); }
+    void unlock() { lock_.unlock(); }
+
+    const std::string& measurement(const cxxmetrics::metric_path& path)
+    {
+        if (measurement_.empty())
+            measurement_ = escaped_measurement(path);
+        return measurement_;
+    }
+
+    const std::string& tags(const cxxmetrics::tag_collection& tags)
+    {
+        auto fnd = tags_.find(tags);
+        if (fnd != tags_.end())
+            return fnd->second;
+
+        return tags_.emplace(tags, escaped_tags(tags)).first->second;
+    }
+};
+
+/**
+ * \brief Writes the line of a series with every component of its snapshot as a field
+ *
+ * Timers are written in milliseconds with their rates as fields prefixed with rate_.
+ */
+class line_writer : public cxxmetrics::internal::flat_snapshot_writer<line_writer>
+{
+    friend class cxxmetrics::internal::flat_snapshot_writer<line_writer>;
+
+    exposition_buffer& out_;
+    bool first_;
+
+    /**
+     * \brief Start a field, separating it from the one before it
+     */
+    exposition_buffer& key(const char* prefix, const char* name, std::size_t length)
+    {
+        out_ << (first_ ? ' ' : ',') << prefix;
+        first_ = false;
+        return format_element(out_, name, length, true) << '=';
+    }
+
+    void field(const char* prefix, const char* name, std::size_t length, const cxxmetrics::metric_value& value)
+    {
+        switch (value.kind())
+        {
+            case cxxmetrics::metric_value_kind::signed_integral:
+                key(prefix, name, length).append_integer(static_cast<int64_t>(value)) << 'i';
+                return;
+            case cxxmetrics::metric_value_kind::unsigned_integral:
+            {
+                auto integral = static_cast<uint64_t>(value);
+                if (integral <= static_cast<uint64_t>(std::numeric_limits<int64_t>::max()))
+                {
+                    key(prefix, name, length).append_unsigned(integral) << 'i';
+                    return;
+                }
+                break;
+            }
+            case cxxmetrics::metric_value_kind::string:
+            {
+                auto text = static_cast<std::string>(value);
+                key(prefix, name, length) << '"';
+                for (auto c : text)
+                {
+                    if (c == '"' || c == '\\')
+                        out_ << '\\';
+                    out_ << c;
+                }
+                out_ << '"';
+                return;
+            }
+            default:
+                break;
+        }
+
+        // influx has no spelling for the values that aren't finite so the field is left out
+        auto floating = static_cast<double>(value);
+        if (std::isfinite(floating))
+            key(prefix, name, length).append_double(floating);
+    }
+
+    void value(const cxxmetrics::metric_value& value)
+    {
+        field("", "value", 5, value);
+    }
+
+    void count(uint64_t count)
+    {
+        field("", "count", 5, cxxmetrics::metric_value(count));
+    }
+
+public:
+    line_writer(exposition_buffer& out, const cxxmetrics::publish_options& options) :
+            flat_snapshot_writer(options, "", "rate_"),
+            out_(out),
+            first_(true)
+    { }
+
+    /**
+     * \brief Whether the snapshot had no fields to write, in which case the line has to be dropped
+     */
+    bool empty() const noexcept
+    {
+        return first_;
+    }
+};
+
+}
+
+/**
+ * \brief A publisher that writes the metrics in a registry in the influx line protocol
+ *
+ * Every series is a single line. Its measurement is the metric path joined with '.', its tags are the tags of the
+ * series and every component of its snapshot is a field: the value of counters and gauges, the mean and rates of
+ * meters, and the count, mean and quantiles of histograms and timers. Timers are in milliseconds. Every line of a
+ * write has the same timestamp, in nanoseconds.
+ *
+ * The lines are formatted straight into a buffer that's kept between writes, which can be pulled into a stream or
+ * pushed to a file descriptor such as a socket to telegraf or the influx HTTP API.
+ */
+template<typename TMetricRepo>
+class influx_publisher : public cxxmetrics::metrics_publisher<TMetricRepo>
+{
+    exposition_buffer buffer_;
+    std::mutex buffer_lock_;
+
+public:
+    influx_publisher(cxxmetrics::metrics_registry<TMetricRepo>& registry) :
+            cxxmetrics::metrics_publisher<TMetricRepo>(registry),
+            buffer_(16384)
+    { }
+
+    /**
+     * \brief The content type of the lines to use when sending them over http
+     */
+    static const char* content_type() noexcept
+    {
+        return "text/plain; charset=utf-8";
+    }
+
+    /**
+     * \brief Append the line of every series of every registered metric to a buffer
+     */
+    void write(exposition_buffer& into)
+    {
+        auto timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+
+        this->visit_all([&](const cxxmetrics::metric_path& path, cxxmetrics::basic_registered_metric& metric) {
+            if (path.begin() == path.end())
+                return;
+
+            const auto& options = this->effective_options(metric);
+            auto& state = this->template get_data_for<internal::influx_series>(metric);
+            std::lock_guard<internal::influx_series> lock(state);
+
+            const auto& measurement = state.measurement(path);
+            metric.visit([&](const cxxmetrics::tag_collection& tags, const auto& snapshot) {
+                auto start = into.size();
+                into << measurement << state.tags(tags);
+
+                internal::line_writer writer(into, options);
+                writer.write(snapshot);
+                if (writer.empty())
+                {
+                    into.truncate(start);
+                    return;
+                }
+
+                into << ' ' << timestamp << '\n';
+            });
+        });
+    }
+
+    /**
+     * \brief Write the line of every series of every registered metric to a stream
+     *
+     * The lines are rendered into a buffer that's kept between writes and then written to the stream in one go
+     */
+    void write(std::ostream& into)
+    {
+        std::lock_guard<std::mutex> lock(buffer_lock_);
+        buffer_.clear();
+        write(buffer_);
+        buffer_.write_to(into);
+    }
+
+    /**
+     * \brief Write the line of every series of every registered metric to a file descriptor
+     *
+     * The lines are rendered into a buffer that's kept between writes and then written until all of it is written,
+     * waiting for non-blocking descriptors to take more.
+     *
+     * \throws std::system_error if the descriptor fails
+     */
+    void write(int fd)
+    {
+        std::lock_guard<std::mutex> lock(buffer_lock_);
+        buffer_.clear();
+        write(buffer_);
+
+        auto data = buffer_.data();
+        auto remaining = buffer_.size();
+        while (remaining > 0)
+        {
+            auto written = ::write(fd, data, remaining);
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                if (errno != EAGAIN && errno != EWOULDBLOCK)
+                    throw std::system_error(errno, std::generic_category(), "write");
+
+                pollfd wait{fd, POLLOUT, 0};
+                ::poll(&wait, 1, -1);
+                continue;
+            }
+
+            data += written;
+            remaining -= static_cast<std::size_t>(written);
+        }
+    }
+};
+
+}
+
+#endif //CXXMETRICS_INFLUX_PUBLISHER_HPP
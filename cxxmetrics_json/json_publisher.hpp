@@ -0,0 +1,447 @@
+#ifndef CXXMETRICS_JSON_PUBLISHER_HPP
+#define CXXMETRICS_JSON_PUBLISHER_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+#include <cxxmetrics/exposition_buffer.hpp>
+#include <cxxmetrics/publish_format.hpp>
+#include <cxxmetrics/publisher.hpp>
+
+namespace cxxmetrics_json
+{
+
+using cxxmetrics::exposition_buffer;
+
+namespace internal
+{
+
+constexpr char hex_digits[] = "0123456789abcdef";
+
+/**
+ * \brief Write text as a quoted json string
+ */
+inline exposition_buffer& format_string(exposition_buffer& into, const char* text, std::size_t length)
+{
+    into << '"';
+    auto end = text + length;
+    auto run = text;
+    for (auto c = text; c != end; ++c)
+    {
+        auto ch = static_cast<unsigned char>(*c);
+        if (ch >= 0x20 && ch != '"' && ch != '\\')
+            continue;
+
+        into.append(run, c - run);
+        run = c + 1;
+        switch (ch)
+        {
+            case '"':
+                into << "\\\"";
+                break;
+            case '\\':
+                into << "\\\\";
+                break;
+            case '\n':
+                into << "\\n";
+                break;
+            case '\r':
+                into << "\\r";
+                break;
+            case '\t':
+                into << "\\t";
+                break;
+            default:
+                into << "\\u00" << hex_digits[ch >> 4] << hex_digits[ch & 0xf];
+                break;
+        }
+    }
+
+    return into.append(run, end - run) << '"';
+}
+
+inline exposition_buffer& format_string(exposition_buffer& into, const std::string& text)
+{
+    return format_string(into, text.data(), text.size());
+}
+
+/**
+ * \brief Write a segment of a metric path as the key of its object
+ *
+ * The object of a metric has its type and series next to the objects of the paths below it, so segments named type or
+ * series, with any number of underscores in front, get another underscore in front. Taking one off of any key like that
+ * gets the segment back.
+ */
+inline exposition_buffer& format_segment(exposition_buffer& into, const std::string& segment)
+{
+    auto name = segment.find_first_not_of('_');
+    if (name != std::string::npos && (segment.compare(name, std::string::npos, "type") == 0 || segment.compare(name, std::string::npos, "series") == 0))
+        return format_string(into, "_" + segment);
+
+    return format_string(into, segment);
+}
+
+/**
+ * \brief Write a metric value as a json number, or a string if it's one. Json has no spelling for the values that
+ * aren't finite so those are null
+ */
+inline exposition_buffer& format_value(exposition_buffer& into, const cxxmetrics::metric_value& value)
+{
+    switch (value.kind())
+    {
+        case cxxmetrics::metric_value_kind::floating_point:
+        {
+            auto floating = static_cast<double>(value);
+            if (!std::isfinite(floating))
+                return into << "null";
+            return into.append_double(floating);
+        }
+        case cxxmetrics::metric_value_kind::string:
+            return format_string(into, static_cast<std::string>(value));
+        default:
+            return into.append_value(value);
+    }
+}
+
+/**
+ * \brief Writes the members of a json object one after the other, separating them as it goes
+ */
+class object_writer
+{
+    exposition_buffer& out_;
+    bool first_;
+
+public:
+    explicit object_writer(exposition_buffer& out) :
+            out_(out),
+            first_(true)
+    {
+        out_ << '{';
+    }
+
+    exposition_buffer& key(const char* name)
+    {
+        return key(name, std::strlen(name));
+    }
+
+    exposition_buffer& key(const char* name, std::size_t length)
+    {
+        if (!first_)
+            out_ << ',';
+        first_ = false;
+        return format_string(out_, name, length) << ':';
+    }
+
+    void value(const char* name, const cxxmetrics::metric_value& value)
+    {
+        format_value(key(name), value);
+    }
+
+    void close()
+    {
+        out_ << '}';
+    }
+};
+
+/**
+ * \brief Writes a series of a metric as a json object of the components of its snapshot
+ */
+class series_writer
+{
+    const cxxmetrics::publish_options& options_;
+    object_writer object_;
+
+    template<typename TRates>
+    void rates(const TRates& rates, bool include_mean, const cxxmetrics::value_publish_options& opts)
+    {
+        exposition_buffer name(16);
+        object_writer object(object_.key("rates"));
+        if (include_mean)
+            object.value("mean", cxxmetrics::internal::scale_value(rates.value(), opts));
+        for (const auto& rate : rates)
+        {
+            name.clear();
+            cxxmetrics::internal::format_window(name, rate.first);
+            format_value(object.key(name.data(), name.size()), cxxmetrics::internal::scale_value(cxxmetrics::metric_value(rate.second), opts));
+        }
+        object.close();
+    }
+
+    template<typename TConvert>
+    void quantiles(const cxxmetrics::histogram_snapshot& snapshot, const cxxmetrics::histogram_publish_options& opts, TConvert&& convert)
+    {
+        exposition_buffer name(16);
+        object_writer object(object_.key("quantiles"));
+        opts.quantiles()->visit(snapshot, [&](const cxxmetrics::quantile& q, cxxmetrics::metric_value&& value) {
+            name.clear();
+            cxxmetrics::internal::format_percentile(name, q);
+            format_value(object.key(name.data(), name.size()), convert(std::move(value)));
+        });
+        object.close();
+    }
+
+public:
+    series_writer(exposition_buffer& out, const cxxmetrics::publish_options& options, const cxxmetrics::tag_collection& tags) :
+            options_(options),
+            object_(out)
+    {
+        object_writer tag_object(object_.key("tags"));
+        exposition_buffer value(64);
+        for (const auto& tag : tags)
+        {
+            value.clear();
+            value << tag.second;
+            format_string(tag_object.key(tag.first.data(), tag.first.size()), value.data(), value.size());
+        }
+        tag_object.close();
+    }
+
+    ~series_writer()
+    {
+        object_.close();
+    }
+
+    static const char* type(const cxxmetrics::cumulative_value_snapshot&) noexcept { return "counter"; }
+    static const char* type(const cxxmetrics::average_value_snapshot&) noexcept { return "gauge"; }
+    static const char* type(const cxxmetrics::meter_snapshot&) noexcept { return "meter"; }
+    static const char* type(const cxxmetrics::histogram_snapshot&) noexcept { return "histogram"; }
+    static const char* type(const cxxmetrics::timer_snapshot&) noexcept { return "timer"; }
+
+    void write(const cxxmetrics::cumulative_value_snapshot& snapshot)
+    {
+        object_.value("value", cxxmetrics::internal::scale_value(snapshot.value(), options_.value_options()));
+    }
+
+    void write(const cxxmetrics::average_value_snapshot& snapshot)
+    {
+        object_.value("value", cxxmetrics::internal::scale_value(snapshot.value(), options_.value_options()));
+    }
+
+    void write(const cxxmetrics::meter_snapshot& snapshot)
+    {
+        const auto& opts = options_.meter_options();
+        rates(snapshot, opts.include_mean(), opts);
+    }
+
+    void write(const cxxmetrics::histogram_snapshot& snapshot)
+    {
+        const auto& opts = options_.histogram_options();
+        if (opts.include_count())
+            object_.value("count", cxxmetrics::metric_value(snapshot.count()));
+        object_.value("mean", cxxmetrics::internal::scale_value(snapshot.mean(), opts));
+        quantiles(snapshot, opts, [&opts](cxxmetrics::metric_value&& value) { return cxxmetrics::internal::scale_value(std::move(value), opts); });
+    }
+
+    /**
+     * \brief Timers are written in milliseconds
+     */
+    void write(const cxxmetrics::timer_snapshot& snapshot)
+    {
+        const auto& opts = options_.timer_options();
+        auto millis = [&opts](const cxxmetrics::metric_value& value) {
+            return cxxmetrics::internal::scale_value(cxxmetrics::internal::timer_milliseconds(value), opts);
+        };
+
+        if (opts.include_count())
+            object_.value("count", cxxmetrics::metric_value(snapshot.count()));
+        object_.value("mean", millis(snapshot.mean()));
+        quantiles(snapshot, opts, millis);
+
+        if (opts.include_rates())
+            rates(snapshot.rate(), opts.include_mean(), opts);
+    }
+};
+
+}
+
+/**
+ * \brief A publisher that streams the metrics in a registry as a json document
+ *
+ * The document nests an object for every segment of the metric paths, so a metric at a/b is at ["a"]["b"]. The
+ * object of a metric has its type and a series array with an object per set of tags holding the tags and the
+ * components of its snapshot: the value of counters and gauges, the rates of meters, and the count, mean and
+ * quantiles of histograms and timers. Timers are in milliseconds. A path that's also the prefix of other paths has
+ * the objects of those paths alongside its type and series, so the keys of segments named type or series, with any
+ * number of underscores in front, have another underscore in front.
+ *
+ * Nothing is built up before it's written. The registered metrics are ordered by path so that the objects of the
+ * segments can be opened and closed as the metrics are streamed, and every series is written straight out of its
+ * snapshot.
+ */
+template<typename TMetricRepo>
+class json_publisher : public cxxmetrics::metrics_publisher<TMetricRepo>
+{
+    std::size_t flush_size_;
+
+    struct entry
+    {
+        const cxxmetrics::metric_path* path;
+        cxxmetrics::basic_registered_metric* metric;
+        const cxxmetrics::registry_snapshot::family* family;
+    };
+
+    template<typename TFlush>
+    void render(exposition_buffer& into, TFlush&& flush, const cxxmetrics::registry_snapshot* snapshot = nullptr)
+    {
+        std::vector<entry> metrics;
+        // registered metrics are never removed so they can be written after the registry lets go of them
+        if (snapshot)
+        {
+            for (const auto& family : snapshot->families())
+            {
+                if (family.path().begin() != family.path().end())
+                    metrics.push_back(entry{&family.path(), &family.metric(), &family});
+            }
+        }
+        else
+        {
+            this->visit_all([&metrics](const cxxmetrics::metric_path& path, cxxmetrics::basic_registered_metric& metric) {
+                if (path.begin() != path.end())
+                    metrics.push_back(entry{&path, &metric, nullptr});
+            });
+        }
+
+        // sorting by segment puts every path right after its prefixes and next to the paths it shares them with
+        std::sort(metrics.begin(), metrics.end(), [](const entry& a, const entry& b) {
+            return std::lexicographical_compare(a.path->begin(), a.path->end(), b.path->begin(), b.path->end());
+        });
+
+        // the segments whose objects are open and whether each open object has any members yet
+        std::vector<const std::string*> open;
+        std::vector<bool> members{false};
+        into << '{';
+
+        for (const auto& current : metrics)
+        {
+            const auto& path = *current.path;
+            auto& metric = *current.metric;
+
+            std::size_t common = 0;
+            auto segment = path.begin();
+            while (common < open.size() && segment != path.end() && *open[common] == *segment)
+            {
+                ++common;
+                ++segment;
+            }
+
+            while (open.size() > common)
+            {
+                into << '}';
+                open.pop_back();
+                members.pop_back();
+            }
+
+            for (; segment != path.end(); ++segment)
+            {
+                if (members.back())
+                    into << ',';
+                members.back() = true;
+
+                internal::format_segment(into, *segment) << ":{";
+                open.push_back(&*segment);
+                members.push_back(false);
+            }
+
+            if (members.back())
+                into << ',';
+            members.back() = true;
+
+            const auto& options = this->effective_options(metric);
+            bool first = true;
+            auto write_series = [&](const cxxmetrics::tag_collection& tags, const auto& value) {
+                if (first)
+                {
+                    into << "\"type\":\"" << internal::series_writer::type(value) << "\",\"series\":[";
+                    first = false;
+                }
+                else
+                    into << ',';
+
+                {
+                    internal::series_writer writer(into, options, tags);
+                    writer.write(value);
+                }
+                flush(into);
+            };
+
+            if (current.family)
+                current.family->visit(write_series);
+            else
+                metric.visit(write_series);
+
+            into << (first ? "\"series\":[]" : "]");
+        }
+
+        for (std::size_t i = 0; i < open.size(); i++)
+            into << '}';
+        into << '}';
+        flush(into);
+    }
+
+public:
+    /**
+     * \brief Construct the publisher
+     *
+     * \param registry the registry to publish
+     * \param flush_size how much of the document to hold on to before passing it on to a stream
+     */
+    json_publisher(cxxmetrics::metrics_registry<TMetricRepo>& registry, std::size_t flush_size = 16384) :
+            cxxmetrics::metrics_publisher<TMetricRepo>(registry),
+            flush_size_(flush_size)
+    { }
+
+    /**
+     * \brief The content type of the document to use when serving it over http
+     */
+    static const char* content_type() noexcept
+    {
+        return "application/json";
+    }
+
+    /**
+     * \brief Append the document to a buffer
+     */
+    void write(exposition_buffer& into)
+    {
+        render(into, [](exposition_buffer&) { });
+    }
+
+    /**
+     * \brief Append the document of a collected snapshot of the registry to a buffer
+     *
+     * Any number of publishers can render the same snapshot at once, and none of them snapshot a metric themselves.
+     */
+    void write(const cxxmetrics::registry_snapshot& snapshot, exposition_buffer& into)
+    {
+        render(into, [](exposition_buffer&) { }, &snapshot);
+    }
+
+    /**
+     * \brief Stream the document to a stream
+     *
+     * The document is written to the stream whenever more than the flush size of it has been formatted, so the
+     * memory it takes doesn't depend on the size of the registry
+     */
+    void write(std::ostream& into)
+    {
+        exposition_buffer buffer(flush_size_ + 1024);
+        render(buffer, [this, &into](exposition_buffer& pending) {
+            if (pending.size() < flush_size_)
+                return;
+
+            pending.write_to(into);
+            pending.clear();
+        });
+
+        buffer.write_to(into);
+    }
+};
+
+}
+
+#endif //CXXMETRICS_JSON_PUBLISHER_HPP
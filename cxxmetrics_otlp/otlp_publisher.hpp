@@ -0,0 +1,862 @@
+#ifndef CXXMETRICS_OTLP_PUBLISHER_HPP
+#define CXXMETRICS_OTLP_PUBLISHER_HPP
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#ifdef CXXMETRICS_WITH_ZLIB
+#include <zlib.h>
+#endif
+#include <cxxmetrics/exposition_buffer.hpp>
+#include <cxxmetrics/http_connection.hpp>
+#include <cxxmetrics/internal/interval_thread.hpp>
+#include <cxxmetrics/publish_format.hpp>
+#include <cxxmetrics/publisher.hpp>
+
+namespace cxxmetrics_otlp
+{
+
+using cxxmetrics::exposition_buffer;
+
+/**
+ * \brief The settings of an otlp_publisher
+ */
+struct otlp_options
+{
+    /**
+     * \brief The IPv4 address of the OTLP/HTTP receiver
+     */
+    std::string address = "127.0.0.1";
+
+    /**
+     * \brief The port of the OTLP/HTTP receiver
+     */
+    uint16_t port = 4318;
+
+    /**
+     * \brief The path that metrics are posted to
+     */
+    std::string path = "/v1/metrics";
+
+    /**
+     * \brief The attributes of the resource the metrics describe, such as service.name
+     */
+    std::vector<std::pair<std::string, std::string>> resource;
+
+    /**
+     * \brief The name of the instrumentation scope of the metrics
+     */
+    std::string scope = "cxxmetrics";
+
+    /**
+     * \brief The size of the encoded metrics at which they're sent as a request of their own
+     */
+    std::size_t max_batch = 512 * 1024;
+
+    /**
+     * \brief The most bytes of requests to hold on to while they can't be sent. When there are more, the oldest
+     * requests are dropped
+     */
+    std::size_t max_pending = 8 * 1024 * 1024;
+
+    /**
+     * \brief Whether to compress the requests with gzip. This only has an effect when built with
+     * CXXMETRICS_WITH_ZLIB and linked to zlib
+     */
+    bool compress = true;
+
+    /**
+     * \brief How long to wait on the receiver to connect, take a request or respond to it
+     */
+    std::chrono::milliseconds timeout = std::chrono::seconds(10);
+};
+
+namespace internal
+{
+
+/**
+ * \brief Protobuf wire encoding for the field types used by the OTLP metrics protocol
+ */
+namespace protobuf
+{
+
+enum class wire_type : uint32_t
+{
+    varint = 0,
+    fixed64 = 1,
+    length_delimited = 2
+};
+
+inline exposition_buffer& append_varint(exposition_buffer& into, uint64_t value)
+{
+    char bytes[10];
+    std::size_t length = 0;
+    while (value >= 0x80)
+    {
+        bytes[length++] = static_cast<char>((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    bytes[length++] = static_cast<char>(value);
+
+    return into.append(bytes, length);
+}
+
+inline exposition_buffer& append_key(exposition_buffer& into, uint32_t field, wire_type type)
+{
+    return append_varint(into, (static_cast<uint64_t>(field) << 3) | static_cast<uint32_t>(type));
+}
+
+inline exposition_buffer& append_varint_field(exposition_buffer& into, uint32_t field, uint64_t value)
+{
+    append_key(into, field, wire_type::varint);
+    return append_varint(into, value);
+}
+
+inline exposition_buffer& append_fixed64(exposition_buffer& into, uint64_t bits)
+{
+    // fixed64 is always little endian on the wire
+    char bytes[8];
+    for (int i = 0; i < 8; i++)
+        bytes[i] = static_cast<char>((bits >> (i * 8)) & 0xff);
+    return into.append(bytes, sizeof(bytes));
+}
+
+inline exposition_buffer& append_fixed64_field(exposition_buffer& into, uint32_t field, uint64_t value)
+{
+    append_key(into, field, wire_type::fixed64);
+    return append_fixed64(into, value);
+}
+
+inline uint64_t double_bits(double value) noexcept
+{
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+inline exposition_buffer& append_double_field(exposition_buffer& into, uint32_t field, double value)
+{
+    return append_fixed64_field(into, field, double_bits(value));
+}
+
+inline exposition_buffer& append_bytes_field(exposition_buffer& into, uint32_t field, const char* data, std::size_t length)
+{
+    append_key(into, field, wire_type::length_delimited);
+    append_varint(into, length);
+    return into.append(data, length);
+}
+
+inline exposition_buffer& append_bytes_field(exposition_buffer& into, uint32_t field, const exposition_buffer& message)
+{
+    return append_bytes_field(into, field, message.data(), message.size());
+}
+
+inline exposition_buffer& append_bytes_field(exposition_buffer& into, uint32_t field, const std::string& value)
+{
+    return append_bytes_field(into, field, value.data(), value.size());
+}
+
+// field numbers from opentelemetry/proto/metrics/v1/metrics.proto and its dependencies
+namespace fields
+{
+constexpr uint32_t request_resource_metrics = 1;
+
+constexpr uint32_t resource_metrics_resource = 1;
+constexpr uint32_t resource_metrics_scope_metrics = 2;
+constexpr uint32_t resource_attributes = 1;
+
+constexpr uint32_t scope_metrics_scope = 1;
+constexpr uint32_t scope_metrics_metrics = 2;
+constexpr uint32_t scope_name = 1;
+
+constexpr uint32_t key_value_key = 1;
+constexpr uint32_t key_value_value = 2;
+constexpr uint32_t any_string = 1;
+constexpr uint32_t any_int = 3;
+constexpr uint32_t any_double = 4;
+
+constexpr uint32_t metric_name = 1;
+constexpr uint32_t metric_unit = 3;
+constexpr uint32_t metric_gauge = 5;
+constexpr uint32_t metric_sum = 7;
+constexpr uint32_t metric_histogram = 9;
+
+constexpr uint32_t data_points = 1;
+constexpr uint32_t aggregation_temporality = 2;
+constexpr uint32_t sum_is_monotonic = 3;
+
+constexpr uint32_t number_start_time = 2;
+constexpr uint32_t number_time = 3;
+constexpr uint32_t number_as_double = 4;
+constexpr uint32_t number_as_int = 6;
+constexpr uint32_t number_attributes = 7;
+
+constexpr uint32_t histogram_start_time = 2;
+constexpr uint32_t histogram_time = 3;
+constexpr uint32_t histogram_count = 4;
+constexpr uint32_t histogram_bucket_counts = 6;
+constexpr uint32_t histogram_explicit_bounds = 7;
+constexpr uint32_t histogram_attributes = 9;
+}
+
+constexpr uint64_t temporality_delta = 1;
+
+}
+
+/**
+ * \brief Encode a KeyValue message
+ */
+inline exposition_buffer& encode_attribute(exposition_buffer& into, const std::string& key, const cxxmetrics::metric_value& value)
+{
+    exposition_buffer any(64);
+    switch (value.kind())
+    {
+        case cxxmetrics::metric_value_kind::signed_integral:
+            protobuf::append_varint_field(any, protobuf::fields::any_int, static_cast<uint64_t>(static_cast<int64_t>(value)));
+            break;
+        case cxxmetrics::metric_value_kind::unsigned_integral:
+            protobuf::append_varint_field(any, protobuf::fields::any_int, static_cast<uint64_t>(value));
+            break;
+        case cxxmetrics::metric_value_kind::floating_point:
+            protobuf::append_double_field(any, protobuf::fields::any_double, static_cast<double>(value));
+            break;
+        default:
+            protobuf::append_bytes_field(any, protobuf::fields::any_string, static_cast<std::string>(value));
+            break;
+    }
+
+    protobuf::append_bytes_field(into, protobuf::fields::key_value_key, key);
+    return protobuf::append_bytes_field(into, protobuf::fields::key_value_value, any);
+}
+
+inline exposition_buffer& append_attribute(exposition_buffer& into, uint32_t field, const std::string& key, const cxxmetrics::metric_value& value)
+{
+    exposition_buffer pair(128);
+    return protobuf::append_bytes_field(into, field, encode_attribute(pair, key, value));
+}
+
+/**
+ * \brief What was last exported for a series, to take the deltas of the next export from
+ */
+struct series_state
+{
+    std::vector<std::string> attributes;
+    uint64_t start;
+    double value;
+    uint64_t count;
+    std::vector<uint64_t> buckets;
+
+    series_state(std::vector<std::string>&& a, uint64_t s) :
+            attributes(std::move(a)),
+            start(s),
+            value(0),
+            count(0)
+    { }
+
+    void append_attributes(exposition_buffer& into, uint32_t field) const
+    {
+        for (const auto& attribute : attributes)
+            protobuf::append_bytes_field(into, field, attribute);
+    }
+};
+
+/**
+ * \brief The name of a registered metric and the state of its series, kept for the metric by each publisher
+ */
+class otlp_series
+{
+    std::unordered_map<cxxmetrics::tag_collection, series_state> series_;
+    std::string name_;
+    std::mutex lock_;
+
+public:
+    void lock() { lock_.lock(); }
+    void unlock() { lock_.unlock(); }
+
+    const std::string& name(const cxxmetrics::metric_path& path)
+    {
+        if (name_.empty())
+            name_ = path.join(".");
+        return name_;
+    }
+
+    series_state& state(const cxxmetrics::tag_collection& tags, uint64_t start)
+    {
+        auto fnd = series_.find(tags);
+        if (fnd != series_.end())
+            return fnd->second;
+
+        // the attributes never change so they're only encoded once
+        std::vector<std::string> attributes;
+        exposition_buffer encoded(128);
+        for (const auto& tag : tags)
+        {
+            encoded.clear();
+            encode_attribute(encoded, tag.first, tag.second);
+            attributes.emplace_back(encoded.data(), encoded.size());
+        }
+
+        return series_.emplace(tags, series_state(std::move(attributes), start)).first->second;
+    }
+};
+
+enum class otlp_kind
+{
+    gauge,
+    sum,
+    histogram
+};
+
+/**
+ * \brief The data points of one OTLP metric being collected from the series of a registered metric
+ */
+struct otlp_component
+{
+    std::string suffix;
+    otlp_kind kind;
+    const char* unit;
+    exposition_buffer points;
+    bool monotonic;
+    bool used;
+
+    otlp_component(std::string&& s, otlp_kind k, const char* u) :
+            suffix(std::move(s)),
+            kind(k),
+            unit(u),
+            points(1024),
+            monotonic(true),
+            used(true)
+    { }
+};
+
+/**
+ * \brief Writes the series of a registered metric as data points of the OTLP metrics they map to
+ *
+ * Counters are delta sums of the change since the last export. Gauges and ewmas are gauges. Meters are a gauge for
+ * each window and one for the mean. Histograms and timers are delta histograms with the explicit buckets of their
+ * publish options, or with no buckets at all if they have none. They leave out the optional sum, since the sum of a
+ * reservoir's samples doesn't only ever grow the way a delta sum has to. Timers are in milliseconds and also have gauges for
+ * their rates.
+ */
+class series_writer
+{
+    std::vector<otlp_component>& components_;
+    const cxxmetrics::publish_options& options_;
+    series_state& state_;
+    uint64_t now_;
+    exposition_buffer scratch_;
+    exposition_buffer point_;
+
+    otlp_component& component(const char* suffix, std::size_t length, otlp_kind kind, const char* unit)
+    {
+        for (auto& c : components_)
+        {
+            if (c.suffix.size() == length && c.suffix.compare(0, length, suffix, length) == 0)
+            {
+                if (!c.used)
+                {
+                    c.kind = kind;
+                    c.unit = unit;
+                    c.monotonic = true;
+                    c.used = true;
+                }
+                return c;
+            }
+        }
+
+        components_.emplace_back(std::string(suffix, length), kind, unit);
+        return components_.back();
+    }
+
+    void number(otlp_component& into, const cxxmetrics::metric_value& value, uint64_t start)
+    {
+        point_.clear();
+        state_.append_attributes(point_, protobuf::fields::number_attributes);
+        protobuf::append_fixed64_field(point_, protobuf::fields::number_start_time, start);
+        protobuf::append_fixed64_field(point_, protobuf::fields::number_time, now_);
+        if (value.kind() == cxxmetrics::metric_value_kind::signed_integral || value.kind() == cxxmetrics::metric_value_kind::unsigned_integral)
+            protobuf::append_fixed64_field(point_, protobuf::fields::number_as_int, static_cast<uint64_t>(static_cast<int64_t>(value)));
+        else
+            protobuf::append_double_field(point_, protobuf::fields::number_as_double, static_cast<double>(value));
+        protobuf::append_bytes_field(into.points, protobuf::fields::data_points, point_);
+    }
+
+    void gauge(const char* suffix, double value, const char* unit = "")
+    {
+        if (!std::isfinite(value))
+            return;
+        number(component(suffix, std::strlen(suffix), otlp_kind::gauge, unit), cxxmetrics::metric_value(value), now_);
+    }
+
+    template<typename TRates>
+    void rates(const char* prefix, const TRates& rates, bool include_mean, const cxxmetrics::value_publish_options& opts)
+    {
+        if (include_mean)
+        {
+            scratch_.clear();
+            scratch_ << prefix << "mean";
+            auto value = static_cast<double>(rates.value()) * cxxmetrics::internal::scale_multiplier(opts);
+            if (std::isfinite(value))
+                number(component(scratch_.data(), scratch_.size(), otlp_kind::gauge, ""), cxxmetrics::metric_value(value), now_);
+        }
+
+        for (const auto& rate : rates)
+        {
+            scratch_.clear();
+            cxxmetrics::internal::format_window(scratch_ << prefix, rate.first);
+            auto value = static_cast<double>(rate.second) * cxxmetrics::internal::scale_multiplier(opts);
+            if (std::isfinite(value))
+                number(component(scratch_.data(), scratch_.size(), otlp_kind::gauge, ""), cxxmetrics::metric_value(value), now_);
+        }
+    }
+
+    template<typename TConvert>
+    void histogram(const cxxmetrics::histogram_snapshot& snapshot, const cxxmetrics::histogram_publish_options& opts, const char* unit, TConvert&& convert)
+    {
+        static const std::vector<double> no_bounds;
+        const auto& bounds = opts.buckets() ? opts.buckets()->bounds() : no_bounds;
+
+        std::vector<uint64_t> cumulative(bounds.size());
+        snapshot.bucket_counts(bounds, convert, cumulative.data());
+
+        auto count = snapshot.count();
+
+        // a histogram that was reset starts over from nothing
+        if (count < state_.count || state_.buckets.size() != bounds.size())
+        {
+            state_.count = 0;
+            state_.buckets.assign(bounds.size(), 0);
+        }
+
+        // the delta of every cumulative bucket is kept within the delta of the count and ascending so the buckets
+        // always add up to the count, even though the counts of the buckets are estimates
+        auto delta_count = count - state_.count;
+        std::vector<uint64_t> delta(bounds.size() + 1);
+        uint64_t below = 0;
+        for (std::size_t i = 0; i < bounds.size(); i++)
+        {
+            auto at = cumulative[i] > state_.buckets[i] ? cumulative[i] - state_.buckets[i] : 0;
+            at = std::min(std::max(at, below), delta_count);
+            delta[i] = at - below;
+            below = at;
+        }
+        delta[bounds.size()] = delta_count - below;
+
+        point_.clear();
+        state_.append_attributes(point_, protobuf::fields::histogram_attributes);
+        protobuf::append_fixed64_field(point_, protobuf::fields::histogram_start_time, state_.start);
+        protobuf::append_fixed64_field(point_, protobuf::fields::histogram_time, now_);
+        protobuf::append_fixed64_field(point_, protobuf::fields::histogram_count, delta_count);
+
+        scratch_.clear();
+        for (auto c : delta)
+            protobuf::append_fixed64(scratch_, c);
+        protobuf::append_bytes_field(point_, protobuf::fields::histogram_bucket_counts, scratch_);
+
+        if (!bounds.empty())
+        {
+            scratch_.clear();
+            for (auto b : bounds)
+                protobuf::append_fixed64(scratch_, protobuf::double_bits(b));
+            protobuf::append_bytes_field(point_, protobuf::fields::histogram_explicit_bounds, scratch_);
+        }
+
+        protobuf::append_bytes_field(component("", 0, otlp_kind::histogram, unit).points, protobuf::fields::data_points, point_);
+
+        state_.count = count;
+        state_.buckets = std::move(cumulative);
+    }
+
+public:
+    series_writer(std::vector<otlp_component>& components, const cxxmetrics::publish_options& options, series_state& state, uint64_t now) :
+            components_(components),
+            options_(options),
+            state_(state),
+            now_(now),
+            scratch_(64),
+            point_(256)
+    { }
+
+    void write(const cxxmetrics::cumulative_value_snapshot& snapshot)
+    {
+        const auto& opts = options_.value_options();
+        auto value = snapshot.value();
+        auto current = static_cast<double>(value) * cxxmetrics::internal::scale_multiplier(opts);
+        auto delta = current - state_.value;
+
+        auto& into = component("", 0, otlp_kind::sum, "");
+        if (delta < 0)
+            into.monotonic = false;
+
+        if (!opts.scale() && (value.kind() == cxxmetrics::metric_value_kind::signed_integral || value.kind() == cxxmetrics::metric_value_kind::unsigned_integral))
+            number(into, cxxmetrics::metric_value(static_cast<int64_t>(value) - static_cast<int64_t>(state_.value)), state_.start);
+        else
+            number(into, cxxmetrics::metric_value(delta), state_.start);
+
+        state_.value = current;
+    }
+
+    void write(const cxxmetrics::average_value_snapshot& snapshot)
+    {
+        gauge("", static_cast<double>(snapshot.value()) * cxxmetrics::internal::scale_multiplier(options_.value_options()));
+    }
+
+    void write(const cxxmetrics::meter_snapshot& snapshot)
+    {
+        const auto& opts = options_.meter_options();
+        rates(".", snapshot, opts.include_mean(), opts);
+    }
+
+    void write(const cxxmetrics::histogram_snapshot& snapshot)
+    {
+        const auto& opts = options_.histogram_options();
+        const double factor = cxxmetrics::internal::scale_multiplier(opts);
+        histogram(snapshot, opts, "", [factor](const cxxmetrics::metric_value& value) {
+            return static_cast<double>(value) * factor;
+        });
+    }
+
+    void write(const cxxmetrics::timer_snapshot& snapshot)
+    {
+        const auto& opts = options_.timer_options();
+        const double factor = cxxmetrics::internal::scale_multiplier(opts);
+        histogram(snapshot, opts, "ms", [factor](const cxxmetrics::metric_value& value) {
+            return static_cast<double>(cxxmetrics::internal::timer_milliseconds(value)) * factor;
+        });
+
+        if (opts.include_rates())
+            rates(".rate.", snapshot.rate(), opts.include_mean(), opts);
+    }
+};
+
+#ifdef CXXMETRICS_WITH_ZLIB
+/**
+ * \brief Compress data into a gzip member
+ */
+inline void gzip(const char* data, std::size_t length, exposition_buffer& into)
+{
+    z_stream stream{};
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        throw std::runtime_error("couldn't start gzip compression");
+
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    stream.avail_in = static_cast<uInt>(length);
+
+    char chunk[16384];
+    int result;
+    do
+    {
+        stream.next_out = reinterpret_cast<Bytef*>(chunk);
+        stream.avail_out = sizeof(chunk);
+        result = deflate(&stream, Z_FINISH);
+        into.append(chunk, sizeof(chunk) - stream.avail_out);
+    } while (result == Z_OK);
+
+    deflateEnd(&stream);
+    if (result != Z_STREAM_END)
+        throw std::runtime_error("gzip compression failed");
+}
+#endif
+
+}
+
+/**
+ * \brief A publisher that exports the metrics in a registry to an OpenTelemetry collector over OTLP/HTTP
+ *
+ * Every export encodes an ExportMetricsServiceRequest protobuf by hand, with delta temporality for the metrics that
+ * accumulate: counters are sums of the change since the last export, and histograms and timers are histograms of the
+ * values recorded since the last export, in the explicit buckets of their publish options. Gauges, ewmas and the
+ * rates of meters and timers are gauges. The names of the metrics are their paths joined with '.'.
+ *
+ * The encoded metrics are split into requests of around the batch size, which are compressed with gzip when that's
+ * available and posted over a kept alive connection. Requests that can't be delivered are kept up to a bound and
+ * retried on the next export, oldest first, so that no deltas are lost to a short outage of the collector.
+ */
+template<typename TMetricRepo>
+class otlp_publisher : public cxxmetrics::metrics_publisher<TMetricRepo>
+{
+    otlp_options options_;
+    cxxmetrics::publisher_state<internal::otlp_series> states_;
+    cxxmetrics::internal::http_connection connection_;
+    std::string head_;
+    exposition_buffer scope_;
+    exposition_buffer batch_;
+    std::deque<exposition_buffer> pending_;
+    std::size_t pending_bytes_;
+    uint64_t start_;
+    uint64_t sent_;
+    uint64_t dropped_;
+    uint64_t rejected_;
+    uint64_t connections_;
+    std::mutex lock_;
+
+    cxxmetrics::internal::interval_thread thread_;
+
+    static uint64_t now_ns()
+    {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count());
+    }
+
+    bool compressed() const noexcept
+    {
+#ifdef CXXMETRICS_WITH_ZLIB
+        return options_.compress;
+#else
+        return false;
+#endif
+    }
+
+    /**
+     * \brief Wrap the batch in a request and queue it to be sent
+     */
+    void enqueue()
+    {
+        if (batch_.empty())
+            return;
+
+        exposition_buffer scope_metrics(batch_.size() + scope_.size() + 16);
+        scope_metrics.append(scope_.data(), scope_.size());
+        scope_metrics.append(batch_.data(), batch_.size());
+        batch_.clear();
+
+        exposition_buffer resource(256);
+        for (const auto& attribute : options_.resource)
+            internal::append_attribute(resource, internal::protobuf::fields::resource_attributes, attribute.first, cxxmetrics::metric_value(attribute.second));
+
+        exposition_buffer resource_metrics(scope_metrics.size() + resource.size() + 16);
+        internal::protobuf::append_bytes_field(resource_metrics, internal::protobuf::fields::resource_metrics_resource, resource);
+        internal::protobuf::append_bytes_field(resource_metrics, internal::protobuf::fields::resource_metrics_scope_metrics, scope_metrics);
+
+        exposition_buffer request(resource_metrics.size() + 16);
+        internal::protobuf::append_bytes_field(request, internal::protobuf::fields::request_resource_metrics, resource_metrics);
+
+#ifdef CXXMETRICS_WITH_ZLIB
+        if (compressed())
+        {
+            exposition_buffer body(request.size() / 4 + 64);
+            internal::gzip(request.data(), request.size(), body);
+            request = std::move(body);
+        }
+#endif
+
+        pending_bytes_ += request.size();
+        pending_.push_back(std::move(request));
+        while (pending_bytes_ > options_.max_pending && pending_.size() > 1)
+        {
+            pending_bytes_ -= pending_.front().size();
+            pending_.pop_front();
+            ++dropped_;
+        }
+    }
+
+    /**
+     * \brief Send the pending requests oldest first until one of them can't be delivered
+     */
+    void send()
+    {
+        while (!pending_.empty())
+        {
+            const auto& body = pending_.front();
+            auto head = head_;
+            head.append(std::to_string(body.size())).append("\r\n\r\n");
+
+            auto status = connection_.request(head, body, connections_);
+            if (status < 0 || status == 429 || status >= 500)
+                return;
+
+            if (status >= 200 && status < 300)
+                ++sent_;
+            else
+                ++rejected_;
+
+            pending_bytes_ -= body.size();
+            pending_.pop_front();
+        }
+    }
+
+public:
+    otlp_publisher(cxxmetrics::metrics_registry<TMetricRepo>& registry, otlp_options options = otlp_options()) :
+            cxxmetrics::metrics_publisher<TMetricRepo>(registry),
+            options_(std::move(options)),
+            connection_(options_.address, options_.port, options_.timeout),
+            scope_(128),
+            batch_(options_.max_batch + 4096),
+            pending_bytes_(0),
+            start_(now_ns()),
+            sent_(0),
+            dropped_(0),
+            rejected_(0),
+            connections_(0)
+    {
+        head_ = "POST " + options_.path + " HTTP/1.1\r\nHost: " + options_.address + ":" + std::to_string(options_.port) +
+                "\r\nContent-Type: application/x-protobuf\r\n";
+        if (compressed())
+            head_ += "Content-Encoding: gzip\r\n";
+        head_ += "Content-Length: ";
+
+        exposition_buffer scope(64);
+        internal::protobuf::append_bytes_field(scope, internal::protobuf::fields::scope_name, options_.scope);
+        internal::protobuf::append_bytes_field(scope_, internal::protobuf::fields::scope_metrics_scope, scope);
+    }
+
+    otlp_publisher(const otlp_publisher&) = delete;
+    otlp_publisher& operator=(const otlp_publisher&) = delete;
+
+    ~otlp_publisher()
+    {
+        stop();
+    }
+
+    /**
+     * \brief Encode every registered metric into requests and send them along with any that are still pending
+     *
+     * \return the number of series that were encoded
+     */
+    std::size_t publish()
+    {
+        auto now = now_ns();
+        std::vector<internal::otlp_component> components;
+        exposition_buffer message(1024);
+        exposition_buffer data(1024);
+
+        std::lock_guard<std::mutex> lock(lock_);
+        std::size_t series = 0;
+        this->visit_all([&](const cxxmetrics::metric_path& path, cxxmetrics::basic_registered_metric& metric) {
+            if (path.begin() == path.end())
+                return;
+
+            const auto& options = this->effective_options(metric);
+            auto& state = states_.get(metric);
+            std::lock_guard<internal::otlp_series> state_lock(state);
+
+            for (auto& component : components)
+            {
+                component.points.clear();
+                component.used = false;
+            }
+
+            metric.visit([&](const cxxmetrics::tag_collection& tags, const auto& snapshot) {
+                auto& current = state.state(tags, start_);
+                internal::series_writer writer(components, options, current, now);
+                writer.write(snapshot);
+                current.start = now;
+                ++series;
+            });
+
+            const auto& name = state.name(path);
+            for (const auto& component : components)
+            {
+                if (!component.used || component.points.empty())
+                    continue;
+
+                data.clear();
+                data.append(component.points.data(), component.points.size());
+
+                uint32_t field = internal::protobuf::fields::metric_gauge;
+                if (component.kind == internal::otlp_kind::sum)
+                {
+                    field = internal::protobuf::fields::metric_sum;
+                    internal::protobuf::append_varint_field(data, internal::protobuf::fields::aggregation_temporality, internal::protobuf::temporality_delta);
+                    internal::protobuf::append_varint_field(data, internal::protobuf::fields::sum_is_monotonic, component.monotonic ? 1 : 0);
+                }
+                else if (component.kind == internal::otlp_kind::histogram)
+                {
+                    field = internal::protobuf::fields::metric_histogram;
+                    internal::protobuf::append_varint_field(data, internal::protobuf::fields::aggregation_temporality, internal::protobuf::temporality_delta);
+                }
+
+                message.clear();
+                internal::protobuf::append_key(message, internal::protobuf::fields::metric_name, internal::protobuf::wire_type::length_delimited);
+                internal::protobuf::append_varint(message, name.size() + component.suffix.size());
+                message.append(name).append(component.suffix);
+                if (*component.unit)
+                    internal::protobuf::append_bytes_field(message, internal::protobuf::fields::metric_unit, component.unit, std::strlen(component.unit));
+                internal::protobuf::append_bytes_field(message, field, data);
+
+                internal::protobuf::append_bytes_field(batch_, internal::protobuf::fields::scope_metrics_metrics, message);
+            }
+
+            if (batch_.size() >= options_.max_batch)
+                enqueue();
+        });
+
+        enqueue();
+        send();
+        return series;
+    }
+
+    /**
+     * \brief Export on an interval from a background thread until stopped
+     *
+     * \throws std::invalid_argument if the interval isn't positive
+     */
+    void start(std::chrono::milliseconds interval)
+    {
+        thread_.start(interval, [this]() { publish(); });
+    }
+
+    void stop()
+    {
+        thread_.stop();
+    }
+
+    /**
+     * \brief The number of requests waiting to be sent
+     */
+    std::size_t pending()
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        return pending_.size();
+    }
+
+    /**
+     * \brief The number of requests the receiver accepted
+     */
+    uint64_t sent()
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        return sent_;
+    }
+
+    /**
+     * \brief The number of requests dropped because too many were pending
+     */
+    uint64_t dropped()
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        return dropped_;
+    }
+
+    /**
+     * \brief The number of requests the receiver refused in a way that retrying won't fix
+     */
+    uint64_t rejected()
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        return rejected_;
+    }
+
+    /**
+     * \brief The number of connections that have been established
+     */
+    uint64_t connections()
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        return connections_;
+    }
+};
+
+}
+
+#endif //CXXMETRICS_OTLP_PUBLISHER_HPP
@@ -0,0 +1,259 @@
+#ifndef CXXMETRICS_PROMETHEUS_BACKGROUND_PUBLISHER_HPP
+#define CXXMETRICS_PROMETHEUS_BACKGROUND_PUBLISHER_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <cxxmetrics/internal/interval_thread.hpp>
+#include "compressed_exposition.hpp"
+
+namespace cxxmetrics_prometheus
+{
+
+/**
+ * \brief Renders the exposition of a publisher on an interval so that scrapes only copy out the last render
+ *
+ * The exposition is rendered into a back buffer off the request path and swapped in as the front buffer once it's
+ * complete. Scrapes take a reference to the front buffer and copy it out, so their latency doesn't depend on the
+ * number of series. The buffer that was swapped out is rendered into next unless a scrape is still copying it.
+ *
+ * Scrapes that want the exposition compressed share one compression of each render, made by the first of them to
+ * ask for the encoding. Encodings that are precompressed are compressed on the background thread right after the
+ * render instead, so the scrapes don't wait on the compression either.
+ *
+ * \tparam TPublisher a publisher with write(exposition_buffer&) and content_type(), such as the prometheus_publisher
+ */
+template<typename TPublisher>
+class background_publisher
+{
+    TPublisher publisher_;
+    std::chrono::milliseconds interval_;
+
+    std::shared_ptr<rendered_exposition> front_;
+    std::shared_ptr<rendered_exposition> spare_;
+    bool precompress_[3];
+    std::function<void()> rendered_;
+    std::mutex swap_lock_;
+    std::mutex render_lock_;
+
+    cxxmetrics::internal::interval_thread thread_;
+
+public:
+    /**
+     * \brief Construct the publisher, rendering on the interval once started
+     *
+     * \param registry the registry the underlying publisher publishes
+     * \param interval how often the exposition is rendered
+     */
+    template<typename TRegistry>
+    background_publisher(TRegistry& registry, std::chrono::milliseconds interval) :
+            publisher_(registry),
+            interval_(interval),
+            precompress_{false, false, false}
+    { }
+
+    background_publisher(const background_publisher&) = delete;
+    background_publisher& operator=(const background_publisher&) = delete;
+
+    ~background_publisher()
+    {
+        stop();
+    }
+
+    /**
+     * \brief The content type of the exposition the underlying publisher renders
+     */
+    static const char* content_type() noexcept
+    {
+        return TPublisher::content_type();
+    }
+
+    /**
+     * \brief Start rendering on a background thread, starting with a render right away
+     *
+     * \throws std::invalid_argument if the interval the publisher was constructed with isn't positive
+     */
+    void start()
+    {
+        thread_.start_loop(interval_, [this](int wake, std::chrono::milliseconds interval) {
+            do
+            {
+                try
+                {
+                    render();
+                }
+                catch (...)
+                {
+                    // the last complete render keeps being served
+                }
+            } while (!cxxmetrics::internal::interval_thread::wait(wake, interval));
+        });
+    }
+
+    /**
+     * \brief Stop rendering in the background. The last render is still served
+     */
+    void stop()
+    {
+        thread_.stop();
+    }
+
+    /**
+     * \brief Render the exposition now and make it the one that's served
+     */
+    void render()
+    {
+        std::lock_guard<std::mutex> render(render_lock_);
+
+        std::shared_ptr<rendered_exposition> back;
+        bool precompress[3];
+        {
+            std::lock_guard<std::mutex> lock(swap_lock_);
+            back = std::move(spare_);
+            std::copy(precompress_, precompress_ + 3, precompress);
+        }
+
+        // a scrape that's still copying the swapped out buffer holds on to it, so render into a new one instead
+        if (!back || back.use_count() > 1)
+            back = std::make_shared<rendered_exposition>(front_ ? front_->capacity() : 4096);
+
+        back->clear();
+        publisher_.write(*back);
+        for (auto encoding : {content_encoding::gzip, content_encoding::zstd})
+        {
+            if (precompress[static_cast<int>(encoding)])
+                back->encoded(encoding);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(swap_lock_);
+            spare_ = std::move(front_);
+            front_ = std::move(back);
+        }
+
+        if (rendered_)
+            rendered_();
+    }
+
+    /**
+     * \brief Call a function on the rendering thread every time a render is swapped in
+     *
+     * This is set before the publisher is started.
+     */
+    void on_render(std::function<void()> fn)
+    {
+        rendered_ = std::move(fn);
+    }
+
+    /**
+     * \brief Get the last complete render, rendering on the calling thread if there hasn't been one yet
+     */
+    std::shared_ptr<const rendered_exposition> latest()
+    {
+        {
+            std::lock_guard<std::mutex> lock(swap_lock_);
+            if (front_)
+                return front_;
+        }
+
+        render();
+        std::lock_guard<std::mutex> lock(swap_lock_);
+        return front_;
+    }
+
+    /**
+     * \brief Append the last complete render to a buffer
+     */
+    void write(exposition_buffer& into)
+    {
+        auto front = latest();
+        into.append(front->data(), front->size());
+    }
+
+    /**
+     * \brief Append the last complete render to a buffer in an encoding
+     *
+     * \throws std::invalid_argument if the encoding isn't available in this build
+     */
+    void write(exposition_buffer& into, content_encoding encoding)
+    {
+        auto front = latest();
+        const auto& body = front->encoded(encoding);
+        into.append(body.data(), body.size());
+    }
+
+    /**
+     * \brief Append the last complete render to a list of buffers in an encoding, without copying it
+     *
+     * The sink holds on to the render until it's cleared, so it's rendered into a new buffer in the meantime rather
+     * than into the one the sink references.
+     *
+     * \throws std::invalid_argument if the encoding isn't available in this build
+     */
+    void write(iovec_sink& into, content_encoding encoding = content_encoding::identity)
+    {
+        auto front = latest();
+        const auto& body = front->encoded(encoding);
+        into.append_reference(body.data(), body.size(), std::move(front));
+    }
+
+    /**
+     * \brief Append the last complete render to a list of buffers like write, unless there hasn't been one yet
+     *
+     * \return whether there was a render to append
+     */
+    bool try_write(iovec_sink& into, content_encoding encoding = content_encoding::identity)
+    {
+        std::shared_ptr<const rendered_exposition> front;
+        {
+            std::lock_guard<std::mutex> lock(swap_lock_);
+            front = front_;
+        }
+
+        if (!front)
+            return false;
+
+        const auto& body = front->encoded(encoding);
+        into.append_reference(body.data(), body.size(), std::move(front));
+        return true;
+    }
+
+    /**
+     * \brief Compress every render in an encoding on the background thread as soon as it's rendered
+     *
+     * \throws std::invalid_argument if the encoding isn't available in this build
+     */
+    void precompress(content_encoding encoding)
+    {
+        if (!encoding_available(encoding))
+            throw std::invalid_argument(std::string("the ") + encoding_name(encoding) + " content encoding isn't available");
+
+        std::lock_guard<std::mutex> lock(swap_lock_);
+        precompress_[static_cast<int>(encoding)] = true;
+    }
+
+    /**
+     * \brief Write the last complete render to a stream
+     */
+    void write(std::ostream& into)
+    {
+        latest()->write_to(into);
+    }
+
+    /**
+     * \brief The publisher the exposition is rendered with
+     */
+    TPublisher& publisher() noexcept
+    {
+        return publisher_;
+    }
+};
+
+}
+
+#endif //CXXMETRICS_PROMETHEUS_BACKGROUND_PUBLISHER_HPP
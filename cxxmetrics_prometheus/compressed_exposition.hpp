@@ -0,0 +1,400 @@
+#ifndef CXXMETRICS_PROMETHEUS_COMPRESSED_EXPOSITION_HPP
+#define CXXMETRICS_PROMETHEUS_COMPRESSED_EXPOSITION_HPP
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#ifdef CXXMETRICS_WITH_ZLIB
+#include <zlib.h>
+#endif
+#ifdef CXXMETRICS_WITH_ZSTD
+#include <zstd.h>
+#endif
+#include "exposition_buffer.hpp"
+
+namespace cxxmetrics_prometheus
+{
+
+/**
+ * \brief The content encodings an exposition can be served with
+ *
+ * gzip is only available when built with CXXMETRICS_WITH_ZLIB and linked to zlib, and zstd only when built with
+ * CXXMETRICS_WITH_ZSTD and linked to libzstd.
+ */
+enum class content_encoding
+{
+    identity,
+    gzip,
+    zstd
+};
+
+/**
+ * \brief The name of a content encoding as it's used in the Content-Encoding header
+ */
+inline const char* encoding_name(content_encoding encoding) noexcept
+{
+    switch (encoding)
+    {
+        case content_encoding::gzip:
+            return "gzip";
+        case content_encoding::zstd:
+            return "zstd";
+        default:
+            return "identity";
+    }
+}
+
+/**
+ * \brief Whether an encoding is available in this build
+ */
+inline bool encoding_available(content_encoding encoding) noexcept
+{
+    switch (encoding)
+    {
+        case content_encoding::identity:
+            return true;
+        case content_encoding::gzip:
+#ifdef CXXMETRICS_WITH_ZLIB
+            return true;
+#else
+            return false;
+#endif
+        case content_encoding::zstd:
+#ifdef CXXMETRICS_WITH_ZSTD
+            return true;
+#else
+            return false;
+#endif
+    }
+
+    return false;
+}
+
+namespace internal
+{
+
+/**
+ * \brief Pick the content encoding to respond with from an Accept-Encoding header
+ *
+ * The available encoding with the highest q wins, with zstd winning ties with gzip. Identity is only picked when
+ * neither of them is both available and acceptable.
+ */
+inline content_encoding negotiate_encoding(const char* accept, std::size_t length) noexcept
+{
+    double gzip = -1;
+    double zstd = -1;
+    double any = 0;
+
+    auto end = accept + length;
+    while (accept < end)
+    {
+        auto coding_end = std::find(accept, end, ',');
+        auto name_end = std::find(accept, coding_end, ';');
+
+        auto name = accept;
+        while (name < name_end && (*name == ' ' || *name == '\t'))
+            ++name;
+        auto name_last = name_end;
+        while (name_last > name && (name_last[-1] == ' ' || name_last[-1] == '\t'))
+            --name_last;
+
+        double q = 1;
+        for (auto param = name_end; param < coding_end; param = std::find(param + 1, coding_end, ';'))
+        {
+            auto value = std::find(param, coding_end, '=');
+            auto key = param + 1;
+            while (key < value && (*key == ' ' || *key == '\t'))
+                ++key;
+            if (value < coding_end && value - key == 1 && (*key == 'q' || *key == 'Q'))
+                q = std::strtod(std::string(value + 1, std::find(value, coding_end, ';')).c_str(), nullptr);
+        }
+
+        auto size = static_cast<std::size_t>(name_last - name);
+        auto is = [name, size](const char* coding) {
+            if (std::strlen(coding) != size)
+                return false;
+            for (std::size_t i = 0; i < size; i++)
+            {
+                if (std::tolower(static_cast<unsigned char>(name[i])) != coding[i])
+                    return false;
+            }
+            return true;
+        };
+
+        if (is("gzip") || is("x-gzip"))
+            gzip = std::max(gzip, q);
+        else if (is("zstd"))
+            zstd = std::max(zstd, q);
+        else if (is("*"))
+            any = std::max(any, q);
+
+        accept = coding_end + (coding_end < end ? 1 : 0);
+    }
+
+    if (gzip < 0)
+        gzip = any;
+    if (zstd < 0)
+        zstd = any;
+    if (!encoding_available(content_encoding::gzip))
+        gzip = 0;
+    if (!encoding_available(content_encoding::zstd))
+        zstd = 0;
+
+    if (zstd > 0 && zstd >= gzip)
+        return content_encoding::zstd;
+    if (gzip > 0)
+        return content_encoding::gzip;
+    return content_encoding::identity;
+}
+
+/**
+ * \brief A streaming compressor that appends what it compresses to a buffer
+ *
+ * Data is compressed as it's written in, so a big exposition can be compressed a piece at a time as it's rendered
+ * rather than in one pass once it's done.
+ */
+class exposition_compressor
+{
+    content_encoding encoding_;
+    exposition_buffer& out_;
+#ifdef CXXMETRICS_WITH_ZLIB
+    z_stream zlib_;
+#endif
+#ifdef CXXMETRICS_WITH_ZSTD
+    ZSTD_CCtx* zstd_;
+#endif
+
+#ifdef CXXMETRICS_WITH_ZLIB
+    void deflate(const char* data, std::size_t length, int flush)
+    {
+        zlib_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+        zlib_.avail_in = static_cast<uInt>(length);
+
+        char chunk[16384];
+        int result;
+        do
+        {
+            zlib_.next_out = reinterpret_cast<Bytef*>(chunk);
+            zlib_.avail_out = sizeof(chunk);
+            result = ::deflate(&zlib_, flush);
+            if (result == Z_STREAM_ERROR)
+                throw std::runtime_error("gzip compression failed");
+            out_.append(chunk, sizeof(chunk) - zlib_.avail_out);
+        } while (zlib_.avail_out == 0 || (flush == Z_FINISH && result != Z_STREAM_END));
+    }
+#endif
+
+#ifdef CXXMETRICS_WITH_ZSTD
+    void compress_stream(const char* data, std::size_t length, ZSTD_EndDirective directive)
+    {
+        ZSTD_inBuffer in{data, length, 0};
+        char chunk[16384];
+        std::size_t left;
+        do
+        {
+            ZSTD_outBuffer out{chunk, sizeof(chunk), 0};
+            left = ZSTD_compressStream2(zstd_, &out, &in, directive);
+            if (ZSTD_isError(left))
+                throw std::runtime_error("zstd compression failed");
+            out_.append(chunk, out.pos);
+        } while (in.pos < in.size || (directive == ZSTD_e_end && left != 0));
+    }
+#endif
+
+public:
+    /**
+     * \param level the compression level, or 0 for the default of the encoding
+     *
+     * \throws std::invalid_argument if the encoding isn't available in this build
+     */
+    exposition_compressor(content_encoding encoding, exposition_buffer& out, int level = 0) :
+            encoding_(encoding),
+            out_(out)
+    {
+        switch (encoding)
+        {
+#ifdef CXXMETRICS_WITH_ZLIB
+            case content_encoding::gzip:
+                zlib_ = z_stream{};
+                if (deflateInit2(&zlib_, level ? level : Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+                    throw std::runtime_error("couldn't start gzip compression");
+                return;
+#endif
+#ifdef CXXMETRICS_WITH_ZSTD
+            case content_encoding::zstd:
+                zstd_ = ZSTD_createCCtx();
+                if (!zstd_)
+                    throw std::runtime_error("couldn't start zstd compression");
+                if (level)
+                    ZSTD_CCtx_setParameter(zstd_, ZSTD_c_compressionLevel, level);
+                return;
+#endif
+            default:
+                (void)level;
+                throw std::invalid_argument(std::string("the ") + encoding_name(encoding) + " content encoding isn't available");
+        }
+    }
+
+    exposition_compressor(const exposition_compressor&) = delete;
+    exposition_compressor& operator=(const exposition_compressor&) = delete;
+
+    ~exposition_compressor()
+    {
+#ifdef CXXMETRICS_WITH_ZLIB
+        if (encoding_ == content_encoding::gzip)
+            deflateEnd(&zlib_);
+#endif
+#ifdef CXXMETRICS_WITH_ZSTD
+        if (encoding_ == content_encoding::zstd)
+            ZSTD_freeCCtx(zstd_);
+#endif
+    }
+
+    /**
+     * \brief Compress more data, appending whatever compressed output is ready
+     */
+    void write(const char* data, std::size_t length)
+    {
+#ifdef CXXMETRICS_WITH_ZLIB
+        if (encoding_ == content_encoding::gzip)
+            deflate(data, length, Z_NO_FLUSH);
+#endif
+#ifdef CXXMETRICS_WITH_ZSTD
+        if (encoding_ == content_encoding::zstd)
+            compress_stream(data, length, ZSTD_e_continue);
+#endif
+        (void)data;
+        (void)length;
+    }
+
+    /**
+     * \brief Append the rest of the compressed output
+     */
+    void finish()
+    {
+#ifdef CXXMETRICS_WITH_ZLIB
+        if (encoding_ == content_encoding::gzip)
+            deflate(nullptr, 0, Z_FINISH);
+#endif
+#ifdef CXXMETRICS_WITH_ZSTD
+        if (encoding_ == content_encoding::zstd)
+            compress_stream(nullptr, 0, ZSTD_e_end);
+#endif
+    }
+};
+
+}
+
+/**
+ * \brief A rendered exposition along with the compressed bodies it's been served with
+ *
+ * Renders are shared by every scrape that coalesces onto them, so their compressed bodies are too: the first scrape
+ * to want an encoding compresses the render and the rest get the same body. A render can also be compressed as it's
+ * rendered, in pieces as the metrics are appended, so the compression of a big exposition overlaps the rendering of
+ * it and the compressed body is ready as soon as the render is.
+ */
+class rendered_exposition : public exposition_buffer
+{
+    static constexpr std::size_t encodings = 2;
+    static constexpr std::size_t chunk_size = 64 * 1024;
+
+    mutable std::mutex lock_;
+    mutable exposition_buffer encoded_[encodings];
+    mutable bool ready_[encodings];
+    std::unique_ptr<internal::exposition_compressor> compressor_;
+    std::size_t compressing_;
+    std::size_t compressed_;
+
+    static std::size_t index(content_encoding encoding) noexcept
+    {
+        return encoding == content_encoding::zstd ? 1 : 0;
+    }
+
+public:
+    explicit rendered_exposition(std::size_t capacity = 4096) :
+            exposition_buffer(capacity),
+            ready_{false, false},
+            compressing_(0),
+            compressed_(0)
+    { }
+
+    /**
+     * \brief Drop the render and its compressed bodies, keeping their capacity
+     */
+    void clear() noexcept
+    {
+        exposition_buffer::clear();
+        compressor_.reset();
+        for (std::size_t i = 0; i < encodings; i++)
+            ready_[i] = false;
+    }
+
+    /**
+     * \brief Compress the render as it's rendered, starting with what's already in it
+     *
+     * The metrics should call compress_rendered() as they're appended and the render should call it with finish
+     * once it's done.
+     */
+    void compress_as_rendered(content_encoding encoding)
+    {
+        if (encoding == content_encoding::identity)
+            return;
+
+        compressing_ = index(encoding);
+        encoded_[compressing_].clear();
+        compressor_.reset(new internal::exposition_compressor(encoding, encoded_[compressing_]));
+        compressed_ = 0;
+    }
+
+    /**
+     * \brief Compress what's been rendered since the last call, once there's at least a chunk of it or the render
+     * is finished
+     */
+    void compress_rendered(bool finish = false)
+    {
+        if (!compressor_ || (!finish && size() - compressed_ < chunk_size))
+            return;
+
+        compressor_->write(data() + compressed_, size() - compressed_);
+        compressed_ = size();
+        if (!finish)
+            return;
+
+        compressor_->finish();
+        compressor_.reset();
+        ready_[compressing_] = true;
+    }
+
+    /**
+     * \brief Get the render in an encoding, compressing it the first time the encoding is asked for
+     *
+     * \throws std::invalid_argument if the encoding isn't available in this build
+     */
+    const exposition_buffer& encoded(content_encoding encoding) const
+    {
+        if (encoding == content_encoding::identity)
+            return *this;
+
+        auto i = index(encoding);
+        std::lock_guard<std::mutex> lock(lock_);
+        if (!ready_[i])
+        {
+            encoded_[i].clear();
+            internal::exposition_compressor compressor(encoding, encoded_[i]);
+            compressor.write(data(), size());
+            compressor.finish();
+            ready_[i] = true;
+        }
+
+        return encoded_[i];
+    }
+};
+
+}
+
+#endif //CXXMETRICS_PROMETHEUS_COMPRESSED_EXPOSITION_HPP
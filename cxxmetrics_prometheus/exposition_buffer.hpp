@@ -0,0 +1,16 @@
+#ifndef CXXMETRICS_PROMETHEUS_EXPOSITION_BUFFER_HPP
+#define CXXMETRICS_PROMETHEUS_EXPOSITION_BUFFER_HPP
+
+#include <cxxmetrics/exposition_buffer.hpp>
+
+namespace cxxmetrics_prometheus
+{
+
+using cxxmetrics::exposition_buffer;
+using cxxmetrics::fd_sink;
+using cxxmetrics::iovec_sink;
+using cxxmetrics::ostream_sink;
+
+}
+
+#endif //CXXMETRICS_PROMETHEUS_EXPOSITION_BUFFER_HPP
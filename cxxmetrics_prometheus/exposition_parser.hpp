@@ -0,0 +1,416 @@
+#ifndef CXXMETRICS_PROMETHEUS_EXPOSITION_PARSER_HPP
+#define CXXMETRICS_PROMETHEUS_EXPOSITION_PARSER_HPP
+
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <string>
+#if defined(__SSE2__) && defined(__GNUC__)
+#include <emmintrin.h>
+#endif
+#include "snapshot_writer.hpp"
+
+namespace cxxmetrics_prometheus
+{
+
+namespace internal
+{
+
+/**
+ * \brief Find the first of three characters, looking at 16 bytes at a time where SSE2 is available
+ *
+ * \return the first of the characters or end if there aren't any
+ */
+inline const char* find_first_of(const char* begin, const char* end, char a, char b, char c) noexcept
+{
+#if defined(__SSE2__) && defined(__GNUC__)
+    auto first = _mm_set1_epi8(a);
+    auto second = _mm_set1_epi8(b);
+    auto third = _mm_set1_epi8(c);
+    while (end - begin >= 16)
+    {
+        auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+        auto hits = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, first), _mm_cmpeq_epi8(chunk, second)), _mm_cmpeq_epi8(chunk, third));
+        auto mask = _mm_movemask_epi8(hits);
+        if (mask)
+            return begin + __builtin_ctz(static_cast<unsigned>(mask));
+        begin += 16;
+    }
+#endif
+    for (; begin < end; ++begin)
+    {
+        if (*begin == a || *begin == b || *begin == c)
+            return begin;
+    }
+
+    return end;
+}
+
+inline bool is_blank(char c) noexcept
+{
+    return c == ' ' || c == '\t';
+}
+
+inline const char* skip_blanks(const char* at, const char* end) noexcept
+{
+    while (at < end && is_blank(*at))
+        ++at;
+    return at;
+}
+
+/**
+ * \brief Parse a sample value, including the prometheus spellings of the non-finite values
+ *
+ * Values with at most 19 significant digits that fit in a double exactly and a decimal exponent of at most 22 are
+ * parsed with a single exact multiplication or division, which rounds correctly. Anything else goes to strtod.
+ *
+ * \return false if the whole range isn't a number
+ */
+inline bool parse_sample_value(const char* begin, const char* end, double& value) noexcept
+{
+    auto length = static_cast<std::size_t>(end - begin);
+    if (length == 0)
+        return false;
+
+    auto at = begin;
+    bool negative = *at == '-';
+    if (negative || *at == '+')
+        ++at;
+
+    auto rest = static_cast<std::size_t>(end - at);
+    if ((rest == 3 && std::memcmp(at, "Inf", 3) == 0) || (rest == 8 && std::memcmp(at, "Infinity", 8) == 0))
+    {
+        value = negative ? -std::numeric_limits<double>::infinity() : std::numeric_limits<double>::infinity();
+        return true;
+    }
+    if (rest == 3 && std::memcmp(at, "NaN", 3) == 0)
+    {
+        value = std::numeric_limits<double>::quiet_NaN();
+        return true;
+    }
+
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    bool any = false;
+    for (; at < end && *at >= '0' && *at <= '9'; ++at)
+    {
+        any = true;
+        if (digits < 19)
+        {
+            mantissa = mantissa * 10 + static_cast<uint64_t>(*at - '0');
+            digits += mantissa != 0;
+        }
+        else
+            ++exponent;
+    }
+
+    if (at < end && *at == '.')
+    {
+        for (++at; at < end && *at >= '0' && *at <= '9'; ++at)
+        {
+            any = true;
+            if (digits < 19)
+            {
+                mantissa = mantissa * 10 + static_cast<uint64_t>(*at - '0');
+                digits += mantissa != 0;
+                --exponent;
+            }
+        }
+    }
+
+    if (!any)
+        return false;
+
+    if (at < end && (*at == 'e' || *at == 'E'))
+    {
+        ++at;
+        bool negative_exponent = at < end && *at == '-';
+        if (at < end && (*at == '-' || *at == '+'))
+            ++at;
+        if (at == end)
+            return false;
+
+        int written = 0;
+        for (; at < end && *at >= '0' && *at <= '9'; ++at)
+        {
+            if (written < 10000)
+                written = written * 10 + (*at - '0');
+        }
+        exponent += negative_exponent ? -written : written;
+    }
+
+    if (at != end)
+        return false;
+
+    if (mantissa <= (uint64_t(1) << 53) && exponent >= -22 && exponent <= 22)
+    {
+        auto result = static_cast<double>(mantissa);
+        result = exponent < 0 ? result / cxxmetrics::internal::exact_powers_of_10[-exponent] : result * cxxmetrics::internal::exact_powers_of_10[exponent];
+        value = negative ? -result : result;
+        return true;
+    }
+
+    // the value isn't terminated where it ends so strtod gets a copy that is
+    char copy[64];
+    if (length >= sizeof(copy))
+        return false;
+    std::memcpy(copy, begin, length);
+    copy[length] = '\0';
+    char* parsed;
+    value = std::strtod(copy, &parsed);
+    return parsed == copy + length;
+}
+
+/**
+ * \brief What a line of a text exposition turned out to be
+ */
+enum class exposition_line_type
+{
+    sample,
+    type,
+    skipped,
+    invalid
+};
+
+/**
+ * \brief A sample line taken apart in place. The name and labels point into the exposition it was parsed from
+ */
+struct exposition_sample
+{
+    const char* name = nullptr;
+    std::size_t name_size = 0;
+
+    /**
+     * \brief The labels as they're written between the braces, still escaped
+     */
+    const char* labels = nullptr;
+    std::size_t labels_size = 0;
+
+    double value = 0;
+};
+
+/**
+ * \brief A label of a sample, pointing into the labels of the sample
+ */
+struct exposition_label
+{
+    const char* name = nullptr;
+    std::size_t name_size = 0;
+    const char* value = nullptr;
+    std::size_t value_size = 0;
+
+    /**
+     * \brief Whether the value has escapes in it, in which case it has to be unescaped to be used
+     */
+    bool escaped = false;
+
+    bool is(const char* label) const noexcept
+    {
+        auto length = std::strlen(label);
+        return name_size == length && std::memcmp(name, label, length) == 0;
+    }
+
+    std::string unescaped_value() const
+    {
+        if (!escaped)
+            return std::string(value, value_size);
+
+        std::string result;
+        result.reserve(value_size);
+        for (std::size_t i = 0; i < value_size; i++)
+        {
+            auto c = value[i];
+            if (c == '\\' && i + 1 < value_size)
+            {
+                c = value[++i];
+                if (c == 'n')
+                    c = '\n';
+            }
+            result.push_back(c);
+        }
+
+        return result;
+    }
+};
+
+/**
+ * \brief Find the end of a quoted label value, skipping escaped characters
+ *
+ * \return the closing quote or end if there isn't one
+ */
+inline const char* find_closing_quote(const char* at, const char* end, bool& escaped) noexcept
+{
+    while (true)
+    {
+        at = find_first_of(at, end, '"', '\\', '\\');
+        if (at == end || *at == '"')
+            return at;
+
+        escaped = true;
+        at += 2;
+        if (at >= end)
+            return end;
+    }
+}
+
+/**
+ * \brief Take the next label off the labels of a sample
+ *
+ * \return false once there aren't any more labels or if the labels are malformed
+ */
+inline bool next_label(const char*& at, const char* end, exposition_label& label) noexcept
+{
+    at = skip_blanks(at, end);
+    if (at < end && *at == ',')
+        at = skip_blanks(at + 1, end);
+    if (at >= end)
+        return false;
+
+    auto equals = static_cast<const char*>(std::memchr(at, '=', end - at));
+    if (equals == nullptr)
+        return false;
+
+    auto name_end = equals;
+    while (name_end > at && is_blank(name_end[-1]))
+        --name_end;
+    if (name_end == at)
+        return false;
+
+    label.name = at;
+    label.name_size = name_end - at;
+
+    auto quote = skip_blanks(equals + 1, end);
+    if (quote == end || *quote != '"')
+        return false;
+
+    label.escaped = false;
+    auto closing = find_closing_quote(quote + 1, end, label.escaped);
+    if (closing == end)
+        return false;
+
+    label.value = quote + 1;
+    label.value_size = closing - label.value;
+    at = closing + 1;
+    return true;
+}
+
+/**
+ * \brief Parse a prometheus metric type as it's written in a TYPE line
+ */
+inline bool parse_metric_type(const char* begin, const char* end, metric_type& type) noexcept
+{
+    auto is = [begin, end](const char* name) {
+        auto length = std::strlen(name);
+        return static_cast<std::size_t>(end - begin) == length && std::memcmp(begin, name, length) == 0;
+    };
+
+    if (is("counter"))
+        type = metric_type::counter;
+    else if (is("gauge"))
+        type = metric_type::gauge;
+    else if (is("summary"))
+        type = metric_type::summary;
+    else if (is("histogram"))
+        type = metric_type::histogram;
+    else if (is("untyped"))
+        type = metric_type::untyped;
+    else
+        return false;
+
+    return true;
+}
+
+/**
+ * \brief Take apart a line of the text exposition format without copying any of it
+ *
+ * Sample lines are of the form name{labels} value [timestamp], where the labels are optional. The timestamp is
+ * checked but otherwise ignored. TYPE lines give the name of the family in the name of the sample along with its
+ * type. HELP lines, other comments and blank lines are skipped.
+ */
+inline exposition_line_type parse_exposition_line(const char* begin, const char* end, exposition_sample& sample, metric_type& type) noexcept
+{
+    begin = skip_blanks(begin, end);
+    if (begin == end)
+        return exposition_line_type::skipped;
+
+    if (*begin == '#')
+    {
+        auto at = skip_blanks(begin + 1, end);
+        if (end - at < 5 || std::memcmp(at, "TYPE", 4) != 0 || !is_blank(at[4]))
+            return exposition_line_type::skipped;
+
+        at = skip_blanks(at + 5, end);
+        auto name_end = find_first_of(at, end, ' ', '\t', '\t');
+        auto type_begin = skip_blanks(name_end, end);
+        auto type_end = find_first_of(type_begin, end, ' ', '\t', '\t');
+        if (name_end == at || !parse_metric_type(type_begin, type_end, type))
+            return exposition_line_type::invalid;
+
+        sample.name = at;
+        sample.name_size = name_end - at;
+        return exposition_line_type::type;
+    }
+
+    auto name_end = find_first_of(begin, end, '{', ' ', '\t');
+    if (name_end == begin || name_end == end)
+        return exposition_line_type::invalid;
+
+    sample.name = begin;
+    sample.name_size = name_end - begin;
+    sample.labels = name_end;
+    sample.labels_size = 0;
+
+    auto at = name_end;
+    if (*at == '{')
+    {
+        // braces and commas can be in the label values so the values are skipped as a whole
+        auto labels = at + 1;
+        at = labels;
+        while (true)
+        {
+            at = find_first_of(at, end, '"', '}', '}');
+            if (at == end)
+                return exposition_line_type::invalid;
+            if (*at == '}')
+                break;
+
+            bool escaped = false;
+            at = find_closing_quote(at + 1, end, escaped);
+            if (at == end)
+                return exposition_line_type::invalid;
+            ++at;
+        }
+
+        sample.labels = labels;
+        sample.labels_size = at - labels;
+        ++at;
+    }
+
+    auto value = skip_blanks(at, end);
+    auto value_end = find_first_of(value, end, ' ', '\t', '\t');
+    if (!parse_sample_value(value, value_end, sample.value))
+        return exposition_line_type::invalid;
+
+    auto timestamp = skip_blanks(value_end, end);
+    if (timestamp != end)
+    {
+        if (*timestamp == '-')
+            ++timestamp;
+        auto timestamp_end = timestamp;
+        while (timestamp_end < end && *timestamp_end >= '0' && *timestamp_end <= '9')
+            ++timestamp_end;
+        if (timestamp_end == timestamp || skip_blanks(timestamp_end, end) != end)
+            return exposition_line_type::invalid;
+    }
+
+    return exposition_line_type::sample;
+}
+
+}
+
+}
+
+#endif //CXXMETRICS_PROMETHEUS_EXPOSITION_PARSER_HPP
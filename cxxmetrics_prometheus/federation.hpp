@@ -0,0 +1,659 @@
+#ifndef CXXMETRICS_PROMETHEUS_FEDERATION_HPP
+#define CXXMETRICS_PROMETHEUS_FEDERATION_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <cxxmetrics/http_connection.hpp>
+#include <cxxmetrics/metrics_registry.hpp>
+#include "exposition_parser.hpp"
+
+namespace cxxmetrics_prometheus
+{
+
+/**
+ * \brief The settings of a prometheus_federator
+ */
+struct federation_options
+{
+    /**
+     * \brief The IPv4 address of the endpoint to scrape
+     */
+    std::string address = "127.0.0.1";
+
+    /**
+     * \brief The port of the endpoint to scrape. Scraping needs one, merging expositions directly doesn't
+     */
+    uint16_t port = 0;
+
+    /**
+     * \brief The path of the exposition on the endpoint
+     */
+    std::string path = "/metrics";
+
+    /**
+     * \brief How long a scrape can take before it's given up on
+     */
+    std::chrono::milliseconds timeout = std::chrono::seconds(5);
+
+    /**
+     * \brief A path element to put the federated metrics under, or empty to register them at their own names
+     */
+    std::string prefix;
+
+    /**
+     * \brief Tags to add to every federated series. The labels of a series win over these
+     */
+    cxxmetrics::tag_collection tags;
+};
+
+/**
+ * \brief A histogram that's rebuilt from the quantiles of a prometheus summary or the buckets of a prometheus histogram
+ *
+ * The points of the summary or histogram are taken as a curve of the fraction of observations at or below a value,
+ * and the snapshot is a fixed number of values spread evenly along that curve, interpolating linearly between its
+ * points. The quantiles of the snapshot are therefore close to the ones that were scraped, but its mean is only an
+ * approximation of sum / count.
+ */
+class summary_histogram : public cxxmetrics::metric<summary_histogram>
+{
+    static constexpr std::size_t snapshot_size = 128;
+
+    // (quantile, value) for summaries and (upper bound, cumulative count) for histograms, each sorted by its first
+    std::vector<std::pair<double, double>> quantiles_;
+    std::vector<std::pair<double, double>> buckets_;
+    double count_;
+    double sum_;
+    cxxmetrics::internal::change_epoch epoch_;
+    mutable std::mutex lock_;
+
+    static void set_point(std::vector<std::pair<double, double>>& points, double key, double value)
+    {
+        auto fnd = std::lower_bound(points.begin(), points.end(), key, [](const std::pair<double, double>& p, double k) { return p.first < k; });
+        if (fnd != points.end() && fnd->first == key)
+        {
+            if (std::isnan(value))
+                points.erase(fnd);
+            else
+                fnd->second = value;
+        }
+        else if (!std::isnan(value))
+            points.insert(fnd, std::make_pair(key, value));
+    }
+
+    /**
+     * \brief The (fraction, value) points of the curve the snapshot is spread along
+     */
+    std::vector<std::pair<double, double>> curve() const
+    {
+        std::vector<std::pair<double, double>> result;
+        if (!quantiles_.empty())
+        {
+            result = quantiles_;
+            return result;
+        }
+
+        if (buckets_.empty())
+            return result;
+
+        auto total = std::isinf(buckets_.back().first) ? buckets_.back().second : count_;
+        if (!(total > 0))
+            return result;
+
+        // like histogram_quantile, the first bucket starts at 0 unless its bound is below that
+        if (buckets_.front().first > 0)
+            result.emplace_back(0.0, 0.0);
+        for (const auto& bucket : buckets_)
+        {
+            if (!std::isinf(bucket.first))
+                result.emplace_back(std::min(bucket.second / total, 1.0), bucket.first);
+        }
+
+        return result;
+    }
+
+public:
+    summary_histogram() :
+            count_(0),
+            sum_(0)
+    { }
+
+    /**
+     * \brief Set the value of a quantile of a summary, or remove it if the value is NaN
+     */
+    void quantile(double q, double value)
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        set_point(quantiles_, q, value);
+        epoch_.touch();
+    }
+
+    /**
+     * \brief Set the cumulative count of the bucket of a histogram with the given upper bound
+     */
+    void bucket(double le, double cumulative)
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        set_point(buckets_, le, cumulative);
+        epoch_.touch();
+    }
+
+    void count(double count)
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        count_ = count;
+        epoch_.touch();
+    }
+
+    void sum(double sum)
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        sum_ = sum;
+        epoch_.touch();
+    }
+
+    double count() const
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        return count_;
+    }
+
+    double sum() const
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        return sum_;
+    }
+
+    uint64_t epoch() const noexcept
+    {
+        return epoch_.value();
+    }
+
+    cxxmetrics::histogram_snapshot snapshot() const
+    {
+        std::vector<std::pair<double, double>> points;
+        double count;
+        {
+            std::lock_guard<std::mutex> lock(lock_);
+            points = curve();
+            count = count_;
+        }
+
+        std::vector<cxxmetrics::metric_value> values;
+        if (!points.empty())
+        {
+            values.reserve(snapshot_size);
+
+            // the quantiles of a reservoir snapshot put value i at the fraction (i + 1) / (size + 1)
+            std::size_t segment = 0;
+            for (std::size_t i = 0; i < snapshot_size; i++)
+            {
+                auto fraction = static_cast<double>(i + 1) / (snapshot_size + 1);
+                while (segment < points.size() && points[segment].first < fraction)
+                    ++segment;
+
+                double value;
+                if (segment == 0)
+                    value = points.front().second;
+                else if (segment == points.size())
+                    value = points.back().second;
+                else
+                {
+                    const auto& low = points[segment - 1];
+                    const auto& high = points[segment];
+                    value = low.second + (fraction - low.first) / (high.first - low.first) * (high.second - low.second);
+                }
+
+                values.emplace_back(value);
+            }
+        }
+
+        return cxxmetrics::histogram_snapshot(cxxmetrics::reservoir_snapshot::from_sorted(std::move(values)), count > 0 ? static_cast<uint64_t>(std::llround(count)) : 0);
+    }
+};
+
+/**
+ * \brief Federates the text expositions of other processes into the metrics of a registry
+ *
+ * Expositions are parsed in place, a line at a time, and every sample is mapped back to a registry metric by the
+ * TYPE of its family:
+ *
+ * - counters, from their value or _total sample, feed registry counters with how much they went up since the last
+ *   merge, or with their whole value if they went down because the source restarted
+ * - gauges and untyped samples set registry gauges of doubles
+ * - summaries, from their quantile samples, and histograms, from their bucket samples, feed a summary_histogram
+ *   along with their _sum and _count
+ *
+ * Samples that don't belong to the family of the last TYPE line are taken as untyped. Names are split into paths on
+ * ':' and labels become tags. Timestamps are ignored.
+ *
+ * The registry metric of a series is looked up once and kept as a prepared handle. A source exposes its series in the
+ * same order every time, so the handles are also kept in the order they were last seen in and every sample is first
+ * checked against the handle at the same position, only hashing its series when the order changed.
+ *
+ * \tparam TMetricRepo the repository type of the registry
+ */
+template<typename TMetricRepo>
+class prometheus_federator
+{
+public:
+    using counter_type = cxxmetrics::counter<int64_t>;
+    using gauge_type = cxxmetrics::gauge<double>;
+
+private:
+    /**
+     * \brief What a sample is to the series it belongs to
+     */
+    enum class sample_role
+    {
+        value,
+        total,
+        quantile,
+        bucket,
+        sum,
+        count,
+        ignored
+    };
+
+    /**
+     * \brief The registry metric of a series, looked up once
+     */
+    struct prepared_handle
+    {
+        std::string key;
+        std::shared_ptr<counter_type> counter;
+        std::shared_ptr<gauge_type> gauge;
+        std::shared_ptr<summary_histogram> summary;
+
+        // the last total applied to the counter, to turn totals into increments
+        int64_t applied = 0;
+    };
+
+    cxxmetrics::metrics_registry<TMetricRepo>& registry_;
+    federation_options options_;
+
+    std::unordered_map<std::string, std::unique_ptr<prepared_handle>> handles_;
+    std::vector<prepared_handle*> order_;
+    std::string family_;
+    metric_type family_type_;
+    std::string key_;
+    std::mutex lock_;
+
+    cxxmetrics::internal::http_connection connection_;
+    std::string head_;
+    std::string body_;
+    uint64_t connections_;
+    std::mutex scrape_lock_;
+
+    std::atomic<uint64_t> samples_;
+    std::atomic<uint64_t> rejected_;
+
+    static bool is(const char* suffix, std::size_t size, const char* expected) noexcept
+    {
+        auto length = std::strlen(expected);
+        return size == length && std::memcmp(suffix, expected, length) == 0;
+    }
+
+    static sample_role role_of(metric_type type, const char* suffix, std::size_t size, bool& matched) noexcept
+    {
+        matched = true;
+        if (is(suffix, size, "_created"))
+            return sample_role::ignored;
+
+        switch (type)
+        {
+            case metric_type::counter:
+                if (size == 0 || is(suffix, size, "_total"))
+                    return sample_role::total;
+                break;
+            case metric_type::summary:
+                if (size == 0)
+                    return sample_role::quantile;
+                if (is(suffix, size, "_sum"))
+                    return sample_role::sum;
+                if (is(suffix, size, "_count"))
+                    return sample_role::count;
+                if (is(suffix, size, "_mean"))
+                    return sample_role::ignored;
+                break;
+            case metric_type::histogram:
+                if (is(suffix, size, "_bucket"))
+                    return sample_role::bucket;
+                if (is(suffix, size, "_sum"))
+                    return sample_role::sum;
+                if (is(suffix, size, "_count"))
+                    return sample_role::count;
+                break;
+            default:
+                if (size == 0)
+                    return sample_role::value;
+                break;
+        }
+
+        matched = false;
+        return sample_role::value;
+    }
+
+    cxxmetrics::metric_path path_of(const char* name, std::size_t size) const
+    {
+        auto end = name + size;
+        auto colon = static_cast<const char*>(std::memchr(name, ':', size));
+        cxxmetrics::metric_path result(std::string(name, colon ? colon : end));
+        if (!options_.prefix.empty())
+            result = cxxmetrics::metric_path(options_.prefix) / result;
+
+        while (colon)
+        {
+            auto elem = colon + 1;
+            colon = static_cast<const char*>(std::memchr(elem, ':', end - elem));
+            if ((colon ? colon : end) != elem)
+                result = result / cxxmetrics::metric_path(std::string(elem, colon ? colon : end));
+        }
+
+        return result;
+    }
+
+    cxxmetrics::tag_collection tags_of(const internal::exposition_sample& sample) const
+    {
+        std::unordered_map<std::string, cxxmetrics::metric_value> result;
+        auto at = sample.labels;
+        auto end = sample.labels + sample.labels_size;
+        internal::exposition_label label;
+        while (internal::next_label(at, end, label))
+        {
+            if (!label.is("quantile") && !label.is("le"))
+                result.emplace(std::string(label.name, label.name_size), cxxmetrics::metric_value(label.unescaped_value()));
+        }
+
+        for (const auto& tag : options_.tags)
+            result.emplace(tag.first, tag.second);
+
+        return cxxmetrics::tag_collection(result);
+    }
+
+    /**
+     * \brief Get the handle for a series the first time it's seen
+     */
+    prepared_handle* prepare(const char* name, std::size_t size, sample_role role, const internal::exposition_sample& sample)
+    {
+        std::unique_ptr<prepared_handle> handle(new prepared_handle());
+        handle->key = key_;
+        try
+        {
+            auto path = path_of(name, size);
+            auto tags = tags_of(sample);
+            switch (role)
+            {
+                case sample_role::total:
+                    handle->counter = registry_.template counter<int64_t>(path, tags);
+                    break;
+                case sample_role::value:
+                    handle->gauge = registry_.gauge(path, 0.0, tags);
+                    break;
+                default:
+                {
+                    auto summary = std::make_shared<summary_histogram>();
+                    if (registry_.register_existing(path, summary, tags))
+                        handle->summary = std::move(summary);
+                    break;
+                }
+            }
+        }
+        catch (const cxxmetrics::metric_type_mismatch&)
+        {
+            // the handle stays empty so the samples of the series keep being rejected without another lookup
+        }
+
+        return handles_.emplace(key_, std::move(handle)).first->second.get();
+    }
+
+    /**
+     * \brief Build the key of the series of a summary or histogram, which leaves out the quantile or le label
+     *
+     * \return false if the labels are malformed or the quantile or bucket is missing its label
+     */
+    bool summary_key(const internal::exposition_sample& sample, sample_role role, double& bound)
+    {
+        auto at = sample.labels;
+        auto end = sample.labels + sample.labels_size;
+        bool found = false;
+        internal::exposition_label label;
+        while (internal::next_label(at, end, label))
+        {
+            if ((role == sample_role::quantile && label.is("quantile")) || (role == sample_role::bucket && label.is("le")))
+            {
+                found = internal::parse_sample_value(label.value, label.value + label.value_size, bound);
+                continue;
+            }
+
+            key_.append(label.name, label.name_size);
+            key_ += '=';
+            key_ += '"';
+            key_.append(label.value, label.value_size);
+            key_ += '"';
+            key_ += ',';
+        }
+
+        if (at != end)
+            return false;
+
+        return found || (role != sample_role::quantile && role != sample_role::bucket);
+    }
+
+    void apply(const internal::exposition_sample& sample, std::size_t& cursor)
+    {
+        const char* name = sample.name;
+        std::size_t size = sample.name_size;
+        auto role = sample_role::value;
+        if (!family_.empty() && size >= family_.size() && std::memcmp(name, family_.data(), family_.size()) == 0)
+        {
+            bool matched;
+            auto family_role = role_of(family_type_, name + family_.size(), size - family_.size(), matched);
+            if (matched)
+            {
+                role = family_role;
+                size = family_.size();
+            }
+        }
+
+        if (role == sample_role::ignored)
+            return;
+
+        double bound = 0;
+        key_.clear();
+        switch (role)
+        {
+            case sample_role::total:
+                key_ += 'c';
+                break;
+            case sample_role::value:
+                key_ += 'g';
+                break;
+            default:
+                key_ += 's';
+                break;
+        }
+        key_.append(name, size);
+        key_ += '{';
+
+        if (role == sample_role::total || role == sample_role::value)
+            key_.append(sample.labels, sample.labels_size);
+        else if (!summary_key(sample, role, bound))
+        {
+            ++rejected_;
+            return;
+        }
+
+        // a summary has several samples in a row for the same series
+        prepared_handle* handle;
+        if (cursor > 0 && order_[cursor - 1]->key == key_)
+            handle = order_[cursor - 1];
+        else
+        {
+            if (cursor < order_.size() && order_[cursor]->key == key_)
+                handle = order_[cursor];
+            else
+            {
+                auto fnd = handles_.find(key_);
+                handle = fnd != handles_.end() ? fnd->second.get() : prepare(name, size, role, sample);
+                if (cursor < order_.size())
+                    order_[cursor] = handle;
+                else
+                    order_.push_back(handle);
+            }
+            ++cursor;
+        }
+
+        auto value = sample.value;
+        if (handle->counter)
+        {
+            if (!std::isfinite(value) || value < 0)
+            {
+                ++rejected_;
+                return;
+            }
+
+            auto total = std::llround(value);
+            *handle->counter += total >= handle->applied ? total - handle->applied : total;
+            handle->applied = total;
+        }
+        else if (handle->gauge)
+            handle->gauge->set(value);
+        else if (handle->summary)
+        {
+            switch (role)
+            {
+                case sample_role::quantile:
+                    handle->summary->quantile(bound, value);
+                    break;
+                case sample_role::bucket:
+                    handle->summary->bucket(bound, value);
+                    break;
+                case sample_role::sum:
+                    handle->summary->sum(value);
+                    break;
+                default:
+                    handle->summary->count(value);
+                    break;
+            }
+        }
+        else
+            ++rejected_;
+    }
+
+public:
+    prometheus_federator(cxxmetrics::metrics_registry<TMetricRepo>& registry, federation_options options = federation_options()) :
+            registry_(registry),
+            options_(std::move(options)),
+            family_type_(metric_type::untyped),
+            connection_(options_.address, options_.port, options_.timeout),
+            head_("GET " + options_.path + " HTTP/1.1\r\nHost: " + options_.address + ":" + std::to_string(options_.port) +
+                  "\r\nAccept: text/plain;version=0.0.4\r\n\r\n"),
+            connections_(0),
+            samples_(0),
+            rejected_(0)
+    { }
+
+    prometheus_federator(const prometheus_federator&) = delete;
+    prometheus_federator& operator=(const prometheus_federator&) = delete;
+
+    /**
+     * \brief Merge a whole text exposition into the registry
+     */
+    void merge(const char* data, std::size_t size)
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        family_.clear();
+        family_type_ = metric_type::untyped;
+
+        std::size_t cursor = 0;
+        uint64_t samples = 0;
+        auto end = data + size;
+        while (data < end)
+        {
+            auto newline = static_cast<const char*>(std::memchr(data, '\n', end - data));
+            auto line_end = newline ? newline : end;
+            if (line_end > data && line_end[-1] == '\r')
+                --line_end;
+
+            internal::exposition_sample sample;
+            metric_type type;
+            switch (internal::parse_exposition_line(data, line_end, sample, type))
+            {
+                case internal::exposition_line_type::sample:
+                    ++samples;
+                    apply(sample, cursor);
+                    break;
+                case internal::exposition_line_type::type:
+                    family_.assign(sample.name, sample.name_size);
+                    family_type_ = type;
+                    break;
+                case internal::exposition_line_type::invalid:
+                    ++samples;
+                    ++rejected_;
+                    break;
+                default:
+                    break;
+            }
+
+            data = newline ? newline + 1 : end;
+        }
+
+        order_.resize(cursor);
+        samples_.fetch_add(samples, std::memory_order_relaxed);
+    }
+
+    void merge(const std::string& exposition)
+    {
+        merge(exposition.data(), exposition.size());
+    }
+
+    /**
+     * \brief Scrape the configured endpoint and merge its exposition into the registry
+     *
+     * \throws std::invalid_argument if there's no port to scrape
+     *
+     * \return whether the endpoint answered with an exposition that was merged
+     */
+    bool scrape()
+    {
+        if (options_.port == 0)
+            throw std::invalid_argument("scraping needs the port of the endpoint");
+
+        std::lock_guard<std::mutex> lock(scrape_lock_);
+        if (connection_.request(head_, nullptr, 0, connections_, &body_) != 200)
+            return false;
+
+        merge(body_);
+        return true;
+    }
+
+    /**
+     * \brief The number of sample lines merged, including rejected ones
+     */
+    uint64_t samples() const noexcept
+    {
+        return samples_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * \brief The number of sample lines that were malformed or conflicted with the type of a registered metric
+     */
+    uint64_t rejected() const noexcept
+    {
+        return rejected_.load(std::memory_order_relaxed);
+    }
+};
+
+}
+
+#endif //CXXMETRICS_PROMETHEUS_FEDERATION_HPP
@@ -0,0 +1,808 @@
+#ifndef CXXMETRICS_PROMETHEUS_METRICS_HTTP_SERVER_HPP
+#define CXXMETRICS_PROMETHEUS_METRICS_HTTP_SERVER_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "background_publisher.hpp"
+#include "prometheus_publisher.hpp"
+#include "prometheus_protobuf_publisher.hpp"
+
+namespace cxxmetrics_prometheus
+{
+
+/**
+ * \brief The settings of a metrics_http_server
+ */
+struct metrics_http_options
+{
+    /**
+     * \brief The IPv4 address to listen on
+     */
+    std::string address = "0.0.0.0";
+
+    /**
+     * \brief The port to listen on, or 0 to have one picked. The picked port is available from the server
+     */
+    uint16_t port = 0;
+
+    /**
+     * \brief The path the metrics are served at. Any other path gets a 404
+     */
+    std::string path = "/metrics";
+
+    /**
+     * \brief The most scrapes whose responses can be in flight at once. Scrapes beyond it get a 503
+     */
+    std::size_t max_scrapes = 4;
+
+    /**
+     * \brief The most open connections. Connections beyond it are closed as soon as they're accepted
+     */
+    std::size_t max_connections = 64;
+
+    /**
+     * \brief The largest request, headers included, that's accepted before responding with a 431 and closing
+     */
+    std::size_t max_request_size = 8192;
+
+    /**
+     * \brief How long a connection can go without any progress before it's closed
+     */
+    std::chrono::milliseconds idle_timeout = std::chrono::seconds(30);
+
+    /**
+     * \brief How often to render the exposition in the background, or 0 to render it in each scrape
+     *
+     * Scrapes are served the last background render. A format is only rendered in the background once it's been asked
+     * for, and the scrapes that come before its first render wait for it without holding up the server thread. With 0,
+     * every scrape renders on the server thread, so the other connections wait while it does.
+     */
+    std::chrono::milliseconds render_interval = std::chrono::seconds(1);
+
+    /**
+     * \brief Whether to compress the exposition for scrapers that accept it, with the best of the encodings available
+     * in the build
+     *
+     * When rendering in the background, an encoding is compressed in the background along with every render once it's
+     * been asked for.
+     */
+    bool compress = true;
+};
+
+namespace internal
+{
+
+inline bool iequals(const char* a, std::size_t length, const char* b) noexcept
+{
+    if (std::strlen(b) != length)
+        return false;
+
+    for (std::size_t i = 0; i < length; i++)
+    {
+        if (std::tolower(static_cast<unsigned char>(a[i])) != std::tolower(static_cast<unsigned char>(b[i])))
+            return false;
+    }
+    return true;
+}
+
+inline void trim(const char*& begin, const char*& end) noexcept
+{
+    while (begin < end && (*begin == ' ' || *begin == '\t'))
+        ++begin;
+    while (end > begin && (end[-1] == ' ' || end[-1] == '\t'))
+        --end;
+}
+
+/**
+ * \brief Whether an Accept header prefers the protobuf exposition over the text exposition
+ *
+ * Each media range is weighed by its q parameter. Protobuf is only picked when it's weighed strictly higher than the
+ * text format, so clients that don't send an Accept header or that accept anything get text.
+ */
+inline bool prefers_protobuf(const char* accept, std::size_t length) noexcept
+{
+    double protobuf = 0;
+    double text = 0;
+
+    auto end = accept + length;
+    while (accept < end)
+    {
+        auto range_end = std::find(accept, end, ',');
+        auto type_end = std::find(accept, range_end, ';');
+
+        auto type = accept;
+        auto type_last = type_end;
+        trim(type, type_last);
+
+        double q = 1;
+        bool delimited = true;
+        for (auto param = type_end; param < range_end;)
+        {
+            auto name = param + 1;
+            param = std::find(name, range_end, ';');
+            auto value = std::find(name, param, '=');
+            if (value == param)
+                continue;
+
+            auto name_last = value;
+            auto value_first = value + 1;
+            auto value_last = param;
+            trim(name, name_last);
+            trim(value_first, value_last);
+
+            if (iequals(name, name_last - name, "q"))
+                q = std::strtod(std::string(value_first, value_last).c_str(), nullptr);
+            else if (iequals(name, name_last - name, "encoding"))
+                delimited = iequals(value_first, value_last - value_first, "delimited");
+        }
+
+        auto size = static_cast<std::size_t>(type_last - type);
+        if (iequals(type, size, "application/vnd.google.protobuf"))
+        {
+            if (delimited)
+                protobuf = std::max(protobuf, q);
+        }
+        else if (iequals(type, size, "text/plain") || iequals(type, size, "text/*") || iequals(type, size, "*/*"))
+            text = std::max(text, q);
+
+        accept = range_end + (range_end < end ? 1 : 0);
+    }
+
+    return protobuf > text;
+}
+
+/**
+ * \brief The parts of an HTTP request the metrics server acts on
+ */
+struct http_request
+{
+    std::string method;
+    std::string target;
+    bool keep_alive = true;
+    bool protobuf = false;
+    content_encoding encoding = content_encoding::identity;
+    std::size_t length = 0;
+};
+
+/**
+ * \brief Parse the request at the start of a buffer
+ *
+ * \return the size of the request including its body, 0 if the request isn't complete yet, or -1 if it's malformed
+ */
+inline long parse_http_request(const std::string& buffer, http_request& request)
+{
+    auto head_end = buffer.find("\r\n\r\n");
+    if (head_end == std::string::npos)
+        return 0;
+
+    auto line_end = buffer.find("\r\n");
+    auto method_end = buffer.find(' ');
+    if (method_end == std::string::npos || method_end > line_end)
+        return -1;
+    auto target_end = buffer.find(' ', method_end + 1);
+    if (target_end == std::string::npos || target_end > line_end)
+        return -1;
+
+    request.method.assign(buffer, 0, method_end);
+    request.target.assign(buffer, method_end + 1, target_end - method_end - 1);
+
+    auto version = buffer.compare(target_end + 1, line_end - target_end - 1, "HTTP/1.0") == 0;
+    request.keep_alive = !version;
+    request.protobuf = false;
+    request.encoding = content_encoding::identity;
+    request.length = 0;
+
+    auto data = buffer.data();
+    for (auto line = line_end + 2; line < head_end;)
+    {
+        auto next = buffer.find("\r\n", line);
+        auto colon = buffer.find(':', line);
+        if (colon == std::string::npos || colon > next)
+            return -1;
+
+        auto value = data + colon + 1;
+        auto value_end = data + next;
+        trim(value, value_end);
+        auto name = data + line;
+        auto name_size = colon - line;
+        auto value_size = static_cast<std::size_t>(value_end - value);
+
+        if (iequals(name, name_size, "connection"))
+        {
+            if (iequals(value, value_size, "close"))
+                request.keep_alive = false;
+            else if (iequals(value, value_size, "keep-alive"))
+                request.keep_alive = true;
+        }
+        else if (iequals(name, name_size, "accept"))
+            request.protobuf = prefers_protobuf(value, value_size);
+        else if (iequals(name, name_size, "accept-encoding"))
+            request.encoding = negotiate_encoding(value, value_size);
+        else if (iequals(name, name_size, "content-length"))
+            request.length = std::strtoul(std::string(value, value_end).c_str(), nullptr, 10);
+
+        line = next + 2;
+    }
+
+    auto total = head_end + 4 + request.length;
+    return buffer.size() < total ? 0 : static_cast<long>(total);
+}
+
+}
+
+/**
+ * \brief A small HTTP/1.1 server that serves the prometheus exposition of a registry on its own thread
+ *
+ * The server runs a single epoll loop on a thread of its own, so slow scrapers never hold up application threads.
+ * Scrapes that are served the same render all reference it rather than copying it into their connections, and each
+ * writes it with a vectored send, together with its response head, as the socket allows. A connection lets go of the
+ * render once its response has been sent. Connections are kept alive unless the client asks otherwise, and the
+ * exposition format is negotiated from the Accept header between the text and the length-delimited protobuf formats.
+ * The exposition is rendered on a background thread by default, so rendering doesn't hold up the epoll loop either.
+ * Responses are compressed with gzip or zstd when the build has them and the Accept-Encoding header allows it.
+ *
+ * This is only available on Linux.
+ */
+template<typename TMetricRepo>
+class metrics_http_server
+{
+    struct connection
+    {
+        int fd;
+        std::string in;
+        exposition_buffer head;
+        iovec_sink body;
+        std::vector<iovec> parts;
+        std::size_t sent;
+        bool writing;
+        bool send_body;
+        bool close_after;
+        bool scrape;
+        bool waiting;
+        bool eof;
+        internal::http_request request;
+        std::chrono::steady_clock::time_point active;
+
+        explicit connection(int socket) :
+                fd(socket),
+                head(256),
+                sent(0),
+                writing(false),
+                send_body(false),
+                close_after(false),
+                scrape(false),
+                waiting(false),
+                eof(false),
+                active(std::chrono::steady_clock::now())
+        { }
+    };
+
+    metrics_http_options options_;
+    background_publisher<prometheus_publisher<TMetricRepo>> text_;
+    background_publisher<prometheus_protobuf_publisher<TMetricRepo>> protobuf_;
+    bool text_started_;
+    bool protobuf_started_;
+    std::unordered_map<int, std::unique_ptr<connection>> connections_;
+    std::vector<int> waiting_;
+    std::size_t scrapes_;
+    int listen_;
+    int epoll_;
+    int wake_;
+    int rendered_;
+    uint16_t port_;
+    std::atomic_bool running_;
+    std::thread thread_;
+
+    static void check(int result, const char* what)
+    {
+        if (result < 0)
+            throw std::system_error(errno, std::generic_category(), what);
+    }
+
+    void watch(connection& c, uint32_t events)
+    {
+        epoll_event ev{};
+        ev.events = events;
+        ev.data.fd = c.fd;
+        epoll_ctl(epoll_, EPOLL_CTL_MOD, c.fd, &ev);
+    }
+
+    void close(connection& c)
+    {
+        if (c.scrape)
+            --scrapes_;
+        if (c.waiting)
+            waiting_.erase(std::remove(waiting_.begin(), waiting_.end(), c.fd), waiting_.end());
+        epoll_ctl(epoll_, EPOLL_CTL_DEL, c.fd, nullptr);
+        ::close(c.fd);
+        connections_.erase(c.fd);
+    }
+
+    void respond(connection& c, const char* status, const char* content_type, bool keep_alive, bool send_body,
+            content_encoding encoding = content_encoding::identity)
+    {
+        c.head.clear();
+        c.head << "HTTP/1.1 " << status << "\r\nContent-Type: " << content_type << "\r\nContent-Length: " << c.body.size();
+        if (encoding != content_encoding::identity)
+            c.head << "\r\nContent-Encoding: " << encoding_name(encoding);
+        if (options_.compress && status[0] == '2')
+            c.head << "\r\nVary: Accept-Encoding";
+        if (status[0] == '5')
+            c.head << "\r\nRetry-After: 1";
+        c.head << "\r\nConnection: " << (keep_alive ? "keep-alive" : "close") << "\r\n\r\n";
+
+        c.sent = 0;
+        c.writing = true;
+        c.send_body = send_body;
+        c.close_after = !keep_alive;
+    }
+
+    void error(connection& c, const char* status, bool keep_alive)
+    {
+        c.body.clear();
+        c.body << status << '\n';
+        respond(c, status, "text/plain; charset=utf-8", keep_alive, true);
+    }
+
+    void handle(connection& c, const internal::http_request& request)
+    {
+        auto path_end = request.target.find('?');
+        bool head = request.method == "HEAD";
+        if (request.target.compare(0, path_end, options_.path) != 0)
+            return error(c, "404 Not Found", request.keep_alive);
+        if (!head && request.method != "GET")
+            return error(c, "405 Method Not Allowed", request.keep_alive);
+        if (scrapes_ >= options_.max_scrapes)
+            return error(c, "503 Service Unavailable", request.keep_alive);
+
+        ++scrapes_;
+        c.scrape = true;
+        c.request = request;
+        scrape(c);
+    }
+
+    /**
+     * \brief Respond to the scrape of a connection, or park the connection until its format has been rendered
+     */
+    void scrape(connection& c)
+    {
+        if (c.request.protobuf)
+            scrape(protobuf_, protobuf_started_, c);
+        else
+            scrape(text_, text_started_, c);
+    }
+
+    template<typename TPublisher>
+    void scrape(background_publisher<TPublisher>& publisher, bool& started, connection& c)
+    {
+        auto encoding = options_.compress ? c.request.encoding : content_encoding::identity;
+        c.body.clear();
+        if (options_.render_interval.count() <= 0)
+            publisher.publisher().write(c.body, encoding);
+        else
+        {
+            if (encoding != content_encoding::identity)
+                publisher.precompress(encoding);
+
+            if (!started)
+            {
+                publisher.start();
+                started = true;
+            }
+
+            if (!publisher.try_write(c.body, encoding))
+            {
+                // the connection isn't read from until the background thread wakes the loop with the first render
+                c.waiting = true;
+                waiting_.push_back(c.fd);
+                watch(c, 0);
+                return;
+            }
+        }
+
+        respond(c, "200 OK", publisher.content_type(), c.request.keep_alive, c.request.method != "HEAD", encoding);
+    }
+
+    /**
+     * \brief Respond to the scrapes that were waiting for a render, now that one has been swapped in
+     */
+    void resume()
+    {
+        uint64_t renders;
+        auto drained = ::read(rendered_, &renders, sizeof(renders));
+        (void)drained;
+
+        auto waiting = std::move(waiting_);
+        waiting_.clear();
+        for (auto fd : waiting)
+        {
+            auto& c = *connections_.at(fd);
+            c.waiting = false;
+            scrape(c);
+            if (!c.waiting && flush(c))
+                process(c);
+        }
+    }
+
+    /**
+     * \brief Send as much of the response as the socket takes
+     *
+     * \return false if the connection was closed
+     */
+    bool flush(connection& c)
+    {
+        auto head = c.head.size();
+        auto total = head + (c.send_body ? c.body.size() : 0);
+        while (c.sent < total)
+        {
+            c.parts.clear();
+            if (c.sent < head)
+                c.parts.push_back(iovec{const_cast<char*>(c.head.data() + c.sent), head - c.sent});
+            if (c.send_body)
+            {
+                auto skip = c.sent > head ? c.sent - head : 0;
+                for (const auto& piece : c.body.pieces())
+                {
+                    if (skip >= piece.iov_len)
+                    {
+                        skip -= piece.iov_len;
+                        continue;
+                    }
+
+                    c.parts.push_back(iovec{static_cast<char*>(piece.iov_base) + skip, piece.iov_len - skip});
+                    skip = 0;
+                    if (c.parts.size() == IOV_MAX)
+                        break;
+                }
+            }
+
+            // sendmsg is writev with flags, which keeps a closed peer from raising SIGPIPE in the application
+            msghdr message{};
+            message.msg_iov = c.parts.data();
+            message.msg_iovlen = c.parts.size();
+            auto written = ::sendmsg(c.fd, &message, MSG_NOSIGNAL);
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                {
+                    watch(c, EPOLLOUT);
+                    return true;
+                }
+
+                close(c);
+                return false;
+            }
+
+            c.sent += static_cast<std::size_t>(written);
+            c.active = std::chrono::steady_clock::now();
+        }
+
+        c.writing = false;
+        c.body.clear();
+        if (c.scrape)
+        {
+            c.scrape = false;
+            --scrapes_;
+        }
+
+        if (c.close_after)
+        {
+            close(c);
+            return false;
+        }
+
+        watch(c, EPOLLIN | EPOLLRDHUP);
+        return true;
+    }
+
+    /**
+     * \brief Answer the requests that have been read in full, one at a time
+     */
+    void process(connection& c)
+    {
+        while (!c.writing && !c.waiting)
+        {
+            internal::http_request request;
+            auto size = internal::parse_http_request(c.in, request);
+            if (size < 0)
+            {
+                error(c, "400 Bad Request", false);
+                c.in.clear();
+            }
+            else if (size == 0)
+            {
+                // a half closed connection still gets the responses to everything it sent in full
+                if (c.eof)
+                {
+                    close(c);
+                    return;
+                }
+                if (c.in.size() <= options_.max_request_size)
+                    return;
+
+                error(c, "431 Request Header Fields Too Large", false);
+                c.in.clear();
+            }
+            else
+            {
+                c.in.erase(0, static_cast<std::size_t>(size));
+                handle(c, request);
+                if (c.waiting)
+                    return;
+            }
+
+            if (!flush(c))
+                return;
+        }
+    }
+
+    void receive(connection& c)
+    {
+        char data[4096];
+        while (!c.eof)
+        {
+            auto received = ::recv(c.fd, data, sizeof(data), 0);
+            if (received > 0)
+            {
+                c.in.append(data, static_cast<std::size_t>(received));
+                c.active = std::chrono::steady_clock::now();
+            }
+            else if (received == 0)
+                c.eof = true;
+            else if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            else if (errno != EINTR)
+            {
+                close(c);
+                return;
+            }
+        }
+
+        process(c);
+    }
+
+    void accept()
+    {
+        while (true)
+        {
+            auto fd = ::accept4(listen_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0)
+            {
+                if (errno == EINTR || errno == ECONNABORTED)
+                    continue;
+                return;
+            }
+
+            if (connections_.size() >= options_.max_connections)
+            {
+                ::close(fd);
+                continue;
+            }
+
+            int on = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+            epoll_event ev{};
+            ev.events = EPOLLIN | EPOLLRDHUP;
+            ev.data.fd = fd;
+            if (epoll_ctl(epoll_, EPOLL_CTL_ADD, fd, &ev) < 0)
+            {
+                ::close(fd);
+                continue;
+            }
+
+            connections_.emplace(fd, std::unique_ptr<connection>(new connection(fd)));
+        }
+    }
+
+    void expire()
+    {
+        auto cutoff = std::chrono::steady_clock::now() - options_.idle_timeout;
+        for (auto it = connections_.begin(); it != connections_.end();)
+        {
+            auto& c = *(it++)->second;
+            if (c.active < cutoff)
+                close(c);
+        }
+    }
+
+    void run()
+    {
+        epoll_event events[64];
+        auto tick = std::min<std::chrono::milliseconds>(options_.idle_timeout, std::chrono::seconds(1));
+        while (running_.load(std::memory_order_acquire))
+        {
+            auto ready = epoll_wait(epoll_, events, 64, static_cast<int>(tick.count()));
+            for (int i = 0; i < ready; i++)
+            {
+                auto fd = events[i].data.fd;
+                if (fd == wake_)
+                    return;
+                if (fd == rendered_)
+                {
+                    resume();
+                    continue;
+                }
+                if (fd == listen_)
+                {
+                    accept();
+                    continue;
+                }
+
+                auto found = connections_.find(fd);
+                if (found == connections_.end())
+                    continue;
+
+                auto& c = *found->second;
+                if (events[i].events & (EPOLLERR | EPOLLHUP))
+                    close(c);
+                else if (c.writing && (events[i].events & EPOLLOUT))
+                {
+                    if (flush(c))
+                        process(c);
+                }
+                else if (!c.writing && (events[i].events & (EPOLLIN | EPOLLRDHUP)))
+                    receive(c);
+            }
+
+            expire();
+        }
+    }
+
+    void release() noexcept
+    {
+        for (auto& c : connections_)
+            ::close(c.first);
+        connections_.clear();
+        waiting_.clear();
+        scrapes_ = 0;
+
+        if (listen_ >= 0)
+            ::close(listen_);
+        if (epoll_ >= 0)
+            ::close(epoll_);
+        if (wake_ >= 0)
+            ::close(wake_);
+        if (rendered_ >= 0)
+            ::close(rendered_);
+        listen_ = epoll_ = wake_ = rendered_ = -1;
+    }
+
+public:
+    metrics_http_server(cxxmetrics::metrics_registry<TMetricRepo>& registry, metrics_http_options options = metrics_http_options()) :
+            options_(std::move(options)),
+            text_(registry, options_.render_interval),
+            protobuf_(registry, options_.render_interval),
+            text_started_(false),
+            protobuf_started_(false),
+            scrapes_(0),
+            listen_(-1),
+            epoll_(-1),
+            wake_(-1),
+            rendered_(-1),
+            port_(0),
+            running_(false)
+    {
+        auto notify = [this]() {
+            uint64_t one = 1;
+            auto written = ::write(rendered_, &one, sizeof(one));
+            (void)written;
+        };
+        text_.on_render(notify);
+        protobuf_.on_render(notify);
+    }
+
+    metrics_http_server(const metrics_http_server&) = delete;
+    metrics_http_server& operator=(const metrics_http_server&) = delete;
+
+    ~metrics_http_server()
+    {
+        stop();
+    }
+
+    /**
+     * \brief Start listening and serving scrapes on the server thread
+     *
+     * \throws std::system_error if the server can't listen on the configured address and port
+     */
+    void start()
+    {
+        if (running_.load())
+            return;
+
+        try
+        {
+            sockaddr_in address{};
+            address.sin_family = AF_INET;
+            address.sin_port = htons(options_.port);
+            if (inet_pton(AF_INET, options_.address.c_str(), &address.sin_addr) != 1)
+                throw std::system_error(std::make_error_code(std::errc::invalid_argument), "invalid listen address");
+
+            check(listen_ = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0), "socket");
+            int on = 1;
+            setsockopt(listen_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+            check(::bind(listen_, reinterpret_cast<sockaddr*>(&address), sizeof(address)), "bind");
+            check(::listen(listen_, 128), "listen");
+
+            socklen_t length = sizeof(address);
+            check(getsockname(listen_, reinterpret_cast<sockaddr*>(&address), &length), "getsockname");
+            port_ = ntohs(address.sin_port);
+
+            check(epoll_ = epoll_create1(EPOLL_CLOEXEC), "epoll_create1");
+            check(wake_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC), "eventfd");
+            check(rendered_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC), "eventfd");
+
+            epoll_event ev{};
+            ev.events = EPOLLIN;
+            ev.data.fd = listen_;
+            check(epoll_ctl(epoll_, EPOLL_CTL_ADD, listen_, &ev), "epoll_ctl");
+            ev.data.fd = wake_;
+            check(epoll_ctl(epoll_, EPOLL_CTL_ADD, wake_, &ev), "epoll_ctl");
+            ev.data.fd = rendered_;
+            check(epoll_ctl(epoll_, EPOLL_CTL_ADD, rendered_, &ev), "epoll_ctl");
+        }
+        catch (...)
+        {
+            release();
+            throw;
+        }
+
+        running_.store(true, std::memory_order_release);
+        thread_ = std::thread([this]() { run(); });
+    }
+
+    /**
+     * \brief Stop serving, closing the listening socket and every open connection
+     */
+    void stop()
+    {
+        if (!running_.exchange(false))
+            return;
+
+        uint64_t one = 1;
+        auto written = ::write(wake_, &one, sizeof(one));
+        (void)written;
+        thread_.join();
+
+        // the background renders wake the loop through rendered_, so they're stopped before it's closed
+        text_.stop();
+        protobuf_.stop();
+        text_started_ = protobuf_started_ = false;
+        release();
+    }
+
+    /**
+     * \brief The port the server is listening on, once started
+     */
+    uint16_t port() const noexcept
+    {
+        return port_;
+    }
+};
+
+}
+
+#endif //CXXMETRICS_PROMETHEUS_METRICS_HTTP_SERVER_HPP
@@ -6,22 +6,22 @@
 namespace cxxmetrics_prometheus
 {
 
-template<>
-class snapshot_writer<cxxmetrics::cumulative_value_snapshot>
+template<typename TOutput>
+class snapshot_writer<cxxmetrics::cumulative_value_snapshot, TOutput>
 {
     void write_header() const
     {
         // use untyped instead of counters since counters can be negative per https://prometheus.io/docs/instrumenting/writing_exporters/
-        stream << "# TYPE " << internal::name(path) << " untyped\n";
+        stream.header(name, metric_type::untyped, std::string());
     }
 
     CXXMETRICS_PROMETHEUS_SNAPSHOT_WRITER_INIT
 public:
 
-    void write(const cxxmetrics::tag_collection& tags, const cxxmetrics::cumulative_value_snapshot& snapshot)
+    void write(const std::string& labels, const cxxmetrics::cumulative_value_snapshot& snapshot)
     {
         // metric_name
-        stream << internal::name(path) << '{' << internal::tags(tags) << "} " << internal::scale_value(snapshot.value(), options.value_options()) << "\n";
+        stream.sample(name, labels, internal::scale_value(snapshot.value(), options.value_options()));
     }
 };
 
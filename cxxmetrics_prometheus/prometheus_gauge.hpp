@@ -6,21 +6,21 @@
 namespace cxxmetrics_prometheus
 {
 
-template<>
-class snapshot_writer<cxxmetrics::average_value_snapshot>
+template<typename TOutput>
+class snapshot_writer<cxxmetrics::average_value_snapshot, TOutput>
 {
     void write_header() const
     {
-        stream << "# TYPE " << internal::name(path) << " gauge\n";
+        stream.header(name, metric_type::gauge, std::string());
     }
 
     CXXMETRICS_PROMETHEUS_SNAPSHOT_WRITER_INIT
 public:
 
-    void write(const cxxmetrics::tag_collection& tags, const cxxmetrics::average_value_snapshot& snapshot)
+    void write(const std::string& labels, const cxxmetrics::average_value_snapshot& snapshot)
     {
         // metric_name
-        stream << internal::name(path) << '{' << internal::tags(tags) << "} " << internal::scale_value(snapshot.value(), options.value_options()) << "\n";
+        stream.sample(name, labels, internal::scale_value(snapshot.value(), options.value_options()));
     }
 };
 
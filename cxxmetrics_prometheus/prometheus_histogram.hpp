@@ -6,29 +6,41 @@
 namespace cxxmetrics_prometheus
 {
 
-template<>
-class snapshot_writer<cxxmetrics::histogram_snapshot>
+template<typename TOutput>
+class snapshot_writer<cxxmetrics::histogram_snapshot, TOutput>
 {
     void write_header() const
     {
-        stream << "# TYPE " << internal::name(path) << " summary\n";
+        stream.header(name, options.histogram_options().buckets() ? metric_type::histogram : metric_type::summary, std::string());
     }
 
     CXXMETRICS_PROMETHEUS_SNAPSHOT_WRITER_INIT
 public:
 
-    void write(const cxxmetrics::tag_collection& tags, const cxxmetrics::histogram_snapshot& snapshot)
+    void write(const std::string& labels, const cxxmetrics::histogram_snapshot& snapshot)
     {
-        const char* comma = "";
-        if (tags.begin() != tags.end())
-            comma = ",";
-
-        if (options.histogram_options().include_count())
-            stream << internal::name(path) << "_count{" << internal::tags(tags) << "} " << internal::scale_value(snapshot.count(), options.histogram_options()) << "\n";
-
-        stream << internal::name(path) << "_mean{" << internal::tags(tags) << "} " << internal::scale_value(snapshot.mean(), options.histogram_options()) << "\n";
-        options.histogram_options().quantiles()->visit(snapshot, [&](cxxmetrics::quantile q, cxxmetrics::metric_value&& value) {
-            stream << internal::name(path) << '{' << "quantile=\"" << (q.percentile() / 100.0) << "\"" << comma << internal::tags(tags) << "} " << internal::scale_value(std::move(value), options.histogram_options()) << "\n";
+        const auto& opts = options.histogram_options();
+        if (opts.buckets())
+        {
+            const auto& bounds = opts.buckets()->bounds();
+            const double factor = internal::scale_multiplier(opts);
+            std::vector<uint64_t> cumulative(bounds.size());
+            snapshot.bucket_counts(bounds, [factor](const cxxmetrics::metric_value& value) {
+                return static_cast<double>(value) * factor;
+            }, cumulative.data());
+
+            stream.histogram(name, labels, bounds, cumulative.data(), snapshot.count(),
+                    static_cast<double>(snapshot.mean()) * factor * snapshot.count());
+            return;
+        }
+
+        auto summary = stream.summary(name, labels,
+                internal::scale_value(snapshot.count(), opts),
+                internal::scale_value(snapshot.mean(), opts),
+                opts.include_count());
+
+        opts.quantiles()->visit(snapshot, [&](cxxmetrics::quantile q, cxxmetrics::metric_value&& value) {
+            summary.quantile(q, internal::scale_value(std::move(value), opts));
         });
     }
 };
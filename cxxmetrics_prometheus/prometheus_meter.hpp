@@ -6,27 +6,23 @@
 namespace cxxmetrics_prometheus
 {
 
-template<>
-class snapshot_writer<cxxmetrics::meter_snapshot>
+template<typename TOutput>
+class snapshot_writer<cxxmetrics::meter_snapshot, TOutput>
 {
     void write_header() const
     {
-        stream << "# TYPE " << internal::name(path) << " gauge\n";
+        stream.header(name, metric_type::gauge, std::string());
     }
 
     CXXMETRICS_PROMETHEUS_SNAPSHOT_WRITER_INIT
 public:
 
-    void write(const cxxmetrics::tag_collection& tags, const cxxmetrics::meter_snapshot& snapshot)
+    void write(const std::string& labels, const cxxmetrics::meter_snapshot& snapshot)
     {
-        const char* comma = "";
-        if (tags.begin() != tags.end())
-            comma = ",";
-
         if (options.meter_options().include_mean())
-            stream << internal::name(path) << '{' << "window=\"mean\"" << comma << internal::tags(tags) << "} " << internal::scale_value(snapshot.value(), options.meter_options()) << "\n";
+            stream.window(name, "", labels, "mean", internal::scale_value(snapshot.value(), options.meter_options()));
         for (const auto& window : snapshot)
-            stream << internal::name(path) << '{' << "window=\"" << internal::window(window.first) << "\"" << comma << internal::tags(tags) << "} " << internal::scale_value(cxxmetrics::metric_value(window.second), options.meter_options()) << "\n";
+            stream.window(name, "", labels, internal::window(window.first), internal::scale_value(cxxmetrics::metric_value(window.second), options.meter_options()));
     }
 };
 
@@ -0,0 +1,192 @@
+#ifndef CXXMETRICS_PROMETHEUS_PROTOBUF_PUBLISHER_HPP
+#define CXXMETRICS_PROMETHEUS_PROTOBUF_PUBLISHER_HPP
+
+#include <chrono>
+#include <mutex>
+#include <cxxmetrics/publisher.hpp>
+#include "protobuf_exposition.hpp"
+#include "series_lookup.hpp"
+#include "single_flight.hpp"
+#include "prometheus_counter.hpp"
+#include "prometheus_gauge.hpp"
+#include "prometheus_meter.hpp"
+#include "prometheus_histogram.hpp"
+#include "prometheus_timer.hpp"
+
+namespace cxxmetrics_prometheus
+{
+
+namespace internal
+{
+
+/**
+ * \brief The publish plan of a registered metric with its escaped name and the protobuf encoded labels of its series
+ */
+class protobuf_series_labels : public cxxmetrics::publish_plan
+{
+    series_lookup<std::string> labels_;
+    std::string name_;
+    std::mutex lock_;
+public:
+    void lock() { lock_.lock(); }
+    void unlock() { lock_.unlock(); }
+
+    void compile(const cxxmetrics::metric_path& path)
+    {
+        if (name_.empty())
+            name_ = escaped_name(path);
+    }
+
+    const std::string& name() const noexcept
+    {
+        return name_;
+    }
+
+    /**
+     * \brief start looking up the labels of a render from the first series, which are all the metric's own
+     */
+    void rewind() noexcept
+    {
+        labels_.rewind(true);
+    }
+
+    const std::string& get(const cxxmetrics::tag_collection& tags)
+    {
+        return labels_.get(tags, [](const cxxmetrics::tag_collection& t) { return protobuf_exposition::labels(t); });
+    }
+};
+
+}
+
+/**
+ * \brief A publisher that writes the prometheus length-delimited protobuf exposition format
+ *
+ * This writes the same metrics as the prometheus_publisher, using the same snapshot writers, as a sequence of
+ * varint length prefixed io.prometheus.client.MetricFamily messages. The messages are encoded directly so
+ * there's no dependency on a protobuf library.
+ */
+template<typename TMetricRepo>
+class prometheus_protobuf_publisher : public cxxmetrics::metrics_publisher<TMetricRepo>
+{
+    internal::single_flight flight_;
+
+public:
+    prometheus_protobuf_publisher(cxxmetrics::metrics_registry<TMetricRepo>& registry) :
+            cxxmetrics::metrics_publisher<TMetricRepo>(registry)
+    { }
+
+    /**
+     * \brief The content type of the exposition to use when serving it over http
+     */
+    static const char* content_type() noexcept
+    {
+        return "application/vnd.google.protobuf; proto=io.prometheus.client.MetricFamily; encoding=delimited";
+    }
+
+    /**
+     * \brief Append the exposition of every registered metric to a buffer
+     *
+     * Writes that overlap are coalesced so that only one of them collects the registry and the rest share its output.
+     */
+    void write(exposition_buffer& into)
+    {
+        auto rendered = flight_.get([this](rendered_exposition& buffer) { render(buffer, content_encoding::identity); });
+        into.append(rendered->data(), rendered->size());
+    }
+
+    /**
+     * \brief Append the exposition of every registered metric to a buffer, compressed in an encoding
+     *
+     * A write that renders compresses the exposition in pieces as it's rendered. Writes that share its render share
+     * its compressed body as well, and a write that shares a render made for another encoding compresses it once for
+     * every write after it that wants the same encoding.
+     *
+     * \throws std::invalid_argument if the encoding isn't available in this build
+     */
+    void write(exposition_buffer& into, content_encoding encoding)
+    {
+        auto rendered = flight_.get([this, encoding](rendered_exposition& buffer) { render(buffer, encoding); });
+        const auto& body = rendered->encoded(encoding);
+        into.append(body.data(), body.size());
+    }
+
+    /**
+     * \brief Append the exposition of every registered metric to a list of buffers, in an encoding and without copying
+     * it
+     *
+     * The sink references the render, which it keeps alive until it's cleared. Writes are coalesced like they are for
+     * any other write.
+     *
+     * \throws std::invalid_argument if the encoding isn't available in this build
+     */
+    void write(iovec_sink& into, content_encoding encoding = content_encoding::identity)
+    {
+        auto rendered = flight_.get([this, encoding](rendered_exposition& buffer) { render(buffer, encoding); });
+        const auto& body = rendered->encoded(encoding);
+        into.append_reference(body.data(), body.size(), rendered);
+    }
+
+    /**
+     * \brief Set how long after a render started it may still be shared with writes that weren't in flight with it
+     *
+     * Writes that arrive while another write is rendering always share its output. By default that's the only output
+     * they share.
+     */
+    void max_staleness(std::chrono::steady_clock::duration staleness)
+    {
+        flight_.max_staleness(staleness);
+    }
+
+    /**
+     * \brief Write the exposition of every registered metric to a stream
+     */
+    void write(std::ostream& into)
+    {
+        flight_.get([this](rendered_exposition& buffer) { render(buffer, content_encoding::identity); })->write_to(into);
+    }
+
+private:
+    void render(rendered_exposition& into, content_encoding encoding)
+    {
+        cxxmetrics::internal::timed_scope<cxxmetrics::internal::self_stat::scrape_ns> timed;
+        auto start = into.size();
+
+        into.compress_as_rendered(encoding);
+        protobuf_exposition out(into);
+        this->visit_all([this, &into, &out](const cxxmetrics::metric_path& path, cxxmetrics::basic_registered_metric& metric) {
+            if (path.begin() == path.end())
+                return;
+
+            auto& labels = this->template get_data_for<internal::protobuf_series_labels>(metric);
+            std::lock_guard<internal::protobuf_series_labels> lock(labels);
+            if (this->refresh_plan(metric, labels))
+                labels.compile(path);
+            labels.rewind();
+
+            const auto& options = labels.options();
+            const auto& name = labels.name();
+            bool written = false;
+            metric.visit([&](const cxxmetrics::tag_collection& tags, const auto& snapshot) {
+                using snapshot_type = typename std::decay<decltype(snapshot)>::type;
+                snapshot_writer<snapshot_type, protobuf_exposition> writer(out, path, name, written, options);
+                writer.write(labels.get(tags), snapshot);
+            });
+
+            out.flush();
+            into.compress_rendered();
+        });
+        into.compress_rendered(true);
+
+        if (cxxmetrics::internal::self_metrics_enabled)
+        {
+            cxxmetrics::internal::self_metric_add(cxxmetrics::internal::self_stat::scrape_bytes, into.size() - start);
+            cxxmetrics::internal::self_metric_add(cxxmetrics::internal::self_stat::scrapes, 1);
+        }
+    }
+};
+
+}
+
+#undef CXXMETRICS_PROMETHEUS_SNAPSHOT_WRITER_INIT
+
+#endif //CXXMETRICS_PROMETHEUS_PROTOBUF_PUBLISHER_HPP
@@ -1,7 +1,13 @@
 #ifndef CXXMETRICS_PROMETHEUS_PUBLISHER_HPP
 #define CXXMETRICS_PROMETHEUS_PUBLISHER_HPP
 
+#include <chrono>
+#include <mutex>
+#include <type_traits>
 #include <cxxmetrics/publisher.hpp>
+#include "exposition_buffer.hpp"
+#include "series_lookup.hpp"
+#include "single_flight.hpp"
 #include "prometheus_counter.hpp"
 #include "prometheus_gauge.hpp"
 #include "prometheus_meter.hpp"
@@ -11,29 +17,393 @@
 namespace cxxmetrics_prometheus
 {
 
+namespace internal
+{
+
+/**
+ * \brief The publish plan of a registered metric along with the last rendered exposition of every one of its series
+ *
+ * This is attached to the registered metric as publisher data. Series whose change epoch hasn't moved since
+ * they were rendered are written straight from here without being snapshotted again.
+ */
+class series_cache : public cxxmetrics::publish_plan
+{
+public:
+    /**
+     * \brief The escaped labels of a series along with the text it was last rendered to
+     */
+    class series
+    {
+        friend class series_cache;
+
+        uint64_t epoch_ = 0;
+        std::string labels_;
+        std::string text_;
+    public:
+        const std::string& labels() const noexcept
+        {
+            return labels_;
+        }
+    };
+
+private:
+    series_lookup<series> series_;
+    std::string name_;
+    std::string header_;
+    std::mutex lock_;
+public:
+    void lock() { lock_.lock(); }
+    void unlock() { lock_.unlock(); }
+
+    /**
+     * \brief compile the plan after its options were refreshed, dropping the text rendered with the old ones
+     */
+    void compile(const cxxmetrics::metric_path& path)
+    {
+        // the escaped name and labels don't depend on the options so they're kept
+        series_.each([](series& s) {
+            s.epoch_ = 0;
+            s.text_.clear();
+        });
+
+        header_.clear();
+        if (name_.empty())
+            name_ = escaped_name(path);
+    }
+
+    /**
+     * \brief get the escaped prometheus name of the metric
+     */
+    const std::string& name() const noexcept
+    {
+        return name_;
+    }
+
+    const std::string& header() const noexcept
+    {
+        return header_;
+    }
+
+    void header(const char* text, std::size_t length)
+    {
+        header_.assign(text, length);
+    }
+
+    /**
+     * \brief start looking up the series of a render from the first one
+     *
+     * \param stable whether the series are visited with the registered metric's own tags
+     */
+    void rewind(bool stable) noexcept
+    {
+        series_.rewind(stable);
+    }
+
+    /**
+     * \brief get the series for a set of tags, escaping its labels the first time it's seen
+     */
+    series& get(const cxxmetrics::tag_collection& tags)
+    {
+        return series_.get(tags, [](const cxxmetrics::tag_collection& t) {
+            series result;
+            result.labels_ = text_exposition::labels(t);
+            return result;
+        });
+    }
+
+    /**
+     * \brief get the cached text for the series if it was rendered at the specified epoch
+     */
+    const std::string* find(const cxxmetrics::tag_collection& tags, uint64_t epoch)
+    {
+        auto& result = get(tags);
+        if (!result.epoch_ || result.epoch_ != epoch)
+            return nullptr;
+
+        return &result.text_;
+    }
+
+    void store(series& s, uint64_t epoch, const char* text, std::size_t length)
+    {
+        s.epoch_ = epoch;
+        s.text_.assign(text, length);
+    }
+};
+
+/**
+ * \brief Where the parts of a render that are kept in the series cache are written before they go to the sink
+ *
+ * Sinks that don't keep what's written to them get the parts through a scratch buffer that they're copied out of.
+ */
+template<typename TSink, bool = std::is_base_of<exposition_buffer, TSink>::value>
+class series_capture
+{
+    TSink& into_;
+    exposition_buffer scratch_;
+public:
+    explicit series_capture(TSink& into) :
+            into_(into),
+            scratch_(1024)
+    { }
+
+    exposition_buffer& buffer() noexcept { return scratch_; }
+    void begin() noexcept { scratch_.clear(); }
+    const char* data() const noexcept { return scratch_.data(); }
+    std::size_t size() const noexcept { return scratch_.size(); }
+    void commit() { into_.append(scratch_.data(), scratch_.size()); }
+};
+
+/**
+ * \brief Buffers keep what's written to them, so the parts are written straight into them and copied from there
+ */
+template<typename TSink>
+class series_capture<TSink, true>
+{
+    exposition_buffer& into_;
+    std::size_t at_;
+public:
+    explicit series_capture(TSink& into) noexcept :
+            into_(into),
+            at_(0)
+    { }
+
+    exposition_buffer& buffer() noexcept { return into_; }
+    void begin() noexcept { at_ = into_.size(); }
+    const char* data() const noexcept { return into_.data() + at_; }
+    std::size_t size() const noexcept { return into_.size() - at_; }
+    void commit() noexcept { }
+};
+
+/**
+ * \brief Called after every metric is rendered, which lets a render that's compressed as it's rendered compress it
+ */
+template<typename TSink>
+void metric_rendered(TSink&)
+{ }
+
+inline void metric_rendered(rendered_exposition& into)
+{
+    into.compress_rendered();
+}
+
+}
+
 template<typename TMetricRepo>
 class prometheus_publisher : public cxxmetrics::metrics_publisher<TMetricRepo>
 {
+    internal::single_flight flight_;
+
 public:
     prometheus_publisher(cxxmetrics::metrics_registry<TMetricRepo>& registry) :
             cxxmetrics::metrics_publisher<TMetricRepo>(registry)
     { }
 
+    /**
+     * \brief The content type of the exposition to use when serving it over http
+     */
+    static const char* content_type() noexcept
+    {
+        return "text/plain; version=0.0.4; charset=utf-8";
+    }
+
+    /**
+     * \brief Append the exposition of every registered metric to a buffer
+     *
+     * Series that track changes and haven't changed since the last write are copied from the output of the
+     * last write instead of being snapshotted and formatted again. The output is the same either way.
+     *
+     * Writes that overlap are coalesced so that only one of them collects the registry and the rest share its output.
+     */
+    void write(exposition_buffer& into)
+    {
+        auto rendered = flight_.get([this](rendered_exposition& buffer) { render(buffer, content_encoding::identity); });
+        into.append(rendered->data(), rendered->size());
+    }
+
+    /**
+     * \brief Append the exposition of every registered metric to a buffer, compressed in an encoding
+     *
+     * A write that renders compresses the exposition in pieces as it's rendered. Writes that share its render share
+     * its compressed body as well, and a write that shares a render made for another encoding compresses it once for
+     * every write after it that wants the same encoding.
+     *
+     * \throws std::invalid_argument if the encoding isn't available in this build
+     */
+    void write(exposition_buffer& into, content_encoding encoding)
+    {
+        auto rendered = flight_.get([this, encoding](rendered_exposition& buffer) { render(buffer, encoding); });
+        const auto& body = rendered->encoded(encoding);
+        into.append(body.data(), body.size());
+    }
+
+    /**
+     * \brief Append the exposition of a collected snapshot of the registry to a buffer
+     *
+     * Any number of publishers can render the same snapshot at once, and none of them snapshot a metric themselves.
+     * Writes of a snapshot aren't coalesced with other writes since the snapshot already fixes what they render.
+     */
+    void write(const cxxmetrics::registry_snapshot& snapshot, exposition_buffer& into)
+    {
+        render_to(into, &snapshot);
+    }
+
+    /**
+     * \brief Append the exposition of every registered metric to a list of buffers, without copying it
+     *
+     * The sink references the render, which it keeps alive until it's cleared, so the exposition can be written
+     * with a single writev. Writes are coalesced like they are for any other write.
+     */
+    void write(iovec_sink& into)
+    {
+        auto rendered = flight_.get([this](rendered_exposition& buffer) { render(buffer, content_encoding::identity); });
+        into.append_reference(rendered->data(), rendered->size(), rendered);
+    }
+
+    /**
+     * \brief Append the exposition of every registered metric to a list of buffers compressed in an encoding, without
+     * copying it
+     *
+     * The compressed body is shared like it is for write(exposition_buffer&, content_encoding) and referenced along
+     * with the render it belongs to.
+     *
+     * \throws std::invalid_argument if the encoding isn't available in this build
+     */
+    void write(iovec_sink& into, content_encoding encoding)
+    {
+        auto rendered = flight_.get([this, encoding](rendered_exposition& buffer) { render(buffer, encoding); });
+        const auto& body = rendered->encoded(encoding);
+        into.append_reference(body.data(), body.size(), rendered);
+    }
+
+    /**
+     * \brief Render the exposition of every registered metric straight into an output sink
+     *
+     * The exposition goes to the sink as it's rendered instead of being rendered into a buffer first, and the
+     * snapshot writers are compiled for the sink so that their writes to it can be inlined. Writes to a sink aren't
+     * coalesced with other writes. See cxxmetrics::output_sink for what a sink has to provide.
+     */
+    template<typename TSink>
+    void write_to(TSink& sink)
+    {
+        render_to(sink, nullptr);
+    }
+
+    /**
+     * \brief Render the exposition of a collected snapshot of the registry straight into an output sink
+     */
+    template<typename TSink>
+    void write_to(const cxxmetrics::registry_snapshot& snapshot, TSink& sink)
+    {
+        render_to(sink, &snapshot);
+    }
+
+    /**
+     * \brief Set how long after a render started it may still be shared with writes that weren't in flight with it
+     *
+     * Writes that arrive while another write is rendering always share its output. By default that's the only output
+     * they share.
+     */
+    void max_staleness(std::chrono::steady_clock::duration staleness)
+    {
+        flight_.max_staleness(staleness);
+    }
+
+    /**
+     * \brief Write the exposition of every registered metric to a stream
+     *
+     * The exposition is rendered into a buffer that's kept between writes and then written to the stream in one go
+     */
     void write(std::ostream& into)
     {
-        this->visit_all([this, &into](const cxxmetrics::metric_path& name, cxxmetrics::basic_registered_metric& metric) {
-            const auto& options = this->effective_options(metric);
-            bool header = false;
+        flight_.get([this](rendered_exposition& buffer) { render(buffer, content_encoding::identity); })->write_to(into);
+    }
+
+private:
+    void render(rendered_exposition& into, content_encoding encoding)
+    {
+        into.compress_as_rendered(encoding);
+        render_to(into, nullptr);
+        into.compress_rendered(true);
+    }
+
+    template<typename TSink>
+    void render_to(TSink& into, const cxxmetrics::registry_snapshot* snapshot)
+    {
+        cxxmetrics::internal::timed_scope<cxxmetrics::internal::self_stat::scrape_ns> timed;
+        auto start = into.size();
 
-            if (name.begin() == name.end())
+        // buffers all get the writers compiled for exposition_buffer rather than their own
+        using direct_sink = typename std::conditional<std::is_base_of<exposition_buffer, TSink>::value, exposition_buffer, TSink>::type;
+        using direct_exposition = basic_text_exposition<direct_sink>;
+        direct_exposition text(into);
+        internal::series_capture<TSink> capture(into);
+        text_exposition captured(capture.buffer());
+        this->visit_families(snapshot, [this, snapshot, &into, &text, &capture, &captured](const cxxmetrics::metric_path& path, cxxmetrics::basic_registered_metric& metric, auto& series) {
+            if (path.begin() == path.end())
                 return;
 
-            metric.visit([&](const cxxmetrics::tag_collection& tags, const auto& snapshot) {
+            auto& cache = this->template get_data_for<internal::series_cache>(metric);
+            std::lock_guard<internal::series_cache> lock(cache);
+            if (this->refresh_plan(metric, cache))
+                cache.compile(path);
+            cache.rewind(snapshot == nullptr);
+
+            const auto& options = cache.options();
+            const auto& name = cache.name();
+            bool header = false;
+            auto write_header = [&]() {
+                if (!header)
+                {
+                    into << cache.header();
+                    header = true;
+                }
+            };
+
+            series.visit_changed([&](const cxxmetrics::tag_collection& tags, uint64_t epoch) {
+                auto cached = cache.find(tags, epoch);
+                if (cached == nullptr)
+                    return false;
+
+                write_header();
+                into << *cached;
+                return true;
+            }, [&](const cxxmetrics::tag_collection& tags, uint64_t epoch, const auto& snapshot) {
                 using snapshot_type = typename std::decay<decltype(snapshot)>::type;
-                snapshot_writer<snapshot_type> writer(into, name, header, options);
-                writer.write(tags, snapshot);
+                bool written = !cache.header().empty();
+                if (!written)
+                {
+                    capture.begin();
+                    snapshot_writer<snapshot_type> writer(captured, path, name, written, options);
+                    cache.header(capture.data(), capture.size());
+                    capture.commit();
+                    header = true;
+                }
+
+                write_header();
+                auto& series = cache.get(tags);
+                if (!epoch)
+                {
+                    // series that don't track changes are never written from the cache so they go straight to the sink
+                    snapshot_writer<snapshot_type, direct_exposition> writer(text, path, name, written, options);
+                    writer.write(series.labels(), snapshot);
+                    return;
+                }
+
+                capture.begin();
+                snapshot_writer<snapshot_type> writer(captured, path, name, written, options);
+                writer.write(series.labels(), snapshot);
+                cache.store(series, epoch, capture.data(), capture.size());
+                capture.commit();
             });
+
+            internal::metric_rendered(into);
         });
+
+        if (cxxmetrics::internal::self_metrics_enabled)
+        {
+            cxxmetrics::internal::self_metric_add(cxxmetrics::internal::self_stat::scrape_bytes, into.size() - start);
+            cxxmetrics::internal::self_metric_add(cxxmetrics::internal::self_stat::scrapes, 1);
+        }
     }
 };
 
@@ -6,45 +6,55 @@
 namespace cxxmetrics_prometheus
 {
 
-template<>
-class snapshot_writer<cxxmetrics::timer_snapshot>
+template<typename TOutput>
+class snapshot_writer<cxxmetrics::timer_snapshot, TOutput>
 {
     void write_header() const
     {
-        stream << "# HELP " << internal::name(path) << " " << path.join("/") << " in microseconds\n";
-        stream << "# TYPE " << internal::name(path) << " summary\n";
+        stream.header(name, options.timer_options().buckets() ? metric_type::histogram : metric_type::summary, path.join("/") + " in microseconds");
     }
 
     CXXMETRICS_PROMETHEUS_SNAPSHOT_WRITER_INIT
 public:
 
-    void write(const cxxmetrics::tag_collection& tags, const cxxmetrics::timer_snapshot& snapshot)
+    void write(const std::string& labels, const cxxmetrics::timer_snapshot& snapshot)
     {
-        const char* comma = "";
-        if (tags.begin() != tags.end())
-            comma = ",";
-
-        if (options.timer_options().include_count())
-            stream << internal::name(path) << "_count{" << internal::tags(tags) << "} " << internal::scale_value(snapshot.count(), options.timer_options()) << "\n";
-
-        stream << internal::name(path) << "_mean{" << internal::tags(tags) << "} " << internal::scale_value(std::chrono::duration_cast<std::chrono::microseconds>(static_cast<std::chrono::nanoseconds>(snapshot.mean())), options.timer_options()) << "\n";
-        options.timer_options().quantiles()->visit(snapshot, [&](cxxmetrics::quantile q, cxxmetrics::metric_value&& value) {
-            stream << internal::name(path) <<
-                    '{' << "quantile=\"" << (q.percentile() / 100.0) << "\"" << comma <<
-                    internal::tags(tags) << "} " <<
-                    internal::scale_value(std::chrono::duration_cast<std::chrono::microseconds>(static_cast<std::chrono::nanoseconds>(value)), options.timer_options()) << "\n";
-        });
-
-        if (options.timer_options().include_rates())
+        const auto& opts = options.timer_options();
+        if (opts.buckets())
         {
-            if (options.timer_options().include_mean())
-                stream << internal::name(path) << ":rates{" << "window=\"mean\"" << comma << internal::tags(tags) << "} " << internal::scale_value(snapshot.rate().value(), options.timer_options()) << "\n";
+            const auto& bounds = opts.buckets()->bounds();
+            const double factor = internal::scale_multiplier(opts) / 1000;
+            std::vector<uint64_t> cumulative(bounds.size());
+            snapshot.bucket_counts(bounds, [factor](const cxxmetrics::metric_value& value) {
+                // compare the exact microseconds rather than truncating them so values just past a bound land above it
+                return static_cast<std::chrono::nanoseconds>(value).count() * factor;
+            }, cumulative.data());
+
+            stream.histogram(name, labels, bounds, cumulative.data(), snapshot.count(),
+                    static_cast<std::chrono::nanoseconds>(snapshot.mean()).count() * factor * snapshot.count());
+        }
+        else
+        {
+            auto summary = stream.summary(name, labels,
+                    internal::scale_value(snapshot.count(), opts),
+                    internal::scale_value(std::chrono::duration_cast<std::chrono::microseconds>(static_cast<std::chrono::nanoseconds>(snapshot.mean())), opts),
+                    opts.include_count());
+
+            opts.quantiles()->visit(snapshot, [&](cxxmetrics::quantile q, cxxmetrics::metric_value&& value) {
+                summary.quantile(q, internal::scale_value(std::chrono::duration_cast<std::chrono::microseconds>(static_cast<std::chrono::nanoseconds>(value)), opts));
+            });
+        }
+
+        if (opts.include_rates())
+        {
+            if (opts.include_mean())
+                stream.window(name, ":rates", labels, "mean", internal::scale_value(snapshot.rate().value(), opts));
             for (const auto& window : snapshot.rate())
-                stream << internal::name(path) << ":rates{" << "window=\"" << internal::window(window.first) << "\"" << comma << internal::tags(tags) << "} " << internal::scale_value(cxxmetrics::metric_value(window.second), options.timer_options()) << "\n";
+                stream.window(name, ":rates", labels, internal::window(window.first), internal::scale_value(cxxmetrics::metric_value(window.second), opts));
         }
     }
 };
 
 }
 
-#endif //CXXMETRICS_PROMETHEUS_HISTOGRAM_HPP
+#endif //CXXMETRICS_PROMETHEUS_TIMER_HPP
@@ -0,0 +1,388 @@
+#ifndef CXXMETRICS_PROMETHEUS_PROTOBUF_EXPOSITION_HPP
+#define CXXMETRICS_PROMETHEUS_PROTOBUF_EXPOSITION_HPP
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include "snapshot_writer.hpp"
+
+namespace cxxmetrics_prometheus
+{
+
+namespace internal
+{
+
+/**
+ * \brief Protobuf wire encoding for the handful of field types used by the prometheus client model
+ */
+namespace protobuf
+{
+
+enum class wire_type : uint32_t
+{
+    varint = 0,
+    fixed64 = 1,
+    length_delimited = 2
+};
+
+inline exposition_buffer& append_varint(exposition_buffer& into, uint64_t value)
+{
+    char bytes[10];
+    std::size_t length = 0;
+    while (value >= 0x80)
+    {
+        bytes[length++] = static_cast<char>((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    bytes[length++] = static_cast<char>(value);
+
+    return into.append(bytes, length);
+}
+
+inline exposition_buffer& append_key(exposition_buffer& into, uint32_t field, wire_type type)
+{
+    return append_varint(into, (static_cast<uint64_t>(field) << 3) | static_cast<uint32_t>(type));
+}
+
+inline exposition_buffer& append_varint_field(exposition_buffer& into, uint32_t field, uint64_t value)
+{
+    append_key(into, field, wire_type::varint);
+    return append_varint(into, value);
+}
+
+inline exposition_buffer& append_double_field(exposition_buffer& into, uint32_t field, double value)
+{
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+
+    // fixed64 is always little endian on the wire
+    char bytes[8];
+    for (int i = 0; i < 8; i++)
+        bytes[i] = static_cast<char>((bits >> (i * 8)) & 0xff);
+
+    append_key(into, field, wire_type::fixed64);
+    return into.append(bytes, sizeof(bytes));
+}
+
+inline exposition_buffer& append_bytes_field(exposition_buffer& into, uint32_t field, const char* data, std::size_t length)
+{
+    append_key(into, field, wire_type::length_delimited);
+    append_varint(into, length);
+    return into.append(data, length);
+}
+
+inline exposition_buffer& append_bytes_field(exposition_buffer& into, uint32_t field, const exposition_buffer& message)
+{
+    return append_bytes_field(into, field, message.data(), message.size());
+}
+
+inline exposition_buffer& append_bytes_field(exposition_buffer& into, uint32_t field, const std::string& value)
+{
+    return append_bytes_field(into, field, value.data(), value.size());
+}
+
+// field numbers from io.prometheus.client metrics.proto
+namespace fields
+{
+constexpr uint32_t label_name = 1;
+constexpr uint32_t label_value = 2;
+
+constexpr uint32_t value = 1;
+
+constexpr uint32_t quantile_quantile = 1;
+constexpr uint32_t quantile_value = 2;
+
+constexpr uint32_t summary_sample_count = 1;
+constexpr uint32_t summary_sample_sum = 2;
+constexpr uint32_t summary_quantile = 3;
+
+constexpr uint32_t bucket_cumulative_count = 1;
+constexpr uint32_t bucket_upper_bound = 2;
+
+constexpr uint32_t histogram_sample_count = 1;
+constexpr uint32_t histogram_sample_sum = 2;
+constexpr uint32_t histogram_bucket = 3;
+
+constexpr uint32_t metric_label = 1;
+constexpr uint32_t metric_gauge = 2;
+constexpr uint32_t metric_counter = 3;
+constexpr uint32_t metric_summary = 4;
+constexpr uint32_t metric_untyped = 5;
+constexpr uint32_t metric_histogram = 7;
+
+constexpr uint32_t family_name = 1;
+constexpr uint32_t family_help = 2;
+constexpr uint32_t family_type = 3;
+constexpr uint32_t family_metric = 4;
+}
+
+}
+
+}
+
+/**
+ * \brief The length-delimited protobuf exposition format that snapshot writers write into
+ *
+ * Every registered metric is written as one or more MetricFamily messages, each preceded by its length as a
+ * varint. Since a family holds every series of the metric, the samples are collected per family while the
+ * series are written and the families are only written out on flush().
+ */
+class protobuf_exposition
+{
+    struct family
+    {
+        std::string suffix;
+        metric_type type;
+        std::string help;
+        exposition_buffer metrics;
+        bool used;
+
+        family(const char* s, metric_type t) :
+                suffix(s),
+                type(t),
+                metrics(1024),
+                used(false)
+        { }
+    };
+
+    exposition_buffer& out_;
+    std::string name_;
+    std::vector<family> families_;
+    exposition_buffer metric_;
+    exposition_buffer message_;
+    exposition_buffer quantiles_;
+    exposition_buffer scratch_;
+
+    family& get_family(const char* suffix, metric_type type)
+    {
+        for (auto& f : families_)
+        {
+            if (f.suffix == suffix)
+            {
+                if (!f.used)
+                {
+                    f.type = type;
+                    f.help.clear();
+                    f.used = true;
+                }
+                return f;
+            }
+        }
+
+        families_.emplace_back(suffix, type);
+        families_.back().used = true;
+        return families_.back();
+    }
+
+    static uint32_t value_field(metric_type type) noexcept
+    {
+        switch (type)
+        {
+            case metric_type::counter:
+                return internal::protobuf::fields::metric_counter;
+            case metric_type::gauge:
+                return internal::protobuf::fields::metric_gauge;
+            default:
+                return internal::protobuf::fields::metric_untyped;
+        }
+    }
+
+    void add_metric(family& f)
+    {
+        internal::protobuf::append_bytes_field(f.metrics, internal::protobuf::fields::family_metric, metric_);
+        metric_.clear();
+    }
+
+public:
+    explicit protobuf_exposition(exposition_buffer& out) :
+            out_(out),
+            metric_(256),
+            message_(1024),
+            quantiles_(256),
+            scratch_(256)
+    { }
+
+    /**
+     * \brief Get the labels of a series, encoded as the LabelPair fields of a Metric message
+     */
+    static std::string labels(const cxxmetrics::tag_collection& tags)
+    {
+        exposition_buffer result(128);
+        exposition_buffer pair(64);
+        exposition_buffer text(64);
+        for (const auto& tag : tags)
+        {
+            pair.clear();
+            text.clear();
+            internal::format_name_element(text, tag.first);
+            internal::protobuf::append_bytes_field(pair, internal::protobuf::fields::label_name, text);
+
+            text.clear();
+            text << tag.second;
+            internal::protobuf::append_bytes_field(pair, internal::protobuf::fields::label_value, text);
+
+            internal::protobuf::append_bytes_field(result, internal::protobuf::fields::metric_label, pair);
+        }
+
+        return result.str();
+    }
+
+    void header(const std::string& name, metric_type type, const std::string& help)
+    {
+        name_ = name;
+        get_family("", type).help = help;
+    }
+
+    void sample(const std::string&, const std::string& labels, const cxxmetrics::metric_value& value)
+    {
+        auto& f = get_family("", metric_type::untyped);
+        message_.clear();
+        internal::protobuf::append_double_field(message_, internal::protobuf::fields::value, static_cast<double>(value));
+
+        metric_.append(labels);
+        internal::protobuf::append_bytes_field(metric_, value_field(f.type), message_);
+        add_metric(f);
+    }
+
+    /**
+     * \brief Write a gauge sample with a window label into the family named with the suffix after the metric name
+     */
+    template<typename TWindow>
+    void window(const std::string&, const char* suffix, const std::string& labels, const TWindow& window, const cxxmetrics::metric_value& value)
+    {
+        auto& f = get_family(suffix, metric_type::gauge);
+
+        scratch_.clear();
+        message_.clear();
+        scratch_ << window;
+        internal::protobuf::append_bytes_field(message_, internal::protobuf::fields::label_name, "window", 6);
+        internal::protobuf::append_bytes_field(message_, internal::protobuf::fields::label_value, scratch_);
+        internal::protobuf::append_bytes_field(metric_, internal::protobuf::fields::metric_label, message_);
+        metric_.append(labels);
+
+        message_.clear();
+        internal::protobuf::append_double_field(message_, internal::protobuf::fields::value, static_cast<double>(value));
+        internal::protobuf::append_bytes_field(metric_, value_field(f.type), message_);
+        add_metric(f);
+    }
+
+    /**
+     * \brief Collects the quantiles of a summary and adds the summary to its family when it goes away
+     */
+    class summary_writer
+    {
+        protobuf_exposition* parent_;
+        const std::string& labels_;
+        uint64_t count_;
+        double sum_;
+    public:
+        summary_writer(protobuf_exposition& parent, const std::string& labels, uint64_t count, double sum) :
+                parent_(&parent),
+                labels_(labels),
+                count_(count),
+                sum_(sum)
+        {
+            parent_->quantiles_.clear();
+        }
+
+        summary_writer(summary_writer&& other) noexcept :
+                parent_(other.parent_),
+                labels_(other.labels_),
+                count_(other.count_),
+                sum_(other.sum_)
+        {
+            other.parent_ = nullptr;
+        }
+
+        summary_writer(const summary_writer&) = delete;
+        summary_writer& operator=(const summary_writer&) = delete;
+
+        void quantile(const cxxmetrics::quantile& q, const cxxmetrics::metric_value& value)
+        {
+            // quantiles are stored in fixed point so they're rounded back to what was asked for like the text labels
+            auto& message = parent_->message_;
+            message.clear();
+            internal::protobuf::append_double_field(message, internal::protobuf::fields::quantile_quantile, std::round(static_cast<double>(q.percentile()) * 1e4) / 1e6);
+            internal::protobuf::append_double_field(message, internal::protobuf::fields::quantile_value, static_cast<double>(value));
+            internal::protobuf::append_bytes_field(parent_->quantiles_, internal::protobuf::fields::summary_quantile, message);
+        }
+
+        ~summary_writer()
+        {
+            if (!parent_)
+                return;
+
+            auto& message = parent_->message_;
+            message.clear();
+            internal::protobuf::append_varint_field(message, internal::protobuf::fields::summary_sample_count, count_);
+            internal::protobuf::append_double_field(message, internal::protobuf::fields::summary_sample_sum, sum_);
+            message.append(parent_->quantiles_.data(), parent_->quantiles_.size());
+
+            auto& metric = parent_->metric_;
+            metric.append(labels_);
+            internal::protobuf::append_bytes_field(metric, internal::protobuf::fields::metric_summary, message);
+            parent_->add_metric(parent_->get_family("", metric_type::summary));
+        }
+    };
+
+    /**
+     * \brief Start a summary with its count and mean and get a writer for its quantiles
+     */
+    summary_writer summary(const std::string&, const std::string& labels, const cxxmetrics::metric_value& count, const cxxmetrics::metric_value& mean, bool)
+    {
+        auto samples = static_cast<uint64_t>(count);
+        return summary_writer(*this, labels, samples, static_cast<double>(mean) * samples);
+    }
+
+    /**
+     * \brief Add a histogram with its cumulative buckets, sum and count
+     */
+    void histogram(const std::string&, const std::string& labels, const std::vector<double>& bounds, const uint64_t* cumulative, uint64_t count, double sum)
+    {
+        message_.clear();
+        internal::protobuf::append_varint_field(message_, internal::protobuf::fields::histogram_sample_count, count);
+        internal::protobuf::append_double_field(message_, internal::protobuf::fields::histogram_sample_sum, sum);
+        for (std::size_t i = 0; i < bounds.size(); i++)
+        {
+            scratch_.clear();
+            internal::protobuf::append_varint_field(scratch_, internal::protobuf::fields::bucket_cumulative_count, cumulative[i]);
+            internal::protobuf::append_double_field(scratch_, internal::protobuf::fields::bucket_upper_bound, bounds[i]);
+            internal::protobuf::append_bytes_field(message_, internal::protobuf::fields::histogram_bucket, scratch_);
+        }
+
+        metric_.append(labels);
+        internal::protobuf::append_bytes_field(metric_, internal::protobuf::fields::metric_histogram, message_);
+        add_metric(get_family("", metric_type::histogram));
+    }
+
+    /**
+     * \brief Write out the families of the current metric
+     */
+    void flush()
+    {
+        for (auto& f : families_)
+        {
+            if (!f.used)
+                continue;
+
+            message_.clear();
+            scratch_.clear();
+            scratch_ << name_ << f.suffix;
+            internal::protobuf::append_bytes_field(message_, internal::protobuf::fields::family_name, scratch_);
+            if (!f.help.empty())
+                internal::protobuf::append_bytes_field(message_, internal::protobuf::fields::family_help, f.help);
+            internal::protobuf::append_varint_field(message_, internal::protobuf::fields::family_type, static_cast<uint64_t>(f.type));
+            message_.append(f.metrics.data(), f.metrics.size());
+
+            internal::protobuf::append_varint(out_, message_.size());
+            out_.append(message_.data(), message_.size());
+
+            f.metrics.clear();
+            f.used = false;
+        }
+    }
+};
+
+}
+
+#endif //CXXMETRICS_PROMETHEUS_PROTOBUF_EXPOSITION_HPP
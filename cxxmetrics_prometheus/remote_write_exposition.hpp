@@ -0,0 +1,306 @@
+#ifndef CXXMETRICS_PROMETHEUS_REMOTE_WRITE_EXPOSITION_HPP
+#define CXXMETRICS_PROMETHEUS_REMOTE_WRITE_EXPOSITION_HPP
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+#include "protobuf_exposition.hpp"
+
+namespace cxxmetrics_prometheus
+{
+
+namespace internal
+{
+
+namespace protobuf
+{
+
+// field numbers from prometheus remote.proto and types.proto
+namespace remote_fields
+{
+constexpr uint32_t request_timeseries = 1;
+constexpr uint32_t request_metadata = 3;
+
+constexpr uint32_t series_label = 1;
+constexpr uint32_t series_sample = 2;
+
+constexpr uint32_t sample_value = 1;
+constexpr uint32_t sample_timestamp = 2;
+
+constexpr uint32_t metadata_type = 1;
+constexpr uint32_t metadata_family_name = 2;
+constexpr uint32_t metadata_help = 4;
+}
+
+}
+
+inline uint64_t read_varint(const char*& at) noexcept
+{
+    uint64_t value = 0;
+    for (int shift = 0; ; shift += 7)
+    {
+        auto byte = static_cast<uint8_t>(*at++);
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return value;
+    }
+}
+
+inline bool name_less(const char* a, std::size_t a_length, const char* b, std::size_t b_length) noexcept
+{
+    auto compared = std::memcmp(a, b, std::min(a_length, b_length));
+    return compared < 0 || (compared == 0 && a_length < b_length);
+}
+
+}
+
+/**
+ * \brief The prometheus remote write format that snapshot writers write into
+ *
+ * Every sample is written as a TimeSeries message of a WriteRequest with the timestamp of the publish, and every
+ * metric gets a MetricMetadata message for its type. The series are the same ones the text exposition has.
+ *
+ * Remote write receivers expect the labels of a series sorted by name, so the labels of a series are encoded as
+ * Label messages sorted by name once, and the name and the label that a sample adds, such as le, are merged into
+ * them as they're copied.
+ */
+class remote_write_exposition
+{
+    exposition_buffer& out_;
+    int64_t timestamp_;
+    exposition_buffer series_;
+    exposition_buffer label_;
+    exposition_buffer name_;
+    exposition_buffer extra_;
+
+    void append_label(const char* name, std::size_t name_length, const char* value, std::size_t value_length)
+    {
+        label_.clear();
+        internal::protobuf::append_bytes_field(label_, internal::protobuf::fields::label_name, name, name_length);
+        internal::protobuf::append_bytes_field(label_, internal::protobuf::fields::label_value, value, value_length);
+        internal::protobuf::append_bytes_field(series_, internal::protobuf::remote_fields::series_label, label_);
+    }
+
+    /**
+     * \brief Write a series with the sample's name and possibly one more label merged into the labels of the series
+     */
+    void write_series(const std::string& labels, const char* extra, double value)
+    {
+        static const char name_label[] = "__name__";
+        struct pending_label
+        {
+            const char* name;
+            std::size_t name_length;
+            const exposition_buffer* value;
+        } pending[2] = {
+                {name_label, sizeof(name_label) - 1, &name_},
+                {extra, extra ? std::strlen(extra) : 0, &extra_}
+        };
+
+        series_.clear();
+        std::size_t next = 0;
+        const std::size_t count = extra ? 2 : 1;
+
+        const char* at = labels.data();
+        const char* end = at + labels.size();
+        while (at != end)
+        {
+            // every entry is a length delimited Label that starts with its length delimited name
+            const char* entry = at;
+            ++at;
+            auto length = internal::read_varint(at);
+            const char* label_end = at + length;
+            ++at;
+            auto name_length = internal::read_varint(at);
+
+            while (next < count && internal::name_less(pending[next].name, pending[next].name_length, at, name_length))
+            {
+                append_label(pending[next].name, pending[next].name_length, pending[next].value->data(), pending[next].value->size());
+                ++next;
+            }
+
+            series_.append(entry, label_end - entry);
+            at = label_end;
+        }
+
+        for (; next < count; ++next)
+            append_label(pending[next].name, pending[next].name_length, pending[next].value->data(), pending[next].value->size());
+
+        label_.clear();
+        internal::protobuf::append_double_field(label_, internal::protobuf::remote_fields::sample_value, value);
+        internal::protobuf::append_varint_field(label_, internal::protobuf::remote_fields::sample_timestamp, static_cast<uint64_t>(timestamp_));
+        internal::protobuf::append_bytes_field(series_, internal::protobuf::remote_fields::series_sample, label_);
+
+        internal::protobuf::append_bytes_field(out_, internal::protobuf::remote_fields::request_timeseries, series_);
+    }
+
+    void write_series(const std::string& name, const char* suffix, const std::string& labels, double value)
+    {
+        name_.clear();
+        name_ << name << suffix;
+        write_series(labels, nullptr, value);
+    }
+
+    static uint64_t metadata_type(metric_type type) noexcept
+    {
+        // MetricMetadata numbers its types differently from the client model
+        switch (type)
+        {
+            case metric_type::counter:
+                return 1;
+            case metric_type::gauge:
+                return 2;
+            case metric_type::histogram:
+                return 3;
+            case metric_type::summary:
+                return 5;
+            default:
+                return 0;
+        }
+    }
+
+public:
+    /**
+     * \param out the buffer the messages of the WriteRequest are appended to
+     * \param timestamp the timestamp of every sample in milliseconds since the epoch
+     */
+    remote_write_exposition(exposition_buffer& out, int64_t timestamp) :
+            out_(out),
+            timestamp_(timestamp),
+            series_(256),
+            label_(128),
+            name_(64),
+            extra_(32)
+    { }
+
+    /**
+     * \brief Get the labels of a series, encoded as Label messages of a TimeSeries sorted by name
+     *
+     * \param external labels to add to every series, which the tags of the series take precedence over
+     */
+    static std::string labels(const cxxmetrics::tag_collection& tags, const std::vector<std::pair<std::string, std::string>>& external = {})
+    {
+        std::vector<std::pair<std::string, std::string>> sorted;
+        exposition_buffer text(64);
+        for (const auto& tag : tags)
+        {
+            text.clear();
+            internal::format_name_element(text, tag.first);
+            auto name = text.str();
+
+            text.clear();
+            text << tag.second;
+            sorted.emplace_back(std::move(name), text.str());
+        }
+
+        for (const auto& label : external)
+        {
+            auto exists = std::find_if(sorted.begin(), sorted.end(), [&](const std::pair<std::string, std::string>& l) {
+                return l.first == label.first;
+            });
+            if (exists == sorted.end())
+                sorted.push_back(label);
+        }
+
+        std::sort(sorted.begin(), sorted.end());
+
+        exposition_buffer result(128);
+        exposition_buffer pair(64);
+        for (const auto& label : sorted)
+        {
+            pair.clear();
+            internal::protobuf::append_bytes_field(pair, internal::protobuf::fields::label_name, label.first);
+            internal::protobuf::append_bytes_field(pair, internal::protobuf::fields::label_value, label.second);
+            internal::protobuf::append_bytes_field(result, internal::protobuf::remote_fields::series_label, pair);
+        }
+
+        return result.str();
+    }
+
+    void header(const std::string& name, metric_type type, const std::string& help)
+    {
+        label_.clear();
+        internal::protobuf::append_varint_field(label_, internal::protobuf::remote_fields::metadata_type, metadata_type(type));
+        internal::protobuf::append_bytes_field(label_, internal::protobuf::remote_fields::metadata_family_name, name);
+        if (!help.empty())
+            internal::protobuf::append_bytes_field(label_, internal::protobuf::remote_fields::metadata_help, help);
+        internal::protobuf::append_bytes_field(out_, internal::protobuf::remote_fields::request_metadata, label_);
+    }
+
+    void sample(const std::string& name, const std::string& labels, const cxxmetrics::metric_value& value)
+    {
+        write_series(name, "", labels, static_cast<double>(value));
+    }
+
+    /**
+     * \brief Write a sample with a window label, named with the suffix after the metric name
+     */
+    template<typename TWindow>
+    void window(const std::string& name, const char* suffix, const std::string& labels, const TWindow& window, const cxxmetrics::metric_value& value)
+    {
+        name_.clear();
+        name_ << name << suffix;
+        extra_.clear();
+        extra_ << window;
+        write_series(labels, "window", static_cast<double>(value));
+    }
+
+    class summary_writer
+    {
+        remote_write_exposition& parent_;
+        const std::string& name_;
+        const std::string& labels_;
+    public:
+        summary_writer(remote_write_exposition& parent, const std::string& name, const std::string& labels) noexcept :
+                parent_(parent),
+                name_(name),
+                labels_(labels)
+        { }
+
+        void quantile(const cxxmetrics::quantile& q, const cxxmetrics::metric_value& value)
+        {
+            parent_.name_.clear();
+            parent_.name_ << name_;
+            parent_.extra_.clear();
+            parent_.extra_ << internal::quantile(q);
+            parent_.write_series(labels_, "quantile", static_cast<double>(value));
+        }
+    };
+
+    /**
+     * \brief Write the count and mean of a summary and get a writer for its quantiles
+     */
+    summary_writer summary(const std::string& name, const std::string& labels, const cxxmetrics::metric_value& count, const cxxmetrics::metric_value& mean, bool include_count)
+    {
+        if (include_count)
+            write_series(name, "_count", labels, static_cast<double>(count));
+        write_series(name, "_mean", labels, static_cast<double>(mean));
+        return summary_writer(*this, name, labels);
+    }
+
+    /**
+     * \brief Write the cumulative buckets of a histogram followed by its sum and count
+     */
+    void histogram(const std::string& name, const std::string& labels, const std::vector<double>& bounds, const uint64_t* cumulative, uint64_t count, double sum)
+    {
+        name_.clear();
+        name_ << name << "_bucket";
+        for (std::size_t i = 0; i < bounds.size(); i++)
+        {
+            extra_.clear();
+            extra_ << bounds[i];
+            write_series(labels, "le", static_cast<double>(cumulative[i]));
+        }
+
+        extra_.clear();
+        extra_ << "+Inf";
+        write_series(labels, "le", static_cast<double>(count));
+
+        write_series(name, "_sum", labels, sum);
+        write_series(name, "_count", labels, static_cast<double>(count));
+    }
+};
+
+}
+
+#endif //CXXMETRICS_PROMETHEUS_REMOTE_WRITE_EXPOSITION_HPP
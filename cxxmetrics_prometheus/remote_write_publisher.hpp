@@ -0,0 +1,356 @@
+#ifndef CXXMETRICS_PROMETHEUS_REMOTE_WRITE_PUBLISHER_HPP
+#define CXXMETRICS_PROMETHEUS_REMOTE_WRITE_PUBLISHER_HPP
+
+#include <chrono>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <cxxmetrics/http_connection.hpp>
+#include <cxxmetrics/internal/interval_thread.hpp>
+#include <cxxmetrics/publisher.hpp>
+#include "remote_write_exposition.hpp"
+#include "snappy.hpp"
+#include "write_ahead_log.hpp"
+#include "prometheus_counter.hpp"
+#include "prometheus_gauge.hpp"
+#include "prometheus_meter.hpp"
+#include "prometheus_histogram.hpp"
+#include "prometheus_timer.hpp"
+
+namespace cxxmetrics_prometheus
+{
+
+/**
+ * \brief The settings of a remote_write_publisher
+ */
+struct remote_write_options
+{
+    /**
+     * \brief The IPv4 address of the remote write receiver
+     */
+    std::string address = "127.0.0.1";
+
+    /**
+     * \brief The port of the remote write receiver
+     */
+    uint16_t port = 9090;
+
+    /**
+     * \brief The path that write requests are posted to
+     */
+    std::string path = "/api/v1/write";
+
+    /**
+     * \brief Labels added to every series, such as job and instance, since nothing scrapes the process to add them
+     */
+    std::vector<std::pair<std::string, std::string>> labels;
+
+    /**
+     * \brief The size of the uncompressed series at which they're sent as a request of their own
+     */
+    std::size_t max_batch = 256 * 1024;
+
+    /**
+     * \brief The directory of the write-ahead log that requests are kept in until the receiver takes them
+     */
+    std::string wal_directory;
+
+    /**
+     * \brief The size at which a segment of the write-ahead log is closed and a new one started
+     */
+    std::size_t wal_segment_size = 4 * 1024 * 1024;
+
+    /**
+     * \brief The most bytes the write-ahead log can take up before its oldest segments are dropped
+     */
+    std::size_t wal_max_size = 64 * 1024 * 1024;
+
+    /**
+     * \brief Whether to flush the write-ahead log to the disk on every write
+     */
+    bool wal_sync = false;
+
+    /**
+     * \brief How long to wait on the receiver to connect, take a request or respond to it
+     */
+    std::chrono::milliseconds timeout = std::chrono::seconds(10);
+};
+
+namespace internal
+{
+
+/**
+ * \brief The publish plan of a registered metric with its escaped name and the remote write encoded labels of its
+ * series, which include the external labels of the publisher it's kept by
+ */
+class remote_write_series : public cxxmetrics::publish_plan
+{
+    std::unordered_map<cxxmetrics::tag_collection, std::string> labels_;
+    std::string name_;
+    std::mutex lock_;
+public:
+    void lock() { lock_.lock(); }
+    void unlock() { lock_.unlock(); }
+
+    void compile(const cxxmetrics::metric_path& path)
+    {
+        if (name_.empty())
+            name_ = escaped_name(path);
+    }
+
+    const std::string& name() const noexcept
+    {
+        return name_;
+    }
+
+    const std::string& get(const cxxmetrics::tag_collection& tags, const std::vector<std::pair<std::string, std::string>>& external)
+    {
+        auto fnd = labels_.find(tags);
+        if (fnd != labels_.end())
+            return fnd->second;
+
+        return labels_.emplace(tags, remote_write_exposition::labels(tags, external)).first->second;
+    }
+};
+
+}
+
+/**
+ * \brief A publisher that pushes the metrics in a registry to a prometheus remote write receiver
+ *
+ * This is for processes that don't live long enough to be scraped, such as batch jobs. Every publish writes the same
+ * series as the prometheus_publisher, using the same snapshot writers, into WriteRequest protobufs of around the batch
+ * size, compresses them with snappy and posts them over a kept alive connection.
+ *
+ * Requests that the receiver can't take right now are appended to a write-ahead log on the local disk instead of being
+ * held in memory, and they're sent oldest first before anything newer once it's back. Since the log is kept on disk,
+ * a job that exits during an outage leaves its requests for the next process that opens the log. The log is bounded,
+ * dropping its oldest segments when it's full.
+ *
+ * Publishing does its network and disk io on the thread that calls publish(), which is a background thread when the
+ * publisher is started with an interval, so the application never waits on the receiver or the log.
+ */
+template<typename TMetricRepo>
+class remote_write_publisher : public cxxmetrics::metrics_publisher<TMetricRepo>
+{
+    remote_write_options options_;
+    cxxmetrics::publisher_state<internal::remote_write_series> states_;
+    cxxmetrics::internal::http_connection connection_;
+    write_ahead_log wal_;
+    std::string head_;
+    exposition_buffer batch_;
+    exposition_buffer compressed_;
+    std::string record_;
+    bool unavailable_;
+    uint64_t sent_;
+    uint64_t rejected_;
+    uint64_t connections_;
+    std::mutex lock_;
+
+    cxxmetrics::internal::interval_thread thread_;
+
+    static const remote_write_options& validated(const remote_write_options& options)
+    {
+        if (options.wal_directory.empty())
+            throw std::invalid_argument("remote write needs a directory for its write-ahead log");
+        return options;
+    }
+
+    static int64_t now_ms()
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    /**
+     * \brief Post a request, returning false if it should be retried later
+     */
+    bool deliver(const char* body, std::size_t length)
+    {
+        auto head = head_;
+        head.append(std::to_string(length)).append("\r\n\r\n");
+
+        auto status = connection_.request(head, body, length, connections_);
+        if (status < 0 || status == 429 || status >= 500)
+        {
+            unavailable_ = true;
+            return false;
+        }
+
+        if (status >= 200 && status < 300)
+            ++sent_;
+        else
+            ++rejected_;
+        return true;
+    }
+
+    /**
+     * \brief Send the requests in the log oldest first until one of them can't be delivered
+     */
+    void drain()
+    {
+        while (!unavailable_ && wal_.front(record_))
+        {
+            if (!deliver(record_.data(), record_.size()))
+                return;
+            wal_.pop();
+        }
+    }
+
+    /**
+     * \brief Compress the batch into a request and send it, or log it if it can't be sent yet
+     */
+    void flush()
+    {
+        if (batch_.empty())
+            return;
+
+        compressed_.clear();
+        internal::snappy::compress(batch_.data(), batch_.size(), compressed_);
+        batch_.clear();
+
+        // once the receiver is down for one request, the rest of the publish goes straight to the log rather than
+        // waiting out the timeout for every one of them
+        if (!unavailable_ && wal_.empty() && deliver(compressed_.data(), compressed_.size()))
+            return;
+
+        wal_.append(compressed_.data(), compressed_.size());
+    }
+
+public:
+    /**
+     * \brief Construct the publisher, opening the write-ahead log and picking up any requests left in it
+     */
+    remote_write_publisher(cxxmetrics::metrics_registry<TMetricRepo>& registry, remote_write_options options) :
+            cxxmetrics::metrics_publisher<TMetricRepo>(registry),
+            options_(validated(options)),
+            connection_(options_.address, options_.port, options_.timeout),
+            wal_(options_.wal_directory, options_.wal_segment_size, options_.wal_max_size, options_.wal_sync),
+            batch_(options_.max_batch + 4096),
+            compressed_(options_.max_batch / 2 + 64),
+            unavailable_(false),
+            sent_(0),
+            rejected_(0),
+            connections_(0)
+    {
+        head_ = "POST " + options_.path + " HTTP/1.1\r\nHost: " + options_.address + ":" + std::to_string(options_.port) +
+                "\r\nContent-Type: application/x-protobuf\r\nContent-Encoding: snappy\r\nUser-Agent: cxxmetrics\r\n"
+                "X-Prometheus-Remote-Write-Version: 0.1.0\r\nContent-Length: ";
+    }
+
+    remote_write_publisher(const remote_write_publisher&) = delete;
+    remote_write_publisher& operator=(const remote_write_publisher&) = delete;
+
+    ~remote_write_publisher()
+    {
+        stop();
+    }
+
+    /**
+     * \brief Send what's left in the write-ahead log, then write every registered metric into requests and send them
+     *
+     * \return the number of series that were written
+     */
+    std::size_t publish()
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        unavailable_ = false;
+        drain();
+
+        remote_write_exposition out(batch_, now_ms());
+        std::size_t series = 0;
+        this->visit_all([&](const cxxmetrics::metric_path& path, cxxmetrics::basic_registered_metric& metric) {
+            if (path.begin() == path.end())
+                return;
+
+            auto& labels = states_.get(metric);
+            std::lock_guard<internal::remote_write_series> labels_lock(labels);
+            if (this->refresh_plan(metric, labels))
+                labels.compile(path);
+
+            const auto& options = labels.options();
+            const auto& name = labels.name();
+            bool written = false;
+            metric.visit([&](const cxxmetrics::tag_collection& tags, const auto& snapshot) {
+                using snapshot_type = typename std::decay<decltype(snapshot)>::type;
+                snapshot_writer<snapshot_type, remote_write_exposition> writer(out, path, name, written, options);
+                writer.write(labels.get(tags, options_.labels), snapshot);
+                ++series;
+            });
+
+            if (batch_.size() >= options_.max_batch)
+                flush();
+        });
+
+        flush();
+        return series;
+    }
+
+    /**
+     * \brief Publish on an interval from a background thread until stopped
+     *
+     * \throws std::invalid_argument if the interval isn't positive
+     */
+    void start(std::chrono::milliseconds interval)
+    {
+        thread_.start(interval, [this]() { publish(); });
+    }
+
+    void stop()
+    {
+        thread_.stop();
+    }
+
+    /**
+     * \brief The number of requests in the write-ahead log waiting to be sent
+     */
+    std::size_t pending()
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        return wal_.records();
+    }
+
+    /**
+     * \brief The number of requests the receiver accepted
+     */
+    uint64_t sent()
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        return sent_;
+    }
+
+    /**
+     * \brief The number of requests dropped from the write-ahead log because it was full
+     */
+    uint64_t dropped()
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        return wal_.dropped();
+    }
+
+    /**
+     * \brief The number of requests the receiver refused in a way that retrying won't fix
+     */
+    uint64_t rejected()
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        return rejected_;
+    }
+
+    /**
+     * \brief The number of connections that have been established
+     */
+    uint64_t connections()
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        return connections_;
+    }
+};
+
+}
+
+#undef CXXMETRICS_PROMETHEUS_SNAPSHOT_WRITER_INIT
+
+#endif //CXXMETRICS_PROMETHEUS_REMOTE_WRITE_PUBLISHER_HPP
@@ -0,0 +1,87 @@
+#ifndef CXXMETRICS_PROMETHEUS_SERIES_LOOKUP_HPP
+#define CXXMETRICS_PROMETHEUS_SERIES_LOOKUP_HPP
+
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <cxxmetrics/tag_collection.hpp>
+
+namespace cxxmetrics_prometheus
+{
+
+namespace internal
+{
+
+/**
+ * \brief What a publisher keeps for each series of a registered metric, looked up by the tags of the series
+ *
+ * Hashing and comparing a tag_collection costs more than writing most series, so a render doesn't do it when it
+ * doesn't have to. The tags a registered metric visits its series with are its own, which stay where they are for as
+ * long as the metric does and come in the same order every time, so the series of a render are matched by where
+ * their tags are against the series of the last render in that order, and only hashed when they don't match.
+ */
+template<typename TSeries>
+class series_lookup
+{
+    std::unordered_map<cxxmetrics::tag_collection, TSeries> series_;
+    std::vector<std::pair<const cxxmetrics::tag_collection*, TSeries*>> order_;
+    std::size_t cursor_ = 0;
+    bool stable_ = false;
+public:
+    /**
+     * \brief start looking up the series of a render from the first one
+     *
+     * \param stable whether the tags of the series are the registered metric's own. Tags that are copies, like the
+     *        ones in a registry snapshot, can be anywhere and are always hashed.
+     */
+    void rewind(bool stable) noexcept
+    {
+        cursor_ = 0;
+        stable_ = stable;
+    }
+
+    /**
+     * \brief get the series for a set of tags, creating it from the tags the first time it's seen
+     *
+     * Looking the same tags up twice in a row gets the same series without moving on to the next one.
+     */
+    template<typename TCreate>
+    TSeries& get(const cxxmetrics::tag_collection& tags, TCreate&& create)
+    {
+        if (stable_)
+        {
+            if (cursor_ > 0 && order_[cursor_ - 1].first == &tags)
+                return *order_[cursor_ - 1].second;
+            if (cursor_ < order_.size() && order_[cursor_].first == &tags)
+                return *order_[cursor_++].second;
+        }
+
+        auto fnd = series_.find(tags);
+        if (fnd == series_.end())
+            fnd = series_.emplace(tags, create(tags)).first;
+
+        if (stable_)
+        {
+            if (cursor_ < order_.size())
+                order_[cursor_] = std::make_pair(&tags, &fnd->second);
+            else
+                order_.emplace_back(&tags, &fnd->second);
+            ++cursor_;
+        }
+
+        return fnd->second;
+    }
+
+    template<typename THandler>
+    void each(THandler&& handler)
+    {
+        for (auto& s : series_)
+            handler(s.second);
+    }
+};
+
+}
+
+}
+
+#endif //CXXMETRICS_PROMETHEUS_SERIES_LOOKUP_HPP
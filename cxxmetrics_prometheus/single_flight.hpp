@@ -0,0 +1,120 @@
+#ifndef CXXMETRICS_PROMETHEUS_SINGLE_FLIGHT_HPP
+#define CXXMETRICS_PROMETHEUS_SINGLE_FLIGHT_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include "compressed_exposition.hpp"
+
+namespace cxxmetrics_prometheus
+{
+
+namespace internal
+{
+
+/**
+ * \brief Coalesces concurrent renders of an exposition into one
+ *
+ * The first caller renders. Callers that arrive while that render is in flight wait for it and share its result
+ * rather than collecting the registry again. A completed render is also shared with callers that arrive within the
+ * max staleness of when it started, which by default is never. Callers that share a render share its compressed
+ * bodies too.
+ */
+class single_flight
+{
+    using clock = std::chrono::steady_clock;
+
+    std::mutex lock_;
+    std::condition_variable done_;
+    std::shared_ptr<rendered_exposition> last_;
+    std::shared_ptr<rendered_exposition> spare_;
+    clock::time_point started_;
+    clock::duration max_staleness_;
+    uint64_t flights_;
+    uint64_t finished_;
+    uint64_t succeeded_;
+    bool rendering_;
+
+public:
+    single_flight() noexcept :
+            max_staleness_(clock::duration::zero()),
+            flights_(0),
+            finished_(0),
+            succeeded_(0),
+            rendering_(false)
+    { }
+
+    void max_staleness(clock::duration staleness)
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        max_staleness_ = staleness;
+    }
+
+    clock::duration max_staleness()
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        return max_staleness_;
+    }
+
+    /**
+     * \brief Get a render, joining the one in flight or a recent enough one, or rendering with the handler
+     *
+     * \param render a handler that renders into the rendered_exposition it's given
+     */
+    template<typename TRender>
+    std::shared_ptr<const rendered_exposition> get(TRender&& render)
+    {
+        std::unique_lock<std::mutex> lock(lock_);
+        auto arrived = clock::now();
+        while (rendering_)
+        {
+            auto flight = flights_;
+            done_.wait(lock, [this, flight]() { return finished_ >= flight; });
+            if (succeeded_ == flight)
+                return last_;
+        }
+
+        if (last_ && max_staleness_ > clock::duration::zero() && started_ + max_staleness_ >= arrived)
+            return last_;
+
+        auto flight = ++flights_;
+        rendering_ = true;
+        auto started = clock::now();
+
+        // the buffer rendered before the last one is reused unless a caller is still reading it
+        auto back = std::move(spare_);
+        lock.unlock();
+
+        try
+        {
+            if (!back || back.use_count() > 1)
+                back = std::make_shared<rendered_exposition>();
+            back->clear();
+            render(*back);
+        }
+        catch (...)
+        {
+            lock.lock();
+            rendering_ = false;
+            finished_ = flight;
+            done_.notify_all();
+            throw;
+        }
+
+        lock.lock();
+        spare_ = std::move(last_);
+        last_ = std::move(back);
+        started_ = started;
+        rendering_ = false;
+        finished_ = succeeded_ = flight;
+        done_.notify_all();
+        return last_;
+    }
+};
+
+}
+
+}
+
+#endif //CXXMETRICS_PROMETHEUS_SINGLE_FLIGHT_HPP
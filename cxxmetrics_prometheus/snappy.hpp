@@ -0,0 +1,261 @@
+#ifndef CXXMETRICS_PROMETHEUS_SNAPPY_HPP
+#define CXXMETRICS_PROMETHEUS_SNAPPY_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include "exposition_buffer.hpp"
+
+namespace cxxmetrics_prometheus
+{
+
+namespace internal
+{
+
+/**
+ * \brief The snappy block format, which is what prometheus remote write bodies are compressed with
+ *
+ * The compressor is the same greedy hash table matcher as the reference implementation: the input is split into
+ * 64KiB blocks so that every copy has an offset that fits in 2 bytes, and every 4 byte sequence is hashed to the
+ * last position it was seen at in the block. It doesn't compress quite as well as the reference, but it's small and
+ * the output is the same format.
+ */
+namespace snappy
+{
+
+constexpr std::size_t block_size = 1 << 16;
+constexpr int hash_bits = 14;
+
+inline uint32_t load32(const char* data) noexcept
+{
+    uint32_t result;
+    std::memcpy(&result, data, sizeof(result));
+    return result;
+}
+
+inline uint32_t hash(uint32_t bytes) noexcept
+{
+    return (bytes * 0x1e35a7bd) >> (32 - hash_bits);
+}
+
+inline void append_varint(exposition_buffer& into, uint64_t value)
+{
+    char bytes[10];
+    std::size_t length = 0;
+    while (value >= 0x80)
+    {
+        bytes[length++] = static_cast<char>((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    bytes[length++] = static_cast<char>(value);
+    into.append(bytes, length);
+}
+
+inline void append_literal(exposition_buffer& into, const char* data, std::size_t length)
+{
+    if (length == 0)
+        return;
+
+    auto n = length - 1;
+    if (n < 60)
+        into.append(static_cast<char>(n << 2));
+    else
+    {
+        // lengths past 60 follow the tag in as many little endian bytes as they need
+        char bytes[5];
+        std::size_t count = 0;
+        while (n > 0)
+        {
+            bytes[1 + count++] = static_cast<char>(n & 0xff);
+            n >>= 8;
+        }
+        bytes[0] = static_cast<char>((59 + count) << 2);
+        into.append(bytes, count + 1);
+    }
+
+    into.append(data, length);
+}
+
+inline void append_copy2(exposition_buffer& into, std::size_t offset, std::size_t length)
+{
+    char bytes[3] = {
+            static_cast<char>(((length - 1) << 2) | 2),
+            static_cast<char>(offset & 0xff),
+            static_cast<char>(offset >> 8)
+    };
+    into.append(bytes, sizeof(bytes));
+}
+
+inline void append_copy(exposition_buffer& into, std::size_t offset, std::size_t length)
+{
+    // a copy holds at most 64 bytes, and the last one of a long match has to keep at least 4
+    while (length >= 68)
+    {
+        append_copy2(into, offset, 64);
+        length -= 64;
+    }
+    if (length > 64)
+    {
+        append_copy2(into, offset, 60);
+        length -= 60;
+    }
+
+    if (length < 12 && offset < 2048)
+    {
+        char bytes[2] = {
+                static_cast<char>(((offset >> 8) << 5) | ((length - 4) << 2) | 1),
+                static_cast<char>(offset & 0xff)
+        };
+        into.append(bytes, sizeof(bytes));
+        return;
+    }
+
+    append_copy2(into, offset, length);
+}
+
+inline void compress_block(const char* block, std::size_t length, uint16_t* table, exposition_buffer& into)
+{
+    std::size_t literal = 0;
+    if (length >= 15)
+    {
+        std::memset(table, 0, sizeof(uint16_t) << hash_bits);
+
+        std::size_t at = 1;
+        const auto limit = length - 4;
+        while (at <= limit)
+        {
+            auto bytes = load32(block + at);
+            auto& entry = table[hash(bytes)];
+            std::size_t candidate = entry;
+            entry = static_cast<uint16_t>(at);
+
+            if (load32(block + candidate) != bytes || candidate >= at)
+            {
+                // skip ahead faster the longer it's been since the last match so incompressible data goes quickly
+                at += 1 + ((at - literal) >> 5);
+                continue;
+            }
+
+            append_literal(into, block + literal, at - literal);
+
+            std::size_t matched = 4;
+            while (at + matched < length && block[candidate + matched] == block[at + matched])
+                ++matched;
+
+            append_copy(into, at - candidate, matched);
+            at += matched;
+            literal = at;
+        }
+    }
+
+    append_literal(into, block + literal, length - literal);
+}
+
+/**
+ * \brief Compress data into a snappy block
+ */
+inline void compress(const char* data, std::size_t length, exposition_buffer& into)
+{
+    append_varint(into, length);
+
+    uint16_t table[1 << hash_bits];
+    for (std::size_t at = 0; at < length; at += block_size)
+        compress_block(data + at, std::min(block_size, length - at), table, into);
+}
+
+/**
+ * \brief Uncompress a snappy block
+ *
+ * \return false if the data isn't a valid block
+ */
+inline bool uncompress(const char* data, std::size_t length, std::string& into)
+{
+    const char* end = data + length;
+    uint64_t expected = 0;
+    for (int shift = 0; ; shift += 7)
+    {
+        if (data == end || shift > 63)
+            return false;
+
+        auto byte = static_cast<uint8_t>(*data++);
+        expected |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            break;
+    }
+
+    auto start = into.size();
+    into.reserve(start + expected);
+    while (data != end)
+    {
+        auto tag = static_cast<uint8_t>(*data++);
+        std::size_t offset;
+        std::size_t copy;
+        switch (tag & 3)
+        {
+            case 0:
+            {
+                std::size_t literal = tag >> 2;
+                if (literal >= 60)
+                {
+                    auto count = literal - 59;
+                    if (static_cast<std::size_t>(end - data) < count)
+                        return false;
+
+                    literal = 0;
+                    for (std::size_t i = 0; i < count; i++)
+                        literal |= static_cast<std::size_t>(static_cast<uint8_t>(data[i])) << (i * 8);
+                    data += count;
+                }
+
+                ++literal;
+                if (static_cast<std::size_t>(end - data) < literal)
+                    return false;
+                into.append(data, literal);
+                data += literal;
+                continue;
+            }
+            case 1:
+                if (data == end)
+                    return false;
+                copy = ((tag >> 2) & 7) + 4;
+                offset = (static_cast<std::size_t>(tag >> 5) << 8) | static_cast<uint8_t>(*data++);
+                break;
+            case 2:
+                if (end - data < 2)
+                    return false;
+                copy = (tag >> 2) + 1;
+                offset = static_cast<uint8_t>(data[0]) | (static_cast<std::size_t>(static_cast<uint8_t>(data[1])) << 8);
+                data += 2;
+                break;
+            default:
+                if (end - data < 4)
+                    return false;
+                copy = (tag >> 2) + 1;
+                offset = 0;
+                for (int i = 0; i < 4; i++)
+                    offset |= static_cast<std::size_t>(static_cast<uint8_t>(data[i])) << (i * 8);
+                data += 4;
+                break;
+        }
+
+        auto written = into.size() - start;
+        if (offset == 0 || offset > written)
+            return false;
+
+        // copies can overlap what they write so they go a byte at a time
+        auto from = into.size() - offset;
+        for (std::size_t i = 0; i < copy; i++)
+            into.push_back(into[from + i]);
+    }
+
+    return into.size() - start == expected;
+}
+
+}
+
+}
+
+}
+
+#endif //CXXMETRICS_PROMETHEUS_SNAPPY_HPP
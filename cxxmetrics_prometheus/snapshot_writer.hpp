@@ -2,9 +2,10 @@
 #define CXXMETRICS_SNAPSHOT_WRITER_HPP
 
 #include <cctype>
-#include <ostream>
 #include <cxxmetrics/snapshots.hpp>
+#include <cxxmetrics/publish_format.hpp>
 #include <cxxmetrics/publisher.hpp>
+#include "exposition_buffer.hpp"
 
 namespace cxxmetrics_prometheus
 {
@@ -12,28 +13,21 @@ namespace cxxmetrics_prometheus
 namespace internal
 {
 
-inline cxxmetrics::metric_value scale_value(cxxmetrics::metric_value&& value, const cxxmetrics::value_publish_options& opts)
+using cxxmetrics::internal::format_window;
+using cxxmetrics::internal::scale_multiplier;
+using cxxmetrics::internal::scale_value;
+
+inline bool is_name_char(char c) noexcept
 {
-    if (opts.scale())
-        return value * cxxmetrics::metric_value(opts.scale().factor());
-    return std::move(value);
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9');
 }
 
-inline std::ostream& format_name_element(std::ostream&into, const std::string& element)
+inline exposition_buffer& format_name_element(exposition_buffer& into, const std::string& element)
 {
-    for (std::size_t i = 0; i < element.size(); i++)
-    {
-        char c = element[i];
-        if (!isalnum(c))
-            into << '_';
-        else
-            into << c;
-    }
-
-    return into;
+    return cxxmetrics::internal::format_replaced(into, element.data(), element.size(), [](char c) { return !is_name_char(c); });
 }
 
-inline std::ostream& format_name(std::ostream& into, const cxxmetrics::metric_path& path)
+inline exposition_buffer& format_name(exposition_buffer& into, const cxxmetrics::metric_path& path)
 {
     auto elem = path.begin();
     if (std::isdigit((*elem)[0]))
@@ -49,20 +43,43 @@ inline std::ostream& format_name(std::ostream& into, const cxxmetrics::metric_pa
     return into;
 }
 
-inline std::ostream& format_tag_value(std::ostream& into, const std::string& value)
+/**
+ * \brief Get the escaped prometheus name for a metric path so that it can be copied into every line as is
+ */
+inline std::string escaped_name(const cxxmetrics::metric_path& path)
 {
-    for (auto c : value)
+    exposition_buffer buffer(64);
+    format_name(buffer, path);
+    return buffer.str();
+}
+
+inline exposition_buffer& format_tag_value(exposition_buffer& into, const std::string& value)
+{
+    const char* run = value.data();
+    const char* end = run + value.size();
+    for (auto c = run; c != end; ++c)
     {
-        if (c == '"')
-            into << "\\\"";
-        else
-            into << c;
+        if (*c != '"')
+            continue;
+
+        into.append(run, c - run);
+        into << "\\\"";
+        run = c + 1;
     }
 
-    return into;
+    return into.append(run, end - run);
 }
 
-inline std::ostream& format_tags(std::ostream& into, const cxxmetrics::tag_collection& tags)
+inline exposition_buffer& format_tag_value(exposition_buffer& into, const cxxmetrics::metric_value& value)
+{
+    // numbers never need escaping so they skip the conversion to a string
+    if (value.kind() != cxxmetrics::metric_value_kind::string)
+        return into.append_value(value);
+
+    return format_tag_value(into, static_cast<std::string>(value));
+}
+
+inline exposition_buffer& format_tags(exposition_buffer& into, const cxxmetrics::tag_collection& tags)
 {
     auto tag = tags.begin();
     if (tag == tags.end())
@@ -70,49 +87,51 @@ inline std::ostream& format_tags(std::ostream& into, const cxxmetrics::tag_colle
 
     format_name_element(into, tag->first);
     into << "=\"";
-    format_tag_value(into, tag->second) << "\"";
+    format_tag_value(into, tag->second) << '"';
     for (++tag; tag != tags.end(); ++tag)
     {
-        into << ",";
+        into << ',';
         format_name_element(into, tag->first) << "=\"";
-        format_tag_value(into, tag->second) << "\"";
+        format_tag_value(into, tag->second) << '"';
     }
 
     return into;
 }
 
-template<typename TRep, typename TPer>
-std::ostream& format_window(std::ostream& into, const std::chrono::duration<TRep, TPer>& time)
+/**
+ * \brief Get the escaped label pairs for a tag collection, without the braces, so they can be copied into every line as is
+ */
+inline std::string escaped_labels(const cxxmetrics::tag_collection& tags)
 {
-    using namespace std::chrono_literals;
-    if (time >= 1h)
-    {
-        into << std::chrono::duration_cast<std::chrono::hours>(time).count() << "hr";
-        return into;
-    }
-    if (time >= 1min)
-    {
-        into << std::chrono::duration_cast<std::chrono::minutes>(time).count() << "min";
-        return into;
-    }
-    if (time >= 1s)
-    {
-        into << std::chrono::duration_cast<std::chrono::seconds>(time).count() << "sec";
-        return into;
-    }
-    if (time >= 1ms)
-    {
-        into << std::chrono::duration_cast<std::chrono::milliseconds>(time).count() << "msec";
-        return into;
-    }
-    if (time >= 1us)
-    {
-        into << std::chrono::duration_cast<std::chrono::microseconds>(time).count() << "usec";
-        return into;
-    }
+    exposition_buffer buffer(64);
+    format_tags(buffer, tags);
+    return buffer.str();
+}
 
-    into << std::chrono::duration_cast<std::chrono::nanoseconds>(time).count() << "nsec";
-    return into;
+/**
+ * \brief Format a quantile label value. Quantiles are stored in fixed point so they're rounded back to what was asked for
+ */
+template<typename TSink>
+TSink& format_quantile(TSink& into, const cxxmetrics::quantile& q)
+{
+    return into.append_double(static_cast<double>(q.percentile() / 100.0), 6);
+}
+
+struct prometheus_quantile_t
+{
+    const cxxmetrics::quantile& value;
+    prometheus_quantile_t(const cxxmetrics::quantile& q) : value(q) { }
+};
+
+inline prometheus_quantile_t quantile(const cxxmetrics::quantile& q)
+{
+    return prometheus_quantile_t(q);
+}
+
+template<typename TSink>
+TSink& operator<<(cxxmetrics::output_sink<TSink>& into, prometheus_quantile_t q)
+{
+    return format_quantile(static_cast<TSink&>(into), q.value);
 }
 
 template<typename TRep, typename TPer>
@@ -128,10 +147,10 @@ prometheus_time_window_t<TRep, TPer> window(const std::chrono::duration<TRep, TP
     return prometheus_time_window_t<TRep, TPer>(d);
 }
 
-template<typename TRep, typename TPer>
-std::ostream& operator<<(std::ostream& stream, prometheus_time_window_t<TRep, TPer> w)
+template<typename TSink, typename TRep, typename TPer>
+TSink& operator<<(cxxmetrics::output_sink<TSink>& into, prometheus_time_window_t<TRep, TPer> w)
 {
-    return format_window(stream, w.duration);
+    return format_window(static_cast<TSink&>(into), w.duration);
 }
 
 struct prometheus_tags_t
@@ -145,9 +164,9 @@ inline prometheus_tags_t tags(const cxxmetrics::tag_collection& tags)
     return prometheus_tags_t(tags);
 }
 
-inline std::ostream& operator<<(std::ostream& stream, prometheus_tags_t t)
+inline exposition_buffer& operator<<(exposition_buffer& into, prometheus_tags_t t)
 {
-    return format_tags(stream, t.tags);
+    return format_tags(into, t.tags);
 }
 
 struct prometheus_name_t
@@ -161,22 +180,167 @@ inline prometheus_name_t name(const cxxmetrics::metric_path& path)
     return prometheus_name_t(path);
 }
 
-inline std::ostream& operator<<(std::ostream& stream, prometheus_name_t t)
+inline exposition_buffer& operator<<(exposition_buffer& into, prometheus_name_t t)
+{
+    return format_name(into, t.name);
+}
+
+};
+
+/**
+ * \brief The prometheus metric types, numbered the same as MetricType in the prometheus protobuf format
+ */
+enum class metric_type
+{
+    counter = 0,
+    gauge = 1,
+    summary = 2,
+    untyped = 3,
+    histogram = 4
+};
+
+inline const char* type_name(metric_type type) noexcept
 {
-    return format_name(stream, t.name);
+    switch (type)
+    {
+        case metric_type::counter:
+            return "counter";
+        case metric_type::gauge:
+            return "gauge";
+        case metric_type::summary:
+            return "summary";
+        case metric_type::histogram:
+            return "histogram";
+        default:
+            return "untyped";
+    }
 }
 
+/**
+ * \brief The text exposition format that snapshot writers write into
+ *
+ * Snapshot writers describe what to expose in terms of samples, windowed samples and summaries. The exposition
+ * formats decide how to encode them, so the same writers are used for every format.
+ *
+ * \tparam TSink the output sink the exposition is written straight into
+ */
+template<typename TSink>
+class basic_text_exposition
+{
+    TSink& out_;
+public:
+    explicit basic_text_exposition(TSink& out) noexcept :
+            out_(out)
+    { }
+
+    /**
+     * \brief Get the labels of a series, encoded to be copied into every line of the series as is
+     */
+    static std::string labels(const cxxmetrics::tag_collection& tags)
+    {
+        return internal::escaped_labels(tags);
+    }
+
+    TSink& buffer() noexcept
+    {
+        return out_;
+    }
+
+    void header(const std::string& name, metric_type type, const std::string& help)
+    {
+        if (!help.empty())
+            out_ << "# HELP " << name << ' ' << help << '\n';
+        out_ << "# TYPE " << name << ' ' << type_name(type) << '\n';
+    }
+
+    void sample(const std::string& name, const std::string& labels, const cxxmetrics::metric_value& value)
+    {
+        out_ << name << '{' << labels << "} " << value << '\n';
+    }
+
+    /**
+     * \brief Write a sample with a window label, named with the suffix after the metric name
+     */
+    template<typename TWindow>
+    void window(const std::string& name, const char* suffix, const std::string& labels, const TWindow& window, const cxxmetrics::metric_value& value)
+    {
+        out_ << name << suffix << "{window=\"" << window << '"';
+        if (!labels.empty())
+            out_ << ',';
+        out_ << labels << "} " << value << '\n';
+    }
+
+    class summary_writer
+    {
+        basic_text_exposition& parent_;
+        const std::string& name_;
+        const std::string& labels_;
+    public:
+        summary_writer(basic_text_exposition& parent, const std::string& name, const std::string& labels) noexcept :
+                parent_(parent),
+                name_(name),
+                labels_(labels)
+        { }
+
+        void quantile(const cxxmetrics::quantile& q, const cxxmetrics::metric_value& value)
+        {
+            auto& out = parent_.out_;
+            out << name_ << "{quantile=\"" << internal::quantile(q) << '"';
+            if (!labels_.empty())
+                out << ',';
+            out << labels_ << "} " << value << '\n';
+        }
+    };
+
+    /**
+     * \brief Write the count and mean of a summary and get a writer for its quantiles
+     */
+    summary_writer summary(const std::string& name, const std::string& labels, const cxxmetrics::metric_value& count, const cxxmetrics::metric_value& mean, bool include_count)
+    {
+        if (include_count)
+            out_ << name << "_count{" << labels << "} " << count << '\n';
+        out_ << name << "_mean{" << labels << "} " << mean << '\n';
+        return summary_writer(*this, name, labels);
+    }
+
+    /**
+     * \brief Write the cumulative buckets of a histogram followed by its sum and count
+     *
+     * \param bounds the upper bounds of the buckets, not including the infinite bucket
+     * \param cumulative the cumulative count of each bound
+     */
+    void histogram(const std::string& name, const std::string& labels, const std::vector<double>& bounds, const uint64_t* cumulative, uint64_t count, double sum)
+    {
+        for (std::size_t i = 0; i < bounds.size(); i++)
+        {
+            out_ << name << "_bucket{le=\"" << bounds[i] << '"';
+            if (!labels.empty())
+                out_ << ',';
+            out_ << labels << "} " << cumulative[i] << '\n';
+        }
+
+        out_ << name << "_bucket{le=\"+Inf\"";
+        if (!labels.empty())
+            out_ << ',';
+        out_ << labels << "} " << count << '\n';
+        out_ << name << "_sum{" << labels << "} " << sum << '\n';
+        out_ << name << "_count{" << labels << "} " << count << '\n';
+    }
 };
 
+using text_exposition = basic_text_exposition<exposition_buffer>;
+
 #define CXXMETRICS_PROMETHEUS_SNAPSHOT_WRITER_INIT \
 private: \
-    std::ostream& stream; \
+    TOutput& stream; \
     const cxxmetrics::metric_path& path; \
+    const std::string& name; \
     const cxxmetrics::publish_options& options; \
 public: \
-    snapshot_writer(std::ostream& out, const cxxmetrics::metric_path& name, bool& header_written, const cxxmetrics::publish_options& opts) : \
+    snapshot_writer(TOutput& out, const cxxmetrics::metric_path& metric_path, const std::string& escaped_name, bool& header_written, const cxxmetrics::publish_options& opts) : \
             stream(out), \
-            path(name), \
+            path(metric_path), \
+            name(escaped_name), \
             options(opts) \
     { \
        if (!header_written) \
@@ -187,7 +351,13 @@ public: \
     } \
 private:
 
-template<typename TSnapshot>
+/**
+ * \brief Writes the exposition for a type of snapshot into an exposition format
+ *
+ * Writers are handed the escaped metric name and the labels of the series already encoded for the format rather
+ * than the path and tags so that those are only encoded once and then copied into every sample.
+ */
+template<typename TSnapshot, typename TOutput = text_exposition>
 class snapshot_writer
 {
 };
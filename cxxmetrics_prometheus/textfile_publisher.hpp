@@ -0,0 +1,269 @@
+#ifndef CXXMETRICS_PROMETHEUS_TEXTFILE_PUBLISHER_HPP
+#define CXXMETRICS_PROMETHEUS_TEXTFILE_PUBLISHER_HPP
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <cxxmetrics/internal/interval_thread.hpp>
+#include <cxxmetrics/publisher.hpp>
+#include "prometheus_publisher.hpp"
+
+namespace cxxmetrics_prometheus
+{
+
+/**
+ * \brief The settings of a textfile_publisher
+ */
+struct textfile_options
+{
+    /**
+     * \brief The file to export to, which should end in .prom and be in the directory of the textfile collector
+     */
+    std::string path;
+
+    /**
+     * \brief Whether to flush every export to the disk before renaming it into place
+     */
+    bool sync = false;
+
+    /**
+     * \brief How long metrics that don't track changes, such as meters and timers, can go without being exported
+     * while nothing else in the registry changes
+     */
+    std::chrono::steady_clock::duration max_staleness = std::chrono::seconds(15);
+};
+
+namespace internal
+{
+
+/**
+ * \brief A summary of the change epochs of every series in a registry
+ *
+ * Change epochs only go up and series are never removed, so the registry has changed if the number of series or the
+ * sum of their epochs has. Series that don't track changes are counted, but whether they changed can't be told from
+ * the fingerprint.
+ */
+struct registry_fingerprint
+{
+    uint64_t series = 0;
+    uint64_t epochs = 0;
+    bool untracked = false;
+
+    bool operator==(const registry_fingerprint& other) const noexcept
+    {
+        return series == other.series && epochs == other.epochs;
+    }
+
+    bool operator!=(const registry_fingerprint& other) const noexcept
+    {
+        return !(*this == other);
+    }
+};
+
+}
+
+/**
+ * \brief A publisher that exports the text exposition to a file for node_exporter's textfile collector
+ *
+ * This is for processes that are too short lived or too infrequent to be scraped, such as cron jobs. Every export
+ * renders the exposition with a prometheus_publisher, sizes a temporary file next to the export to fit it, copies it
+ * through a shared mapping of the file, optionally flushes it and renames it over the export, so the collector only
+ * ever reads a whole exposition.
+ *
+ * Exports are skipped when the change epochs of the registry say nothing has changed since the last one, so a short
+ * cadence doesn't rewrite an unchanged file. Registries with metrics that don't track changes, such as meters and
+ * timers, are also exported once the last export is older than textfile_options::max_staleness.
+ */
+template<typename TMetricRepo>
+class textfile_publisher : public cxxmetrics::metrics_publisher<TMetricRepo>
+{
+    textfile_options options_;
+    std::string temp_;
+    prometheus_publisher<TMetricRepo> publisher_;
+    exposition_buffer rendered_;
+    internal::registry_fingerprint exported_;
+    std::chrono::steady_clock::time_point exported_at_;
+    bool exported_once_;
+    uint64_t exports_;
+    uint64_t skipped_;
+    std::mutex lock_;
+
+    cxxmetrics::internal::interval_thread thread_;
+
+    static const textfile_options& validated(const textfile_options& options)
+    {
+        if (options.path.empty())
+            throw std::invalid_argument("a textfile export needs a path");
+        return options;
+    }
+
+    internal::registry_fingerprint fingerprint()
+    {
+        internal::registry_fingerprint result;
+        this->visit_all([&result](const cxxmetrics::metric_path& path, cxxmetrics::basic_registered_metric& metric) {
+            if (path.begin() == path.end())
+                return;
+
+            metric.visit_changed([&result](const cxxmetrics::tag_collection&, uint64_t epoch) {
+                ++result.series;
+                result.epochs += epoch;
+                return true;
+            }, [&result](const cxxmetrics::tag_collection&, uint64_t, const auto&) {
+                ++result.series;
+                result.untracked = true;
+            });
+        });
+
+        return result;
+    }
+
+    void write_file()
+    {
+        auto fd = ::open(temp_.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0)
+            throw std::system_error(errno, std::generic_category(), "open " + temp_);
+
+        try
+        {
+            if (::ftruncate(fd, static_cast<off_t>(rendered_.size())) != 0)
+                throw std::system_error(errno, std::generic_category(), "ftruncate " + temp_);
+
+            if (!rendered_.empty())
+            {
+                auto mapped = ::mmap(nullptr, rendered_.size(), PROT_WRITE, MAP_SHARED, fd, 0);
+                if (mapped == MAP_FAILED)
+                    throw std::system_error(errno, std::generic_category(), "mmap " + temp_);
+
+                std::memcpy(mapped, rendered_.data(), rendered_.size());
+                auto synced = !options_.sync || ::msync(mapped, rendered_.size(), MS_SYNC) == 0;
+                auto error = errno;
+                ::munmap(mapped, rendered_.size());
+                if (!synced)
+                    throw std::system_error(error, std::generic_category(), "msync " + temp_);
+            }
+
+            if (options_.sync && ::fsync(fd) != 0)
+                throw std::system_error(errno, std::generic_category(), "fsync " + temp_);
+        }
+        catch (...)
+        {
+            ::close(fd);
+            ::unlink(temp_.c_str());
+            throw;
+        }
+
+        ::close(fd);
+        if (::rename(temp_.c_str(), options_.path.c_str()) != 0)
+        {
+            auto error = errno;
+            ::unlink(temp_.c_str());
+            throw std::system_error(error, std::generic_category(), "rename " + temp_);
+        }
+
+        if (options_.sync)
+        {
+            // the rename is only durable once the directory it's in is flushed
+            auto slash = options_.path.rfind('/');
+            auto directory = slash == std::string::npos ? std::string(".") : options_.path.substr(0, slash + 1);
+            auto dir = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (dir >= 0)
+            {
+                ::fsync(dir);
+                ::close(dir);
+            }
+        }
+    }
+
+public:
+    textfile_publisher(cxxmetrics::metrics_registry<TMetricRepo>& registry, textfile_options options) :
+            cxxmetrics::metrics_publisher<TMetricRepo>(registry),
+            options_(validated(options)),
+            temp_(options_.path + ".tmp"),
+            publisher_(registry),
+            exported_once_(false),
+            exports_(0),
+            skipped_(0)
+    { }
+
+    textfile_publisher(const textfile_publisher&) = delete;
+    textfile_publisher& operator=(const textfile_publisher&) = delete;
+
+    ~textfile_publisher()
+    {
+        stop();
+    }
+
+    /**
+     * \brief Export the registry to the file if it changed since the last export
+     *
+     * \return whether the file was written
+     */
+    bool publish()
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+
+        // the fingerprint is taken before the render, so a change that races the render is exported next time
+        auto current = fingerprint();
+        auto now = std::chrono::steady_clock::now();
+        auto stale = current.untracked && now - exported_at_ >= options_.max_staleness;
+        if (exported_once_ && current == exported_ && !stale)
+        {
+            ++skipped_;
+            return false;
+        }
+
+        rendered_.clear();
+        publisher_.write(rendered_);
+        write_file();
+
+        exported_ = current;
+        exported_at_ = now;
+        exported_once_ = true;
+        ++exports_;
+        return true;
+    }
+
+    /**
+     * \brief Export on an interval from a background thread until stopped
+     *
+     * \throws std::invalid_argument if the interval isn't positive
+     */
+    void start(std::chrono::milliseconds interval)
+    {
+        thread_.start(interval, [this]() { publish(); });
+    }
+
+    void stop()
+    {
+        thread_.stop();
+    }
+
+    /**
+     * \brief The number of times the file was written
+     */
+    uint64_t exports()
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        return exports_;
+    }
+
+    /**
+     * \brief The number of exports that were skipped because nothing had changed
+     */
+    uint64_t skipped()
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        return skipped_;
+    }
+};
+
+}
+
+#endif //CXXMETRICS_PROMETHEUS_TEXTFILE_PUBLISHER_HPP
@@ -0,0 +1,519 @@
+#ifndef CXXMETRICS_PROMETHEUS_WRITE_AHEAD_LOG_HPP
+#define CXXMETRICS_PROMETHEUS_WRITE_AHEAD_LOG_HPP
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace cxxmetrics_prometheus
+{
+
+namespace internal
+{
+
+inline uint32_t crc32(const char* data, std::size_t length) noexcept
+{
+    static const struct crc_table
+    {
+        uint32_t values[256];
+        crc_table() noexcept
+        {
+            for (uint32_t i = 0; i < 256; i++)
+            {
+                uint32_t crc = i;
+                for (int bit = 0; bit < 8; bit++)
+                    crc = (crc & 1) ? (crc >> 1) ^ 0xedb88320u : crc >> 1;
+                values[i] = crc;
+            }
+        }
+    } table;
+
+    uint32_t crc = 0xffffffffu;
+    for (std::size_t i = 0; i < length; i++)
+        crc = table.values[(crc ^ static_cast<uint8_t>(data[i])) & 0xff] ^ (crc >> 8);
+    return crc ^ 0xffffffffu;
+}
+
+inline void store32(char* into, uint32_t value) noexcept
+{
+    for (int i = 0; i < 4; i++)
+        into[i] = static_cast<char>((value >> (i * 8)) & 0xff);
+}
+
+inline uint32_t read32(const char* from) noexcept
+{
+    uint32_t result = 0;
+    for (int i = 0; i < 4; i++)
+        result |= static_cast<uint32_t>(static_cast<uint8_t>(from[i])) << (i * 8);
+    return result;
+}
+
+}
+
+/**
+ * \brief A write-ahead log of opaque records in a directory, split over segment files of a bounded total size
+ *
+ * Records are appended to the newest segment until it reaches the segment size, at which point a new segment is
+ * started. Every record is its length and a crc32 of its contents followed by the contents, so a record that was only
+ * partly written when the process died is found and cut off when the log is opened again.
+ *
+ * Records are consumed oldest first with front() and pop(). The position of the oldest record that hasn't been
+ * consumed is saved in a cursor file next to the segments, so the records that were still in the log when the
+ * process exited are picked up by the next process to open it. Segments are deleted as soon as they've been consumed.
+ * When the segments take up more than the maximum size, the oldest ones are deleted along with any records in them
+ * that weren't consumed yet.
+ */
+class write_ahead_log
+{
+    static constexpr std::size_t record_header = 8;
+    static constexpr std::size_t max_record = 1 << 30;
+
+    struct segment
+    {
+        uint64_t index;
+        std::size_t size;
+        std::size_t records;
+    };
+
+    std::string directory_;
+    std::size_t segment_size_;
+    std::size_t max_size_;
+    bool sync_;
+    std::deque<segment> segments_;
+    std::size_t bytes_;
+    std::size_t read_offset_;
+    std::size_t read_records_;
+    std::size_t next_offset_;
+    int write_fd_;
+    int read_fd_;
+    uint64_t last_index_;
+    uint64_t dropped_;
+
+    std::string segment_path(uint64_t index) const
+    {
+        char name[32];
+        std::snprintf(name, sizeof(name), "/%016llx.wal", static_cast<unsigned long long>(index));
+        return directory_ + name;
+    }
+
+    std::string cursor_path() const
+    {
+        return directory_ + "/cursor";
+    }
+
+    static bool read_fully(int fd, char* into, std::size_t length, std::size_t offset)
+    {
+        while (length > 0)
+        {
+            auto got = ::pread(fd, into, length, static_cast<off_t>(offset));
+            if (got < 0 && errno == EINTR)
+                continue;
+            if (got <= 0)
+                return false;
+
+            into += got;
+            offset += static_cast<std::size_t>(got);
+            length -= static_cast<std::size_t>(got);
+        }
+
+        return true;
+    }
+
+    static void write_fully(int fd, const char* data, std::size_t length)
+    {
+        while (length > 0)
+        {
+            auto written = ::write(fd, data, length);
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                throw std::system_error(errno, std::generic_category(), "write");
+            }
+
+            data += written;
+            length -= static_cast<std::size_t>(written);
+        }
+    }
+
+    /**
+     * \brief Read the record at an offset into a segment, returning false if there isn't a whole valid one there
+     */
+    static bool read_record(int fd, std::size_t offset, std::size_t size, std::string& into)
+    {
+        char header[record_header];
+        if (size - offset < record_header || !read_fully(fd, header, record_header, offset))
+            return false;
+
+        auto length = internal::read32(header);
+        if (length > max_record || size - offset - record_header < length)
+            return false;
+
+        into.resize(length);
+        if (length > 0 && !read_fully(fd, &into[0], length, offset + record_header))
+            return false;
+
+        return internal::crc32(into.data(), length) == internal::read32(header + 4);
+    }
+
+    /**
+     * \brief Count the valid records in a segment, cutting off whatever follows the last of them
+     */
+    void scan(segment& s)
+    {
+        auto path = segment_path(s.index);
+        auto fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+        if (fd < 0)
+            throw std::system_error(errno, std::generic_category(), "open " + path);
+
+        struct stat info{};
+        ::fstat(fd, &info);
+        auto size = static_cast<std::size_t>(info.st_size);
+
+        std::string record;
+        std::size_t offset = 0;
+        s.records = 0;
+        while (read_record(fd, offset, size, record))
+        {
+            offset += record_header + record.size();
+            ++s.records;
+        }
+
+        if (offset < size && ::ftruncate(fd, static_cast<off_t>(offset)) != 0)
+        {
+            ::close(fd);
+            throw std::system_error(errno, std::generic_category(), "ftruncate " + path);
+        }
+
+        ::close(fd);
+        s.size = offset;
+    }
+
+    void save_cursor()
+    {
+        if (segments_.empty())
+        {
+            ::unlink(cursor_path().c_str());
+            return;
+        }
+
+        char cursor[64];
+        auto length = std::snprintf(cursor, sizeof(cursor), "%llx %zu %zu\n",
+                static_cast<unsigned long long>(segments_.front().index), read_offset_, read_records_);
+
+        // written to the side and renamed over the old one so there's always a whole cursor
+        auto path = cursor_path();
+        auto temp = path + ".tmp";
+        auto fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0)
+            throw std::system_error(errno, std::generic_category(), "open " + temp);
+
+        try
+        {
+            write_fully(fd, cursor, static_cast<std::size_t>(length));
+        }
+        catch (...)
+        {
+            ::close(fd);
+            throw;
+        }
+
+        if (sync_)
+            ::fdatasync(fd);
+        ::close(fd);
+
+        if (::rename(temp.c_str(), path.c_str()) != 0)
+            throw std::system_error(errno, std::generic_category(), "rename " + temp);
+    }
+
+    void load_cursor()
+    {
+        read_offset_ = 0;
+        read_records_ = 0;
+
+        auto file = std::fopen(cursor_path().c_str(), "r");
+        if (!file)
+            return;
+
+        unsigned long long index = 0;
+        std::size_t offset = 0;
+        std::size_t records = 0;
+        auto parsed = std::fscanf(file, "%llx %zu %zu", &index, &offset, &records);
+        std::fclose(file);
+        if (parsed != 3)
+            return;
+
+        // segments before the cursor were consumed but may not have been deleted before the process died
+        while (!segments_.empty() && segments_.front().index < index)
+        {
+            ::unlink(segment_path(segments_.front().index).c_str());
+            bytes_ -= segments_.front().size;
+            segments_.pop_front();
+        }
+
+        if (!segments_.empty() && segments_.front().index == index && offset <= segments_.front().size && records <= segments_.front().records)
+        {
+            read_offset_ = offset;
+            read_records_ = records;
+        }
+    }
+
+    void close_reader()
+    {
+        if (read_fd_ >= 0)
+            ::close(read_fd_);
+        read_fd_ = -1;
+    }
+
+    void close_writer()
+    {
+        if (write_fd_ >= 0)
+            ::close(write_fd_);
+        write_fd_ = -1;
+    }
+
+    /**
+     * \brief Delete the oldest segment, counting the records in it that weren't consumed as dropped
+     */
+    void remove_front()
+    {
+        auto& front = segments_.front();
+        dropped_ += front.records - read_records_;
+        if (segments_.size() == 1)
+            close_writer();
+        close_reader();
+
+        ::unlink(segment_path(front.index).c_str());
+        bytes_ -= front.size;
+        segments_.pop_front();
+        read_offset_ = 0;
+        read_records_ = 0;
+    }
+
+    void start_segment()
+    {
+        close_writer();
+
+        auto index = segments_.empty() ? (last_index_ + 1) : segments_.back().index + 1;
+        auto path = segment_path(index);
+        write_fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+        if (write_fd_ < 0)
+            throw std::system_error(errno, std::generic_category(), "open " + path);
+
+        segments_.push_back(segment{index, 0, 0});
+        last_index_ = index;
+    }
+
+public:
+    /**
+     * \brief Open the log in a directory, creating the directory if it doesn't exist
+     *
+     * \param directory the directory the segments are kept in, which shouldn't be used by anything else
+     * \param segment_size the size at which a segment is closed and a new one started
+     * \param max_size the most bytes all of the segments can take up before the oldest ones are dropped
+     * \param sync whether to flush every record and cursor to the disk before the write returns
+     */
+    write_ahead_log(std::string directory, std::size_t segment_size, std::size_t max_size, bool sync = false) :
+            directory_(std::move(directory)),
+            segment_size_(segment_size),
+            max_size_(max_size),
+            sync_(sync),
+            bytes_(0),
+            read_offset_(0),
+            read_records_(0),
+            next_offset_(0),
+            write_fd_(-1),
+            read_fd_(-1),
+            last_index_(0),
+            dropped_(0)
+    {
+        if (::mkdir(directory_.c_str(), 0755) != 0 && errno != EEXIST)
+            throw std::system_error(errno, std::generic_category(), "mkdir " + directory_);
+
+        auto dir = ::opendir(directory_.c_str());
+        if (!dir)
+            throw std::system_error(errno, std::generic_category(), "opendir " + directory_);
+
+        std::vector<uint64_t> indexes;
+        while (auto entry = ::readdir(dir))
+        {
+            std::string name(entry->d_name);
+            if (name.size() != 20 || name.compare(16, 4, ".wal") != 0)
+                continue;
+
+            char* end = nullptr;
+            auto index = std::strtoull(name.c_str(), &end, 16);
+            if (end == name.c_str() + 16)
+                indexes.push_back(index);
+        }
+        ::closedir(dir);
+
+        std::sort(indexes.begin(), indexes.end());
+        for (auto index : indexes)
+        {
+            segments_.push_back(segment{index, 0, 0});
+            scan(segments_.back());
+            bytes_ += segments_.back().size;
+            last_index_ = index;
+        }
+
+        load_cursor();
+    }
+
+    write_ahead_log(const write_ahead_log&) = delete;
+    write_ahead_log& operator=(const write_ahead_log&) = delete;
+
+    ~write_ahead_log()
+    {
+        close_reader();
+        close_writer();
+    }
+
+    /**
+     * \brief Append a record to the newest segment, dropping the oldest segments if the log is over its size
+     */
+    void append(const char* data, std::size_t length)
+    {
+        if (length > max_record)
+            throw std::length_error("write ahead log record is too big");
+
+        auto record = record_header + length;
+        if (write_fd_ < 0 || segments_.back().size + record > segment_size_)
+        {
+            if (write_fd_ < 0 || segments_.back().size > 0)
+                start_segment();
+        }
+
+        char header[record_header];
+        internal::store32(header, static_cast<uint32_t>(length));
+        internal::store32(header + 4, internal::crc32(data, length));
+        write_fully(write_fd_, header, record_header);
+        write_fully(write_fd_, data, length);
+        if (sync_)
+            ::fdatasync(write_fd_);
+
+        auto& back = segments_.back();
+        back.size += record;
+        ++back.records;
+        bytes_ += record;
+
+        bool dropped = false;
+        while (bytes_ > max_size_ && segments_.size() > 1)
+        {
+            remove_front();
+            dropped = true;
+        }
+        if (dropped)
+            save_cursor();
+    }
+
+    /**
+     * \brief Read the oldest record that hasn't been consumed
+     *
+     * \return false if every record has been consumed
+     */
+    bool front(std::string& into)
+    {
+        while (!segments_.empty())
+        {
+            auto& front = segments_.front();
+            if (read_records_ < front.records)
+            {
+                if (read_fd_ < 0)
+                {
+                    auto path = segment_path(front.index);
+                    read_fd_ = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+                    if (read_fd_ < 0)
+                        throw std::system_error(errno, std::generic_category(), "open " + path);
+                }
+
+                if (read_record(read_fd_, read_offset_, front.size, into))
+                {
+                    next_offset_ = read_offset_ + record_header + into.size();
+                    return true;
+                }
+
+                // the segment was damaged underneath us, so whatever is left in it is lost
+            }
+
+            remove_front();
+            save_cursor();
+        }
+
+        return false;
+    }
+
+    /**
+     * \brief Mark the record last returned by front() as consumed
+     */
+    void pop()
+    {
+        if (segments_.empty())
+            return;
+
+        read_offset_ = next_offset_;
+        ++read_records_;
+        if (read_records_ >= segments_.front().records)
+            remove_front();
+
+        save_cursor();
+    }
+
+    /**
+     * \brief Whether every record has been consumed
+     */
+    bool empty() const noexcept
+    {
+        return records() == 0;
+    }
+
+    /**
+     * \brief The number of records that haven't been consumed
+     */
+    std::size_t records() const noexcept
+    {
+        std::size_t result = 0;
+        for (const auto& s : segments_)
+            result += s.records;
+        return segments_.empty() ? 0 : result - read_records_;
+    }
+
+    /**
+     * \brief The number of bytes the segments take up
+     */
+    std::size_t bytes() const noexcept
+    {
+        return bytes_;
+    }
+
+    /**
+     * \brief The number of segments
+     */
+    std::size_t segments() const noexcept
+    {
+        return segments_.size();
+    }
+
+    /**
+     * \brief The number of records that were dropped before they were consumed
+     */
+    uint64_t dropped() const noexcept
+    {
+        return dropped_;
+    }
+};
+
+}
+
+#endif //CXXMETRICS_PROMETHEUS_WRITE_AHEAD_LOG_HPP
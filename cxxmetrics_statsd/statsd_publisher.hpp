@@ -0,0 +1,468 @@
+#ifndef CXXMETRICS_STATSD_PUBLISHER_HPP
+#define CXXMETRICS_STATSD_PUBLISHER_HPP
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cxxmetrics/exposition_buffer.hpp>
+#include <cxxmetrics/internal/interval_thread.hpp>
+#include <cxxmetrics/publish_format.hpp>
+#include <cxxmetrics/publisher.hpp>
+
+namespace cxxmetrics_statsd
+{
+
+using cxxmetrics::exposition_buffer;
+
+/**
+ * \brief The settings of a statsd_publisher
+ */
+struct statsd_options
+{
+    /**
+     * \brief The IPv4 address of the statsd agent
+     */
+    std::string address = "127.0.0.1";
+
+    /**
+     * \brief The port of the statsd agent
+     */
+    uint16_t port = 8125;
+
+    /**
+     * \brief The largest datagram to send. Lines are packed into datagrams up to this size
+     *
+     * The default fits in an ethernet MTU after the IP and UDP headers. A single line that's larger still goes out in
+     * a datagram of its own.
+     */
+    std::size_t max_datagram = 1432;
+
+    /**
+     * \brief A prefix for every metric name, joined to the name with a '.'
+     */
+    std::string prefix;
+
+    /**
+     * \brief Whether to send the tags of every series in DogStatsD form. Plain statsd agents don't understand them
+     */
+    bool tags = true;
+};
+
+namespace internal
+{
+
+inline bool is_reserved(char c) noexcept
+{
+    return c == ':' || c == '|' || c == '@' || c == '#' || c == ',' || c == '\n' || c == ' ';
+}
+
+/**
+ * \brief Copy text into a line, replacing the characters that delimit the parts of a statsd line
+ */
+inline exposition_buffer& format_element(exposition_buffer& into, const char* text, std::size_t length)
+{
+    return cxxmetrics::internal::format_replaced(into, text, length, is_reserved);
+}
+
+inline exposition_buffer& format_element(exposition_buffer& into, const std::string& text)
+{
+    return format_element(into, text.data(), text.size());
+}
+
+inline std::string escaped_name(const std::string& prefix, const cxxmetrics::metric_path& path)
+{
+    exposition_buffer buffer(128);
+    if (!prefix.empty())
+        buffer << prefix << '.';
+
+    bool first = true;
+    for (const auto& elem : path)
+    {
+        if (!first)
+            buffer << '.';
+        format_element(buffer, elem);
+        first = false;
+    }
+
+    return buffer.str();
+}
+
+/**
+ * \brief Get the tags of a series in DogStatsD form, including the leading |#
+ */
+inline std::string escaped_tags(const cxxmetrics::tag_collection& tags)
+{
+    exposition_buffer result(128);
+    exposition_buffer value(64);
+    for (const auto& tag : tags)
+    {
+        result << (result.empty() ? "|#" : ",");
+        format_element(result, tag.first);
+        result << ':';
+
+        // values may contain a colon, the tag is split on the first one
+        value.clear();
+        value << tag.second;
+        cxxmetrics::internal::format_replaced(result, value.data(), value.size(), [](char c) { return c != ':' && is_reserved(c); });
+    }
+
+    return result.str();
+}
+
+/**
+ * \brief The escaped name of a registered metric and the state of each of its series between publishes
+ */
+class statsd_series
+{
+public:
+    struct series
+    {
+        std::string tags;
+        cxxmetrics::metric_value last;
+        uint64_t last_count;
+
+        series() :
+                last(0),
+                last_count(0)
+        { }
+    };
+
+private:
+    std::unordered_map<cxxmetrics::tag_collection, series> series_;
+    std::string name_;
+    std::mutex lock_;
+
+public:
+    void lock() { lock_.lock(); }
+    void unlock() { lock_.unlock(); }
+
+    const std::string& name(const std::string& prefix, const cxxmetrics::metric_path& path)
+    {
+        if (name_.empty())
+            name_ = escaped_name(prefix, path);
+        return name_;
+    }
+
+    series& get(const cxxmetrics::tag_collection& tags)
+    {
+        auto fnd = series_.find(tags);
+        if (fnd != series_.end())
+            return fnd->second;
+
+        auto& result = series_[tags];
+        result.tags = escaped_tags(tags);
+        return result;
+    }
+};
+
+/**
+ * \brief Statsd lines packed into datagrams as they're written
+ *
+ * Lines are written one after the other into a single buffer, each followed by a newline. A datagram is a run of
+ * whole lines in the buffer without the last newline, so packing them doesn't copy anything.
+ */
+class datagram_batch
+{
+    exposition_buffer lines_;
+    std::vector<std::pair<std::size_t, std::size_t>> datagrams_;
+    std::size_t max_;
+    std::size_t start_;
+    std::size_t end_;
+
+public:
+    explicit datagram_batch(std::size_t max_datagram) :
+            lines_(16384),
+            max_(max_datagram),
+            start_(0),
+            end_(0)
+    { }
+
+    exposition_buffer& buffer() noexcept
+    {
+        return lines_;
+    }
+
+    /**
+     * \brief Finish the line written since the last one, starting a new datagram if it doesn't fit in the current one
+     */
+    void end_line()
+    {
+        lines_ << '\n';
+        auto end = lines_.size();
+        if (end - start_ - 1 > max_ && end_ > start_)
+        {
+            datagrams_.emplace_back(start_, end_ - start_ - 1);
+            start_ = end_;
+        }
+        end_ = end;
+    }
+
+    const std::vector<std::pair<std::size_t, std::size_t>>& finish()
+    {
+        if (end_ > start_)
+            datagrams_.emplace_back(start_, end_ - start_ - 1);
+        start_ = end_;
+        return datagrams_;
+    }
+
+    const char* data() const noexcept
+    {
+        return lines_.data();
+    }
+
+    void clear()
+    {
+        lines_.clear();
+        datagrams_.clear();
+        start_ = end_ = 0;
+    }
+};
+
+/**
+ * \brief Writes the statsd lines of the series of a metric. Timers are sent in milliseconds, the unit statsd agents
+ * expect of them
+ */
+class line_writer : public cxxmetrics::internal::flat_snapshot_writer<line_writer>
+{
+    friend class cxxmetrics::internal::flat_snapshot_writer<line_writer>;
+
+    datagram_batch& batch_;
+    exposition_buffer& out_;
+    const std::string& name_;
+    statsd_series::series& series_;
+    bool tags_;
+
+    void line(const char* prefix, const char* suffix, std::size_t length, const cxxmetrics::metric_value& value, const char* type)
+    {
+        out_ << name_ << prefix;
+        out_.append(suffix, length) << ':' << value << '|' << type;
+        if (tags_)
+            out_ << series_.tags;
+        batch_.end_line();
+    }
+
+    void field(const char* prefix, const char* name, std::size_t length, const cxxmetrics::metric_value& value)
+    {
+        // a signed gauge value is taken as a change to the gauge so negative values are set from zero
+        if (static_cast<double>(value) < 0)
+            line(prefix, name, length, cxxmetrics::metric_value(0), "g");
+        line(prefix, name, length, value, "g");
+    }
+
+    void value(const cxxmetrics::metric_value& value)
+    {
+        field("", "", 0, value);
+    }
+
+    void count(uint64_t total)
+    {
+        if (total != series_.last_count)
+            line(".", "count", 5, cxxmetrics::metric_value(static_cast<int64_t>(total - series_.last_count)), "c");
+        series_.last_count = total;
+    }
+
+public:
+    line_writer(datagram_batch& batch, const cxxmetrics::publish_options& options, const std::string& name, statsd_series::series& series, bool tags) :
+            flat_snapshot_writer(options, ".", ".rates."),
+            batch_(batch),
+            out_(batch.buffer()),
+            name_(name),
+            series_(series),
+            tags_(tags)
+    { }
+
+    using flat_snapshot_writer::write;
+
+    /**
+     * \brief Counters are sent as the change since the last publish
+     */
+    void write(const cxxmetrics::cumulative_value_snapshot& snapshot)
+    {
+        auto value = cxxmetrics::internal::scale_value(snapshot.value(), options().value_options());
+        auto delta = value - series_.last;
+        if (static_cast<double>(delta) != 0)
+            line("", "", 0, delta, "c");
+        series_.last = std::move(value);
+    }
+};
+
+}
+
+/**
+ * \brief A publisher that pushes the metrics in a registry to a statsd agent over UDP
+ *
+ * Counters are sent as statsd counters with the change since the last publish. Gauges are sent as gauges. Meters
+ * are sent as a gauge per rate. Histograms and timers are already aggregated into a reservoir, so rather than
+ * sending samples they're sent as a gauge per quantile along with their mean and a counter of new observations.
+ * Tags are sent in the DogStatsD form.
+ *
+ * The lines are packed into datagrams up to the configured size and sent in batches with sendmmsg. This is only
+ * available on Linux.
+ */
+template<typename TMetricRepo>
+class statsd_publisher : public cxxmetrics::metrics_publisher<TMetricRepo>
+{
+    statsd_options options_;
+    cxxmetrics::publisher_state<internal::statsd_series> states_;
+    internal::datagram_batch batch_;
+    int socket_;
+    std::mutex publish_lock_;
+
+    cxxmetrics::internal::interval_thread thread_;
+
+    void open()
+    {
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(options_.port);
+        if (inet_pton(AF_INET, options_.address.c_str(), &address.sin_addr) != 1)
+            throw std::system_error(std::make_error_code(std::errc::invalid_argument), "invalid statsd address");
+
+        auto fd = ::socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (fd < 0)
+            throw std::system_error(errno, std::generic_category(), "socket");
+
+        // connecting means the datagrams don't each need an address
+        if (::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0)
+        {
+            auto error = errno;
+            ::close(fd);
+            throw std::system_error(error, std::generic_category(), "connect");
+        }
+
+        socket_ = fd;
+    }
+
+    std::size_t send(const std::vector<std::pair<std::size_t, std::size_t>>& datagrams)
+    {
+        constexpr std::size_t batch = 64;
+        mmsghdr messages[batch];
+        iovec parts[batch];
+
+        std::size_t sent = 0;
+        while (sent < datagrams.size())
+        {
+            auto count = std::min(batch, datagrams.size() - sent);
+            for (std::size_t i = 0; i < count; i++)
+            {
+                parts[i].iov_base = const_cast<char*>(batch_.data() + datagrams[sent + i].first);
+                parts[i].iov_len = datagrams[sent + i].second;
+                messages[i] = mmsghdr{};
+                messages[i].msg_hdr.msg_iov = &parts[i];
+                messages[i].msg_hdr.msg_iovlen = 1;
+            }
+
+            auto result = ::sendmmsg(socket_, messages, static_cast<unsigned int>(count), MSG_NOSIGNAL);
+            if (result < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+
+                // statsd is fire and forget. Whatever couldn't be sent now is dropped
+                break;
+            }
+
+            sent += static_cast<std::size_t>(result);
+        }
+
+        return sent;
+    }
+
+public:
+    statsd_publisher(cxxmetrics::metrics_registry<TMetricRepo>& registry, statsd_options options = statsd_options()) :
+            cxxmetrics::metrics_publisher<TMetricRepo>(registry),
+            options_(std::move(options)),
+            batch_(options_.max_datagram),
+            socket_(-1)
+    { }
+
+    statsd_publisher(const statsd_publisher&) = delete;
+    statsd_publisher& operator=(const statsd_publisher&) = delete;
+
+    ~statsd_publisher()
+    {
+        stop();
+        if (socket_ >= 0)
+            ::close(socket_);
+    }
+
+    /**
+     * \brief Send every registered metric to the agent now
+     *
+     * \throws std::system_error if the socket to the agent can't be opened
+     *
+     * \return the number of datagrams that were sent
+     */
+    std::size_t publish()
+    {
+        return publish_series(nullptr);
+    }
+
+    /**
+     * \brief Send every series in a collected snapshot of the registry to the agent now
+     *
+     * \throws std::system_error if the socket to the agent can't be opened
+     *
+     * \return the number of datagrams that were sent
+     */
+    std::size_t publish(const cxxmetrics::registry_snapshot& snapshot)
+    {
+        return publish_series(&snapshot);
+    }
+
+private:
+    std::size_t publish_series(const cxxmetrics::registry_snapshot* snapshot)
+    {
+        std::lock_guard<std::mutex> lock(publish_lock_);
+        if (socket_ < 0)
+            open();
+
+        batch_.clear();
+        this->visit_families(snapshot, [this](const cxxmetrics::metric_path& path, cxxmetrics::basic_registered_metric& metric, auto& series) {
+            if (path.begin() == path.end())
+                return;
+
+            const auto& options = this->effective_options(metric);
+            auto& state = states_.get(metric);
+            std::lock_guard<internal::statsd_series> state_lock(state);
+
+            const auto& name = state.name(options_.prefix, path);
+            series.visit([&](const cxxmetrics::tag_collection& tags, const auto& value) {
+                internal::line_writer writer(batch_, options, name, state.get(tags), options_.tags);
+                writer.write(value);
+            });
+        });
+
+        return send(batch_.finish());
+    }
+
+public:
+    /**
+     * \brief Publish on an interval from a background thread until stopped
+     *
+     * \throws std::invalid_argument if the interval isn't positive
+     */
+    void start(std::chrono::milliseconds interval)
+    {
+        thread_.start(interval, [this]() { publish(); });
+    }
+
+    void stop()
+    {
+        thread_.stop();
+    }
+};
+
+}
+
+#endif //CXXMETRICS_STATSD_PUBLISHER_HPP
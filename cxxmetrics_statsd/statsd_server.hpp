@@ -0,0 +1,582 @@
+#ifndef CXXMETRICS_STATSD_SERVER_HPP
+#define CXXMETRICS_STATSD_SERVER_HPP
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cxxmetrics/metrics_registry.hpp>
+#include <cxxmetrics/timer.hpp>
+#include <cxxmetrics/uniform_reservoir.hpp>
+
+namespace cxxmetrics_statsd
+{
+
+/**
+ * \brief The settings of a statsd_server
+ */
+struct statsd_server_options
+{
+    /**
+     * \brief The IPv4 address to receive on
+     */
+    std::string address = "0.0.0.0";
+
+    /**
+     * \brief The port to receive on, or 0 to have one picked. The picked port is available from the server
+     */
+    uint16_t port = 8125;
+
+    /**
+     * \brief The number of receiving threads, each with its own socket sharing the port
+     */
+    std::size_t threads = 1;
+
+    /**
+     * \brief The largest datagram that's received in full. A longer one is cut back to its last complete line and the
+     * rest of it is dropped
+     */
+    std::size_t max_datagram = 8192;
+
+    /**
+     * \brief The number of datagrams each thread takes from its socket in a single call
+     */
+    std::size_t batch = 32;
+
+    /**
+     * \brief The receive buffer size to ask for on each socket, or 0 to leave it as is
+     */
+    int receive_buffer = 4 * 1024 * 1024;
+};
+
+namespace internal
+{
+
+/**
+ * \brief The type of a statsd line
+ */
+enum class statsd_type
+{
+    counter,
+    gauge,
+    timer,
+    set,
+    unknown
+};
+
+/**
+ * \brief A statsd line taken apart in place. Every part points into the datagram it was parsed from
+ */
+struct statsd_line
+{
+    const char* name = nullptr;
+    std::size_t name_size = 0;
+    const char* value = nullptr;
+    std::size_t value_size = 0;
+    statsd_type type = statsd_type::unknown;
+    double sample_rate = 1;
+    const char* tags = nullptr;
+    std::size_t tags_size = 0;
+
+    /**
+     * \brief Whether a gauge line changes the gauge by its value rather than setting it
+     */
+    bool relative() const noexcept
+    {
+        return value_size > 0 && (value[0] == '+' || value[0] == '-');
+    }
+};
+
+inline statsd_type parse_type(const char* type, std::size_t size) noexcept
+{
+    if (size == 1)
+    {
+        switch (type[0])
+        {
+            case 'c':
+                return statsd_type::counter;
+            case 'g':
+                return statsd_type::gauge;
+            case 'h':
+            case 'd':
+                return statsd_type::timer;
+            case 's':
+                return statsd_type::set;
+            default:
+                return statsd_type::unknown;
+        }
+    }
+
+    return (size == 2 && type[0] == 'm' && type[1] == 's') ? statsd_type::timer : statsd_type::unknown;
+}
+
+/**
+ * \brief Take apart a line of the form name:value|type[|@rate][|#tags] without copying any of it
+ *
+ * \return false if the line isn't a valid statsd line
+ */
+inline bool parse_line(const char* begin, const char* end, statsd_line& line) noexcept
+{
+    auto colon = static_cast<const char*>(std::memchr(begin, ':', end - begin));
+    if (colon == nullptr || colon == begin)
+        return false;
+
+    line.name = begin;
+    line.name_size = colon - begin;
+
+    auto value = colon + 1;
+    auto pipe = static_cast<const char*>(std::memchr(value, '|', end - value));
+    if (pipe == nullptr || pipe == value)
+        return false;
+
+    line.value = value;
+    line.value_size = pipe - value;
+    line.sample_rate = 1;
+    line.tags = nullptr;
+    line.tags_size = 0;
+
+    auto section = pipe + 1;
+    auto next = static_cast<const char*>(std::memchr(section, '|', end - section));
+    auto section_end = next ? next : end;
+    line.type = parse_type(section, section_end - section);
+    if (line.type == statsd_type::unknown)
+        return false;
+
+    while (next)
+    {
+        section = next + 1;
+        next = static_cast<const char*>(std::memchr(section, '|', end - section));
+        section_end = next ? next : end;
+        if (section == section_end)
+            continue;
+
+        if (*section == '@')
+        {
+            char* parsed;
+            line.sample_rate = std::strtod(section + 1, &parsed);
+            if (parsed != section_end || !(line.sample_rate > 0))
+                return false;
+        }
+        else if (*section == '#')
+        {
+            line.tags = section + 1;
+            line.tags_size = section_end - line.tags;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * \brief Parse the value of a line. The datagram has to be terminated so that the parse stops at its end
+ */
+inline bool parse_value(const statsd_line& line, double& value) noexcept
+{
+    char* parsed;
+    value = std::strtod(line.value, &parsed);
+    return parsed == line.value + line.value_size && std::isfinite(value);
+}
+
+inline cxxmetrics::metric_path parse_path(const char* name, std::size_t size)
+{
+    auto end = name + size;
+    auto dot = static_cast<const char*>(std::memchr(name, '.', size));
+    cxxmetrics::metric_path result(std::string(name, dot ? dot : end));
+    while (dot)
+    {
+        auto elem = dot + 1;
+        dot = static_cast<const char*>(std::memchr(elem, '.', end - elem));
+        if ((dot ? dot : end) != elem)
+            result = result / cxxmetrics::metric_path(std::string(elem, dot ? dot : end));
+    }
+
+    return result;
+}
+
+inline cxxmetrics::tag_collection parse_tags(const char* tags, std::size_t size)
+{
+    std::unordered_map<std::string, cxxmetrics::metric_value> result;
+    auto end = tags + size;
+    while (tags < end)
+    {
+        auto comma = static_cast<const char*>(std::memchr(tags, ',', end - tags));
+        auto tag_end = comma ? comma : end;
+        auto colon = static_cast<const char*>(std::memchr(tags, ':', tag_end - tags));
+        if (tag_end != tags)
+        {
+            if (colon)
+                result.emplace(std::string(tags, colon), cxxmetrics::metric_value(std::string(colon + 1, tag_end)));
+            else
+                result.emplace(std::string(tags, tag_end), cxxmetrics::metric_value(std::string()));
+        }
+
+        tags = tag_end + 1;
+    }
+
+    return cxxmetrics::tag_collection(result);
+}
+
+}
+
+/**
+ * \brief Receives statsd lines over UDP and feeds them into the metrics of a registry
+ *
+ * Each receiving thread has its own socket bound to the same port with SO_REUSEPORT so the kernel spreads datagrams
+ * across them, and drains it a batch of datagrams at a time with recvmmsg. Lines are parsed in place in the receive
+ * buffers.
+ *
+ * Counters feed registry counters, with their values divided by their sample rate and rounded. Gauges feed
+ * registry gauges of doubles, and signed gauge values change the gauge rather than set it. Timers, histograms and
+ * distributions all feed registry timers, with their values taken as milliseconds. Sets aren't supported.
+ *
+ * The registry metric of a series is looked up once and kept as a prepared handle. Every thread keeps its own map
+ * from the raw name, type and tags of a line to the handle so that lines only touch the registry the first time
+ * they're seen. This is only available on Linux.
+ *
+ * \tparam TMetricRepo the repository type of the registry
+ * \tparam TReservoir the reservoir of the timers that are registered for timer lines
+ */
+template<typename TMetricRepo, typename TReservoir = cxxmetrics::uniform_reservoir<std::chrono::steady_clock::duration, 1024>>
+class statsd_server
+{
+public:
+    using counter_type = cxxmetrics::counter<int64_t>;
+    using gauge_type = cxxmetrics::gauge<double>;
+    using timer_type = cxxmetrics::timer<cxxmetrics::time::seconds(1), std::chrono::steady_clock, TReservoir, cxxmetrics::time::minutes(1), cxxmetrics::time::minutes(5)>;
+
+private:
+    /**
+     * \brief The registry metric of a series, looked up once
+     */
+    struct prepared_handle
+    {
+        std::shared_ptr<counter_type> counter;
+        std::shared_ptr<gauge_type> gauge;
+        std::shared_ptr<timer_type> timer;
+        std::mutex gauge_lock;
+    };
+
+    cxxmetrics::metrics_registry<TMetricRepo>& registry_;
+    statsd_server_options options_;
+
+    std::unordered_map<std::string, std::unique_ptr<prepared_handle>> handles_;
+    std::mutex handles_lock_;
+
+    std::vector<int> sockets_;
+    std::vector<std::thread> threads_;
+    int wake_;
+    uint16_t port_;
+    std::atomic_bool running_;
+
+    std::atomic<uint64_t> packets_;
+    std::atomic<uint64_t> lines_;
+    std::atomic<uint64_t> rejected_;
+
+    static void check(int result, const char* what)
+    {
+        if (result < 0)
+            throw std::system_error(errno, std::generic_category(), what);
+    }
+
+    int open_socket(uint16_t port)
+    {
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        if (inet_pton(AF_INET, options_.address.c_str(), &address.sin_addr) != 1)
+            throw std::system_error(std::make_error_code(std::errc::invalid_argument), "invalid statsd address");
+
+        auto fd = ::socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        check(fd, "socket");
+        sockets_.push_back(fd);
+
+        int on = 1;
+        check(setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)), "setsockopt");
+        if (options_.receive_buffer > 0)
+            setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &options_.receive_buffer, sizeof(options_.receive_buffer));
+        check(::bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)), "bind");
+
+        socklen_t length = sizeof(address);
+        check(getsockname(fd, reinterpret_cast<sockaddr*>(&address), &length), "getsockname");
+        port_ = ntohs(address.sin_port);
+        return fd;
+    }
+
+    /**
+     * \brief Get the handle for a series the first time a thread sees it
+     */
+    prepared_handle* prepare(const std::string& key, const internal::statsd_line& line)
+    {
+        std::lock_guard<std::mutex> lock(handles_lock_);
+        auto fnd = handles_.find(key);
+        if (fnd != handles_.end())
+            return fnd->second.get();
+
+        std::unique_ptr<prepared_handle> handle(new prepared_handle());
+        try
+        {
+            auto path = internal::parse_path(line.name, line.name_size);
+            auto tags = internal::parse_tags(line.tags, line.tags_size);
+            switch (line.type)
+            {
+                case internal::statsd_type::counter:
+                    handle->counter = registry_.template counter<int64_t>(path, tags);
+                    break;
+                case internal::statsd_type::gauge:
+                    handle->gauge = registry_.gauge(path, 0.0, tags);
+                    break;
+                default:
+                    handle->timer = registry_.template timer<cxxmetrics::time::seconds(1), std::chrono::steady_clock, TReservoir, cxxmetrics::time::minutes(1), cxxmetrics::time::minutes(5)>(path, TReservoir(), tags);
+                    break;
+            }
+        }
+        catch (const cxxmetrics::metric_type_mismatch&)
+        {
+            // the handle stays empty so the lines of the series keep being rejected without another lookup
+        }
+
+        return handles_.emplace(key, std::move(handle)).first->second.get();
+    }
+
+    void apply(prepared_handle& handle, const internal::statsd_line& line, double value)
+    {
+        if (handle.counter)
+            *handle.counter += std::llround(value / line.sample_rate);
+        else if (handle.gauge)
+        {
+            std::lock_guard<std::mutex> lock(handle.gauge_lock);
+            handle.gauge->set(line.relative() ? handle.gauge->get() + value : value);
+        }
+        else if (handle.timer)
+            handle.timer->update(std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double, std::milli>(value)));
+        else
+            ++rejected_;
+    }
+
+    void receive(int fd)
+    {
+        std::unordered_map<std::string, prepared_handle*> cache;
+        std::string key;
+
+        auto batch = std::max<std::size_t>(options_.batch, 1);
+        auto size = options_.max_datagram + 1;
+        std::unique_ptr<char[]> buffers(new char[batch * size]);
+        std::vector<iovec> parts(batch);
+        std::vector<mmsghdr> messages(batch);
+
+        pollfd waits[2];
+        waits[0].fd = fd;
+        waits[0].events = POLLIN;
+        waits[1].fd = wake_;
+        waits[1].events = POLLIN;
+
+        while (running_.load(std::memory_order_acquire))
+        {
+            for (std::size_t i = 0; i < batch; i++)
+            {
+                parts[i].iov_base = buffers.get() + i * size;
+                parts[i].iov_len = size - 1;
+                messages[i] = mmsghdr{};
+                messages[i].msg_hdr.msg_iov = &parts[i];
+                messages[i].msg_hdr.msg_iovlen = 1;
+            }
+
+            auto received = ::recvmmsg(fd, messages.data(), static_cast<unsigned int>(batch), MSG_DONTWAIT, nullptr);
+            if (received <= 0)
+            {
+                if (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                    return;
+
+                waits[0].revents = waits[1].revents = 0;
+                ::poll(waits, 2, -1);
+                if (waits[1].revents)
+                    return;
+                continue;
+            }
+
+            packets_.fetch_add(static_cast<uint64_t>(received), std::memory_order_relaxed);
+            uint64_t lines = 0;
+            for (int i = 0; i < received; i++)
+            {
+                auto data = buffers.get() + i * size;
+                auto end = data + messages[i].msg_len;
+
+                // a datagram that didn't fit ends part way through a line, which is rejected rather than parsed
+                if (messages[i].msg_hdr.msg_flags & MSG_TRUNC)
+                {
+                    auto last = end;
+                    while (last > data && last[-1] != '\n')
+                        --last;
+                    if (last != end)
+                    {
+                        ++lines;
+                        ++rejected_;
+                    }
+                    end = last;
+                }
+
+                // terminated so value parsing stops at the end of the datagram
+                *end = '\0';
+                while (data < end)
+                {
+                    auto newline = static_cast<char*>(std::memchr(data, '\n', end - data));
+                    auto line_end = newline ? newline : end;
+                    if (line_end > data && line_end[-1] == '\r')
+                        --line_end;
+
+                    internal::statsd_line line;
+                    double value;
+                    if (line_end != data)
+                    {
+                        ++lines;
+                        if (!internal::parse_line(data, line_end, line) || !internal::parse_value(line, value) || line.type == internal::statsd_type::set)
+                            ++rejected_;
+                        else
+                        {
+                            key.assign(line.name, line.name_size);
+                            key += '|';
+                            key += static_cast<char>('0' + static_cast<int>(line.type));
+                            key.append(line.tags ? line.tags : "", line.tags_size);
+
+                            auto fnd = cache.find(key);
+                            auto handle = fnd != cache.end() ? fnd->second : (cache[key] = prepare(key, line));
+                            apply(*handle, line, value);
+                        }
+                    }
+
+                    data = newline ? newline + 1 : end;
+                }
+            }
+
+            lines_.fetch_add(lines, std::memory_order_relaxed);
+        }
+    }
+
+    void release() noexcept
+    {
+        for (auto fd : sockets_)
+            ::close(fd);
+        sockets_.clear();
+        if (wake_ >= 0)
+            ::close(wake_);
+        wake_ = -1;
+    }
+
+public:
+    statsd_server(cxxmetrics::metrics_registry<TMetricRepo>& registry, statsd_server_options options = statsd_server_options()) :
+            registry_(registry),
+            options_(std::move(options)),
+            wake_(-1),
+            port_(0),
+            running_(false),
+            packets_(0),
+            lines_(0),
+            rejected_(0)
+    { }
+
+    statsd_server(const statsd_server&) = delete;
+    statsd_server& operator=(const statsd_server&) = delete;
+
+    ~statsd_server()
+    {
+        stop();
+    }
+
+    /**
+     * \brief Bind the sockets and start receiving on the receiving threads
+     *
+     * \throws std::system_error if the sockets can't be bound to the configured address and port
+     */
+    void start()
+    {
+        if (running_.load())
+            return;
+
+        try
+        {
+            check(wake_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC), "eventfd");
+
+            // the first socket picks the port if it's left to the kernel and the rest share it
+            open_socket(options_.port);
+            for (std::size_t i = 1; i < options_.threads; i++)
+                open_socket(port_);
+        }
+        catch (...)
+        {
+            release();
+            throw;
+        }
+
+        running_.store(true, std::memory_order_release);
+        for (auto fd : sockets_)
+            threads_.emplace_back([this, fd]() { receive(fd); });
+    }
+
+    /**
+     * \brief Stop receiving and close the sockets
+     */
+    void stop()
+    {
+        if (!running_.exchange(false))
+            return;
+
+        uint64_t one = 1;
+        auto written = ::write(wake_, &one, sizeof(one));
+        (void)written;
+        for (auto& t : threads_)
+            t.join();
+        threads_.clear();
+        release();
+    }
+
+    /**
+     * \brief The port the server is receiving on, once started
+     */
+    uint16_t port() const noexcept
+    {
+        return port_;
+    }
+
+    /**
+     * \brief The number of datagrams received
+     */
+    uint64_t packets() const noexcept
+    {
+        return packets_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * \brief The number of lines received, including rejected ones
+     */
+    uint64_t lines() const noexcept
+    {
+        return lines_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * \brief The number of lines that were malformed, unsupported or conflicted with the type of a registered metric
+     */
+    uint64_t rejected() const noexcept
+    {
+        return rejected_.load(std::memory_order_relaxed);
+    }
+};
+
+}
+
+#endif //CXXMETRICS_STATSD_SERVER_HPP
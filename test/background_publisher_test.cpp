@@ -0,0 +1,87 @@
+#include <catch2/catch_all.hpp>
+#include <sstream>
+#include <thread>
+#include <cxxmetrics_prometheus/background_publisher.hpp>
+#include <cxxmetrics_prometheus/prometheus_publisher.hpp>
+
+using namespace cxxmetrics;
+using namespace cxxmetrics_literals;
+using namespace cxxmetrics_prometheus;
+
+TEST_CASE("Background publisher serves the last render until it renders again", "[prometheus]")
+{
+    metrics_registry<> r;
+    background_publisher<prometheus_publisher<decltype(r)::repository_type>> subject(r, std::chrono::hours(1));
+    auto& counter = *r.counter("MyCounter"_m);
+    counter += 10;
+
+    // the first scrape renders when nothing has been rendered yet
+    std::stringstream first;
+    subject.write(first);
+    REQUIRE_THAT(first.str(), Catch::Matchers::ContainsSubstring("MyCounter{} 10\n"));
+
+    counter += 5;
+    auto held = subject.latest();
+
+    exposition_buffer stale;
+    subject.write(stale);
+    REQUIRE(stale.str() == first.str());
+
+    subject.render();
+    exposition_buffer fresh;
+    subject.write(fresh);
+    REQUIRE_THAT(fresh.str(), Catch::Matchers::ContainsSubstring("MyCounter{} 15\n"));
+
+    // a render doesn't touch a buffer that's still being read from
+    subject.render();
+    REQUIRE(held->str() == first.str());
+    REQUIRE(subject.content_type() == std::string(prometheus_publisher<decltype(r)::repository_type>::content_type()));
+}
+
+TEST_CASE("Background publisher renders on its interval once started", "[prometheus]")
+{
+    metrics_registry<> r;
+    background_publisher<prometheus_publisher<decltype(r)::repository_type>> subject(r, std::chrono::milliseconds(5));
+    auto& counter = *r.counter("MyCounter"_m);
+    counter += 10;
+
+    subject.start();
+    REQUIRE_THAT(subject.latest()->str(), Catch::Matchers::ContainsSubstring("MyCounter{} 10\n"));
+
+    counter += 5;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (subject.latest()->str().find("MyCounter{} 15\n") == std::string::npos && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    REQUIRE_THAT(subject.latest()->str(), Catch::Matchers::ContainsSubstring("MyCounter{} 15\n"));
+    subject.stop();
+    subject.stop();
+
+    background_publisher<prometheus_publisher<decltype(r)::repository_type>> unscheduled(r, std::chrono::milliseconds(0));
+    REQUIRE_THROWS_AS(unscheduled.start(), std::invalid_argument);
+}
+
+TEST_CASE("Background publisher hands its render to iovec sinks without copying it", "[prometheus]")
+{
+    metrics_registry<> r;
+    background_publisher<prometheus_publisher<decltype(r)::repository_type>> subject(r, std::chrono::hours(1));
+    for (int i = 0; i < 100; i++)
+        *r.counter("MyCounter" + std::to_string(i)) += i;
+
+    iovec_sink first;
+    subject.write(first);
+    iovec_sink second;
+    subject.write(second);
+
+    REQUIRE(first.pieces().size() == 1);
+    REQUIRE(second.pieces().size() == 1);
+    REQUIRE(first.pieces()[0].iov_base == second.pieces()[0].iov_base);
+    REQUIRE(first.pieces()[0].iov_base == subject.latest()->data());
+
+    // the sinks hold on to the render, so the next one goes into another buffer
+    *r.counter("MyCounter0"_m) += 5;
+    subject.render();
+    REQUIRE(subject.latest()->data() != first.pieces()[0].iov_base);
+    REQUIRE_THAT(first.str(), Catch::Matchers::ContainsSubstring("MyCounter0{} 0\n"));
+    REQUIRE(second.str() == first.str());
+}
@@ -29,3 +29,18 @@ TEST_CASE("Counter excercise snapshot", "[counter]")
     counter<double> a(15.7);
     REQUIRE(a.snapshot() == 15.7);
 }
+
+TEST_CASE("Counter epoch changes on every update", "[counter]")
+{
+    counter<int64_t> a;
+    auto epoch = a.epoch();
+    REQUIRE(epoch != 0);
+    REQUIRE(a.epoch() == epoch);
+
+    a += 0;
+    REQUIRE(a.epoch() != epoch);
+
+    epoch = a.epoch();
+    a = 10;
+    REQUIRE(a.epoch() != epoch);
+}
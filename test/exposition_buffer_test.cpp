@@ -0,0 +1,73 @@
+#include <catch2/catch_all.hpp>
+#include <cstdlib>
+#include <limits>
+#include <cxxmetrics/exposition_buffer.hpp>
+
+using namespace cxxmetrics;
+
+TEST_CASE("Exposition buffer formats integers", "[exposition_buffer]")
+{
+    exposition_buffer subject(1);
+    subject << 0 << ' ' << 7 << ' ' << -42 << ' ' << 1234567890123ull << ' ' << std::numeric_limits<int64_t>::min() << ' ' << std::numeric_limits<uint64_t>::max();
+
+    REQUIRE(subject.str() == "0 7 -42 1234567890123 -9223372036854775808 18446744073709551615");
+}
+
+TEST_CASE("Exposition buffer formats doubles so they read back the same", "[exposition_buffer]")
+{
+    exposition_buffer subject;
+    subject << 923.005;
+    REQUIRE(subject.str() == "923.005");
+
+    subject.clear();
+    subject << 2.0 << ' ' << 0.1 << ' ' << -1.5e-7;
+    REQUIRE(subject.str() == "2 0.1 -1.5e-07");
+
+    subject.clear();
+    subject << std::numeric_limits<double>::quiet_NaN() << ' ' << std::numeric_limits<double>::infinity() << ' ' << -std::numeric_limits<double>::infinity();
+    REQUIRE(subject.str() == "NaN +Inf -Inf");
+
+    for (double value : {1.0 / 3.0, 2.0 / 3.0, 1e300, 123456789.123456789, 5e-324})
+    {
+        subject.clear();
+        subject << value;
+        REQUIRE(std::strtod(subject.str().c_str(), nullptr) == value);
+    }
+}
+
+TEST_CASE("Exposition buffer formats metric values by their kind", "[exposition_buffer]")
+{
+    exposition_buffer subject;
+    subject << metric_value(-3) << ' ' << metric_value(3u) << ' ' << metric_value(1.25) << ' ' << metric_value(std::string("abc")) << ' ' << metric_value(std::chrono::microseconds(15));
+
+    REQUIRE(subject.str() == "-3 3 1.25 abc 15");
+}
+
+TEST_CASE("Exposition buffer grows and keeps its contents", "[exposition_buffer]")
+{
+    exposition_buffer subject(2);
+    std::string expected;
+    for (int i = 0; i < 1000; i++)
+    {
+        subject << "line " << i << '\n';
+        expected += "line " + std::to_string(i) + "\n";
+    }
+
+    REQUIRE(subject.str() == expected);
+
+    auto capacity = subject.capacity();
+    subject.clear();
+    REQUIRE(subject.empty());
+    REQUIRE(subject.capacity() == capacity);
+}
+
+TEST_CASE("Exposition buffer rounds doubles to a maximum precision", "[exposition_buffer]")
+{
+    exposition_buffer subject;
+    subject.append_double(0.4999999998835847, 6) << ' ';
+    subject.append_double(0.9899999999883584, 6) << ' ';
+    subject.append_double(9.9999999, 6) << ' ';
+    subject.append_double(-0.000123456789, 3);
+
+    REQUIRE(subject.str() == "0.5 0.99 10 -0.000123");
+}
@@ -21,6 +21,25 @@ TEST_CASE("Primitive Gauge works", "[gauge]")
     REQUIRE(h.snapshot() == 50);
 }
 
+TEST_CASE("Primitive Gauge epoch changes every time it's set", "[gauge]")
+{
+    gauge<int> g;
+    auto epoch = g.epoch();
+    REQUIRE(epoch != 0);
+    REQUIRE(g.epoch() == epoch);
+
+    g.set(0);
+    REQUIRE(g.epoch() != epoch);
+
+    epoch = g.epoch();
+    g = 10;
+    REQUIRE(g.epoch() != epoch);
+
+    double value = 1;
+    gauge<std::function<double()>> fn([&value]() { return value; });
+    REQUIRE(fn.epoch() == 0);
+}
+
 TEST_CASE("Functional Gauge works", "[gauge]")
 {
     double value = 99.810;
@@ -0,0 +1,239 @@
+#include <catch2/catch_all.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cxxmetrics_graphite/graphite_publisher.hpp>
+#include <cxxmetrics/simple_reservoir.hpp>
+
+using namespace cxxmetrics;
+using namespace cxxmetrics_literals;
+using namespace cxxmetrics_graphite;
+
+namespace
+{
+
+// stands in for the carbon plaintext receiver
+class carbon
+{
+    int listener_;
+    int connection_;
+    uint16_t port_;
+    std::string pending_;
+
+public:
+    explicit carbon(uint16_t port = 0) :
+            listener_(::socket(AF_INET, SOCK_STREAM, 0)),
+            connection_(-1)
+    {
+        int on = 1;
+        setsockopt(listener_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+        REQUIRE(::bind(listener_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0);
+        REQUIRE(::listen(listener_, 4) == 0);
+
+        socklen_t length = sizeof(address);
+        getsockname(listener_, reinterpret_cast<sockaddr*>(&address), &length);
+        port_ = ntohs(address.sin_port);
+    }
+
+    ~carbon()
+    {
+        if (connection_ >= 0)
+            ::close(connection_);
+        ::close(listener_);
+    }
+
+    graphite_options options() const
+    {
+        graphite_options result;
+        result.port = port_;
+        result.min_backoff = std::chrono::milliseconds(5);
+        return result;
+    }
+
+    uint16_t port() const
+    {
+        return port_;
+    }
+
+    /**
+     * \brief Read lines until there are at least count of them, calling poke while waiting
+     */
+    template<typename TPoke>
+    std::vector<std::string> lines(std::size_t count, TPoke&& poke)
+    {
+        std::vector<std::string> result;
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (result.size() < count && std::chrono::steady_clock::now() < deadline)
+        {
+            poke();
+            if (connection_ < 0)
+            {
+                pollfd wait{listener_, POLLIN, 0};
+                if (::poll(&wait, 1, 10) <= 0)
+                    continue;
+                connection_ = ::accept(listener_, nullptr, nullptr);
+            }
+
+            pollfd wait{connection_, POLLIN, 0};
+            if (::poll(&wait, 1, 10) <= 0)
+                continue;
+
+            char data[65536];
+            auto received = ::recv(connection_, data, sizeof(data), 0);
+            if (received <= 0)
+                break;
+            pending_.append(data, static_cast<std::size_t>(received));
+
+            std::size_t end;
+            while ((end = pending_.find('\n')) != std::string::npos)
+            {
+                result.push_back(pending_.substr(0, end));
+                pending_.erase(0, end + 1);
+            }
+        }
+
+        return result;
+    }
+
+    std::vector<std::string> lines(std::size_t count)
+    {
+        return lines(count, []() { });
+    }
+};
+
+bool has_line(const std::vector<std::string>& lines, const std::string& start)
+{
+    return std::any_of(lines.begin(), lines.end(), [&](const std::string& line) {
+        return line.compare(0, start.size(), start) == 0;
+    });
+}
+
+}
+
+TEST_CASE("Graphite publisher sends plaintext lines with tags", "[graphite]")
+{
+    using reservoir_type = simple_reservoir<std::chrono::system_clock::duration, 4>;
+    carbon receiver;
+    metrics_registry<> r;
+    graphite_publisher<decltype(r)::repository_type> subject(r, receiver.options());
+
+    *r.counter("My"/"Counter"_m, {{"tag", "a b"}, {"x=y", "~v;w"}, {"empty", ""}}) += 10;
+    double gauge_value = 2.5;
+    r.gauge("MyGauge"_m, &gauge_value);
+    auto& t = *r.timer<100_micro, std::chrono::system_clock, reservoir_type, true, 1_min>("MyTimer", reservoir_type(), {{"tag", "value"}});
+    t.update(std::chrono::milliseconds(10));
+    t.update(std::chrono::milliseconds(30));
+
+    auto rendered = subject.publish();
+    REQUIRE(rendered == 3);
+
+    auto lines = receiver.lines(10, [&]() { subject.flush(); });
+    REQUIRE(lines.size() >= 10);
+    REQUIRE(subject.pending() == 0);
+    REQUIRE(subject.connections() == 1);
+
+    auto now = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    for (const auto& line : lines)
+    {
+        auto space = line.rfind(' ');
+        REQUIRE(space != std::string::npos);
+        REQUIRE(std::abs(std::stoll(line.substr(space + 1)) - now) <= 5);
+    }
+
+    REQUIRE(has_line(lines, "My.Counter;tag=a_b;x_y=_v_w 10 "));
+    REQUIRE(has_line(lines, "MyGauge 2.5 "));
+    REQUIRE(has_line(lines, "MyTimer.count;tag=value 2 "));
+    REQUIRE(has_line(lines, "MyTimer.mean;tag=value 20 "));
+    REQUIRE(has_line(lines, "MyTimer.p50;tag=value "));
+    REQUIRE(has_line(lines, "MyTimer.rates.1min;tag=value "));
+}
+
+TEST_CASE("Graphite publishers of the same registry name metrics with their own prefixes", "[graphite]")
+{
+    carbon first_receiver;
+    carbon second_receiver;
+    metrics_registry<> r;
+    graphite_publisher<decltype(r)::repository_type> first(r, first_receiver.options());
+    auto second_options = second_receiver.options();
+    second_options.prefix = "app";
+    graphite_publisher<decltype(r)::repository_type> second(r, second_options);
+
+    *r.counter("MyCounter"_m, {{"tag", "a"}}) += 10;
+    first.publish();
+    second.publish();
+
+    auto first_lines = first_receiver.lines(1, [&]() { first.flush(); });
+    auto second_lines = second_receiver.lines(1, [&]() { second.flush(); });
+    REQUIRE(has_line(first_lines, "MyCounter;tag=a 10 "));
+    REQUIRE(has_line(second_lines, "app.MyCounter;tag=a 10 "));
+}
+
+TEST_CASE("Graphite publisher bounds what it holds on to while carbon is unreachable", "[graphite]")
+{
+    uint16_t port;
+    {
+        carbon closed;
+        port = closed.port();
+    }
+
+    metrics_registry<> r;
+    graphite_options options;
+    options.port = port;
+    options.prefix = "app";
+    options.max_pending = 32 * 1024;
+    options.min_backoff = std::chrono::milliseconds(5);
+    graphite_publisher<decltype(r)::repository_type> subject(r, options);
+
+    for (int i = 0; i < 1000; i++)
+        *r.counter("Counter" + std::to_string(i)) += i;
+
+    // every publish renders about 25k and nothing can be sent
+    std::size_t rendered = 0;
+    for (int i = 0; i < 10; i++)
+    {
+        rendered += subject.publish();
+        REQUIRE(subject.pending() <= options.max_pending + 16384 * 2);
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+
+    REQUIRE(subject.connections() == 0);
+    REQUIRE(subject.dropped() > 0);
+    auto kept = rendered - subject.dropped();
+
+    // once carbon is back, whole lines of the newest publishes come through
+    carbon receiver(port);
+    auto lines = receiver.lines(kept, [&]() { subject.flush(); });
+    REQUIRE(lines.size() == kept);
+    REQUIRE(subject.connections() == 1);
+    REQUIRE(subject.pending() == 0);
+    for (const auto& line : lines)
+        REQUIRE(line.compare(0, 11, "app.Counter") == 0);
+    REQUIRE(has_line(lines, "app.Counter999 999 "));
+}
+
+TEST_CASE("Graphite publisher publishes on an interval", "[graphite]")
+{
+    carbon receiver;
+    metrics_registry<> r;
+    graphite_publisher<decltype(r)::repository_type> subject(r, receiver.options());
+
+    auto& counter = *r.counter("MyCounter"_m);
+    counter += 1;
+    REQUIRE_THROWS_AS(subject.start(std::chrono::milliseconds(0)), std::invalid_argument);
+    subject.start(std::chrono::milliseconds(10));
+
+    auto lines = receiver.lines(3);
+    subject.stop();
+    subject.stop();
+
+    REQUIRE(lines.size() >= 3);
+    REQUIRE(has_line(lines, "MyCounter 1 "));
+}
@@ -1,6 +1,26 @@
 #ifndef CXXMETRICS_HELPERS_HPP
 #define CXXMETRICS_HELPERS_HPP
 
+#include <catch2/catch_all.hpp>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cxxmetrics/snapshots.hpp>
+
 struct mock_clock
 {
     mock_clock(unsigned &ref) : value_(ref)
@@ -16,4 +36,253 @@ private:
     unsigned &value_;
 };
 
+// a directory that's removed with everything in it when it goes away
+struct temp_directory
+{
+    std::string path;
+
+    temp_directory()
+    {
+        char name[] = "/tmp/cxxmetrics_test_XXXXXX";
+        REQUIRE(::mkdtemp(name));
+        path = name;
+    }
+
+    ~temp_directory()
+    {
+        if (auto dir = ::opendir(path.c_str()))
+        {
+            while (auto entry = ::readdir(dir))
+            {
+                if (entry->d_name[0] != '.')
+                    ::unlink((path + "/" + entry->d_name).c_str());
+            }
+            ::closedir(dir);
+        }
+        ::rmdir(path.c_str());
+    }
+
+    // the number of files in the directory that end with a suffix
+    std::size_t files(const char* suffix = "") const
+    {
+        std::size_t result = 0;
+        auto length = std::strlen(suffix);
+        auto dir = ::opendir(path.c_str());
+        while (auto entry = ::readdir(dir))
+        {
+            std::string name(entry->d_name);
+            if (name[0] != '.' && name.size() >= length && name.compare(name.size() - length, std::string::npos, suffix) == 0)
+                ++result;
+        }
+        ::closedir(dir);
+        return result;
+    }
+};
+
+// stands in for the HTTP endpoint a publisher posts to, one connection at a time
+class http_receiver
+{
+public:
+    // checks the head of a request and decodes its body in place, returning false to answer it with a 400
+    using validator = std::function<bool(const std::string& head, std::string& body)>;
+
+private:
+    validator validate_;
+    std::string response_body_;
+    int listener_;
+    uint16_t port_;
+    std::thread thread_;
+    std::atomic<bool> stopping_;
+    std::mutex lock_;
+    std::deque<int> statuses_;
+    std::vector<std::string> bodies_;
+
+    void serve(int connection)
+    {
+        std::string pending;
+        while (!stopping_)
+        {
+            auto head_end = pending.find("\r\n\r\n");
+            std::size_t length = 0;
+            if (head_end != std::string::npos)
+            {
+                auto length_at = pending.find("Content-Length: ");
+                if (length_at > head_end)
+                    return;
+                length = std::stoul(pending.substr(length_at + 16));
+            }
+
+            if (head_end == std::string::npos || pending.size() < head_end + 4 + length)
+            {
+                pollfd wait{connection, POLLIN, 0};
+                if (::poll(&wait, 1, 10) <= 0)
+                    continue;
+
+                char data[65536];
+                auto received = ::recv(connection, data, sizeof(data), 0);
+                if (received <= 0)
+                    return;
+                pending.append(data, static_cast<std::size_t>(received));
+                continue;
+            }
+
+            auto head = pending.substr(0, head_end);
+            auto body = pending.substr(head_end + 4, length);
+            pending.erase(0, head_end + 4 + length);
+
+            int status = 400;
+            if (validate_(head, body))
+            {
+                std::lock_guard<std::mutex> lock(lock_);
+                status = 200;
+                if (!statuses_.empty())
+                {
+                    status = statuses_.front();
+                    statuses_.pop_front();
+                }
+                if (status == 200)
+                    bodies_.push_back(std::move(body));
+            }
+
+            auto response = "HTTP/1.1 " + std::to_string(status) + " Whatever\r\nContent-Length: " +
+                    std::to_string(response_body_.size()) + "\r\n\r\n" + response_body_;
+            ::send(connection, response.data(), response.size(), MSG_NOSIGNAL);
+        }
+    }
+
+public:
+    explicit http_receiver(validator validate, std::string response_body = std::string()) :
+            validate_(std::move(validate)),
+            response_body_(std::move(response_body)),
+            listener_(::socket(AF_INET, SOCK_STREAM, 0)),
+            stopping_(false)
+    {
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+        REQUIRE(::bind(listener_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0);
+        REQUIRE(::listen(listener_, 4) == 0);
+
+        socklen_t length = sizeof(address);
+        getsockname(listener_, reinterpret_cast<sockaddr*>(&address), &length);
+        port_ = ntohs(address.sin_port);
+
+        thread_ = std::thread([this]() {
+            while (!stopping_)
+            {
+                pollfd wait{listener_, POLLIN, 0};
+                if (::poll(&wait, 1, 10) <= 0)
+                    continue;
+
+                auto connection = ::accept(listener_, nullptr, nullptr);
+                serve(connection);
+                ::close(connection);
+            }
+        });
+    }
+
+    http_receiver(const http_receiver&) = delete;
+    http_receiver& operator=(const http_receiver&) = delete;
+
+    ~http_receiver()
+    {
+        stopping_ = true;
+        thread_.join();
+        ::close(listener_);
+    }
+
+    uint16_t port() const noexcept
+    {
+        return port_;
+    }
+
+    // answer the next valid request with a status instead of a 200
+    void respond_with(int status)
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        statuses_.push_back(status);
+    }
+
+    // the decoded bodies of the requests that were answered with a 200
+    std::vector<std::string> bodies()
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        return bodies_;
+    }
+};
+
+// just enough of a protobuf decoder to look into the messages the publishers send
+struct field
+{
+    uint32_t number;
+    uint64_t value;
+    std::string bytes;
+};
+
+inline std::vector<field> decode(const std::string& message)
+{
+    std::vector<field> result;
+    std::size_t at = 0;
+    auto varint = [&]() {
+        uint64_t value = 0;
+        for (int shift = 0; at < message.size(); shift += 7)
+        {
+            auto byte = static_cast<uint8_t>(message[at++]);
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+                break;
+        }
+        return value;
+    };
+
+    while (at < message.size())
+    {
+        auto key = varint();
+        field f{static_cast<uint32_t>(key >> 3), 0, std::string()};
+        switch (key & 7)
+        {
+            case 0:
+                f.value = varint();
+                break;
+            case 1:
+                for (int i = 0; i < 8; i++)
+                    f.value |= static_cast<uint64_t>(static_cast<uint8_t>(message[at++])) << (i * 8);
+                break;
+            case 2:
+            {
+                auto length = varint();
+                f.bytes = message.substr(at, length);
+                at += length;
+                break;
+            }
+            default:
+                FAIL("unexpected wire type");
+        }
+        result.push_back(std::move(f));
+    }
+
+    return result;
+}
+
+// the value of a snapshot that has one, for checking the metrics a registry was given
+inline double value_of(const cxxmetrics::value_snapshot& snapshot)
+{
+    return static_cast<double>(snapshot.value());
+}
+
+inline double value_of(const cxxmetrics::histogram_snapshot&)
+{
+    return std::numeric_limits<double>::quiet_NaN();
+}
+
+inline const cxxmetrics::histogram_snapshot* histogram_of(const cxxmetrics::value_snapshot&)
+{
+    return nullptr;
+}
+
+inline const cxxmetrics::histogram_snapshot* histogram_of(const cxxmetrics::histogram_snapshot& snapshot)
+{
+    return &snapshot;
+}
+
 #endif //CXXMETRICS_HELPERS_HPP
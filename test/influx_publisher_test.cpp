@@ -0,0 +1,118 @@
+#include <catch2/catch_all.hpp>
+#include <algorithm>
+#include <chrono>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <cxxmetrics_influx/influx_publisher.hpp>
+#include <cxxmetrics/simple_reservoir.hpp>
+
+using namespace cxxmetrics;
+using namespace cxxmetrics_literals;
+using namespace cxxmetrics_influx;
+
+namespace
+{
+
+std::vector<std::string> lines_of(const std::string& text)
+{
+    std::vector<std::string> result;
+    std::istringstream in(text);
+    std::string line;
+    while (std::getline(in, line))
+        result.push_back(line);
+    return result;
+}
+
+// the line without its timestamp, checking that the timestamp is the current time in nanoseconds
+std::string without_timestamp(const std::string& line)
+{
+    auto space = line.rfind(' ');
+    REQUIRE(space != std::string::npos);
+
+    auto now = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    REQUIRE(std::abs(std::stoll(line.substr(space + 1)) / 1000000000 - now) <= 5);
+    return line.substr(0, space);
+}
+
+}
+
+TEST_CASE("Influx publisher writes a line per series with escaped tags", "[influx]")
+{
+    metrics_registry<> r;
+    influx_publisher<decltype(r)::repository_type> subject(r);
+
+    *r.counter("My"/"Counter"_m, {{"tag", "a b"}, {"k=1", "x,y"}, {"empty", ""}}) += 10;
+    double gauge_value = 2.5;
+    r.gauge("My Gauge"_m, &gauge_value);
+
+    std::ostringstream out;
+    subject.write(out);
+    auto lines = lines_of(out.str());
+    REQUIRE(lines.size() == 2);
+
+    std::vector<std::string> series;
+    for (const auto& line : lines)
+        series.push_back(without_timestamp(line));
+    std::sort(series.begin(), series.end());
+
+    REQUIRE(series[0] == "My.Counter,k\\=1=x\\,y,tag=a\\ b value=10i");
+    REQUIRE(series[1] == "My\\ Gauge value=2.5");
+}
+
+TEST_CASE("Influx publisher writes snapshot components as fields of one line", "[influx]")
+{
+    using reservoir_type = simple_reservoir<std::chrono::system_clock::duration, 4>;
+    metrics_registry<> r;
+    influx_publisher<decltype(r)::repository_type> subject(r);
+
+    auto& t = *r.timer<100_micro, std::chrono::system_clock, reservoir_type, true, 1_min>("MyTimer", reservoir_type(), {{"tag", "value"}});
+    t.update(std::chrono::milliseconds(10));
+    t.update(std::chrono::milliseconds(30));
+
+    exposition_buffer buffer;
+    subject.write(buffer);
+    auto lines = lines_of(buffer.str());
+    REQUIRE(lines.size() == 1);
+
+    auto line = without_timestamp(lines[0]);
+    REQUIRE_THAT(line, Catch::Matchers::StartsWith("MyTimer,tag=value count=2i,mean=20,p50=20,p90=30,p99=30,"));
+    REQUIRE_THAT(line, Catch::Matchers::ContainsSubstring(",rate_mean="));
+    REQUIRE_THAT(line, Catch::Matchers::ContainsSubstring(",rate_1min="));
+    REQUIRE(line.find(' ') == line.rfind(' '));
+}
+
+TEST_CASE("Influx publisher pushes its lines to a file descriptor", "[influx]")
+{
+    metrics_registry<> r;
+    influx_publisher<decltype(r)::repository_type> subject(r);
+    for (int i = 0; i < 2000; i++)
+        *r.counter("Counter" + std::to_string(i)) += i;
+
+    int fds[2];
+    REQUIRE(::pipe(fds) == 0);
+    fcntl(fds[1], F_SETFL, O_NONBLOCK);
+
+    // the lines are bigger than the pipe so the write has to wait on the reader
+    std::string received;
+    std::thread reader([&]() {
+        char data[4096];
+        ssize_t count;
+        while ((count = ::read(fds[0], data, sizeof(data))) > 0)
+            received.append(data, static_cast<std::size_t>(count));
+    });
+
+    subject.write(fds[1]);
+    ::close(fds[1]);
+    reader.join();
+    ::close(fds[0]);
+
+    auto lines = lines_of(received);
+    REQUIRE(lines.size() == 2000);
+    REQUIRE(std::count(lines.begin(), lines.end(), lines[0]) == 1);
+    REQUIRE(std::any_of(lines.begin(), lines.end(), [](const std::string& line) {
+        return line.rfind("Counter1999 value=1999i ", 0) == 0;
+    }));
+}
@@ -0,0 +1,177 @@
+#include <catch2/catch_all.hpp>
+#include <sstream>
+#include <string>
+#include <cxxmetrics_json/json_publisher.hpp>
+#include <cxxmetrics/simple_reservoir.hpp>
+
+using namespace cxxmetrics;
+using namespace cxxmetrics_literals;
+using namespace cxxmetrics_json;
+
+namespace
+{
+
+// checks that brackets and quotes balance, which catches a missing or extra separator around nesting
+bool balanced(const std::string& json)
+{
+    std::string stack;
+    bool quoted = false;
+    for (std::size_t i = 0; i < json.size(); i++)
+    {
+        auto c = json[i];
+        if (quoted)
+        {
+            if (c == '\\')
+                ++i;
+            else if (c == '"')
+                quoted = false;
+            continue;
+        }
+
+        if (c == '"')
+            quoted = true;
+        else if (c == '{' || c == '[')
+            stack.push_back(c);
+        else if (c == '}' || c == ']')
+        {
+            if (stack.empty() || stack.back() != (c == '}' ? '{' : '['))
+                return false;
+            stack.pop_back();
+        }
+        else if (c == ',' && (json[i + 1] == ',' || json[i + 1] == '}' || json[i + 1] == ']'))
+            return false;
+    }
+
+    return stack.empty() && !quoted;
+}
+
+}
+
+TEST_CASE("JSON publisher nests objects by path segment", "[json]")
+{
+    metrics_registry<> r;
+    json_publisher<decltype(r)::repository_type> subject(r);
+
+    *r.counter("a"/"b"_m, {{"tag", "x\"y"}}) += 10;
+    *r.counter("a"/"b"_m, {{"tag", "z"}}) += 1;
+    double gauge_value = 2.5;
+    r.gauge("a"_m/"c"/"d", &gauge_value);
+    double top = 1;
+    r.gauge("a"_m, &top);
+    double other = 3;
+    r.gauge("e"_m, &other);
+
+    exposition_buffer buffer;
+    subject.write(buffer);
+    auto json = buffer.str();
+    REQUIRE(balanced(json));
+
+    REQUIRE_THAT(json, Catch::Matchers::StartsWith("{\"a\":{\"type\":\"gauge\",\"series\":[{\"tags\":{},\"value\":1}],\"b\":{\"type\":\"counter\",\"series\":["));
+    REQUIRE_THAT(json, Catch::Matchers::ContainsSubstring("{\"tags\":{\"tag\":\"x\\\"y\"},\"value\":10}"));
+    REQUIRE_THAT(json, Catch::Matchers::ContainsSubstring("{\"tags\":{\"tag\":\"z\"},\"value\":1}"));
+    REQUIRE_THAT(json, Catch::Matchers::EndsWith("]},\"c\":{\"d\":{\"type\":\"gauge\",\"series\":[{\"tags\":{},\"value\":2.5}]}}},\"e\":{\"type\":\"gauge\",\"series\":[{\"tags\":{},\"value\":3}]}}"));
+}
+
+TEST_CASE("JSON publisher escapes segments that would be taken for the type or series of a metric", "[json]")
+{
+    metrics_registry<> r;
+    json_publisher<decltype(r)::repository_type> subject(r);
+
+    *r.counter("a"_m) += 1;
+    *r.counter("a"/"type"_m) += 2;
+    *r.counter("a"/"series"_m) += 3;
+    *r.counter("a"/"_type"_m) += 4;
+    *r.counter("a"/"types"_m) += 5;
+
+    exposition_buffer buffer;
+    subject.write(buffer);
+    auto json = buffer.str();
+    REQUIRE(balanced(json));
+
+    REQUIRE_THAT(json, Catch::Matchers::StartsWith("{\"a\":{\"type\":\"counter\",\"series\":[{\"tags\":{},\"value\":1}],"));
+    REQUIRE_THAT(json, Catch::Matchers::ContainsSubstring("\"_type\":{\"type\":\"counter\",\"series\":[{\"tags\":{},\"value\":2}]}"));
+    REQUIRE_THAT(json, Catch::Matchers::ContainsSubstring("\"_series\":{\"type\":\"counter\",\"series\":[{\"tags\":{},\"value\":3}]}"));
+    REQUIRE_THAT(json, Catch::Matchers::ContainsSubstring("\"__type\":{\"type\":\"counter\",\"series\":[{\"tags\":{},\"value\":4}]}"));
+    REQUIRE_THAT(json, Catch::Matchers::ContainsSubstring("\"types\":{\"type\":\"counter\",\"series\":[{\"tags\":{},\"value\":5}]}"));
+
+    // the object of a has its own type and series only once each
+    auto a = json.substr(0, json.find("\"__type\""));
+    REQUIRE(a.find("\"type\":{") == std::string::npos);
+    REQUIRE(a.find("\"series\":{") == std::string::npos);
+}
+
+TEST_CASE("JSON publisher writes meter rates and timer quantiles", "[json]")
+{
+    using reservoir_type = simple_reservoir<std::chrono::system_clock::duration, 4>;
+    metrics_registry<> r;
+    json_publisher<decltype(r)::repository_type> subject(r);
+
+    auto& t = *r.timer<100_micro, std::chrono::system_clock, reservoir_type, true, 1_min>("MyTimer", reservoir_type());
+    t.update(std::chrono::milliseconds(10));
+    t.update(std::chrono::milliseconds(30));
+    r.meter<1_sec, 1_min, 5_min>("MyMeter")->mark(5);
+
+    std::ostringstream out;
+    subject.write(out);
+    auto json = out.str();
+    REQUIRE(balanced(json));
+
+    REQUIRE_THAT(json, Catch::Matchers::ContainsSubstring("\"MyTimer\":{\"type\":\"timer\",\"series\":[{\"tags\":{},\"count\":2,\"mean\":20,\"quantiles\":{\"p50\":20,\"p90\":30,\"p99\":30},\"rates\":{\"mean\":"));
+    REQUIRE_THAT(json, Catch::Matchers::ContainsSubstring("\"MyMeter\":{\"type\":\"meter\",\"series\":[{\"tags\":{},\"rates\":{\"mean\":"));
+    REQUIRE_THAT(json, Catch::Matchers::ContainsSubstring("\"1min\":") && Catch::Matchers::ContainsSubstring("\"5min\":"));
+}
+
+TEST_CASE("JSON publisher writes a collected registry snapshot", "[json]")
+{
+    using reservoir_type = simple_reservoir<std::chrono::system_clock::duration, 4>;
+    metrics_registry<> r;
+    json_publisher<decltype(r)::repository_type> subject(r);
+
+    auto& counter = *r.counter("a"/"b"_m, {{"tag", "z"}});
+    counter += 10;
+    auto& t = *r.timer<100_micro, std::chrono::system_clock, reservoir_type, true, 1_min>("MyTimer", reservoir_type());
+    t.update(std::chrono::milliseconds(10));
+    t.update(std::chrono::milliseconds(30));
+
+    auto snapshot = r.collect();
+    counter += 5;
+
+    exposition_buffer out;
+    subject.write(*snapshot, out);
+    auto json = out.str();
+    REQUIRE(balanced(json));
+    REQUIRE_THAT(json, Catch::Matchers::ContainsSubstring("\"a\":{\"b\":{\"type\":\"counter\",\"series\":[{\"tags\":{\"tag\":\"z\"},\"value\":10}]}}"));
+    REQUIRE_THAT(json, Catch::Matchers::ContainsSubstring("\"MyTimer\":{\"type\":\"timer\",\"series\":[{\"tags\":{},\"count\":2,\"mean\":20,\"quantiles\":{\"p50\":20,\"p90\":30,\"p99\":30},\"rates\":{\"mean\":"));
+}
+
+TEST_CASE("JSON publisher streams large registries in pieces", "[json]")
+{
+    metrics_registry<> r;
+    json_publisher<decltype(r)::repository_type> subject(r, 1024);
+    for (int i = 0; i < 1000; i++)
+        *r.counter(metric_path("group" + std::to_string(i % 10)) / metric_path("counter" + std::to_string(i))) += i;
+
+    // counts the writes the stream gets
+    struct counting_buffer : std::stringbuf
+    {
+        int writes = 0;
+        std::streamsize xsputn(const char* s, std::streamsize n) override
+        {
+            ++writes;
+            return std::stringbuf::xsputn(s, n);
+        }
+    } counted;
+
+    std::ostream out(&counted);
+    subject.write(out);
+    auto json = counted.str();
+    REQUIRE(balanced(json));
+    REQUIRE(counted.writes > 10);
+
+    exposition_buffer buffer;
+    subject.write(buffer);
+    REQUIRE(buffer.str() == json);
+    for (int i = 0; i < 10; i++)
+        REQUIRE(json.find("\"group" + std::to_string(i) + "\":{") != std::string::npos);
+    REQUIRE_THAT(json, Catch::Matchers::ContainsSubstring("\"counter999\":{\"type\":\"counter\",\"series\":[{\"tags\":{},\"value\":999}]}"));
+}
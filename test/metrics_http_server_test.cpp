@@ -0,0 +1,278 @@
+#include <catch2/catch_all.hpp>
+#include <cstring>
+#include <string>
+#include <cxxmetrics_prometheus/metrics_http_server.hpp>
+
+using namespace cxxmetrics;
+using namespace cxxmetrics_literals;
+using namespace cxxmetrics_prometheus;
+
+namespace
+{
+
+struct response
+{
+    std::string status;
+    std::string head;
+    std::string body;
+};
+
+class client
+{
+    int fd_;
+    std::string pending_;
+public:
+    explicit client(uint16_t port) :
+            fd_(::socket(AF_INET, SOCK_STREAM, 0))
+    {
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+        REQUIRE(::connect(fd_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0);
+
+        timeval timeout{5, 0};
+        setsockopt(fd_, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    }
+
+    ~client()
+    {
+        ::close(fd_);
+    }
+
+    void send(const std::string& request)
+    {
+        REQUIRE(::send(fd_, request.data(), request.size(), MSG_NOSIGNAL) == static_cast<ssize_t>(request.size()));
+    }
+
+    bool fill()
+    {
+        char data[4096];
+        auto received = ::recv(fd_, data, sizeof(data), 0);
+        if (received <= 0)
+            return false;
+        pending_.append(data, static_cast<std::size_t>(received));
+        return true;
+    }
+
+    response read(bool head_only = false)
+    {
+        while (pending_.find("\r\n\r\n") == std::string::npos)
+            REQUIRE(fill());
+
+        response result;
+        auto head_end = pending_.find("\r\n\r\n") + 4;
+        result.head = pending_.substr(0, head_end);
+        result.status = result.head.substr(9, 3);
+
+        auto length_at = result.head.find("Content-Length: ");
+        REQUIRE(length_at != std::string::npos);
+        auto length = head_only ? 0 : std::stoul(result.head.substr(length_at + 16));
+        while (pending_.size() < head_end + length)
+            REQUIRE(fill());
+
+        result.body = pending_.substr(head_end, length);
+        pending_.erase(0, head_end + length);
+        return result;
+    }
+
+    bool closed()
+    {
+        return pending_.empty() && !fill();
+    }
+};
+
+metrics_http_options local_options()
+{
+    metrics_http_options options;
+    options.address = "127.0.0.1";
+    return options;
+}
+
+}
+
+TEST_CASE("Metrics HTTP server serves the text exposition with keep-alive", "[prometheus]")
+{
+    metrics_registry<> r;
+    *r.counter("MyCounter"_m, {{"tag", "a"}}) += 10;
+
+    // every scrape renders, so the second one sees the update
+    auto options = local_options();
+    options.render_interval = std::chrono::milliseconds(0);
+    metrics_http_server<decltype(r)::repository_type> server(r, options);
+    server.start();
+    REQUIRE(server.port() != 0);
+
+    client c(server.port());
+    c.send("GET /metrics HTTP/1.1\r\nHost: localhost\r\n\r\n");
+    auto first = c.read();
+    REQUIRE(first.status == "200");
+    REQUIRE_THAT(first.head, Catch::Matchers::ContainsSubstring("Content-Type: text/plain; version=0.0.4") &&
+            Catch::Matchers::ContainsSubstring("Connection: keep-alive"));
+    REQUIRE_THAT(first.body, Catch::Matchers::ContainsSubstring("MyCounter{tag=\"a\"} 10\n"));
+
+    // pipelined requests on the same connection are answered in order
+    *r.counter("MyCounter"_m, {{"tag", "a"}}) += 5;
+    c.send("GET /metrics?x=1 HTTP/1.1\r\n\r\nHEAD /metrics HTTP/1.1\r\n\r\n");
+    auto second = c.read();
+    REQUIRE(second.status == "200");
+    REQUIRE_THAT(second.body, Catch::Matchers::ContainsSubstring("MyCounter{tag=\"a\"} 15\n"));
+
+    auto head = c.read(true);
+    REQUIRE(head.status == "200");
+    REQUIRE_THAT(head.head, Catch::Matchers::ContainsSubstring("Content-Length: " + std::to_string(second.body.size())));
+
+    c.send("GET /metrics HTTP/1.1\r\nConnection: close\r\n\r\n");
+    REQUIRE(c.read().status == "200");
+    REQUIRE(c.closed());
+}
+
+TEST_CASE("Metrics HTTP server negotiates the protobuf exposition", "[prometheus]")
+{
+    metrics_registry<> r;
+    *r.counter("MyCounter"_m) += 10;
+
+    metrics_http_server<decltype(r)::repository_type> server(r, local_options());
+    server.start();
+
+    client c(server.port());
+    c.send("GET /metrics HTTP/1.1\r\nAccept: application/vnd.google.protobuf;proto=io.prometheus.client.MetricFamily;encoding=delimited;q=0.7,text/plain;version=0.0.4;q=0.3,*/*;q=0.1\r\n\r\n");
+    auto proto = c.read();
+    REQUIRE(proto.status == "200");
+    REQUIRE_THAT(proto.head, Catch::Matchers::ContainsSubstring("Content-Type: application/vnd.google.protobuf"));
+    REQUIRE_THAT(proto.body, Catch::Matchers::ContainsSubstring("MyCounter"));
+    REQUIRE_THAT(proto.body, !Catch::Matchers::ContainsSubstring("# TYPE"));
+
+    c.send("GET /metrics HTTP/1.1\r\nAccept: application/vnd.google.protobuf;q=0.2, text/plain\r\n\r\n");
+    auto text = c.read();
+    REQUIRE_THAT(text.head, Catch::Matchers::ContainsSubstring("Content-Type: text/plain"));
+
+    REQUIRE(cxxmetrics_prometheus::internal::prefers_protobuf("application/vnd.google.protobuf", 31));
+    REQUIRE_FALSE(cxxmetrics_prometheus::internal::prefers_protobuf("*/*", 3));
+    REQUIRE_FALSE(cxxmetrics_prometheus::internal::prefers_protobuf("application/vnd.google.protobuf;encoding=text", 45));
+}
+
+TEST_CASE("Metrics HTTP server can serve background renders", "[prometheus]")
+{
+    metrics_registry<> r;
+    auto& counter = *r.counter("MyCounter"_m);
+    counter += 10;
+
+    auto options = local_options();
+    options.render_interval = std::chrono::milliseconds(5);
+    metrics_http_server<decltype(r)::repository_type> server(r, options);
+    server.start();
+
+    client c(server.port());
+    c.send("GET /metrics HTTP/1.1\r\n\r\n");
+    REQUIRE_THAT(c.read().body, Catch::Matchers::ContainsSubstring("MyCounter{} 10\n"));
+
+    counter += 5;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    std::string body;
+    do
+    {
+        c.send("GET /metrics HTTP/1.1\r\n\r\n");
+        body = c.read().body;
+    }
+    while (body.find("MyCounter{} 15\n") == std::string::npos && std::chrono::steady_clock::now() < deadline);
+
+    REQUIRE_THAT(body, Catch::Matchers::ContainsSubstring("MyCounter{} 15\n"));
+}
+
+TEST_CASE("Metrics HTTP server answers the scrapes before the first background render once it's done", "[prometheus]")
+{
+    metrics_registry<> r;
+    for (int i = 0; i < 1000; i++)
+        *r.counter("MyCounter" + std::to_string(i)) += i;
+
+    metrics_http_server<decltype(r)::repository_type> server(r, local_options());
+    server.start();
+
+    client first(server.port());
+    client second(server.port());
+    first.send("GET /metrics HTTP/1.1\r\n\r\nHEAD /metrics HTTP/1.1\r\n\r\n");
+    second.send("GET /metrics HTTP/1.1\r\n\r\n");
+
+    auto body = first.read().body;
+    REQUIRE_THAT(body, Catch::Matchers::ContainsSubstring("MyCounter999{} 999\n"));
+    auto head = first.read(true);
+    REQUIRE(head.status == "200");
+    REQUIRE_THAT(head.head, Catch::Matchers::ContainsSubstring("Content-Length: " + std::to_string(body.size())));
+    REQUIRE(second.read().body == body);
+}
+
+TEST_CASE("Metrics HTTP server compresses the exposition when it's accepted", "[prometheus]")
+{
+    metrics_registry<> r;
+    *r.counter("MyCounter"_m) += 10;
+
+    for (auto interval : {0, 5})
+    {
+        auto options = local_options();
+        options.render_interval = std::chrono::milliseconds(interval);
+        metrics_http_server<decltype(r)::repository_type> server(r, options);
+        server.start();
+
+        client c(server.port());
+        c.send("GET /metrics HTTP/1.1\r\n\r\n");
+        auto plain = c.read();
+        REQUIRE(plain.head.find("Content-Encoding") == std::string::npos);
+        REQUIRE_THAT(plain.head, Catch::Matchers::ContainsSubstring("Vary: Accept-Encoding"));
+
+        c.send("GET /metrics HTTP/1.1\r\nAccept-Encoding: gzip, zstd\r\n\r\n");
+        auto compressed = c.read();
+        REQUIRE(compressed.status == "200");
+        if (!encoding_available(content_encoding::gzip) && !encoding_available(content_encoding::zstd))
+        {
+            REQUIRE(compressed.head.find("Content-Encoding") == std::string::npos);
+            continue;
+        }
+
+        auto encoding = encoding_available(content_encoding::zstd) ? content_encoding::zstd : content_encoding::gzip;
+        REQUIRE_THAT(compressed.head, Catch::Matchers::ContainsSubstring(std::string("Content-Encoding: ") + encoding_name(encoding)));
+        REQUIRE(compressed.body != plain.body);
+        REQUIRE(compressed.body.size() > 0);
+    }
+
+    auto options = local_options();
+    options.compress = false;
+    metrics_http_server<decltype(r)::repository_type> server(r, options);
+    server.start();
+
+    client c(server.port());
+    c.send("GET /metrics HTTP/1.1\r\nAccept-Encoding: gzip, zstd\r\n\r\n");
+    auto plain = c.read();
+    REQUIRE(plain.head.find("Content-Encoding") == std::string::npos);
+    REQUIRE_THAT(plain.body, Catch::Matchers::ContainsSubstring("MyCounter{} 10\n"));
+}
+
+TEST_CASE("Metrics HTTP server rejects what it doesn't serve", "[prometheus]")
+{
+    metrics_registry<> r;
+    auto options = local_options();
+    options.max_scrapes = 0;
+
+    metrics_http_server<decltype(r)::repository_type> server(r, options);
+    server.start();
+
+    client c(server.port());
+    c.send("GET /other HTTP/1.1\r\n\r\n");
+    REQUIRE(c.read().status == "404");
+
+    c.send("POST /metrics HTTP/1.1\r\nContent-Length: 4\r\n\r\nbody");
+    REQUIRE(c.read().status == "405");
+
+    // every scrape is over the cap
+    c.send("GET /metrics HTTP/1.1\r\n\r\n");
+    auto busy = c.read();
+    REQUIRE(busy.status == "503");
+    REQUIRE_THAT(busy.head, Catch::Matchers::ContainsSubstring("Retry-After: 1"));
+
+    c.send("garbage\r\n\r\n");
+    REQUIRE(c.read().status == "400");
+    REQUIRE(c.closed());
+
+    server.stop();
+    server.stop();
+}
@@ -1,4 +1,6 @@
 #include <catch2/catch_all.hpp>
+#include <atomic>
+#include <chrono>
 #include <thread>
 #include <cxxmetrics/metrics_registry.hpp>
 #include <cxxmetrics/simple_reservoir.hpp>
@@ -78,6 +80,124 @@ TEST_CASE("Registry visitor visits counters", "[metrics_registry]")
     REQUIRE(total == 55);
 }
 
+TEST_CASE("Registry tagged metrics can be added while visiting", "[metrics_registry]")
+{
+    int instances = 0;
+
+    metrics_registry<> subject;
+    *subject.counter("MyCounter") += 10;
+    *subject.counter("MyCounter", {{"mytag","tagvalue"}}) += 45;
+
+    basic_registered_metric* registered = nullptr;
+    subject.visit_registered_metrics([&registered](const metric_path& path, basic_registered_metric& metric) {
+        registered = &metric;
+    });
+    REQUIRE(registered != nullptr);
+
+    // the visit iterates a stable view, so adding children from inside it must neither block nor be visited
+    registered->visit([&](const tag_collection& tags, const value_snapshot& ctr) {
+        ++instances;
+        *subject.counter("MyCounter", {{"mytag", instances + 100}}) += 1;
+    });
+
+    REQUIRE(instances == 2);
+
+    instances = 0;
+    int total = 0;
+    registered->visit([&](const tag_collection& tags, const value_snapshot& ctr) {
+        ++instances;
+        total += static_cast<int>(ctr.value());
+    });
+
+    REQUIRE(instances == 4);
+    REQUIRE(total == 57);
+}
+
+TEST_CASE("Registry creates many tag sets on one metric", "[metrics_registry]")
+{
+    constexpr int tag_sets = 20000;
+    metrics_registry<> subject;
+
+    basic_registered_metric* registered = nullptr;
+    *subject.counter("MyCounter", {{"id", -1}}) += 1;
+    subject.visit_registered_metrics([&registered](const metric_path&, basic_registered_metric& metric) {
+        registered = &metric;
+    });
+    REQUIRE(registered != nullptr);
+
+    // a reader visits the whole time the tag sets are being added
+    std::atomic_bool adding(true);
+    std::atomic_bool empty(false);
+    std::thread reader([&]() {
+        while (adding.load())
+        {
+            std::size_t visited = 0;
+            registered->visit([&visited](const tag_collection&, const value_snapshot&) { ++visited; });
+            if (visited == 0)
+                empty = true;
+        }
+    });
+
+    // adding a tag set doesn't copy the ones before it, so this takes milliseconds rather than minutes
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < tag_sets; i++)
+        *subject.counter("MyCounter", {{"id", i}}) += i;
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    adding = false;
+    reader.join();
+    REQUIRE_FALSE(empty.load());
+    REQUIRE(elapsed < std::chrono::seconds(10));
+
+    REQUIRE(registered->size() == tag_sets + 1);
+    for (int i = 0; i < tag_sets; i += 997)
+        REQUIRE(subject.counter("MyCounter", {{"id", i}})->value() == i);
+
+    std::size_t visited = 0;
+    int64_t total = 0;
+    registered->visit([&](const tag_collection&, const value_snapshot& ctr) {
+        ++visited;
+        total += static_cast<int64_t>(ctr.value());
+    });
+    REQUIRE(visited == tag_sets + 1);
+    REQUIRE(total == int64_t(tag_sets) * (tag_sets - 1) / 2 + 1);
+}
+
+TEST_CASE("Registry changed visitor skips unchanged metrics", "[metrics_registry]")
+{
+    metrics_registry<> subject;
+    auto c1 = subject.counter("MyCounter");
+    auto c2 = subject.counter("MyCounter", {{"mytag","tagvalue"}});
+
+    std::unordered_map<tag_collection, uint64_t> seen;
+    auto filter = [&seen](const tag_collection& tags, uint64_t epoch) {
+        auto fnd = seen.find(tags);
+        return fnd != seen.end() && fnd->second == epoch;
+    };
+
+    int visited = 0;
+    auto handler = [&](const tag_collection& tags, uint64_t epoch, const value_snapshot& ctr) {
+        ++visited;
+        seen[tags] = epoch;
+    };
+
+    subject.visit_registered_metrics([&](const metric_path& path, basic_registered_metric& metric) {
+        metric.visit_changed(filter, handler);
+    });
+    REQUIRE(visited == 2);
+
+    visited = 0;
+    subject.visit_registered_metrics([&](const metric_path& path, basic_registered_metric& metric) {
+        metric.visit_changed(filter, handler);
+    });
+    REQUIRE(visited == 0);
+
+    *c2 += 5;
+    subject.visit_registered_metrics([&](const metric_path& path, basic_registered_metric& metric) {
+        metric.visit_changed(filter, handler);
+    });
+    REQUIRE(visited == 1);
+}
+
 TEST_CASE("Registry supports all the types", "[metrics_registry]")
 {
     int names = 0;
@@ -0,0 +1,304 @@
+#include <catch2/catch_all.hpp>
+#include <chrono>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+#include <cxxmetrics_otlp/otlp_publisher.hpp>
+#include <cxxmetrics/simple_reservoir.hpp>
+#include "helpers.hpp"
+
+using namespace cxxmetrics;
+using namespace cxxmetrics_literals;
+using namespace cxxmetrics_otlp;
+
+namespace
+{
+
+#ifdef CXXMETRICS_WITH_ZLIB
+bool gunzip(const std::string& data, std::string& result)
+{
+    z_stream stream{};
+    if (inflateInit2(&stream, 15 + 16) != Z_OK)
+        return false;
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+    stream.avail_in = static_cast<uInt>(data.size());
+
+    char chunk[16384];
+    int status;
+    do
+    {
+        stream.next_out = reinterpret_cast<Bytef*>(chunk);
+        stream.avail_out = sizeof(chunk);
+        status = inflate(&stream, Z_NO_FLUSH);
+        result.append(chunk, sizeof(chunk) - stream.avail_out);
+    } while (status == Z_OK);
+
+    inflateEnd(&stream);
+    return status == Z_STREAM_END;
+}
+#endif
+
+// stands in for the OTLP/HTTP receiver of a collector
+class collector : public http_receiver
+{
+public:
+    collector() :
+            http_receiver([](const std::string& head, std::string& body) {
+                if (head.compare(0, 24, "POST /v1/metrics HTTP/1.") != 0 ||
+                        head.find("Content-Type: application/x-protobuf") == std::string::npos)
+                    return false;
+#ifdef CXXMETRICS_WITH_ZLIB
+                std::string request;
+                if (head.find("Content-Encoding: gzip") == std::string::npos || !gunzip(body, request))
+                    return false;
+                body = std::move(request);
+#endif
+                return true;
+            }, "{}")
+    { }
+
+    otlp_options options() const
+    {
+        otlp_options result;
+        result.port = port();
+        result.resource = {{"service.name", "test"}};
+        result.timeout = std::chrono::seconds(2);
+        return result;
+    }
+};
+
+std::vector<std::string> all(const std::string& message, uint32_t number)
+{
+    std::vector<std::string> result;
+    for (const auto& f : decode(message))
+    {
+        if (f.number == number)
+            result.push_back(f.bytes);
+    }
+    return result;
+}
+
+const field* find(const std::vector<field>& fields, uint32_t number)
+{
+    for (const auto& f : fields)
+    {
+        if (f.number == number)
+            return &f;
+    }
+    return nullptr;
+}
+
+double as_double(uint64_t bits)
+{
+    double value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+/**
+ * \brief The metrics in the requests by name
+ */
+std::map<std::string, std::vector<field>> metrics_of(const std::vector<std::string>& bodies)
+{
+    std::map<std::string, std::vector<field>> result;
+    for (const auto& body : bodies)
+    {
+        for (const auto& resource_metrics : all(body, 1))
+        {
+            auto resource = all(resource_metrics, 1);
+            REQUIRE(resource.size() == 1);
+            auto attribute = decode(all(resource[0], 1).at(0));
+            REQUIRE(find(attribute, 1)->bytes == "service.name");
+
+            for (const auto& scope_metrics : all(resource_metrics, 2))
+            {
+                REQUIRE(decode(all(scope_metrics, 1).at(0)).at(0).bytes == "cxxmetrics");
+                for (const auto& metric : all(scope_metrics, 2))
+                {
+                    auto fields = decode(metric);
+                    result[find(fields, 1)->bytes] = fields;
+                }
+            }
+        }
+    }
+    return result;
+}
+
+/**
+ * \brief The data points of a metric
+ */
+std::vector<std::vector<field>> points_of(const std::vector<field>& metric, uint32_t kind)
+{
+    auto data = find(metric, kind);
+    REQUIRE(data);
+
+    std::vector<std::vector<field>> result;
+    for (const auto& point : all(data->bytes, 1))
+        result.push_back(decode(point));
+    return result;
+}
+
+}
+
+TEST_CASE("OTLP publisher exports deltas of counters and histograms", "[otlp]")
+{
+    collector receiver;
+    metrics_registry<> r;
+    otlp_publisher<decltype(r)::repository_type> subject(r, receiver.options());
+
+    auto counter = r.counter("requests"_m, {{"code", 200}});
+    *counter += 5;
+    double level = 2.5;
+    r.gauge("level"_m, &level);
+    auto& meter = *r.meter<1_sec, 1_min>("hits");
+    meter.mark(3);
+    auto& histogram = *r.histogram("latency", simple_reservoir<int, 32>());
+    r.publish_options("latency"_m, publish_options(histogram_publish_options(bucket_layout{10, 100})));
+    histogram.update(5);
+    histogram.update(50);
+    histogram.update(500);
+
+    REQUIRE(subject.publish() == 4);
+    REQUIRE(subject.sent() == 1);
+    REQUIRE(subject.pending() == 0);
+
+    auto metrics = metrics_of(receiver.bodies());
+    REQUIRE(metrics.count("requests"));
+    REQUIRE(metrics.count("level"));
+    REQUIRE(metrics.count("hits.mean"));
+    REQUIRE(metrics.count("hits.1min"));
+    REQUIRE(metrics.count("latency"));
+
+    auto sum = find(metrics["requests"], 7);
+    REQUIRE(sum);
+    auto sum_fields = decode(sum->bytes);
+    REQUIRE(find(sum_fields, 2)->value == 1);
+    REQUIRE(find(sum_fields, 3)->value == 1);
+    auto point = points_of(metrics["requests"], 7).at(0);
+    REQUIRE(static_cast<int64_t>(find(point, 6)->value) == 5);
+    auto attribute = decode(find(point, 7)->bytes);
+    REQUIRE(find(attribute, 1)->bytes == "code");
+    REQUIRE(static_cast<int64_t>(find(decode(find(attribute, 2)->bytes), 3)->value) == 200);
+    REQUIRE(find(point, 3)->value >= find(point, 2)->value);
+
+    point = points_of(metrics["level"], 5).at(0);
+    REQUIRE(as_double(find(point, 4)->value) == 2.5);
+
+    point = points_of(metrics["latency"], 9).at(0);
+    REQUIRE(find(point, 4)->value == 3);
+    REQUIRE(find(point, 5) == nullptr);
+    auto buckets = find(point, 6)->bytes;
+    REQUIRE(buckets.size() == 3 * 8);
+    for (int i = 0; i < 3; i++)
+        REQUIRE(static_cast<uint8_t>(buckets[i * 8]) == 1);
+    REQUIRE(find(point, 7)->bytes.size() == 2 * 8);
+
+    // the next export only has what changed since
+    *counter += 2;
+    histogram.update(20);
+    REQUIRE(subject.publish() == 4);
+    REQUIRE(subject.sent() == 2);
+
+    metrics = metrics_of({receiver.bodies().back()});
+    point = points_of(metrics["requests"], 7).at(0);
+    REQUIRE(static_cast<int64_t>(find(point, 6)->value) == 2);
+
+    point = points_of(metrics["latency"], 9).at(0);
+    REQUIRE(find(point, 4)->value == 1);
+    buckets = find(point, 6)->bytes;
+    REQUIRE(static_cast<uint8_t>(buckets[0]) == 0);
+    REQUIRE(static_cast<uint8_t>(buckets[8]) == 1);
+    REQUIRE(static_cast<uint8_t>(buckets[16]) == 0);
+
+    // a single connection is kept alive for every request
+    REQUIRE(subject.connections() == 1);
+}
+
+TEST_CASE("OTLP publishers of the same registry export their own deltas", "[otlp]")
+{
+    collector first_receiver;
+    collector second_receiver;
+    metrics_registry<> r;
+    otlp_publisher<decltype(r)::repository_type> first(r, first_receiver.options());
+    otlp_publisher<decltype(r)::repository_type> second(r, second_receiver.options());
+
+    auto counter = r.counter("requests"_m);
+    *counter += 5;
+    auto& histogram = *r.histogram("latency", simple_reservoir<int, 32>());
+    r.publish_options("latency"_m, publish_options(histogram_publish_options(bucket_layout{10, 100})));
+    histogram.update(5);
+
+    first.publish();
+    *counter += 2;
+    histogram.update(50);
+    first.publish();
+
+    auto point = points_of(metrics_of({first_receiver.bodies().back()})["requests"], 7).at(0);
+    REQUIRE(static_cast<int64_t>(find(point, 6)->value) == 2);
+    point = points_of(metrics_of({first_receiver.bodies().back()})["latency"], 9).at(0);
+    REQUIRE(find(point, 4)->value == 1);
+
+    // the second exporter hasn't exported anything yet, so its first delta is everything since it started
+    second.publish();
+    point = points_of(metrics_of({second_receiver.bodies().back()})["requests"], 7).at(0);
+    REQUIRE(static_cast<int64_t>(find(point, 6)->value) == 7);
+    point = points_of(metrics_of({second_receiver.bodies().back()})["latency"], 9).at(0);
+    REQUIRE(find(point, 4)->value == 2);
+
+    *counter += 1;
+    second.publish();
+    first.publish();
+    point = points_of(metrics_of({second_receiver.bodies().back()})["requests"], 7).at(0);
+    REQUIRE(static_cast<int64_t>(find(point, 6)->value) == 1);
+    point = points_of(metrics_of({first_receiver.bodies().back()})["requests"], 7).at(0);
+    REQUIRE(static_cast<int64_t>(find(point, 6)->value) == 1);
+}
+
+TEST_CASE("OTLP publisher keeps requests the collector couldn't take", "[otlp]")
+{
+    collector receiver;
+    metrics_registry<> r;
+    otlp_publisher<decltype(r)::repository_type> subject(r, receiver.options());
+
+    auto counter = r.counter("requests"_m);
+    *counter += 1;
+
+    receiver.respond_with(503);
+    subject.publish();
+    REQUIRE(subject.sent() == 0);
+    REQUIRE(subject.pending() == 1);
+
+    *counter += 2;
+    subject.publish();
+    REQUIRE(subject.sent() == 2);
+    REQUIRE(subject.pending() == 0);
+
+    // both deltas made it so nothing was lost to the outage
+    int64_t total = 0;
+    for (const auto& body : receiver.bodies())
+        total += static_cast<int64_t>(find(points_of(metrics_of({body})["requests"], 7).at(0), 6)->value);
+    REQUIRE(total == 3);
+
+    // a request the collector refuses outright isn't retried
+    receiver.respond_with(400);
+    subject.publish();
+    REQUIRE(subject.rejected() == 1);
+    REQUIRE(subject.pending() == 0);
+}
+
+TEST_CASE("OTLP publisher splits exports into batches", "[otlp]")
+{
+    collector receiver;
+    metrics_registry<> r;
+    auto options = receiver.options();
+    options.max_batch = 64;
+    otlp_publisher<decltype(r)::repository_type> subject(r, options);
+
+    for (int i = 0; i < 10; i++)
+        *r.counter(metric_path("counter" + std::to_string(i))) += i;
+
+    REQUIRE(subject.publish() == 10);
+    REQUIRE(subject.sent() > 1);
+    REQUIRE(metrics_of(receiver.bodies()).size() == 10);
+}
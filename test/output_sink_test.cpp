@@ -0,0 +1,161 @@
+#include <catch2/catch_all.hpp>
+#include <fcntl.h>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <cxxmetrics/exposition_buffer.hpp>
+
+using namespace cxxmetrics;
+
+namespace
+{
+
+// a pipe whose read end is drained on a thread of its own so writes to it never fill it
+class drained_pipe
+{
+    int fds_[2];
+    std::string read_;
+    std::thread reader_;
+public:
+    explicit drained_pipe(bool nonblocking = false)
+    {
+        REQUIRE(::pipe(fds_) == 0);
+        if (nonblocking)
+            ::fcntl(fds_[1], F_SETFL, ::fcntl(fds_[1], F_GETFL) | O_NONBLOCK);
+
+        reader_ = std::thread([this]() {
+            char chunk[4096];
+            ssize_t got;
+            while ((got = ::read(fds_[0], chunk, sizeof(chunk))) > 0)
+                read_.append(chunk, static_cast<std::size_t>(got));
+        });
+    }
+
+    ~drained_pipe()
+    {
+        if (reader_.joinable())
+            close();
+    }
+
+    int fd() const noexcept
+    {
+        return fds_[1];
+    }
+
+    std::string close()
+    {
+        ::close(fds_[1]);
+        reader_.join();
+        ::close(fds_[0]);
+        return read_;
+    }
+};
+
+template<typename TSink>
+void write_sample(TSink& sink, int lines)
+{
+    for (int i = 0; i < lines; i++)
+        sink << "series{index=\"" << i << "\"} " << i * 0.5 << ' ' << metric_value(-i) << '\n';
+}
+
+std::string expected_sample(int lines)
+{
+    exposition_buffer expected;
+    write_sample(expected, lines);
+    return expected.str();
+}
+
+}
+
+TEST_CASE("Output sinks format the same as an exposition buffer", "[output_sink]")
+{
+    std::ostringstream stream;
+    {
+        ostream_sink subject(stream, 64);
+        write_sample(subject, 1000);
+        REQUIRE(subject.size() == expected_sample(1000).size());
+    }
+    REQUIRE(stream.str() == expected_sample(1000));
+
+    iovec_sink pieces;
+    write_sample(pieces, 1000);
+    REQUIRE(pieces.str() == expected_sample(1000));
+    REQUIRE(pieces.size() == expected_sample(1000).size());
+}
+
+TEST_CASE("Fd sink buffers its writes to the descriptor", "[output_sink]")
+{
+    auto nonblocking = GENERATE(false, true);
+    drained_pipe pipe(nonblocking);
+    {
+        fd_sink subject(pipe.fd(), 128);
+        write_sample(subject, 20000);
+
+        // writes bigger than the buffer skip it
+        std::string big(1000, 'x');
+        subject << big;
+        subject.flush();
+        REQUIRE(subject.size() == expected_sample(20000).size() + big.size());
+    }
+
+    REQUIRE(pipe.close() == expected_sample(20000) + std::string(1000, 'x'));
+}
+
+TEST_CASE("Fd sink reports descriptors it can't write to", "[output_sink]")
+{
+    int fds[2];
+    REQUIRE(::pipe(fds) == 0);
+    ::close(fds[1]);
+
+    fd_sink subject(fds[0], 16);
+    subject << "short";
+    REQUIRE_THROWS_AS(subject.flush(), std::system_error);
+    REQUIRE_THROWS_AS(subject << "more than sixteen bytes", std::system_error);
+    ::close(fds[0]);
+}
+
+TEST_CASE("Iovec sink references data instead of copying it", "[output_sink]")
+{
+    auto owned = std::make_shared<std::string>(4096, 'r');
+    std::weak_ptr<std::string> watched = owned;
+
+    iovec_sink subject;
+    subject << "head ";
+    subject.append_reference(owned->data(), owned->size(), owned);
+    subject << " tail";
+    subject.append_reference("short", 5);
+    owned.reset();
+
+    REQUIRE(subject.pieces().size() == 3);
+    REQUIRE(subject.pieces()[1].iov_base == watched.lock()->data());
+    REQUIRE(subject.str() == "head " + std::string(4096, 'r') + " tailshort");
+
+    drained_pipe pipe(true);
+    subject.write_to(pipe.fd());
+    REQUIRE(pipe.close() == subject.str());
+
+    subject.clear();
+    REQUIRE(watched.expired());
+    REQUIRE(subject.size() == 0);
+    subject << "again";
+    REQUIRE(subject.str() == "again");
+}
+
+TEST_CASE("Iovec sink writes more pieces than a single writev takes", "[output_sink]")
+{
+    std::vector<std::shared_ptr<std::string>> chunks;
+    iovec_sink subject;
+    std::string expected;
+    for (int i = 0; i < 3000; i++)
+    {
+        chunks.push_back(std::make_shared<std::string>(300, static_cast<char>('a' + i % 26)));
+        subject.append_reference(chunks.back()->data(), chunks.back()->size());
+        subject << i;
+        expected += *chunks.back() + std::to_string(i);
+    }
+
+    drained_pipe pipe;
+    subject.write_to(pipe.fd());
+    REQUIRE(pipe.close() == expected);
+}
@@ -0,0 +1,159 @@
+#include <catch2/catch_all.hpp>
+#include <chrono>
+#include <sstream>
+#include <string>
+#include <cxxmetrics_prometheus/prometheus_publisher.hpp>
+#include <cxxmetrics_prometheus/prometheus_protobuf_publisher.hpp>
+#include <cxxmetrics/simple_reservoir.hpp>
+
+using namespace cxxmetrics;
+using namespace cxxmetrics_literals;
+using namespace cxxmetrics_prometheus;
+
+// These are hidden and only run when asked for, as in: cxxmetrics_prometheus_test "[benchmark]". They're meant for
+// optimized builds.
+
+namespace prometheus_benchmark
+{
+
+constexpr int series = 1000;
+constexpr int scrapes = 200;
+
+inline double value_of(const cumulative_value_snapshot& snapshot)
+{
+    return static_cast<double>(snapshot.value());
+}
+
+inline double value_of(const average_value_snapshot& snapshot)
+{
+    return static_cast<double>(snapshot.value());
+}
+
+inline double value_of(const histogram_snapshot& snapshot)
+{
+    return static_cast<double>(snapshot.count());
+}
+
+template<typename TSnapshot>
+double value_of(const TSnapshot&)
+{
+    return 0;
+}
+
+struct fixture
+{
+    using reservoir_type = simple_reservoir<int64_t, 64>;
+    using timer_reservoir_type = simple_reservoir<std::chrono::steady_clock::duration, 64>;
+    using timer_type = timer<time::seconds(1), std::chrono::steady_clock, timer_reservoir_type, time::minutes(1)>;
+
+    metrics_registry<> registry;
+    std::vector<std::shared_ptr<counter<int64_t>>> counters;
+    std::vector<std::shared_ptr<gauge<double>>> gauges;
+    std::vector<std::shared_ptr<histogram<int64_t, reservoir_type>>> histograms;
+    std::vector<std::shared_ptr<timer_type>> timers;
+
+    fixture()
+    {
+        for (int i = 0; i < series; i++)
+        {
+            tag_collection tags{{"endpoint", "/api/v1/resource/" + std::to_string(i)}, {"method", "GET"}, {"status", 200}};
+            counters.push_back(registry.template counter<int64_t>("http"/"requests"_m, tags));
+            gauges.push_back(registry.gauge("http"/"inflight"_m, 0.0, tags));
+
+            // a tenth of the series have a histogram and a timer, which render many lines each
+            if (i % 10 == 0)
+            {
+                histograms.push_back(registry.histogram("http"/"response_size"_m, reservoir_type(), tags));
+                timers.push_back(registry.template timer<time::seconds(1), std::chrono::steady_clock, timer_reservoir_type, time::minutes(1)>("http"/"latency"_m, timer_reservoir_type(), tags));
+            }
+        }
+    }
+
+    // every series changes between scrapes, so nothing can be reused from the last one
+    void update(int round)
+    {
+        for (int i = 0; i < series; i++)
+        {
+            *counters[i] += i + round;
+            gauges[i]->set(i * 0.125 + round);
+        }
+        for (std::size_t i = 0; i < histograms.size(); i++)
+        {
+            histograms[i]->update(static_cast<int64_t>(i * 100 + round));
+            timers[i]->update(std::chrono::microseconds(i * 10 + round));
+        }
+    }
+};
+
+template<typename TScrape>
+double per_scrape(fixture& f, TScrape&& scrape)
+{
+    std::chrono::steady_clock::duration total{};
+    for (int i = 0; i < scrapes; i++)
+    {
+        f.update(i);
+        auto start = std::chrono::steady_clock::now();
+        scrape();
+        total += std::chrono::steady_clock::now() - start;
+    }
+
+    return std::chrono::duration<double, std::micro>(total).count() / scrapes;
+}
+
+}
+
+TEST_CASE("Prometheus scrape benchmark of write_to against write(std::ostream&)", "[.][benchmark][prometheus]")
+{
+    prometheus_benchmark::fixture f;
+    prometheus_publisher<decltype(f.registry)::repository_type> publisher(f.registry);
+
+    std::ostringstream stream;
+    auto ostream_us = prometheus_benchmark::per_scrape(f, [&]() {
+        stream.str(std::string());
+        publisher.write(stream);
+    });
+
+    exposition_buffer buffer;
+    auto buffer_us = prometheus_benchmark::per_scrape(f, [&]() {
+        buffer.clear();
+        publisher.write_to(buffer);
+    });
+
+    // only the snapshots, which both have to take, to show how much of a scrape is left to the writer
+    double sink = 0;
+    auto snapshot_us = prometheus_benchmark::per_scrape(f, [&]() {
+        f.registry.visit_registered_metrics([&](const metric_path&, basic_registered_metric& metric) {
+            metric.visit([&](const tag_collection&, const auto& snapshot) { sink += prometheus_benchmark::value_of(snapshot); });
+        });
+    });
+
+    WARN("write(std::ostream&): " << ostream_us << "us per scrape, " << stream.str().size() << " bytes");
+    WARN("write_to(exposition_buffer&): " << buffer_us << "us per scrape, " << buffer.size() << " bytes");
+    WARN("snapshots alone: " << snapshot_us << "us per scrape");
+    WARN("write_to speedup: " << ostream_us / buffer_us << "x for the scrape, " << (ostream_us - snapshot_us) / (buffer_us - snapshot_us) << "x for the writer");
+    REQUIRE(sink != 0);
+}
+
+TEST_CASE("Prometheus scrape benchmark of the text exposition against the protobuf one", "[.][benchmark][prometheus]")
+{
+    prometheus_benchmark::fixture f;
+    prometheus_publisher<decltype(f.registry)::repository_type> text(f.registry);
+    prometheus_protobuf_publisher<decltype(f.registry)::repository_type> protobuf(f.registry);
+
+    exposition_buffer text_buffer;
+    auto text_us = prometheus_benchmark::per_scrape(f, [&]() {
+        text_buffer.clear();
+        text.write(text_buffer);
+    });
+
+    exposition_buffer protobuf_buffer;
+    auto protobuf_us = prometheus_benchmark::per_scrape(f, [&]() {
+        protobuf_buffer.clear();
+        protobuf.write(protobuf_buffer);
+    });
+
+    WARN("text: " << text_us << "us per scrape, " << text_buffer.size() << " bytes");
+    WARN("protobuf: " << protobuf_us << "us per scrape, " << protobuf_buffer.size() << " bytes");
+    REQUIRE(text_buffer.size() > 0);
+    REQUIRE(protobuf_buffer.size() > 0);
+}
@@ -0,0 +1,208 @@
+#include <catch2/catch_all.hpp>
+#include <stdexcept>
+#include <string>
+#include <cxxmetrics_prometheus/background_publisher.hpp>
+#include <cxxmetrics_prometheus/prometheus_publisher.hpp>
+#include <cxxmetrics_prometheus/prometheus_protobuf_publisher.hpp>
+
+using namespace cxxmetrics;
+using namespace cxxmetrics_literals;
+using namespace cxxmetrics_prometheus;
+
+namespace
+{
+
+std::string decompress(content_encoding encoding, const exposition_buffer& body)
+{
+    std::string result;
+    char chunk[16384];
+#ifdef CXXMETRICS_WITH_ZLIB
+    if (encoding == content_encoding::gzip)
+    {
+        z_stream stream{};
+        REQUIRE(inflateInit2(&stream, 15 + 16) == Z_OK);
+        stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(body.data()));
+        stream.avail_in = static_cast<uInt>(body.size());
+        int status;
+        do
+        {
+            stream.next_out = reinterpret_cast<Bytef*>(chunk);
+            stream.avail_out = sizeof(chunk);
+            status = inflate(&stream, Z_NO_FLUSH);
+            REQUIRE((status == Z_OK || status == Z_STREAM_END));
+            result.append(chunk, sizeof(chunk) - stream.avail_out);
+        } while (status != Z_STREAM_END);
+        REQUIRE(stream.avail_in == 0);
+        inflateEnd(&stream);
+    }
+#endif
+#ifdef CXXMETRICS_WITH_ZSTD
+    if (encoding == content_encoding::zstd)
+    {
+        auto context = ZSTD_createDCtx();
+        ZSTD_inBuffer in{body.data(), body.size(), 0};
+        std::size_t left;
+        do
+        {
+            ZSTD_outBuffer out{chunk, sizeof(chunk), 0};
+            left = ZSTD_decompressStream(context, &out, &in);
+            REQUIRE(!ZSTD_isError(left));
+            result.append(chunk, out.pos);
+        } while (in.pos < in.size || left != 0);
+        ZSTD_freeDCtx(context);
+    }
+#endif
+    (void)encoding;
+    (void)body;
+    (void)chunk;
+    return result;
+}
+
+}
+
+TEST_CASE("Content encodings are negotiated from the Accept-Encoding header", "[prometheus]")
+{
+    auto negotiate = [](const std::string& accept) {
+        return cxxmetrics_prometheus::internal::negotiate_encoding(accept.data(), accept.size());
+    };
+
+    REQUIRE(negotiate("") == content_encoding::identity);
+    REQUIRE(negotiate("identity") == content_encoding::identity);
+    REQUIRE(negotiate("br, deflate") == content_encoding::identity);
+    REQUIRE(negotiate("gzip;q=0, zstd;q=0") == content_encoding::identity);
+
+    auto gzip = encoding_available(content_encoding::gzip) ? content_encoding::gzip : content_encoding::identity;
+    auto zstd = encoding_available(content_encoding::zstd) ? content_encoding::zstd : content_encoding::identity;
+    auto best = zstd != content_encoding::identity ? zstd : gzip;
+
+    REQUIRE(negotiate("gzip") == gzip);
+    REQUIRE(negotiate(" X-GZIP ;Q=0.5") == gzip);
+    REQUIRE(negotiate("zstd") == zstd);
+    REQUIRE(negotiate("gzip, zstd") == best);
+    REQUIRE(negotiate("*") == best);
+    REQUIRE(negotiate("gzip;q=1.0, zstd;q=0.5") == (gzip != content_encoding::identity ? gzip : zstd));
+    REQUIRE(negotiate("*;q=0.1, zstd;q=0") == gzip);
+}
+
+TEST_CASE("Prometheus Publisher refuses encodings that aren't available", "[prometheus]")
+{
+    metrics_registry<> r;
+    prometheus_publisher<decltype(r)::repository_type> subject(r);
+    *r.counter("MyCounter"_m) += 1;
+
+    for (auto encoding : {content_encoding::gzip, content_encoding::zstd})
+    {
+        exposition_buffer body;
+        if (encoding_available(encoding))
+            subject.write(body, encoding);
+        else
+            REQUIRE_THROWS_AS(subject.write(body, encoding), std::invalid_argument);
+    }
+}
+
+TEST_CASE("Prometheus Publisher compresses the exposition as it renders", "[prometheus]")
+{
+    metrics_registry<> r;
+    prometheus_publisher<decltype(r)::repository_type> subject(r);
+    prometheus_protobuf_publisher<decltype(r)::repository_type> protobuf(r);
+
+    // enough series to be compressed in several pieces
+    for (int i = 0; i < 4000; i++)
+        *r.counter("MyCounter" + std::to_string(i)) += i;
+
+    for (auto encoding : {content_encoding::gzip, content_encoding::zstd})
+    {
+        if (!encoding_available(encoding))
+            continue;
+
+        exposition_buffer plain;
+        subject.write(plain);
+        REQUIRE(plain.size() > 128 * 1024);
+
+        exposition_buffer compressed;
+        subject.write(compressed, encoding);
+        REQUIRE(compressed.size() < plain.size() / 4);
+        REQUIRE(decompress(encoding, compressed) == plain.str());
+
+        exposition_buffer protobuf_plain;
+        protobuf.write(protobuf_plain);
+        exposition_buffer protobuf_compressed;
+        protobuf.write(protobuf_compressed, encoding);
+        REQUIRE(decompress(encoding, protobuf_compressed) == protobuf_plain.str());
+    }
+}
+
+TEST_CASE("Prometheus Publisher shares the compressed body of a shared render", "[prometheus]")
+{
+    metrics_registry<> r;
+    prometheus_publisher<decltype(r)::repository_type> subject(r);
+    subject.max_staleness(std::chrono::hours(1));
+    auto& counter = *r.counter("MyCounter"_m);
+    counter += 10;
+
+    for (auto encoding : {content_encoding::gzip, content_encoding::zstd})
+    {
+        if (!encoding_available(encoding))
+            continue;
+
+        exposition_buffer first;
+        subject.write(first, encoding);
+
+        // a write within the staleness gets the same render, and the body compressed for the first one
+        counter += 5;
+        exposition_buffer second;
+        subject.write(second, encoding);
+        REQUIRE(second.str() == first.str());
+        REQUIRE_THAT(decompress(encoding, second), Catch::Matchers::ContainsSubstring("MyCounter{} 10\n"));
+    }
+
+    rendered_exposition rendered;
+    rendered << "MyCounter{} 10\n";
+    for (auto encoding : {content_encoding::gzip, content_encoding::zstd})
+    {
+        if (!encoding_available(encoding))
+            continue;
+
+        const auto& body = rendered.encoded(encoding);
+        REQUIRE(&rendered.encoded(encoding) == &body);
+        REQUIRE(decompress(encoding, body) == "MyCounter{} 10\n");
+    }
+
+    // a render that's reused compresses its new contents
+    rendered.clear();
+    rendered << "MyCounter{} 15\n";
+    REQUIRE(&rendered.encoded(content_encoding::identity) == &rendered);
+    for (auto encoding : {content_encoding::gzip, content_encoding::zstd})
+    {
+        if (encoding_available(encoding))
+            REQUIRE(decompress(encoding, rendered.encoded(encoding)) == "MyCounter{} 15\n");
+    }
+}
+
+TEST_CASE("Background publisher precompresses its renders", "[prometheus]")
+{
+    metrics_registry<> r;
+    background_publisher<prometheus_publisher<decltype(r)::repository_type>> subject(r, std::chrono::hours(1));
+    auto& counter = *r.counter("MyCounter"_m);
+    counter += 10;
+
+    for (auto encoding : {content_encoding::gzip, content_encoding::zstd})
+    {
+        if (!encoding_available(encoding))
+        {
+            REQUIRE_THROWS_AS(subject.precompress(encoding), std::invalid_argument);
+            continue;
+        }
+
+        subject.precompress(encoding);
+        counter += 1;
+        subject.render();
+
+        exposition_buffer plain;
+        subject.write(plain);
+        exposition_buffer compressed;
+        subject.write(compressed, encoding);
+        REQUIRE(decompress(encoding, compressed) == plain.str());
+        REQUIRE(&subject.latest()->encoded(encoding) == &subject.latest()->encoded(encoding));
+    }
+}
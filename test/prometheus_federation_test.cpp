@@ -0,0 +1,294 @@
+#include <catch2/catch_all.hpp>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <cxxmetrics_prometheus/federation.hpp>
+#include <cxxmetrics_prometheus/metrics_http_server.hpp>
+#include <cxxmetrics_prometheus/prometheus_publisher.hpp>
+#include <cxxmetrics/simple_reservoir.hpp>
+#include "helpers.hpp"
+
+using namespace cxxmetrics;
+using namespace cxxmetrics_literals;
+using namespace cxxmetrics_prometheus;
+
+namespace federation_test
+{
+
+cxxmetrics_prometheus::internal::exposition_line_type parse(const std::string& line, cxxmetrics_prometheus::internal::exposition_sample& sample, metric_type& type)
+{
+    return cxxmetrics_prometheus::internal::parse_exposition_line(line.data(), line.data() + line.size(), sample, type);
+}
+
+bool parse_value(const std::string& value, double& result)
+{
+    return cxxmetrics_prometheus::internal::parse_sample_value(value.data(), value.data() + value.size(), result);
+}
+
+template<typename THandler>
+void visit_series(metrics_registry<>& registry, const std::string& name, const tag_collection& tags, THandler&& handler)
+{
+    int found = 0;
+    registry.visit_registered_metrics([&](const metric_path& path, basic_registered_metric& metric) {
+        if (path.join("/") != name)
+            return;
+
+        metric.visit([&](const tag_collection& series, const auto& snapshot) {
+            if (series != tags)
+                return;
+
+            ++found;
+            handler(snapshot);
+        });
+    });
+    REQUIRE(found == 1);
+}
+
+double value_at(metrics_registry<>& registry, const std::string& name, const tag_collection& tags = tag_collection())
+{
+    double result = std::numeric_limits<double>::quiet_NaN();
+    federation_test::visit_series(registry, name, tags, [&result](const auto& snapshot) { result = value_of(snapshot); });
+    return result;
+}
+
+template<typename THandler>
+void histogram_at(metrics_registry<>& registry, const std::string& name, const tag_collection& tags, THandler&& handler)
+{
+    federation_test::visit_series(registry, name, tags, [&handler](const auto& snapshot) {
+        auto histogram = histogram_of(snapshot);
+        REQUIRE(histogram != nullptr);
+        handler(*histogram);
+    });
+}
+
+}
+
+TEST_CASE("Exposition parser takes lines apart in place", "[prometheus]")
+{
+    cxxmetrics_prometheus::internal::exposition_sample sample;
+    metric_type type;
+
+    std::string line = "http_requests_total{method=\"post\",path=\"/a{b}\\\"c\"} 1027 1395066363000";
+    REQUIRE(federation_test::parse(line, sample, type) == cxxmetrics_prometheus::internal::exposition_line_type::sample);
+    REQUIRE(std::string(sample.name, sample.name_size) == "http_requests_total");
+    REQUIRE(std::string(sample.labels, sample.labels_size) == "method=\"post\",path=\"/a{b}\\\"c\"");
+    REQUIRE(sample.value == 1027);
+
+    auto at = sample.labels;
+    auto end = sample.labels + sample.labels_size;
+    cxxmetrics_prometheus::internal::exposition_label label;
+    REQUIRE(cxxmetrics_prometheus::internal::next_label(at, end, label));
+    REQUIRE(label.is("method"));
+    REQUIRE(label.unescaped_value() == "post");
+    REQUIRE(cxxmetrics_prometheus::internal::next_label(at, end, label));
+    REQUIRE(label.is("path"));
+    REQUIRE(label.escaped);
+    REQUIRE(label.unescaped_value() == "/a{b}\"c");
+    REQUIRE_FALSE(cxxmetrics_prometheus::internal::next_label(at, end, label));
+    REQUIRE(at == end);
+
+    std::string up = "up 1";
+    REQUIRE(federation_test::parse(up, sample, type) == cxxmetrics_prometheus::internal::exposition_line_type::sample);
+    REQUIRE(std::string(sample.name, sample.name_size) == "up");
+    REQUIRE(sample.labels_size == 0);
+
+    std::string type_line = "# TYPE rpc_duration_seconds summary";
+    REQUIRE(federation_test::parse(type_line, sample, type) == cxxmetrics_prometheus::internal::exposition_line_type::type);
+    REQUIRE(std::string(sample.name, sample.name_size) == "rpc_duration_seconds");
+    REQUIRE(type == metric_type::summary);
+
+    REQUIRE(federation_test::parse("# HELP up whether the target is up", sample, type) == cxxmetrics_prometheus::internal::exposition_line_type::skipped);
+    REQUIRE(federation_test::parse("", sample, type) == cxxmetrics_prometheus::internal::exposition_line_type::skipped);
+    REQUIRE(federation_test::parse("# TYPE up enum", sample, type) == cxxmetrics_prometheus::internal::exposition_line_type::invalid);
+    REQUIRE(federation_test::parse("up{job=\"a} 1", sample, type) == cxxmetrics_prometheus::internal::exposition_line_type::invalid);
+    REQUIRE(federation_test::parse("up one", sample, type) == cxxmetrics_prometheus::internal::exposition_line_type::invalid);
+    REQUIRE(federation_test::parse("up 1 later", sample, type) == cxxmetrics_prometheus::internal::exposition_line_type::invalid);
+    REQUIRE(federation_test::parse("up", sample, type) == cxxmetrics_prometheus::internal::exposition_line_type::invalid);
+}
+
+TEST_CASE("Exposition parser reads sample values", "[prometheus]")
+{
+    double value;
+    REQUIRE(federation_test::parse_value("0.1", value));
+    REQUIRE(value == 0.1);
+    REQUIRE(federation_test::parse_value("-2.5e3", value));
+    REQUIRE(value == -2500);
+    REQUIRE(federation_test::parse_value("1.7976931348623157e308", value));
+    REQUIRE(value == std::numeric_limits<double>::max());
+    REQUIRE(federation_test::parse_value("123456789012345678901234", value));
+    REQUIRE(value == 123456789012345678901234.0);
+    REQUIRE(federation_test::parse_value("4.9e-324", value));
+    REQUIRE(value == std::numeric_limits<double>::denorm_min());
+    REQUIRE(federation_test::parse_value("+Inf", value));
+    REQUIRE(value == std::numeric_limits<double>::infinity());
+    REQUIRE(federation_test::parse_value("-Inf", value));
+    REQUIRE(value == -std::numeric_limits<double>::infinity());
+    REQUIRE(federation_test::parse_value("NaN", value));
+    REQUIRE(std::isnan(value));
+
+    REQUIRE_FALSE(federation_test::parse_value("", value));
+    REQUIRE_FALSE(federation_test::parse_value(".", value));
+    REQUIRE_FALSE(federation_test::parse_value("1e", value));
+    REQUIRE_FALSE(federation_test::parse_value("12a", value));
+}
+
+TEST_CASE("Prometheus federator feeds counters and gauges", "[prometheus]")
+{
+    metrics_registry<> r;
+    r.gauge("remote"/"conflict"_m, 0.0);
+
+    federation_options options;
+    options.prefix = "remote";
+    options.tags = {{"source", "a"}, {"method", "ignored"}};
+    prometheus_federator<decltype(r)::repository_type> subject(r, options);
+
+    subject.merge("# HELP requests the requests\n"
+                  "# TYPE requests counter\n"
+                  "requests_total{method=\"GET\"} 10\n"
+                  "requests_created{method=\"GET\"} 1395066363\n"
+                  "# TYPE temperature gauge\n"
+                  "temperature 21.5 1395066363000\n"
+                  "disk:free{mount=\"/\"} 1024\n"
+                  "# TYPE conflict counter\n"
+                  "conflict 1\n"
+                  "bad{ 1\n");
+
+    tag_collection get{{"method", "GET"}, {"source", "a"}};
+    tag_collection untagged{{"method", "ignored"}, {"source", "a"}};
+    REQUIRE(federation_test::value_at(r, "remote/requests", get) == 10);
+    REQUIRE(federation_test::value_at(r, "remote/temperature", untagged) == 21.5);
+    REQUIRE(federation_test::value_at(r, "remote/disk/free", {{"method", "ignored"}, {"mount", "/"}, {"source", "a"}}) == 1024);
+    REQUIRE(subject.samples() == 6);
+    REQUIRE(subject.rejected() == 2);
+
+    // counters go up by how much the source went up, and by the whole value when the source restarted
+    subject.merge("# TYPE requests counter\nrequests_total{method=\"GET\"} 15\n# TYPE temperature gauge\ntemperature 19\n");
+    REQUIRE(federation_test::value_at(r, "remote/requests", get) == 15);
+    REQUIRE(federation_test::value_at(r, "remote/temperature", untagged) == 19);
+
+    subject.merge("# TYPE requests counter\nrequests_total{method=\"GET\"} 3\n");
+    REQUIRE(federation_test::value_at(r, "remote/requests", get) == 18);
+
+    subject.merge("# TYPE requests counter\nrequests_total{method=\"GET\"} -1\n");
+    REQUIRE(federation_test::value_at(r, "remote/requests", get) == 18);
+    REQUIRE(subject.rejected() == 3);
+}
+
+TEST_CASE("Prometheus federator rebuilds summaries and histograms", "[prometheus]")
+{
+    metrics_registry<> r;
+    prometheus_federator<decltype(r)::repository_type> subject(r);
+
+    subject.merge("# TYPE rpc_seconds summary\n"
+                  "rpc_seconds{service=\"a\",quantile=\"0.5\"} 10\n"
+                  "rpc_seconds{service=\"a\",quantile=\"0.9\"} 50\n"
+                  "rpc_seconds{service=\"a\",quantile=\"0.99\"} 100\n"
+                  "rpc_seconds_sum{service=\"a\"} 17000\n"
+                  "rpc_seconds_count{service=\"a\"} 1000\n"
+                  "# TYPE size_bytes histogram\n"
+                  "size_bytes_bucket{le=\"1\"} 25\n"
+                  "size_bytes_bucket{le=\"5\"} 75\n"
+                  "size_bytes_bucket{le=\"10\"} 100\n"
+                  "size_bytes_bucket{le=\"+Inf\"} 100\n"
+                  "size_bytes_sum 400\n"
+                  "size_bytes_count 100\n"
+                  "# TYPE missing summary\n"
+                  "missing 1\n");
+    REQUIRE(subject.rejected() == 1);
+
+    federation_test::histogram_at(r, "rpc_seconds", {{"service", "a"}}, [](const histogram_snapshot& snapshot) {
+        REQUIRE(snapshot.count() == 1000);
+        REQUIRE(std::abs(static_cast<double>(snapshot.value<50_p>()) - 10) < 1);
+        REQUIRE(std::abs(static_cast<double>(snapshot.value<90_p>()) - 50) < 2);
+        REQUIRE(std::abs(static_cast<double>(snapshot.value<99_p>()) - 100) < 2);
+    });
+
+    federation_test::histogram_at(r, "size_bytes", tag_collection(), [](const histogram_snapshot& snapshot) {
+        REQUIRE(snapshot.count() == 100);
+        REQUIRE(std::abs(static_cast<double>(snapshot.value<50_p>()) - 3) < 0.1);
+        REQUIRE(std::abs(static_cast<double>(snapshot.value<99_p>()) - 10) < 0.5);
+    });
+
+    subject.merge("# TYPE rpc_seconds summary\n"
+                  "rpc_seconds{service=\"a\",quantile=\"0.5\"} 20\n"
+                  "rpc_seconds_count{service=\"a\"} 2000\n");
+    federation_test::histogram_at(r, "rpc_seconds", {{"service", "a"}}, [](const histogram_snapshot& snapshot) {
+        REQUIRE(snapshot.count() == 2000);
+        REQUIRE(std::abs(static_cast<double>(snapshot.value<50_p>()) - 20) < 1);
+    });
+}
+
+TEST_CASE("Prometheus federator merges the exposition of a prometheus publisher", "[prometheus]")
+{
+    metrics_registry<> source;
+    for (int i = 0; i < 2000; i++)
+    {
+        *source.counter("requests"_m, {{"endpoint", "/api/" + std::to_string(i)}, {"method", "GET"}}) += i;
+        source.gauge("app"/"load"_m, i * 0.5, {{"core", std::to_string(i)}});
+    }
+
+    auto& latency = *source.histogram("latency"_m, simple_reservoir<int64_t, 1000>(), {{"tag", "quoted \"value\""}});
+    for (int i = 1; i <= 1000; i++)
+        latency.update(i);
+
+    prometheus_publisher<decltype(source)::repository_type> publisher(source);
+    std::stringstream stream;
+    publisher.write(stream);
+    auto fixture = stream.str();
+
+    metrics_registry<> r;
+    prometheus_federator<decltype(r)::repository_type> subject(r);
+    subject.merge(fixture);
+    REQUIRE(subject.rejected() == 0);
+    REQUIRE(subject.samples() > 4000);
+
+    REQUIRE(federation_test::value_at(r, "requests", {{"endpoint", "/api/1234"}, {"method", "GET"}}) == 1234);
+    REQUIRE(federation_test::value_at(r, "app/load", {{"core", "17"}}) == 8.5);
+    federation_test::histogram_at(r, "latency", {{"tag", "quoted \"value\""}}, [](const histogram_snapshot& snapshot) {
+        REQUIRE(snapshot.count() == 1000);
+        REQUIRE(std::abs(static_cast<double>(snapshot.value<50_p>()) - 500) < 10);
+        REQUIRE(std::abs(static_cast<double>(snapshot.value<99_p>()) - 990) < 10);
+    });
+
+    // every series has its handle now, so merging again only parses and applies
+    auto merges = 20;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < merges; i++)
+        subject.merge(fixture);
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    WARN("merged " << fixture.size() * merges / elapsed / (1024 * 1024) << " MB/s");
+    REQUIRE(subject.rejected() == 0);
+    REQUIRE(federation_test::value_at(r, "requests", {{"endpoint", "/api/1234"}, {"method", "GET"}}) == 1234);
+}
+
+TEST_CASE("Prometheus federator scrapes a metrics endpoint", "[prometheus]")
+{
+    metrics_registry<> source;
+    *source.counter("MyCounter"_m, {{"tag", "a"}}) += 10;
+
+    metrics_http_options server_options;
+    server_options.address = "127.0.0.1";
+    server_options.render_interval = std::chrono::milliseconds(0);
+    metrics_http_server<decltype(source)::repository_type> server(source, server_options);
+    server.start();
+
+    metrics_registry<> r;
+    REQUIRE_THROWS_AS(prometheus_federator<decltype(r)::repository_type>(r).scrape(), std::invalid_argument);
+
+    federation_options options;
+    options.port = server.port();
+    prometheus_federator<decltype(r)::repository_type> subject(r, options);
+    REQUIRE(subject.scrape());
+    REQUIRE(federation_test::value_at(r, "MyCounter", {{"tag", "a"}}) == 10);
+
+    *source.counter("MyCounter"_m, {{"tag", "a"}}) += 5;
+    REQUIRE(subject.scrape());
+    REQUIRE(federation_test::value_at(r, "MyCounter", {{"tag", "a"}}) == 15);
+
+    federation_options missing = options;
+    missing.path = "/missing";
+    prometheus_federator<decltype(r)::repository_type> lost(r, missing);
+    REQUIRE_FALSE(lost.scrape());
+}
@@ -0,0 +1,231 @@
+#include <catch2/catch_all.hpp>
+#include <cstring>
+#include <cmath>
+#include <map>
+#include <set>
+#include <sstream>
+#include <cxxmetrics_prometheus/prometheus_protobuf_publisher.hpp>
+#include <cxxmetrics/simple_reservoir.hpp>
+
+using namespace cxxmetrics;
+using namespace cxxmetrics_literals;
+using namespace cxxmetrics_prometheus;
+
+namespace
+{
+
+// just enough of a protobuf reader to take apart the messages in the exposition
+struct message
+{
+    std::multimap<uint32_t, uint64_t> varints;
+    std::multimap<uint32_t, double> doubles;
+    std::multimap<uint32_t, std::string> bytes;
+
+    std::string string(uint32_t field) const
+    {
+        auto fnd = bytes.find(field);
+        return fnd == bytes.end() ? std::string() : fnd->second;
+    }
+
+    std::vector<message> messages(uint32_t field) const;
+};
+
+uint64_t read_varint(const std::string& data, std::size_t& at)
+{
+    uint64_t result = 0;
+    for (int shift = 0; at < data.size(); shift += 7)
+    {
+        auto b = static_cast<unsigned char>(data[at++]);
+        result |= static_cast<uint64_t>(b & 0x7f) << shift;
+        if (!(b & 0x80))
+            break;
+    }
+    return result;
+}
+
+message parse(const std::string& data)
+{
+    message result;
+    std::size_t at = 0;
+    while (at < data.size())
+    {
+        auto key = read_varint(data, at);
+        auto field = static_cast<uint32_t>(key >> 3);
+        switch (key & 7)
+        {
+            case 0:
+                result.varints.emplace(field, read_varint(data, at));
+                break;
+            case 1:
+            {
+                uint64_t bits = 0;
+                for (int i = 0; i < 8; i++)
+                    bits |= static_cast<uint64_t>(static_cast<unsigned char>(data[at + i])) << (i * 8);
+                double value;
+                std::memcpy(&value, &bits, sizeof(value));
+                result.doubles.emplace(field, value);
+                at += 8;
+                break;
+            }
+            case 2:
+            {
+                auto length = read_varint(data, at);
+                result.bytes.emplace(field, data.substr(at, length));
+                at += length;
+                break;
+            }
+            default:
+                FAIL("unexpected wire type");
+        }
+    }
+
+    return result;
+}
+
+std::vector<message> message::messages(uint32_t field) const
+{
+    std::vector<message> result;
+    auto range = bytes.equal_range(field);
+    for (auto i = range.first; i != range.second; ++i)
+        result.push_back(parse(i->second));
+    return result;
+}
+
+std::map<std::string, message> families(const std::string& data)
+{
+    std::map<std::string, message> result;
+    std::size_t at = 0;
+    while (at < data.size())
+    {
+        auto length = read_varint(data, at);
+        auto family = parse(data.substr(at, length));
+        at += length;
+        result.emplace(family.string(1), family);
+    }
+    return result;
+}
+
+std::map<std::string, std::string> labels(const message& metric)
+{
+    std::map<std::string, std::string> result;
+    for (const auto& pair : metric.messages(1))
+        result.emplace(pair.string(1), pair.string(2));
+    return result;
+}
+
+}
+
+TEST_CASE("Prometheus protobuf publisher writes counters and gauges", "[prometheus]")
+{
+    metrics_registry<> r;
+    prometheus_protobuf_publisher<decltype(r)::repository_type> subject(r);
+    *r.counter("MyCounter"_m, {{"tag", "a\"b"}, {"x2", 123523}}) += 1200100;
+    *r.counter("MyCounter"_m, {{"tag", "c"}, {"x2", 1}}) += 5;
+    r.gauge("MyGauge"_m, 923.005);
+
+    std::stringstream stream;
+    subject.write(stream);
+
+    auto found = families(stream.str());
+    REQUIRE(found.size() == 2);
+
+    const auto& counter = found["MyCounter"];
+    REQUIRE(counter.varints.find(3)->second == static_cast<uint64_t>(metric_type::untyped));
+    auto metrics = counter.messages(4);
+    REQUIRE(metrics.size() == 2);
+
+    bool saw_tagged = false;
+    for (const auto& metric : metrics)
+    {
+        auto l = labels(metric);
+        if (l["tag"] != "a\"b")
+            continue;
+
+        saw_tagged = true;
+        REQUIRE(l["x2"] == "123523");
+        REQUIRE(metric.messages(5).at(0).doubles.find(1)->second == 1200100);
+    }
+    REQUIRE(saw_tagged);
+
+    const auto& gauge = found["MyGauge"];
+    REQUIRE(gauge.varints.find(3)->second == static_cast<uint64_t>(metric_type::gauge));
+    REQUIRE(gauge.messages(4).at(0).messages(2).at(0).doubles.find(1)->second == 923.005);
+}
+
+TEST_CASE("Prometheus protobuf publisher writes timers as summaries and rate gauges", "[prometheus]")
+{
+    using reservoir_type = simple_reservoir<std::chrono::system_clock::duration, 4>;
+    metrics_registry<> r;
+    prometheus_protobuf_publisher<decltype(r)::repository_type> subject(r);
+    auto& t = *r.timer<100_micro, std::chrono::system_clock, reservoir_type, true, 5_min, 1_min>("MyTimer", reservoir_type(), {{"tag", "value"}});
+    t.update(std::chrono::microseconds(10));
+    t.update(std::chrono::microseconds(30));
+
+    std::stringstream stream;
+    subject.write(stream);
+
+    auto found = families(stream.str());
+    REQUIRE(found.size() == 2);
+
+    const auto& timer = found["MyTimer"];
+    REQUIRE(timer.varints.find(3)->second == static_cast<uint64_t>(metric_type::summary));
+    REQUIRE(timer.string(2) == "MyTimer in microseconds");
+
+    auto metric = timer.messages(4).at(0);
+    REQUIRE(labels(metric)["tag"] == "value");
+    auto summary = metric.messages(4).at(0);
+    REQUIRE(summary.varints.find(1)->second == 2);
+    REQUIRE(std::abs(summary.doubles.find(2)->second - 40) < 0.001);
+
+    auto quantiles = summary.messages(3);
+    REQUIRE_FALSE(quantiles.empty());
+    for (const auto& q : quantiles)
+    {
+        auto quantile = q.doubles.find(1)->second;
+        REQUIRE((quantile == 0.5 || quantile == 0.9 || quantile == 0.99 || quantile == 0.999));
+    }
+
+    const auto& rates = found["MyTimer:rates"];
+    REQUIRE(rates.varints.find(3)->second == static_cast<uint64_t>(metric_type::gauge));
+    std::set<std::string> windows;
+    for (const auto& m : rates.messages(4))
+    {
+        auto l = labels(m);
+        REQUIRE(l["tag"] == "value");
+        windows.insert(l["window"]);
+    }
+    REQUIRE(windows == std::set<std::string>{"mean", "5min", "1min", "1usec"});
+}
+
+TEST_CASE("Prometheus protobuf publisher writes bucketed timers as histograms", "[prometheus]")
+{
+    using reservoir_type = simple_reservoir<std::chrono::system_clock::duration, 4>;
+    metrics_registry<> r;
+    prometheus_protobuf_publisher<decltype(r)::repository_type> subject(r);
+    auto& t = *r.timer<100_micro, std::chrono::system_clock, reservoir_type, true, 5_min>("MyTimer", reservoir_type(), {{"tag", "value"}});
+    r.publish_options("MyTimer"_m, publish_options(histogram_publish_options(), timer_publish_options(bucket_layout{15, 100}, false)));
+    t.update(std::chrono::microseconds(10));
+    t.update(std::chrono::microseconds(30));
+
+    std::stringstream stream;
+    subject.write(stream);
+
+    auto found = families(stream.str());
+    REQUIRE(found.size() == 1);
+
+    const auto& timer = found["MyTimer"];
+    REQUIRE(timer.varints.find(3)->second == static_cast<uint64_t>(metric_type::histogram));
+
+    auto metric = timer.messages(4).at(0);
+    REQUIRE(labels(metric)["tag"] == "value");
+    auto histogram = metric.messages(7).at(0);
+    REQUIRE(histogram.varints.find(1)->second == 2);
+    REQUIRE(std::abs(histogram.doubles.find(2)->second - 40) < 0.001);
+
+    auto buckets = histogram.messages(3);
+    REQUIRE(buckets.size() == 2);
+    REQUIRE(buckets[0].doubles.find(2)->second == 15);
+    REQUIRE(buckets[0].varints.find(1)->second == 1);
+    REQUIRE(buckets[1].doubles.find(2)->second == 100);
+    REQUIRE(buckets[1].varints.find(1)->second == 2);
+}
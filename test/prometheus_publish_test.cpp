@@ -1,5 +1,9 @@
 #include <catch2/catch_all.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
 #include <sstream>
+#include <thread>
 #include <cxxmetrics_prometheus/prometheus_publisher.hpp>
 #include <cxxmetrics/simple_reservoir.hpp>
 
@@ -92,6 +96,31 @@ TEST_CASE("Prometheus Publisher can publish histogram values", "[prometheus]")
             Catch::Matchers::ContainsSubstring(".99"));
 }
 
+TEST_CASE("Prometheus Publisher can publish histograms as cumulative buckets", "[prometheus]")
+{
+    metrics_registry<> r;
+    prometheus_publisher<decltype(r)::repository_type> subject(r);
+    auto& hist = *r.histogram("MyHistogram"_m, cxxmetrics::simple_reservoir<int64_t, 100>(), {{"mytag","tagvalue2"}});
+    r.publish_options("MyHistogram"_m, publish_options(histogram_publish_options(bucket_layout{10000, 1000, 5000})));
+
+    for (int i = 1; i <= 100; i++)
+        hist.update(i * 97);
+
+    std::stringstream stream;
+    subject.write(stream);
+
+    auto out = stream.str();
+    WARN(out);
+    REQUIRE_THAT(out, Catch::Matchers::ContainsSubstring("# TYPE MyHistogram histogram\n"
+            "MyHistogram_bucket{le=\"1000\",mytag=\"tagvalue2\"} 10\n"
+            "MyHistogram_bucket{le=\"5000\",mytag=\"tagvalue2\"} 51\n"
+            "MyHistogram_bucket{le=\"10000\",mytag=\"tagvalue2\"} 100\n"
+            "MyHistogram_bucket{le=\"+Inf\",mytag=\"tagvalue2\"} 100\n"
+            "MyHistogram_sum{mytag=\"tagvalue2\"} 489850\n"
+            "MyHistogram_count{mytag=\"tagvalue2\"} 100\n"));
+    REQUIRE_THAT(out, !Catch::Matchers::ContainsSubstring("quantile"));
+}
+
 TEST_CASE("Prometheus Publisher can publish timer values", "[prometheus]")
 {
     using reservoir_type = simple_reservoir<std::chrono::system_clock::duration, 4>;
@@ -122,3 +151,299 @@ TEST_CASE("Prometheus Publisher can publish timer values", "[prometheus]")
             Catch::Matchers::ContainsSubstring("5min") &&
             Catch::Matchers::ContainsSubstring("x2=\"123523\""));
 }
+
+TEST_CASE("Prometheus Publisher incremental output matches a full render", "[prometheus]")
+{
+    int gauge_value = 7;
+    auto populate = [&gauge_value](metrics_registry<>& r) {
+        *r.counter("MyCounter"_m, {{"tag", "a"}}) += 10;
+        *r.counter("MyCounter"_m, {{"tag", "b"}}) += 20;
+        r.gauge("MyGauge"_m, gauge_value);
+        auto& hist = *r.histogram("MyHistogram"_m, cxxmetrics::simple_reservoir<int64_t, 100>(), {{"mytag","tagvalue2"}});
+        for (int i = 1; i <= 100; i++)
+            hist.update(i * 97);
+    };
+    auto update = [](metrics_registry<>& r) {
+        *r.counter("MyCounter"_m, {{"tag", "b"}}) += 5;
+        r.histogram("MyHistogram"_m, cxxmetrics::simple_reservoir<int64_t, 100>(), {{"mytag","tagvalue2"}})->update(12);
+    };
+
+    metrics_registry<> incremental;
+    metrics_registry<> full;
+    populate(incremental);
+    populate(full);
+
+    prometheus_publisher<decltype(incremental)::repository_type> subject(incremental);
+    std::stringstream first;
+    subject.write(first);
+
+    std::stringstream second;
+    subject.write(second);
+    REQUIRE(first.str() == second.str());
+
+    update(incremental);
+    update(full);
+    gauge_value = 9;
+
+    std::stringstream updated;
+    subject.write(updated);
+    REQUIRE(updated.str() != first.str());
+    REQUIRE_THAT(updated.str(), Catch::Matchers::ContainsSubstring("MyCounter{tag=\"b\"} 25"));
+
+    prometheus_publisher<decltype(full)::repository_type> reference(full);
+    std::stringstream expected;
+    reference.write(expected);
+    REQUIRE(updated.str() == expected.str());
+
+    incremental.publish_options("MyCounter"_m, publish_options(value_publish_options(scale_factor(2))));
+    std::stringstream scaled;
+    subject.write(scaled);
+    REQUIRE_THAT(scaled.str(), Catch::Matchers::ContainsSubstring("MyCounter{tag=\"b\"} 50"));
+}
+
+TEST_CASE("Prometheus Publisher writes the escaped labels on every line of a series", "[prometheus]")
+{
+    using reservoir_type = simple_reservoir<std::chrono::system_clock::duration, 4>;
+    metrics_registry<> r;
+    prometheus_publisher<decltype(r)::repository_type> subject(r);
+    auto& t = *r.timer<100_micro, std::chrono::system_clock, reservoir_type, true, 5_min, 1_min>("MyTimer", reservoir_type(), {{"tag", "quoted \"value\""}});
+    t.update(std::chrono::microseconds(100));
+
+    std::stringstream first;
+    subject.write(first);
+
+    *r.counter("MyCounter"_m, {{"tag", "a"}}) += 1;
+    t.update(std::chrono::microseconds(200));
+
+    std::stringstream second;
+    subject.write(second);
+
+    for (const auto& out : {first.str(), second.str()})
+    {
+        std::istringstream lines(out);
+        std::string line;
+        std::size_t series = 0;
+        while (std::getline(lines, line))
+        {
+            if (line.empty() || line[0] == '#' || line.compare(0, 7, "MyTimer") != 0)
+                continue;
+
+            ++series;
+            REQUIRE_THAT(line, Catch::Matchers::ContainsSubstring("tag=\"quoted \\\"value\\\"\"}"));
+        }
+
+        REQUIRE(series == 9);
+    }
+
+    REQUIRE_THAT(second.str(), Catch::Matchers::ContainsSubstring("MyCounter{tag=\"a\"} 1"));
+}
+
+TEST_CASE("Prometheus Publisher coalesces overlapping writes", "[prometheus]")
+{
+    metrics_registry<> r;
+    prometheus_publisher<decltype(r)::repository_type> subject(r);
+
+    std::mutex lock;
+    std::condition_variable changed;
+    bool entered = false;
+    bool released = false;
+    std::atomic_int collections(0);
+    r.gauge("SlowGauge"_m, std::function<uint64_t()>([&]() -> uint64_t {
+        std::unique_lock<std::mutex> l(lock);
+        entered = true;
+        changed.notify_all();
+        changed.wait(l, [&]() { return released; });
+        return ++collections;
+    }));
+
+    std::stringstream first;
+    std::thread leader([&]() { subject.write(first); });
+    {
+        std::unique_lock<std::mutex> l(lock);
+        changed.wait(l, [&]() { return entered; });
+    }
+
+    std::stringstream second;
+    std::thread follower([&]() { subject.write(second); });
+
+    // give the follower time to join the write in flight before letting it finish
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    {
+        std::lock_guard<std::mutex> l(lock);
+        released = true;
+    }
+    changed.notify_all();
+    leader.join();
+    follower.join();
+
+    REQUIRE(collections == 1);
+    REQUIRE_THAT(first.str(), Catch::Matchers::ContainsSubstring("SlowGauge{} 1\n"));
+    REQUIRE(second.str() == first.str());
+
+    std::stringstream third;
+    subject.write(third);
+    REQUIRE(collections == 2);
+    REQUIRE_THAT(third.str(), Catch::Matchers::ContainsSubstring("SlowGauge{} 2\n"));
+}
+
+TEST_CASE("Prometheus Publisher shares writes within the max staleness", "[prometheus]")
+{
+    metrics_registry<> r;
+    prometheus_publisher<decltype(r)::repository_type> subject(r);
+    auto& counter = *r.counter("MyCounter"_m);
+    counter += 10;
+
+    subject.max_staleness(std::chrono::hours(1));
+    std::stringstream first;
+    subject.write(first);
+
+    counter += 5;
+    std::stringstream shared;
+    subject.write(shared);
+    REQUIRE(shared.str() == first.str());
+
+    subject.max_staleness(std::chrono::seconds(0));
+    std::stringstream fresh;
+    subject.write(fresh);
+    REQUIRE_THAT(fresh.str(), Catch::Matchers::ContainsSubstring("MyCounter{} 15\n"));
+}
+
+TEST_CASE("Prometheus Publisher renders a collected registry snapshot", "[prometheus]")
+{
+    metrics_registry<> r;
+    prometheus_publisher<decltype(r)::repository_type> subject(r);
+    auto& counter = *r.counter("MyCounter"_m, {{"tag", "a"}});
+    counter += 10;
+    auto& hist = *r.histogram("MyHistogram"_m, cxxmetrics::simple_reservoir<int64_t, 100>(), {{"mytag", "tagvalue"}});
+    for (int i = 1; i <= 100; i++)
+        hist.update(i * 97);
+
+    auto snapshot = r.collect();
+    exposition_buffer live;
+    subject.write(live);
+    exposition_buffer collected;
+    subject.write(*snapshot, collected);
+    REQUIRE(collected.str() == live.str());
+
+    // the snapshot renders what was collected even after the registry moves on
+    counter += 5;
+    exposition_buffer later;
+    subject.write(*snapshot, later);
+    REQUIRE(later.str() == live.str());
+    REQUIRE_THAT(later.str(), Catch::Matchers::ContainsSubstring("MyCounter{tag=\"a\"} 10\n"));
+
+    exposition_buffer current;
+    subject.write(current);
+    REQUIRE_THAT(current.str(), Catch::Matchers::ContainsSubstring("MyCounter{tag=\"a\"} 15\n"));
+}
+
+TEST_CASE("Prometheus Publisher renders straight into output sinks", "[prometheus]")
+{
+    using reservoir_type = cxxmetrics::simple_reservoir<int64_t, 16>;
+    metrics_registry<> r;
+    prometheus_publisher<decltype(r)::repository_type> subject(r);
+    for (int i = 0; i < 100; i++)
+        *r.counter("MyCounter" + std::to_string(i), {{"tag", "value"}}) += i;
+    auto& hist = *r.histogram("MyHistogram"_m, reservoir_type());
+    for (int i = 1; i <= 16; i++)
+        hist.update(i);
+
+    exposition_buffer expected;
+    subject.write(expected);
+    REQUIRE_THAT(expected.str(), Catch::Matchers::ContainsSubstring("MyCounter42{tag=\"value\"} 42\n"));
+
+    // the counters are written from the series cache on the second pass
+    for (int pass = 0; pass < 2; pass++)
+    {
+        std::ostringstream stream;
+        {
+            ostream_sink sink(stream, 256);
+            subject.write_to(sink);
+        }
+        REQUIRE(stream.str() == expected.str());
+
+        iovec_sink pieces;
+        subject.write_to(pieces);
+        REQUIRE(pieces.str() == expected.str());
+
+        char name[] = "/tmp/cxxmetrics_sink_XXXXXX";
+        auto fd = ::mkstemp(name);
+        REQUIRE(fd >= 0);
+        {
+            fd_sink sink(fd, 256);
+            subject.write_to(*r.collect(), sink);
+            sink.flush();
+            REQUIRE(sink.size() == expected.size());
+        }
+        std::string written(expected.size(), '\0');
+        REQUIRE(::pread(fd, &written[0], written.size(), 0) == static_cast<ssize_t>(written.size()));
+        REQUIRE(written == expected.str());
+        ::close(fd);
+        ::unlink(name);
+    }
+}
+
+TEST_CASE("Prometheus Publisher hands a shared render to an iovec sink", "[prometheus]")
+{
+    metrics_registry<> r;
+    prometheus_publisher<decltype(r)::repository_type> subject(r);
+    subject.max_staleness(std::chrono::hours(1));
+    for (int i = 0; i < 100; i++)
+        *r.counter("MyCounter" + std::to_string(i)) += i;
+
+    iovec_sink first;
+    subject.write(first);
+    iovec_sink second;
+    subject.write(second);
+
+    REQUIRE(first.pieces().size() == 1);
+    REQUIRE(second.pieces().size() == 1);
+    REQUIRE(first.pieces()[0].iov_base == second.pieces()[0].iov_base);
+
+    exposition_buffer expected;
+    subject.write(expected);
+    REQUIRE(first.str() == expected.str());
+}
+
+// a publisher that lets a test look into the series it cached
+template<typename TRepo>
+struct cache_inspecting_publisher : public prometheus_publisher<TRepo>
+{
+    using prometheus_publisher<TRepo>::prometheus_publisher;
+
+    cxxmetrics_prometheus::internal::series_cache* cache(const metric_path& path)
+    {
+        return this->template get_data_for<cxxmetrics_prometheus::internal::series_cache>(path);
+    }
+};
+
+TEST_CASE("Prometheus Publisher writes unchanged gauges from the series cache", "[prometheus]")
+{
+    metrics_registry<> r;
+    cache_inspecting_publisher<decltype(r)::repository_type> subject(r);
+    tag_collection tags{{"tag", "a"}};
+    auto& g = *r.gauge("MyGauge"_m, 5, tags);
+
+    exposition_buffer first;
+    subject.write(first);
+    REQUIRE_THAT(first.str(), Catch::Matchers::ContainsSubstring("MyGauge{tag=\"a\"} 5\n"));
+
+    // swap out the cached text so that a write from the cache can be told apart from a fresh snapshot
+    auto cache = subject.cache("MyGauge"_m);
+    REQUIRE(cache != nullptr);
+    {
+        std::lock_guard<cxxmetrics_prometheus::internal::series_cache> lock(*cache);
+        REQUIRE(cache->find(tags, g.epoch()) != nullptr);
+        std::string cached("MyGauge{tag=\"a\"} 42\n");
+        cache->store(cache->get(tags), g.epoch(), cached.data(), cached.size());
+    }
+
+    exposition_buffer unchanged;
+    subject.write(unchanged);
+    REQUIRE_THAT(unchanged.str(), Catch::Matchers::ContainsSubstring("MyGauge{tag=\"a\"} 42\n"));
+
+    g.set(7);
+    exposition_buffer changed;
+    subject.write(changed);
+    REQUIRE_THAT(changed.str(), Catch::Matchers::ContainsSubstring("MyGauge{tag=\"a\"} 7\n"));
+}
@@ -0,0 +1,307 @@
+#include <catch2/catch_all.hpp>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+#include <cxxmetrics_prometheus/remote_write_publisher.hpp>
+#include <cxxmetrics/simple_reservoir.hpp>
+#include "helpers.hpp"
+
+using namespace cxxmetrics;
+using namespace cxxmetrics_literals;
+using namespace cxxmetrics_prometheus;
+
+namespace
+{
+
+// stands in for a remote write endpoint
+class receiver : public http_receiver
+{
+public:
+    receiver() :
+            http_receiver([](const std::string& head, std::string& body) {
+                std::string request;
+                if (head.compare(0, 27, "POST /api/v1/write HTTP/1.1") != 0 ||
+                        head.find("Content-Encoding: snappy") == std::string::npos ||
+                        head.find("X-Prometheus-Remote-Write-Version: 0.1.0") == std::string::npos ||
+                        !cxxmetrics_prometheus::internal::snappy::uncompress(body.data(), body.size(), request))
+                    return false;
+
+                body = std::move(request);
+                return true;
+            })
+    { }
+
+    remote_write_options options(const temp_directory& wal) const
+    {
+        remote_write_options result;
+        result.port = port();
+        result.labels = {{"job", "batch"}};
+        result.wal_directory = wal.path;
+        result.timeout = std::chrono::seconds(2);
+        return result;
+    }
+};
+
+struct series
+{
+    std::vector<std::pair<std::string, std::string>> labels;
+    double value;
+    int64_t timestamp;
+};
+
+/**
+ * \brief The series in the write requests, keyed by their labels in the order they were sent
+ */
+std::map<std::string, series> series_of(const std::vector<std::string>& bodies)
+{
+    std::map<std::string, series> result;
+    for (const auto& body : bodies)
+    {
+        for (const auto& f : decode(body))
+        {
+            if (f.number != 1)
+                continue;
+
+            series s{};
+            std::string key;
+            for (const auto& part : decode(f.bytes))
+            {
+                auto fields = decode(part.bytes);
+                if (part.number == 1)
+                {
+                    s.labels.emplace_back(fields.at(0).bytes, fields.at(1).bytes);
+                    key += fields.at(0).bytes + "=" + fields.at(1).bytes + ";";
+                }
+                else
+                {
+                    std::memcpy(&s.value, &fields.at(0).value, sizeof(double));
+                    s.timestamp = static_cast<int64_t>(fields.at(1).value);
+                }
+            }
+            result[key] = s;
+        }
+    }
+    return result;
+}
+
+}
+
+TEST_CASE("Snappy compression round trips", "[prometheus][remote_write]")
+{
+    std::string data;
+    for (int i = 0; i < 20000; i++)
+        data += "metric_name{label=\"" + std::to_string(i % 37) + "\"} " + std::to_string(i * 7919 % 104729) + "\n";
+    REQUIRE(data.size() > cxxmetrics_prometheus::internal::snappy::block_size * 2);
+
+    exposition_buffer compressed(1024);
+    cxxmetrics_prometheus::internal::snappy::compress(data.data(), data.size(), compressed);
+    REQUIRE(compressed.size() < data.size() / 2);
+
+    std::string uncompressed;
+    REQUIRE(cxxmetrics_prometheus::internal::snappy::uncompress(compressed.data(), compressed.size(), uncompressed));
+    REQUIRE(uncompressed == data);
+
+    // long runs and short inputs take the other paths through the encoder
+    for (const auto& input : {std::string(), std::string("abc"), std::string(1000, 'x'), std::string("abcdabcdabcdabcdabcd")})
+    {
+        compressed.clear();
+        uncompressed.clear();
+        cxxmetrics_prometheus::internal::snappy::compress(input.data(), input.size(), compressed);
+        REQUIRE(cxxmetrics_prometheus::internal::snappy::uncompress(compressed.data(), compressed.size(), uncompressed));
+        REQUIRE(uncompressed == input);
+    }
+
+    REQUIRE_FALSE(cxxmetrics_prometheus::internal::snappy::uncompress("\x05\x01", 2, uncompressed));
+}
+
+TEST_CASE("Write-ahead log rotates segments and survives reopening", "[prometheus][remote_write]")
+{
+    temp_directory dir;
+    std::string record;
+    {
+        write_ahead_log wal(dir.path, 80, 1024);
+        REQUIRE(wal.empty());
+        REQUIRE_FALSE(wal.front(record));
+
+        for (int i = 0; i < 10; i++)
+        {
+            auto data = "record " + std::to_string(i) + std::string(20, '.');
+            wal.append(data.data(), data.size());
+        }
+
+        // two records fit in a segment
+        REQUIRE(wal.segments() == 5);
+        REQUIRE(wal.records() == 10);
+
+        for (int i = 0; i < 3; i++)
+        {
+            REQUIRE(wal.front(record));
+            REQUIRE(record.compare(0, 8, "record " + std::to_string(i)) == 0);
+            wal.pop();
+        }
+
+        // consumed segments are deleted right away
+        REQUIRE(wal.segments() == 4);
+        REQUIRE(dir.files(".wal") == 4);
+    }
+
+    {
+        // a record that was only half written when the process died is cut off
+        auto last = dir.path + "/0000000000000005.wal";
+        auto fd = ::open(last.c_str(), O_WRONLY | O_APPEND);
+        REQUIRE(fd >= 0);
+        REQUIRE(::write(fd, "\x40\x00\x00\x00garbage", 11) == 11);
+        ::close(fd);
+    }
+
+    {
+        write_ahead_log wal(dir.path, 80, 200);
+        REQUIRE(wal.records() == 7);
+        REQUIRE(wal.front(record));
+        REQUIRE(record.compare(0, 8, "record 3") == 0);
+
+        // going over the size drops the oldest segments along with what wasn't consumed in them
+        for (int i = 10; i < 12; i++)
+        {
+            auto data = "record " + std::to_string(i) + std::string(20, '.');
+            wal.append(data.data(), data.size());
+        }
+        REQUIRE(wal.bytes() <= 200);
+        REQUIRE(wal.dropped() == 5);
+
+        REQUIRE(wal.front(record));
+        REQUIRE(record.compare(0, 8, "record 8") == 0);
+
+        std::size_t remaining = 0;
+        while (wal.front(record))
+        {
+            ++remaining;
+            wal.pop();
+        }
+        REQUIRE(remaining == 4);
+        REQUIRE(wal.empty());
+        REQUIRE(dir.files(".wal") == 0);
+    }
+}
+
+TEST_CASE("Remote write publisher sends sorted series with snappy", "[prometheus][remote_write]")
+{
+    temp_directory wal;
+    receiver endpoint;
+    metrics_registry<> r;
+    remote_write_publisher<decltype(r)::repository_type> subject(r, endpoint.options(wal));
+
+    *r.counter("requests"_m, {{"code", 200}, {"Method", "GET"}}) += 5;
+    auto& meter = *r.meter<1_sec, 1_min>("hits");
+    meter.mark(3);
+    auto& histogram = *r.histogram("latency", simple_reservoir<int, 32>());
+    r.publish_options("latency"_m, publish_options(histogram_publish_options(bucket_layout{10, 100})));
+    histogram.update(5);
+    histogram.update(50);
+    histogram.update(500);
+
+    REQUIRE(subject.publish() == 3);
+    REQUIRE(subject.sent() == 1);
+    REQUIRE(subject.pending() == 0);
+
+    auto sent = series_of(endpoint.bodies());
+    auto requests = sent.find("Method=GET;__name__=requests;code=200;job=batch;");
+    REQUIRE(requests != sent.end());
+    REQUIRE(requests->second.value == 5);
+    REQUIRE(std::abs(requests->second.timestamp - std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count()) < 60000);
+
+    REQUIRE(sent.count("__name__=hits;job=batch;window=mean;"));
+    REQUIRE(sent.count("__name__=hits;job=batch;window=1min;"));
+
+    REQUIRE(sent.at("__name__=latency_bucket;job=batch;le=10;").value == 1);
+    REQUIRE(sent.at("__name__=latency_bucket;job=batch;le=100;").value == 2);
+    REQUIRE(sent.at("__name__=latency_bucket;job=batch;le=+Inf;").value == 3);
+    REQUIRE(sent.at("__name__=latency_count;job=batch;").value == 3);
+    REQUIRE(sent.at("__name__=latency_sum;job=batch;").value == 555);
+
+    // the metadata carries the type of every metric
+    int histograms = 0;
+    for (const auto& f : decode(endpoint.bodies().at(0)))
+    {
+        if (f.number != 3)
+            continue;
+
+        auto metadata = decode(f.bytes);
+        if (metadata.at(1).bytes == "latency")
+        {
+            REQUIRE(metadata.at(0).value == 3);
+            ++histograms;
+        }
+    }
+    REQUIRE(histograms == 1);
+}
+
+TEST_CASE("Remote write publishers of the same registry send their own external labels", "[prometheus][remote_write]")
+{
+    temp_directory first_wal;
+    temp_directory second_wal;
+    receiver first_endpoint;
+    receiver second_endpoint;
+    metrics_registry<> r;
+    remote_write_publisher<decltype(r)::repository_type> first(r, first_endpoint.options(first_wal));
+    auto second_options = second_endpoint.options(second_wal);
+    second_options.labels = {{"job", "other"}, {"region", "east"}};
+    remote_write_publisher<decltype(r)::repository_type> second(r, second_options);
+
+    *r.counter("requests"_m, {{"code", 200}}) += 5;
+    REQUIRE(first.publish() == 1);
+    REQUIRE(second.publish() == 1);
+
+    auto sent = series_of(first_endpoint.bodies());
+    REQUIRE(sent.size() == 1);
+    REQUIRE(sent.count("__name__=requests;code=200;job=batch;"));
+
+    sent = series_of(second_endpoint.bodies());
+    REQUIRE(sent.size() == 1);
+    REQUIRE(sent.count("__name__=requests;code=200;job=other;region=east;"));
+}
+
+TEST_CASE("Remote write publisher logs requests through an outage", "[prometheus][remote_write]")
+{
+    temp_directory wal;
+    receiver endpoint;
+    metrics_registry<> r;
+    auto counter = r.counter("requests"_m);
+    {
+        auto options = endpoint.options(wal);
+        options.max_batch = 1;
+        remote_write_publisher<decltype(r)::repository_type> subject(r, options);
+        *r.counter("other"_m) += 1;
+
+        *counter += 1;
+        endpoint.respond_with(503);
+        subject.publish();
+
+        // the first batch couldn't be sent so the rest went to the log without trying
+        REQUIRE(subject.sent() == 0);
+        REQUIRE(subject.pending() == 2);
+        REQUIRE(wal.files(".wal") == 1);
+    }
+
+    // a new process picks up what the last one left and sends it before anything newer
+    remote_write_publisher<decltype(r)::repository_type> subject(r, endpoint.options(wal));
+    REQUIRE(subject.pending() == 2);
+
+    *counter += 2;
+    subject.publish();
+    REQUIRE(subject.sent() == 3);
+    REQUIRE(subject.pending() == 0);
+    REQUIRE(wal.files(".wal") == 0);
+
+    auto bodies = endpoint.bodies();
+    REQUIRE(bodies.size() == 3);
+    REQUIRE(series_of({bodies[0], bodies[1]}).at("__name__=requests;job=batch;").value == 1);
+    REQUIRE(series_of({bodies[2]}).at("__name__=requests;job=batch;").value == 3);
+
+    // a request the receiver refuses outright isn't retried
+    endpoint.respond_with(400);
+    subject.publish();
+    REQUIRE(subject.rejected() == 1);
+    REQUIRE(subject.pending() == 0);
+}
@@ -0,0 +1,146 @@
+#include <catch2/catch_all.hpp>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+#include <cxxmetrics_prometheus/textfile_publisher.hpp>
+#include "helpers.hpp"
+
+using namespace cxxmetrics;
+using namespace cxxmetrics_literals;
+using namespace cxxmetrics_prometheus;
+
+namespace
+{
+
+std::string read_file(const std::string& path)
+{
+    std::ifstream file(path);
+    std::stringstream result;
+    result << file.rdbuf();
+    return result.str();
+}
+
+}
+
+TEST_CASE("Textfile publisher only rewrites the file when the registry changes", "[prometheus]")
+{
+    temp_directory dir;
+    metrics_registry<> r;
+    auto& counter = *r.counter("MyCounter"_m, {{"tag", "a"}});
+    counter += 10;
+
+    textfile_options options;
+    options.path = dir.path + "/job.prom";
+    options.sync = GENERATE(false, true);
+    textfile_publisher<decltype(r)::repository_type> subject(r, options);
+
+    REQUIRE(subject.publish());
+    REQUIRE_THAT(read_file(options.path), Catch::Matchers::ContainsSubstring("MyCounter{tag=\"a\"} 10\n"));
+    REQUIRE(dir.files() == 1);
+
+    struct stat before{};
+    REQUIRE(::stat(options.path.c_str(), &before) == 0);
+
+    REQUIRE_FALSE(subject.publish());
+    REQUIRE_FALSE(subject.publish());
+    struct stat unchanged{};
+    REQUIRE(::stat(options.path.c_str(), &unchanged) == 0);
+    REQUIRE(unchanged.st_ino == before.st_ino);
+
+    counter += 5;
+    REQUIRE(subject.publish());
+    REQUIRE_THAT(read_file(options.path), Catch::Matchers::ContainsSubstring("MyCounter{tag=\"a\"} 15\n"));
+
+    // a new series is a change too
+    *r.counter("MyCounter"_m, {{"tag", "b"}}) += 1;
+    REQUIRE(subject.publish());
+    REQUIRE_THAT(read_file(options.path), Catch::Matchers::ContainsSubstring("MyCounter{tag=\"b\"} 1\n"));
+
+    REQUIRE(subject.exports() == 3);
+    REQUIRE(subject.skipped() == 2);
+    REQUIRE(dir.files() == 1);
+}
+
+TEST_CASE("Textfile publisher doesn't rewrite unchanged settable gauges", "[prometheus]")
+{
+    temp_directory dir;
+    metrics_registry<> r;
+    auto& g = *r.gauge("MyGauge"_m, 5, {{"tag", "a"}});
+
+    textfile_options options;
+    options.path = dir.path + "/job.prom";
+    textfile_publisher<decltype(r)::repository_type> subject(r, options);
+
+    REQUIRE(subject.publish());
+    REQUIRE_FALSE(subject.publish());
+    REQUIRE_THAT(read_file(options.path), Catch::Matchers::ContainsSubstring("MyGauge{tag=\"a\"} 5\n"));
+
+    g.set(7);
+    REQUIRE(subject.publish());
+    REQUIRE_THAT(read_file(options.path), Catch::Matchers::ContainsSubstring("MyGauge{tag=\"a\"} 7\n"));
+    REQUIRE(subject.exports() == 2);
+    REQUIRE(subject.skipped() == 1);
+}
+
+TEST_CASE("Textfile publisher exports metrics that don't track changes once they're stale", "[prometheus]")
+{
+    temp_directory dir;
+    metrics_registry<> r;
+    auto& meter = *r.meter<1_sec, 1_min>("MyMeter");
+    meter.mark(1);
+    auto& counter = *r.counter("MyCounter"_m);
+
+    textfile_options options;
+    options.path = dir.path + "/job.prom";
+    textfile_publisher<decltype(r)::repository_type> subject(r, options);
+
+    // the meter alone doesn't rewrite the file until the last export gets stale
+    REQUIRE(subject.publish());
+    REQUIRE_FALSE(subject.publish());
+    counter += 1;
+    REQUIRE(subject.publish());
+    REQUIRE_THAT(read_file(options.path), Catch::Matchers::ContainsSubstring("MyMeter"));
+
+    options.max_staleness = std::chrono::steady_clock::duration::zero();
+    textfile_publisher<decltype(r)::repository_type> always(r, options);
+    REQUIRE(always.publish());
+    REQUIRE(always.publish());
+    REQUIRE(always.exports() == 2);
+}
+
+TEST_CASE("Textfile publisher exports on its cadence", "[prometheus]")
+{
+    temp_directory dir;
+    metrics_registry<> r;
+    auto& counter = *r.counter("MyCounter"_m);
+    counter += 10;
+
+    textfile_options options;
+    options.path = dir.path + "/job.prom";
+    textfile_publisher<decltype(r)::repository_type> subject(r, options);
+    REQUIRE_THROWS_AS(subject.start(std::chrono::milliseconds(-1)), std::invalid_argument);
+    subject.start(std::chrono::milliseconds(5));
+
+    counter += 5;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (read_file(options.path).find("MyCounter{} 15\n") == std::string::npos && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+
+    subject.stop();
+    REQUIRE_THAT(read_file(options.path), Catch::Matchers::ContainsSubstring("MyCounter{} 15\n"));
+}
+
+TEST_CASE("Textfile publisher reports where it can't export", "[prometheus]")
+{
+    metrics_registry<> r;
+    *r.counter("MyCounter"_m) += 1;
+
+    REQUIRE_THROWS_AS(textfile_publisher<decltype(r)::repository_type>(r, textfile_options()), std::invalid_argument);
+
+    textfile_options options;
+    options.path = "/nonexistent/cxxmetrics/job.prom";
+    textfile_publisher<decltype(r)::repository_type> subject(r, options);
+    REQUIRE_THROWS_AS(subject.publish(), std::system_error);
+    REQUIRE(subject.exports() == 0);
+}
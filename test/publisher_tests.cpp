@@ -65,6 +65,11 @@ public:
     {
         return this->effective_options(metric);
     }
+
+    bool refresh(basic_registered_metric& metric, publish_plan& plan) const
+    {
+        return this->refresh_plan(metric, plan);
+    }
 };
 
 struct test_pubdata : public basic_publish_options
@@ -355,3 +360,77 @@ TEST_CASE("Publisher can get histogram options", "[publisher]")
     REQUIRE(values.size() == 10);
     REQUIRE(count == 4);
 }
+
+TEST_CASE("Publisher bucket layouts are sorted and unique", "[publisher]")
+{
+    REQUIRE(bucket_layout{5, 1, 3, 1}.bounds() == std::vector<double>{1, 3, 5});
+    REQUIRE(bucket_layout::linear(10, 5, 3).bounds() == std::vector<double>{10, 15, 20});
+    REQUIRE(bucket_layout::exponential(1, 10, 4).bounds() == std::vector<double>{1, 10, 100, 1000});
+
+    histogram_publish_options quantiled;
+    REQUIRE_FALSE(quantiled.buckets());
+
+    timer_publish_options bucketed(bucket_layout{1, 2}, false);
+    REQUIRE(bucketed.buckets()->bounds().size() == 2);
+    REQUIRE_FALSE(bucketed.include_rates());
+}
+
+TEST_CASE("Publisher plans are only refreshed when publish options change", "[publisher]")
+{
+    metrics_registry<> r;
+    test_publisher<> subject(r);
+    r.counter("MyCounter"_m);
+    r.counter("OtherCounter"_m);
+
+    struct test_plan : public publish_plan
+    {
+        int compiled = 0;
+    };
+
+    auto refresh = [&](const metric_path& path) {
+        bool refreshed = false;
+        test_plan* plan = nullptr;
+        subject.visit_metric(path, [&](const metric_path&, basic_registered_metric& metric) {
+            plan = subject.metric_data<test_plan>(path);
+            refreshed = subject.refresh(metric, *plan);
+            if (refreshed)
+                ++plan->compiled;
+        });
+        return std::make_pair(refreshed, plan);
+    };
+
+    auto first = refresh("MyCounter"_m);
+    REQUIRE(first.first);
+    REQUIRE(&first.second->options() == &r.publish_options());
+    REQUIRE_FALSE(refresh("MyCounter"_m).first);
+    REQUIRE(refresh("MyCounter"_m).second == first.second);
+
+    // options set on any metric refresh every plan, since plans only check the registry's epoch
+    r.publish_options("OtherCounter"_m, publish_options(value_publish_options(scale_factor(2))));
+    REQUIRE(refresh("MyCounter"_m).first);
+    REQUIRE_FALSE(refresh("MyCounter"_m).first);
+
+    r.publish_options("MyCounter"_m, publish_options(value_publish_options(scale_factor(3))));
+    auto scaled = refresh("MyCounter"_m);
+    REQUIRE(scaled.first);
+    REQUIRE(&scaled.second->options() != &r.publish_options());
+    REQUIRE(scaled.second->compiled == 3);
+}
+
+TEST_CASE("Publisher data is shared between threads without a lock", "[publisher]")
+{
+    metrics_registry<> r;
+    test_publisher<> subject(r);
+    r.counter("MyCounter"_m);
+
+    std::vector<test_pubdata*> seen(8);
+    std::vector<std::thread> threads;
+    for (std::size_t i = 0; i < seen.size(); i++)
+        threads.emplace_back([&, i]() { seen[i] = subject.metric_data<test_pubdata>("MyCounter"_m, static_cast<int>(i) + 1); });
+    for (auto& t : threads)
+        t.join();
+
+    for (auto data : seen)
+        REQUIRE(data == seen.front());
+    REQUIRE(subject.has_metric_data<test_pubdata>("MyCounter"_m));
+}
@@ -0,0 +1,210 @@
+#include <catch2/catch_all.hpp>
+#include <sys/wait.h>
+#include <cxxmetrics/region_aggregator.hpp>
+#include <cxxmetrics/simple_reservoir.hpp>
+#include "helpers.hpp"
+
+using namespace cxxmetrics;
+using namespace cxxmetrics_literals;
+
+namespace aggregator_test
+{
+
+const std::string prefix = "/cxxmetrics_region_aggregator_test";
+constexpr std::size_t worker_count = 3;
+
+struct regions_cleanup
+{
+    ~regions_cleanup()
+    {
+        for (std::size_t i = 0; i < worker_count; i++)
+            shared_region::remove(region_aggregator<>::region_name(prefix, i));
+    }
+};
+
+void run_worker(std::size_t index, int64_t requests)
+{
+    metrics_registry<> registry;
+    auto region = shared_region::create(region_aggregator<>::region_name(prefix, index));
+
+    region->counter(registry, "requests"_m, {{"method", "GET"}})->incr(requests);
+    region->gauge(registry, "load"_m)->set(static_cast<double>(index));
+    region->meter<time::seconds(1), time::minutes(1)>(registry, "hits"_m)->mark(requests);
+
+    auto latency = region->histogram(registry, "latency"_m, bucket_layout{10, 100}, simple_reservoir<int, 16>(), tag_collection(), 16);
+    for (int64_t i = 0; i < requests; i++)
+        latency->update(static_cast<int>(index * 100 + i));
+}
+
+template<typename THandler>
+void visit_metric(metrics_registry<>& registry, const std::string& name, THandler&& handler)
+{
+    int found = 0;
+    registry.visit_registered_metrics([&](const metric_path& path, basic_registered_metric& metric) {
+        if (path.join("/") != name)
+            return;
+
+        ++found;
+        metric.visit([&](const tag_collection& tags, const auto& snapshot) {
+            handler(tags, snapshot);
+        });
+    });
+    REQUIRE(found == 1);
+}
+
+}
+
+using namespace aggregator_test;
+
+TEST_CASE("Region aggregator merges the metrics of forked workers", "[region_aggregator]")
+{
+    regions_cleanup cleanup;
+    metrics_registry<> registry;
+    region_aggregator<> aggregator(registry, prefix, worker_count);
+
+    // nothing to aggregate before the workers start
+    aggregator.refresh();
+    REQUIRE(aggregator.series() == 0);
+
+    for (std::size_t i = 0; i < worker_count; i++)
+    {
+        auto pid = ::fork();
+        REQUIRE(pid >= 0);
+        if (pid == 0)
+        {
+            run_worker(i, static_cast<int64_t>(i + 1) * 2);
+            ::_exit(0);
+        }
+
+        int status = 0;
+        REQUIRE(::waitpid(pid, &status, 0) == pid);
+        REQUIRE(WIFEXITED(status));
+        REQUIRE(WEXITSTATUS(status) == 0);
+    }
+
+    aggregator.refresh();
+    REQUIRE(aggregator.series() == 4);
+    REQUIRE(aggregator.conflicts() == 0);
+
+    // the regions of the workers outlive them so their last values are still aggregated
+    int visited = 0;
+    aggregator_test::visit_metric(registry, "requests", [&](const tag_collection& tags, const auto& snapshot) {
+        using snapshot_type = std::decay_t<decltype(snapshot)>;
+        REQUIRE(std::is_same<snapshot_type, cumulative_value_snapshot>::value);
+        REQUIRE(tags == tag_collection({{"method", "GET"}}));
+        REQUIRE(value_of(snapshot) == 2 + 4 + 6);
+        ++visited;
+    });
+
+    aggregator_test::visit_metric(registry, "load", [&](const tag_collection&, const auto& snapshot) {
+        REQUIRE(std::abs(value_of(snapshot) - 1.0) < 0.0001);
+        ++visited;
+    });
+
+    aggregator_test::visit_metric(registry, "hits", [&](const tag_collection&, const auto& snapshot) {
+        using snapshot_type = std::decay_t<decltype(snapshot)>;
+        REQUIRE(std::is_same<snapshot_type, meter_snapshot>::value);
+        ++visited;
+    });
+
+    aggregator_test::visit_metric(registry, "latency", [&](const tag_collection&, const auto& snapshot) {
+        using snapshot_type = std::decay_t<decltype(snapshot)>;
+        REQUIRE(std::is_same<snapshot_type, histogram_snapshot>::value);
+        REQUIRE(histogram_of(snapshot)->count() == 2 + 4 + 6);
+        ++visited;
+    });
+    REQUIRE(visited == 4);
+
+    // a restarted worker replaces its series as it registers them again, and what it counted before is kept
+    run_worker(1, 1);
+    aggregator.refresh();
+    REQUIRE(aggregator.series() == 4);
+    aggregator_test::visit_metric(registry, "requests", [&](const tag_collection&, const auto& snapshot) {
+        REQUIRE(value_of(snapshot) == 2 + 4 + 1 + 6);
+    });
+}
+
+TEST_CASE("Region aggregator keeps the most recent histogram samples", "[region_aggregator]")
+{
+    regions_cleanup cleanup;
+    metrics_registry<> registry;
+    region_aggregator<> aggregator(registry, prefix, worker_count);
+
+    metrics_registry<> worker_registries[2];
+    std::vector<std::shared_ptr<shared_region>> regions;
+    for (std::size_t i = 0; i < 2; i++)
+    {
+        regions.push_back(shared_region::create(region_aggregator<>::region_name(prefix, i)));
+        auto latency = regions.back()->histogram(worker_registries[i], metric_path("latency" + std::to_string(i)), bucket_layout{10}, simple_reservoir<int, 16>(), tag_collection(), 4);
+        for (int v = 1; v <= 6; v++)
+            latency->update(v * static_cast<int>(i + 1));
+    }
+
+    // a conflicting type at the same path as another worker is skipped
+    regions[0]->gauge(worker_registries[0], "latency1"_m);
+
+    aggregator.refresh();
+    REQUIRE(aggregator.conflicts() == 1);
+
+    aggregator_test::visit_metric(registry, "latency0", [&](const tag_collection&, const auto& snapshot) {
+        auto h = histogram_of(snapshot);
+        REQUIRE(h);
+        REQUIRE(h->count() == 6);
+
+        // only the 4 most recent values are kept in the region
+        REQUIRE(static_cast<int>(h->min()) == 3);
+        REQUIRE(static_cast<int>(h->max()) == 6);
+    });
+}
+
+TEST_CASE("Region aggregator estimates histograms without samples from their buckets", "[region_aggregator]")
+{
+    regions_cleanup cleanup;
+    metrics_registry<> registry;
+    region_aggregator<> aggregator(registry, prefix, worker_count);
+
+    metrics_registry<> worker_registry;
+    auto region = shared_region::create(region_aggregator<>::region_name(prefix, 0));
+
+    // the default keeps no samples in the region
+    auto latency = region->histogram(worker_registry, "latency"_m, bucket_layout{10, 100}, simple_reservoir<int, 16>());
+    for (int v = 0; v < 10; v++)
+    {
+        latency->update(5);
+        latency->update(50);
+    }
+    latency->update(500);
+
+    aggregator.refresh();
+    int visited = 0;
+    aggregator_test::visit_metric(registry, "latency", [&](const tag_collection&, const auto& snapshot) {
+        auto h = histogram_of(snapshot);
+        REQUIRE(h);
+        REQUIRE(h->count() == 21);
+        REQUIRE(static_cast<double>(h->min()) > 0);
+
+        // what the other buckets leave of the sum is put in the infinite one
+        REQUIRE(std::abs(static_cast<double>(h->max()) - 450) < 0.0001);
+
+        // the values are estimated into the buckets they were counted in
+        uint64_t cumulative[2];
+        h->bucket_counts({10, 100}, [](const metric_value& v) { return static_cast<double>(v); }, cumulative);
+        REQUIRE(cumulative[0] == 10);
+        REQUIRE(cumulative[1] == 20);
+        REQUIRE(static_cast<double>(h->template value<25_p>()) <= 10);
+        REQUIRE(static_cast<double>(h->template value<75_p>()) > 10);
+        ++visited;
+    });
+    REQUIRE(visited == 1);
+}
+
+TEST_CASE("Aggregated metrics without a record yet have empty snapshots", "[region_aggregator]")
+{
+    REQUIRE(aggregated_metric<shared_metric_kind::counter>().workers() == 0);
+    REQUIRE(static_cast<double>(aggregated_metric<shared_metric_kind::counter>().snapshot().value()) == 0);
+    REQUIRE(static_cast<double>(aggregated_metric<shared_metric_kind::gauge>().snapshot().value()) == 0);
+    REQUIRE(aggregated_metric<shared_metric_kind::histogram>().snapshot().count() == 0);
+
+    auto meter = aggregated_metric<shared_metric_kind::meter>().snapshot();
+    REQUIRE(meter.begin() == meter.end());
+}
@@ -0,0 +1,175 @@
+#include <catch2/catch_all.hpp>
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cxxmetrics/metrics_registry.hpp>
+#include <cxxmetrics/simple_reservoir.hpp>
+
+using namespace cxxmetrics;
+using namespace cxxmetrics_literals;
+
+namespace
+{
+
+std::string describe(const tag_collection& tags)
+{
+    std::vector<std::string> pairs;
+    for (const auto& tag : tags)
+    {
+        std::ostringstream pair;
+        pair << tag.first << '=' << tag.second;
+        pairs.push_back(pair.str());
+    }
+    std::sort(pairs.begin(), pairs.end());
+
+    std::string result;
+    for (const auto& pair : pairs)
+        result += pair + ',';
+    return result;
+}
+
+std::string describe(const cumulative_value_snapshot& snapshot)
+{
+    std::ostringstream result;
+    result << "cumulative " << snapshot.value();
+    return result.str();
+}
+
+std::string describe(const average_value_snapshot& snapshot)
+{
+    std::ostringstream result;
+    result << "value " << snapshot.value();
+    return result.str();
+}
+
+std::string describe(const histogram_snapshot& snapshot)
+{
+    std::ostringstream result;
+    result << "histogram " << snapshot.count();
+    for (const auto& value : snapshot.values())
+        result << ' ' << value;
+    return result.str();
+}
+
+template<typename TSnapshot>
+std::string describe(const TSnapshot&)
+{
+    return "other";
+}
+
+std::vector<std::string> describe_all(basic_registered_metric& metric)
+{
+    std::vector<std::string> result;
+    metric.visit([&result](const tag_collection& tags, const auto& snapshot) {
+        result.push_back(describe(tags) + " " + describe(snapshot));
+    });
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+std::vector<std::string> describe_all(const registry_snapshot::family& family)
+{
+    std::vector<std::string> result;
+    family.visit([&result](const tag_collection& tags, const auto& snapshot) {
+        result.push_back(describe(tags) + " " + describe(snapshot));
+    });
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+}
+
+TEST_CASE("Registry snapshot collects every series in columns", "[registry_snapshot]")
+{
+    using reservoir_type = simple_reservoir<int, 8>;
+    metrics_registry<> r;
+    *r.counter("MyCounter"_m, {{"tag", "a"}}) += 10;
+    *r.counter("MyCounter"_m, {{"tag", "b"}}) += 20;
+    auto& h = *r.histogram("MyHistogram"_m, reservoir_type(), {{"tag", "a"}});
+    for (auto value : {30, 10, 20})
+        h.update(value);
+    r.meter<1_sec, 1_min>("MyMeter")->mark(5);
+
+    auto snapshot = r.collect();
+    REQUIRE(snapshot->families().size() == 3);
+    REQUIRE(snapshot->series() == 4);
+
+    std::size_t visited = 0;
+    snapshot->visit([&](const registry_snapshot::family& family) {
+        ++visited;
+        REQUIRE(describe_all(family) == describe_all(family.metric()));
+
+        if (family.path() == "MyHistogram"_m)
+        {
+            REQUIRE(family.kind() == registry_snapshot::series_kind::histogram);
+            REQUIRE(family.size() == 1);
+            auto samples = snapshot->samples(family.first());
+            REQUIRE(samples.second - samples.first == 3);
+            REQUIRE(std::is_sorted(samples.first, samples.second));
+            REQUIRE(snapshot->count(family.first()) == 3);
+        }
+        else if (family.path() == "MyMeter"_m)
+        {
+            REQUIRE(family.kind() == registry_snapshot::series_kind::meter);
+            REQUIRE(snapshot->epoch(family.first()) == 0);
+            REQUIRE(snapshot->rates(family.first()) == 1);
+            REQUIRE(snapshot->rate(family.first(), 0).first == std::chrono::minutes(1));
+        }
+        else
+        {
+            REQUIRE(family.kind() == registry_snapshot::series_kind::cumulative);
+            REQUIRE(family.size() == 2);
+            REQUIRE(snapshot->epoch(family.first()) != 0);
+        }
+    });
+    REQUIRE(visited == 3);
+}
+
+TEST_CASE("Registry snapshot interns label sets", "[registry_snapshot]")
+{
+    metrics_registry<> r;
+    *r.counter("MyCounter"_m, {{"tag", "a"}}) += 1;
+    *r.counter("MyOtherCounter"_m, {{"tag", "a"}}) += 1;
+    *r.counter("MyOtherCounter"_m, {{"tag", "b"}}) += 1;
+
+    auto snapshot = r.collect();
+    REQUIRE(snapshot->series() == 3);
+
+    std::vector<uint32_t> a;
+    std::vector<uint32_t> b;
+    for (std::size_t i = 0; i < snapshot->series(); i++)
+        (snapshot->labels(i) == tag_collection{{"tag", "a"}} ? a : b).push_back(snapshot->label_id(i));
+
+    REQUIRE(a.size() == 2);
+    REQUIRE(a[0] == a[1]);
+    REQUIRE(b.size() == 1);
+    REQUIRE(b[0] != a[0]);
+}
+
+TEST_CASE("Registry snapshot doesn't change with the registry", "[registry_snapshot]")
+{
+    metrics_registry<> r;
+    auto& counter = *r.counter("MyCounter"_m);
+    counter += 10;
+
+    auto snapshot = r.collect();
+    counter += 5;
+    *r.counter("MyOtherCounter"_m) += 1;
+
+    REQUIRE(snapshot->families().size() == 1);
+    REQUIRE(snapshot->value(0) == metric_value(10));
+
+    std::vector<uint64_t> epochs;
+    snapshot->families()[0].visit_changed([](const tag_collection&, uint64_t) { return false; },
+            [&epochs](const tag_collection&, uint64_t epoch, const auto&) { epochs.push_back(epoch); });
+    REQUIRE(epochs.size() == 1);
+
+    // a filter skips the series like it does on the registered metric
+    std::size_t visited = 0;
+    snapshot->families()[0].visit_changed([](const tag_collection&, uint64_t) { return true; },
+            [&visited](const tag_collection&, uint64_t, const auto&) { ++visited; });
+    REQUIRE(visited == 0);
+
+    REQUIRE(r.collect()->families().size() == 2);
+}
@@ -0,0 +1,56 @@
+#include <catch2/catch_all.hpp>
+#include <sstream>
+#include <cxxmetrics/metrics_registry.hpp>
+#include <cxxmetrics_prometheus/prometheus_publisher.hpp>
+
+using namespace cxxmetrics;
+using namespace cxxmetrics_literals;
+using namespace cxxmetrics_prometheus;
+
+TEST_CASE("Self metrics are registered under the reserved path", "[self_metrics]")
+{
+    metrics_registry<> r;
+    *r.counter("MyCounter", {{"mytag", "a"}}) += 1;
+    *r.counter("MyCounter", {{"mytag", "b"}}) += 1;
+
+    uint64_t series = 0;
+    int self = 0;
+    r.visit_registered_metrics([&](const metric_path& path, basic_registered_metric& metric) {
+        if (*path.begin() != cxxmetrics::internal::self_metrics_root)
+            return;
+
+        ++self;
+        if (path == metric_path("cxxmetrics")/"series")
+        {
+            metric.visit([&](const tag_collection& tags, const value_snapshot& ss) {
+                for (const auto& tag : tags)
+                {
+                    if (tag.first == "family" && static_cast<std::string>(tag.second) == "MyCounter")
+                        series = ss.value();
+                }
+            });
+        }
+    });
+
+    REQUIRE(self == 9);
+    REQUIRE(series == 2);
+}
+
+TEST_CASE("Self metrics track publisher scrapes", "[self_metrics]")
+{
+    metrics_registry<> r;
+    prometheus_publisher<decltype(r)::repository_type> subject(r);
+    *r.counter("MyCounter") += 1;
+
+    auto& stats = cxxmetrics::internal::self_metrics::instance();
+    auto scrapes = stats.value(cxxmetrics::internal::self_stat::scrapes);
+    auto bytes = stats.value(cxxmetrics::internal::self_stat::scrape_bytes);
+
+    std::stringstream stream;
+    subject.write(stream);
+
+    REQUIRE(stats.value(cxxmetrics::internal::self_stat::scrapes) == scrapes + 1);
+    REQUIRE(stats.value(cxxmetrics::internal::self_stat::scrape_bytes) == bytes + stream.str().size());
+    REQUIRE_THAT(stream.str(), Catch::Matchers::ContainsSubstring("cxxmetrics:publisher:scrape_bytes"));
+    REQUIRE_THAT(stream.str(), Catch::Matchers::ContainsSubstring("cxxmetrics:series{family=\"MyCounter\"} 1"));
+}
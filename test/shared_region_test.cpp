@@ -0,0 +1,184 @@
+#include <thread>
+#include <catch2/catch_all.hpp>
+#include <cxxmetrics/shared_region.hpp>
+#include <cxxmetrics/simple_reservoir.hpp>
+
+using namespace cxxmetrics;
+using namespace cxxmetrics_literals;
+
+namespace
+{
+
+const std::string region_name = "/cxxmetrics_shared_region_test";
+
+struct region_cleanup
+{
+    ~region_cleanup()
+    {
+        shared_region::remove(region_name);
+    }
+};
+
+}
+
+TEST_CASE("Shared region metrics can be read from another mapping", "[shared_region]")
+{
+    region_cleanup cleanup;
+    metrics_registry<> registry;
+    auto region = shared_region::create(region_name, 64 * 1024);
+
+    auto requests = region->counter(registry, "http"_m/"requests", {{"code", 200}});
+    auto temperature = region->gauge(registry, "temperature"_m);
+    auto latency = region->histogram(registry, "latency"_m, bucket_layout{1, 10, 100}, simple_reservoir<int, 16>());
+
+    *requests += 5;
+    ++*requests;
+    temperature->set(20.5);
+    temperature->add(1);
+    latency->update(1);
+    latency->update(7);
+    latency->update(50);
+    latency->update(500);
+
+    REQUIRE(region->counter(registry, "http"_m/"requests", {{"code", 200}}) == requests);
+    REQUIRE(requests->value() == 6);
+
+    auto reader = shared_region::open(region_name);
+    REQUIRE(reader->pid() == ::getpid());
+    REQUIRE(reader->used() == region->used());
+
+    int records = 0;
+    reader->visit([&](const shared_record& record) {
+        ++records;
+        switch (record.kind())
+        {
+            case shared_metric_kind::counter:
+                REQUIRE(record.path().join("/") == "http/requests");
+                REQUIRE(record.tags() == tag_collection({{"code", "200"}}));
+                REQUIRE(record.counter_value() == 6);
+                break;
+            case shared_metric_kind::gauge:
+                REQUIRE(record.path().join("/") == "temperature");
+                REQUIRE(record.gauge_value() == 21.5);
+                break;
+            case shared_metric_kind::histogram:
+                REQUIRE(record.bounds() == std::vector<double>({1, 10, 100}));
+                REQUIRE(record.bucket(0) == 1);
+                REQUIRE(record.bucket(1) == 1);
+                REQUIRE(record.bucket(2) == 1);
+                REQUIRE(record.bucket(3) == 1);
+                REQUIRE(record.histogram_count() == 4);
+                REQUIRE(record.histogram_sum() == 558);
+                break;
+            default:
+                FAIL("unexpected record");
+        }
+    });
+    REQUIRE(records == 3);
+
+    REQUIRE_THROWS_AS(reader->counter(registry, "other"_m), std::logic_error);
+}
+
+TEST_CASE("Shared region metrics are published from the registry", "[shared_region]")
+{
+    region_cleanup cleanup;
+    metrics_registry<> registry;
+    auto region = shared_region::create(region_name);
+
+    region->counter(registry, "count"_m)->incr(3);
+    region->gauge(registry, "level"_m)->set(1.5);
+    region->histogram(registry, "size"_m, bucket_layout{10}, simple_reservoir<int, 16>())->update(4);
+
+    int visited = 0;
+    registry.visit_registered_metrics([&](const metric_path& path, basic_registered_metric& metric) {
+        metric.visit([&](const tag_collection&, const auto& snapshot) {
+            ++visited;
+            using snapshot_type = std::decay_t<decltype(snapshot)>;
+            if (std::is_same<snapshot_type, cumulative_value_snapshot>::value)
+                REQUIRE(path.join("/") == "count");
+        });
+    });
+    REQUIRE(visited == 3);
+}
+
+TEST_CASE("Shared region won't share a metric that's already registered outside of it", "[shared_region]")
+{
+    region_cleanup cleanup;
+    const std::string other_name = "/cxxmetrics_shared_region_test_other";
+    metrics_registry<> registry;
+    auto other = shared_region::create(other_name);
+    auto region = shared_region::create(region_name);
+
+    other->counter(registry, "count"_m, {{"code", 200}})->incr(2);
+    REQUIRE_THROWS_AS(region->counter(registry, "count"_m, {{"code", 200}}), std::logic_error);
+
+    // other tags of the same path can still be shared
+    region->counter(registry, "count"_m, {{"code", 500}})->incr(3);
+
+    auto reader = shared_region::open(region_name);
+    int records = 0;
+    reader->visit([&](const shared_record& record) {
+        ++records;
+        REQUIRE(record.tags() == tag_collection({{"code", "500"}}));
+        REQUIRE(record.counter_value() == 3);
+    });
+    REQUIRE(records == 1);
+    REQUIRE(other->counter(registry, "count"_m, {{"code", 200}})->value() == 2);
+
+    // the metric that failed to register isn't handed out later either
+    REQUIRE_THROWS_AS(region->counter(registry, "count"_m, {{"code", 200}}), std::logic_error);
+    shared_region::remove(other_name);
+}
+
+TEST_CASE("Shared region ewma keeps its rate in the region", "[shared_region]")
+{
+    region_cleanup cleanup;
+    metrics_registry<> registry;
+    auto region = shared_region::create(region_name);
+
+    auto ewma = region->ewma<time::seconds(10), time::milliseconds(5)>(registry, "rate"_m);
+    ewma->mark(10);
+    std::this_thread::sleep_for(std::chrono::milliseconds(6));
+    ewma->mark(0);
+
+    auto rate = ewma->rate();
+    REQUIRE(rate > 0);
+
+    auto reader = shared_region::open(region_name);
+    reader->visit([&](const shared_record& record) {
+        REQUIRE(record.kind() == shared_metric_kind::ewma);
+        REQUIRE(record.ewma_total() == 10);
+        REQUIRE(record.ewma_rate() == rate);
+        REQUIRE(record.ewma_window() == std::chrono::seconds(10));
+        REQUIRE(record.ewma_interval() == std::chrono::milliseconds(5));
+    });
+}
+
+TEST_CASE("Shared region outlives the process that wrote it", "[shared_region]")
+{
+    region_cleanup cleanup;
+    {
+        metrics_registry<> registry;
+        auto region = shared_region::create(region_name, 4096);
+        region->counter(registry, "before"_m)->incr(42);
+
+        // a record that doesn't fit is never written
+        REQUIRE_THROWS_AS(region->histogram(registry, "big"_m, bucket_layout::linear(0, 1, 1000), simple_reservoir<int, 16>()), std::length_error);
+
+        // neither is one that can't be registered
+        registry.gauge("taken"_m, 1.0);
+        REQUIRE_THROWS_AS(region->counter(registry, "taken"_m), metric_type_mismatch);
+    }
+
+    auto reader = shared_region::open(region_name);
+    int records = 0;
+    reader->visit([&](const shared_record& record) {
+        ++records;
+        REQUIRE(record.path().join("/") == "before");
+        REQUIRE(record.counter_value() == 42);
+    });
+    REQUIRE(records == 1);
+
+    shared_region::remove(region_name);
+    REQUIRE_THROWS_AS(shared_region::open(region_name), std::system_error);
+}
@@ -0,0 +1,218 @@
+#include <catch2/catch_all.hpp>
+#include <algorithm>
+#include <cstring>
+#include <set>
+#include <string>
+#include <vector>
+#include <cxxmetrics_statsd/statsd_publisher.hpp>
+#include <cxxmetrics/simple_reservoir.hpp>
+
+using namespace cxxmetrics;
+using namespace cxxmetrics_literals;
+using namespace cxxmetrics_statsd;
+
+namespace
+{
+
+// stands in for the statsd agent
+class agent
+{
+    int fd_;
+    uint16_t port_;
+public:
+    agent() :
+            fd_(::socket(AF_INET, SOCK_DGRAM, 0))
+    {
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+        REQUIRE(::bind(fd_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0);
+
+        socklen_t length = sizeof(address);
+        getsockname(fd_, reinterpret_cast<sockaddr*>(&address), &length);
+        port_ = ntohs(address.sin_port);
+
+        timeval timeout{0, 200000};
+        setsockopt(fd_, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    }
+
+    ~agent()
+    {
+        ::close(fd_);
+    }
+
+    statsd_options options() const
+    {
+        statsd_options result;
+        result.port = port_;
+        return result;
+    }
+
+    std::vector<std::string> datagrams(std::size_t count)
+    {
+        std::vector<std::string> result;
+        char data[65536];
+        while (result.size() < count)
+        {
+            auto received = ::recv(fd_, data, sizeof(data), 0);
+            if (received < 0)
+                break;
+            result.emplace_back(data, static_cast<std::size_t>(received));
+        }
+        return result;
+    }
+
+    std::set<std::string> lines(std::size_t count)
+    {
+        std::set<std::string> result;
+        for (const auto& datagram : datagrams(count))
+        {
+            std::size_t at = 0;
+            while (at <= datagram.size())
+            {
+                auto end = std::min(datagram.find('\n', at), datagram.size());
+                result.insert(datagram.substr(at, end - at));
+                at = end + 1;
+            }
+        }
+        return result;
+    }
+};
+
+}
+
+TEST_CASE("Statsd publisher sends counter deltas and gauges with DogStatsD tags", "[statsd]")
+{
+    agent listener;
+    metrics_registry<> r;
+    statsd_publisher<decltype(r)::repository_type> subject(r, listener.options());
+
+    auto& counter = *r.counter("My"/"Counter"_m, {{"tag", "a|b"}});
+    counter += 10;
+    double gauge_value = -2.5;
+    r.gauge("MyGauge"_m, &gauge_value, {{"host", "x:y"}});
+
+    REQUIRE(subject.publish() == 1);
+    auto first = listener.lines(1);
+    REQUIRE(first == std::set<std::string>{"My.Counter:10|c|#tag:a_b", "MyGauge:0|g|#host:x:y", "MyGauge:-2.5|g|#host:x:y"});
+
+    counter += 5;
+    gauge_value = 4;
+    subject.publish();
+    REQUIRE(listener.lines(1) == std::set<std::string>{"My.Counter:5|c|#tag:a_b", "MyGauge:4|g|#host:x:y"});
+
+    // unchanged counters aren't sent
+    subject.publish();
+    REQUIRE(listener.lines(1) == std::set<std::string>{"MyGauge:4|g|#host:x:y"});
+}
+
+TEST_CASE("Statsd publishers of the same registry keep their own counter deltas and names", "[statsd]")
+{
+    agent first_listener;
+    agent second_listener;
+    metrics_registry<> r;
+    statsd_publisher<decltype(r)::repository_type> first(r, first_listener.options());
+    auto second_options = second_listener.options();
+    second_options.prefix = "app";
+    statsd_publisher<decltype(r)::repository_type> second(r, second_options);
+
+    auto& counter = *r.counter("MyCounter"_m, {{"tag", "a"}});
+    counter += 10;
+    first.publish();
+    REQUIRE(first_listener.lines(1) == std::set<std::string>{"MyCounter:10|c|#tag:a"});
+
+    counter += 5;
+    first.publish();
+    REQUIRE(first_listener.lines(1) == std::set<std::string>{"MyCounter:5|c|#tag:a"});
+
+    // the second publisher hasn't sent anything yet, so it sends the whole count under its own prefix
+    second.publish();
+    REQUIRE(second_listener.lines(1) == std::set<std::string>{"app.MyCounter:15|c|#tag:a"});
+
+    counter += 1;
+    second.publish();
+    REQUIRE(second_listener.lines(1) == std::set<std::string>{"app.MyCounter:1|c|#tag:a"});
+    first.publish();
+    REQUIRE(first_listener.lines(1) == std::set<std::string>{"MyCounter:1|c|#tag:a"});
+}
+
+TEST_CASE("Statsd publisher sends a collected registry snapshot", "[statsd]")
+{
+    agent listener;
+    metrics_registry<> r;
+    statsd_publisher<decltype(r)::repository_type> subject(r, listener.options());
+
+    auto& counter = *r.counter("MyCounter"_m, {{"tag", "a"}});
+    counter += 10;
+    auto snapshot = r.collect();
+    counter += 5;
+
+    REQUIRE(subject.publish(*snapshot) == 1);
+    REQUIRE(listener.lines(1) == std::set<std::string>{"MyCounter:10|c|#tag:a"});
+
+    // the deltas carry on from the snapshot
+    subject.publish();
+    REQUIRE(listener.lines(1) == std::set<std::string>{"MyCounter:5|c|#tag:a"});
+}
+
+TEST_CASE("Statsd publisher packs lines into datagrams no larger than the max", "[statsd]")
+{
+    agent listener;
+    metrics_registry<> r;
+    auto options = listener.options();
+    options.max_datagram = 64;
+    options.prefix = "app";
+    statsd_publisher<decltype(r)::repository_type> subject(r, options);
+
+    for (int i = 0; i < 100; i++)
+        *r.counter("Counter" + std::to_string(i)) += i + 1;
+
+    auto sent = subject.publish();
+    REQUIRE(sent > 1);
+
+    auto datagrams = listener.datagrams(sent);
+    REQUIRE(datagrams.size() == sent);
+
+    std::set<std::string> lines;
+    for (const auto& datagram : datagrams)
+    {
+        REQUIRE(datagram.size() <= 64);
+        REQUIRE(datagram.back() != '\n');
+        std::size_t at = 0;
+        while (at <= datagram.size())
+        {
+            auto end = std::min(datagram.find('\n', at), datagram.size());
+            lines.insert(datagram.substr(at, end - at));
+            at = end + 1;
+        }
+    }
+
+    REQUIRE(lines.size() == 100);
+    REQUIRE(lines.count("app.Counter0:1|c") == 1);
+    REQUIRE(lines.count("app.Counter99:100|c") == 1);
+}
+
+TEST_CASE("Statsd publisher sends timers as millisecond quantile gauges", "[statsd]")
+{
+    using reservoir_type = simple_reservoir<std::chrono::system_clock::duration, 4>;
+    agent listener;
+    metrics_registry<> r;
+    auto options = listener.options();
+    options.tags = false;
+    statsd_publisher<decltype(r)::repository_type> subject(r, options);
+
+    auto& t = *r.timer<100_micro, std::chrono::system_clock, reservoir_type, true, 1_min>("MyTimer", reservoir_type(), {{"tag", "value"}});
+    t.update(std::chrono::milliseconds(10));
+    t.update(std::chrono::milliseconds(30));
+
+    subject.publish();
+    auto lines = listener.lines(1);
+    REQUIRE(lines.count("MyTimer.count:2|c") == 1);
+    REQUIRE(lines.count("MyTimer.mean:20|g") == 1);
+    for (const auto& quantile : {"MyTimer.p50", "MyTimer.p90", "MyTimer.p99", "MyTimer.rates.mean", "MyTimer.rates.1min"})
+    {
+        REQUIRE(std::any_of(lines.begin(), lines.end(), [&](const std::string& line) {
+            return line.compare(0, std::strlen(quantile) + 1, std::string(quantile) + ":") == 0 && line.find("|g") != std::string::npos;
+        }));
+    }
+}
@@ -0,0 +1,198 @@
+#include <catch2/catch_all.hpp>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <cxxmetrics_statsd/statsd_server.hpp>
+
+using namespace cxxmetrics;
+using namespace cxxmetrics_literals;
+using namespace cxxmetrics_statsd;
+
+namespace
+{
+
+// stands in for the applications sending statsd lines
+class sender
+{
+    int fd_;
+public:
+    explicit sender(uint16_t port) :
+            fd_(::socket(AF_INET, SOCK_DGRAM, 0))
+    {
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+        REQUIRE(::connect(fd_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0);
+    }
+
+    ~sender()
+    {
+        ::close(fd_);
+    }
+
+    bool send(const std::string& datagram)
+    {
+        return ::send(fd_, datagram.data(), datagram.size(), 0) == static_cast<ssize_t>(datagram.size());
+    }
+};
+
+statsd_server_options local_options(std::size_t threads = 1)
+{
+    statsd_server_options options;
+    options.address = "127.0.0.1";
+    options.port = 0;
+    options.threads = threads;
+    return options;
+}
+
+using server_type = statsd_server<default_repository>;
+
+template<typename TPredicate>
+bool eventually(TPredicate&& predicate)
+{
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (!predicate() && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    return predicate();
+}
+
+}
+
+TEST_CASE("Statsd line parser takes lines apart in place", "[statsd]")
+{
+    cxxmetrics_statsd::internal::statsd_line line;
+    std::string data = "api.requests:12.5|c|@0.5|#env:prod,host:a";
+    REQUIRE(cxxmetrics_statsd::internal::parse_line(data.data(), data.data() + data.size(), line));
+    REQUIRE(std::string(line.name, line.name_size) == "api.requests");
+    REQUIRE(std::string(line.value, line.value_size) == "12.5");
+    REQUIRE(line.type == cxxmetrics_statsd::internal::statsd_type::counter);
+    REQUIRE(line.sample_rate == 0.5);
+    REQUIRE(std::string(line.tags, line.tags_size) == "env:prod,host:a");
+    REQUIRE(line.name >= data.data());
+
+    data = "queue.depth:-3|g";
+    REQUIRE(cxxmetrics_statsd::internal::parse_line(data.data(), data.data() + data.size(), line));
+    REQUIRE(line.type == cxxmetrics_statsd::internal::statsd_type::gauge);
+    REQUIRE(line.relative());
+    REQUIRE(line.tags == nullptr);
+
+    data = "db.query:3|ms";
+    REQUIRE(cxxmetrics_statsd::internal::parse_line(data.data(), data.data() + data.size(), line));
+    REQUIRE(line.type == cxxmetrics_statsd::internal::statsd_type::timer);
+
+    for (std::string bad : {"no_value", ":1|c", "x:|c", "x:1", "x:1|q", "x:1|c|@0", "x:1|c|@abc"})
+        REQUIRE_FALSE(cxxmetrics_statsd::internal::parse_line(bad.data(), bad.data() + bad.size(), line));
+
+    auto path = cxxmetrics_statsd::internal::parse_path("a.b..c", 6);
+    REQUIRE(path.join("/") == "a/b/c");
+}
+
+TEST_CASE("Statsd server feeds counters, gauges and timers", "[statsd]")
+{
+    metrics_registry<> r;
+    server_type server(r, local_options());
+    server.start();
+    REQUIRE(server.port() != 0);
+
+    sender s(server.port());
+    REQUIRE(s.send("api.requests:2|c|#env:prod\napi.requests:3|c|@0.5|#env:prod\r\nqueue.depth:10|g"));
+    REQUIRE(s.send("queue.depth:+5|g\nqueue.depth:-2|g\ndb.query:250|ms\ndb.query:750|h\nusers:joe|s\nbad line\n\n"));
+    REQUIRE(eventually([&]() { return server.lines() >= 9; }));
+
+    REQUIRE(server.packets() == 2);
+    REQUIRE(server.rejected() == 2);
+    REQUIRE(r.counter<int64_t>("api"_m/"requests", {{"env", "prod"}})->value() == 8);
+    REQUIRE(r.gauge("queue"_m/"depth", 0.0)->get() == 13.0);
+
+    auto timer = r.timer<time::seconds(1), std::chrono::steady_clock, uniform_reservoir<std::chrono::steady_clock::duration, 1024>, time::minutes(1), time::minutes(5)>("db"_m/"query");
+    auto ss = timer->snapshot();
+    REQUIRE(ss.count() == 2);
+    REQUIRE(std::abs(static_cast<double>(ss.mean()) - std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::milliseconds(500)).count()) < 1);
+
+    // a line conflicting with a registered metric of another type is rejected
+    REQUIRE(s.send("queue.depth:1|c"));
+    REQUIRE(eventually([&]() { return server.lines() >= 10; }));
+    REQUIRE(server.rejected() == 3);
+
+    server.stop();
+    server.stop();
+}
+
+TEST_CASE("Statsd server rejects the line a datagram that didn't fit was cut off in", "[statsd]")
+{
+    metrics_registry<> r;
+    auto options = local_options();
+    options.max_datagram = 38;
+    server_type server(r, options);
+    server.start();
+
+    // the datagram is cut off in the tags of the last line, which would otherwise parse
+    sender s(server.port());
+    REQUIRE(s.send("first:1|c\nsecond:2|c\nthird:3|c|#env:production\n"));
+    REQUIRE(eventually([&]() { return server.lines() >= 3; }));
+
+    REQUIRE(server.rejected() == 1);
+    REQUIRE(r.counter<int64_t>("first"_m)->value() == 1);
+    REQUIRE(r.counter<int64_t>("second"_m)->value() == 2);
+    REQUIRE(r.counter<int64_t>("third"_m, {{"env", "pr"}})->value() == 0);
+
+    // and one cut off in its only line is dropped altogether
+    REQUIRE(s.send("third:3|c|#env:production,region:us-east-1"));
+    REQUIRE(eventually([&]() { return server.lines() >= 4; }));
+    REQUIRE(server.rejected() == 2);
+
+    server.stop();
+}
+
+TEST_CASE("Statsd server receives on several threads sharing the port", "[statsd]")
+{
+    metrics_registry<> r;
+    server_type server(r, local_options(4));
+    server.start();
+
+    const uint64_t packets = 50000;
+    std::string datagram;
+    for (int i = 0; i < 8; i++)
+        datagram += "bench.requests:1|c|#shard:" + std::to_string(i) + "\n";
+
+    // several senders so that the kernel spreads the datagrams over the sockets
+    auto started = std::chrono::steady_clock::now();
+    std::vector<std::thread> senders;
+    for (int i = 0; i < 4; i++)
+    {
+        senders.emplace_back([&]() {
+            sender s(server.port());
+            for (uint64_t p = 0; p < packets / 4; p++)
+                while (!s.send(datagram))
+                    std::this_thread::yield();
+        });
+    }
+    for (auto& t : senders)
+        t.join();
+
+    // whatever wasn't dropped is drained once the count stops moving
+    auto received = server.packets();
+    auto drained = std::chrono::steady_clock::now();
+    do
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        if (server.packets() != received)
+        {
+            received = server.packets();
+            drained = std::chrono::steady_clock::now();
+        }
+    }
+    while (received < packets && std::chrono::steady_clock::now() - drained < std::chrono::milliseconds(100));
+    auto elapsed = std::chrono::duration<double>(drained - started).count();
+    WARN("statsd server received " << server.packets() << " of " << packets << " datagrams at " << static_cast<uint64_t>(server.packets() / elapsed) << " packets/s");
+
+    // datagrams can be dropped under load but everything received is counted once
+    int64_t total = 0;
+    for (int i = 0; i < 8; i++)
+        total += r.counter<int64_t>("bench"_m/"requests", {{"shard", std::to_string(i)}})->value();
+    REQUIRE(server.packets() > 0);
+    REQUIRE(static_cast<uint64_t>(total) == server.lines());
+    REQUIRE(server.rejected() == 0);
+}